@@ -0,0 +1,482 @@
+/*
+* _______________________   __________                                                    ______  
+* ____  _/__  __/_  ____/   ___  ____/____________ _______ ___________      _________________  /__
+*  __  / __  /  _  /        __  /_   __  ___/  __ `/_  __ `__ \  _ \_ | /| / /  __ \_  ___/_  //_/
+* __/ /  _  /   / /___      _  __/   _  /   / /_/ /_  / / / / /  __/_ |/ |/ // /_/ /  /   _  ,<   
+* /___/  /_/    \____/      /_/      /_/    \__,_/ /_/ /_/ /_/\___/____/|__/ \____//_/    /_/|_|  
+*                                                                                                 
+*/
+
+
+// Okay, first let's create an itc API declarations. Which functions we will offer to the end users.
+
+#ifndef __ITC_H__
+#define __ITC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+
+
+/*****************************************************************************\/
+*****                          VARIABLE MACROS                             *****
+*******************************************************************************/
+#define ITC_MAX_NAME_LENGTH 		255
+#define ITC_MAX_MAILBOXES		65534
+#define ITC_MAX_MAILBOXES_PER_PROCESS	255
+#define ITC_MAX_SG_SEGMENTS		16
+#define ITC_DISPATCH_MAX_SPAN		4096 // Max distance between lowest and highest msgno in one handler table
+#define ITC_DISPATCH_BATCH		32 // Max messages handled per itc_dispatch() call
+#define ITC_CREDIT_WINDOW		64 // Max messages on their way from one process to one ITC_FLOW_CONTROL process
+
+// If you make sure your mailbox's names you set later will be unique across the entire universe, you can use this flag
+// for itc_init() call
+#define ITC_NO_NAMESPACE	0x00000100
+// Flag for itc_init() call. Rx threads of IPC transports and their kernel objects are only set up on the first send to
+// another process that may be answered, e.g. itc_locate_sync(), or when another process locates one of our mailboxes,
+// in which case itccoord has us start them before it answers that process
+#define ITC_LAZY_TRANSPORTS	0x00000200
+// Flag for itc_init() call. Shared memory transports fault in and mlock() their segments when they create or attach them,
+// instead of taking page faults on first use while a receiver's queue is locked. Locking is best effort, bounded by RLIMIT_MEMLOCK
+#define ITC_PREFAULT_SHM	0x00000400
+// Flag for itc_create_mailbox() call. The fd from itc_get_fd() is non-blocking and meant for EPOLLET: it is signalled once
+// when messages arrive after the owner last saw its mailbox empty, and ITC never reads it. After each wakeup the owner
+// must call itc_receive(ITC_NO_WAIT) until it returns NULL, otherwise it gets no further wakeups
+#define ITC_EDGE_TRIGGERED_FD	0x00000800
+// Flag for itc_create_mailbox() call. Other processes send to this mailbox over sysvmq with its own mtype, and its owner
+// receives those messages itself while it waits in itc_receive(), itc_receive_into() or itc_call(), instead of being
+// handed them by the sysvmq rx thread. itc_get_fd() fails on such mailboxes. Ignored if sysvmq is not running yet
+#define ITC_DIRECT_IPC_RX	0x00001000
+// Flag for itc_init() call. Other processes may only have ITC_CREDIT_WINDOW messages on their way to this process over
+// IPC transports. Credits are handed back in batches as the messages are delivered to their mailboxes. A sender without
+// credits waits for ITC_CREDIT_TMO ms, from the environment of the sender, then its itc_send() fails
+#define ITC_FLOW_CONTROL	0x00002000
+#define ITC_NO_MBOX_ID		0xFFFFFFFF
+#define ITC_NO_WAIT		0
+#define ITC_WAIT_FOREVER	-1
+#define ITC_MY_MBOX_ID		0xFFF00000
+
+/* Currently,
++ 0x90000100 - 0x90000500: For SYSV Message Queue
++ 0x90000500 - 0x90000A00: For SOCKET protocol (locate itccoord, over-host communication,...) */
+#define ITC_MSG_BASE		0x90000000
+
+
+/*****************************************************************************\/
+*****                        ITC TYPE DECLARATIONS                         *****
+*******************************************************************************/
+typedef uint32_t itc_mbox_id_t;
+
+/* Describes the message copied out by itc_receive_into() */
+struct itc_msg_info {
+	uint32_t		msgno;
+	itc_mbox_id_t		sender;
+	itc_mbox_id_t		receiver;
+	size_t			size;		// Full size of the itc_msg, msgno included
+	bool			truncated;	// The itc_msg did not fit in the buffer and was cut at cap bytes
+};
+
+typedef enum {
+        ITC_INVALID_SCHEME = -1,
+        ITC_MALLOC = 0,
+        ITC_MALLOC_ALIGNED,     // Same as ITC_MALLOC, but every itc_msg starts on a 64-byte boundary so that user data
+                                // such as doubles, 64-bit counters or SIMD arrays laid out after msgno is aligned too
+        ITC_NUM_SCHEMES
+} itc_alloc_scheme;
+
+/*****************************************************************************\/
+*****                        CORE API DECLARATIONS                         *****
+*******************************************************************************/
+/*
+*  Initialize important infrastructure for ITC system (Only once per a process).
+*  1. Need to be called once per process before any other ITC calls.
+*  2. Specify how many mailboxes ("number_of_mailboxes") to pre-allocate, in cache line aligned blocks of 64.
+*  3. When user call itc_create_mailbox(), take an mailbox available from a block and give it to user. If all are
+*  taken, another block is added, up to ITC_MAX_MAILBOXES.
+*  4. IPC transports towards other processes are taken from environment variable ITC_TRANSPORTS, a comma separated
+*  list in order of preference out of "sysvmq", "posixmq", "posixshm" and "sysvshm". "sysvmq" is always enabled last.
+*  Each message goes over the first transport of the sender's list that the receiver has enabled too and that can carry
+*  it. A sender only moves a process on to another transport once all it sent over the previous one has been delivered,
+*  so messages between two mailboxes never overtake each other.
+*  5. Per message size the fastest transport can be picked instead, by the size of each message. ITC_TRANSPORT_PROFILE
+*  names a file of "<max message bytes> <transport>" lines to load. If it does not exist
+*  and ITC_TRANSPORT_CALIBRATE is set, itc_init() times every enabled transport with messages from 64 bytes to 1MB and
+*  saves the result there.
+*  6. alloc_scheme ITC_MALLOC_ALIGNED makes itc_alloc() and received messages start on a 64-byte boundary.
+*/
+extern bool itc_init(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme,
+                    uint32_t init_flags); // First usage is to see if itc_coord or not,
+                                            // this is reserved for future usages.
+
+/*
+*  Release all ITC resources for the current process
+*  This is only allowed if there is no active mailboxes being used by threads. This means that all used mailboxes
+*  should be deleted by itc_delete_mailbox() first.
+*/
+extern bool itc_exit(void);
+
+/*
+*  Allocate an itc_msg 
+*/
+extern union itc_msg *itc_alloc(size_t size, uint32_t msgno);
+
+/*
+*  Deallocate an itc_msg 
+*/
+extern bool itc_free(union itc_msg **msg);
+
+/*
+*  Allocate a scatter-gather itc_msg.
+*       1. Only "size" bytes (msgno + your protocol header) are allocated contiguously as the head of the message.
+*       2. Additional payload buffers are then attached by itc_append_segment() without being copied.
+*       3. Sending to a mailbox in the same process is zero-copy, the receiver gets exactly the same message.
+*       Transports that carry messages over processes gather the segments directly into their own tx buffers,
+*       so the receiver in another process always gets an ordinary contiguous itc_msg.
+*       4. A local receiver that needs contiguous memory can call itc_flatten(), or walk the segments by
+*       itc_get_segments().
+*/
+extern union itc_msg *itc_alloc_sg(size_t size, uint32_t msgno);
+
+/*
+*  Attach a buffer as the next payload segment of a scatter-gather itc_msg (max ITC_MAX_SG_SEGMENTS segments).
+*       The buffer is referenced, not copied. So it must stay valid until the message is freed, by either you
+*       (send failed) or the receiver. If "release" is not NULL, it will be called with "buf" at that point.
+*/
+extern bool itc_append_segment(union itc_msg *msg, void *buf, size_t len, void (*release)(void *buf));
+
+/*
+*  Convert a scatter-gather itc_msg into an ordinary contiguous itc_msg, *msg will be replaced by the new one.
+*  Calling this on an ordinary itc_msg does nothing.
+*/
+extern bool itc_flatten(union itc_msg **msg);
+
+/*
+*  Fill "iov" with the head and the segments of an itc_msg, return how many entries were used or -1 if "iovcnt"
+*  is too small. An ordinary itc_msg always has exactly one entry.
+*/
+extern int itc_get_segments(union itc_msg *msg, struct iovec *iov, int iovcnt);
+
+/*
+*  Create a mailbox for the current thread.
+*/
+extern itc_mbox_id_t itc_create_mailbox(const char *name, uint32_t flags);
+
+/*
+*  Delete a mailbox for the current thread. You're only allowed to delete your own mailboxes in your thread.
+*/
+extern bool itc_delete_mailbox(itc_mbox_id_t mbox_id);
+
+/*
+*  Send an itc_msg
+*/
+extern bool itc_send(union itc_msg **msg, itc_mbox_id_t to, itc_mbox_id_t from, char *ns);
+
+/*
+*  Receive an itc_msg.
+*       1. You can filter which message types you want to get. Param filter is an array with:
+                filter[0] = how many message types you want to get.
+                filter[1] = msgno1
+                filter[2] = msgno2
+                filter[3] = msgno3
+                ...
+        2. You can set timeout in miliseconds to let your thread be blocked to wait for messages.
+        ITC_WAIT_FOREVER means wait forever until receiving any message and 0 means check the rx queue and return
+        immediately no matter if there are messages or not. (in milisecond)
+        3. You may want to get messages from someone only, or get from all mailboxes via ITC_FROM_ALL.
+
+	Note that: 1 and 3 will be implemented in ITC V2.
+*/
+// extern union itc_msg *itc_receive(const uint32_t *filter, int32_t tmo, itc_mbox_id_t from);
+
+/* We can easily use ITC_MY_MBOX_ID for "from" */
+extern union itc_msg *itc_receive(int32_t tmo); // By default ITC V1 receiving the 1st message in the rx queue
+						 			// no matter from who it came.
+
+/*
+*  Receive the next message straight into a caller-provided buffer, no itc_free() needed afterwards.
+*       buf is filled in with the itc_msg (msgno first), at most cap bytes, and info describes the message.
+*       Messages arriving from other processes while we are blocked here are copied from the transport rx buffer
+*       directly into buf, messages already in the rx queue are copied and freed internally.
+*
+*       Return false if nothing was received within tmo.
+*/
+extern bool itc_receive_into(void *buf, size_t cap, int32_t tmo, struct itc_msg_info *info);
+
+/*
+*  Send a request and wait for its reply, synchronous RPC.
+*       The request is tagged with a correlation id, the reply is delivered straight into a per-thread reply slot
+*       and wakes the caller up without passing through the rx queue. Other messages arriving in the meantime
+*       stay in the rx queue for a later itc_receive().
+*
+*       On success the request is consumed and the reply is returned, NULL is returned on failure or timeout.
+*       If sending failed, *msg is left untouched so the caller still owns it. A reply arriving after timeout is dropped.
+*/
+extern union itc_msg *itc_call(union itc_msg **msg, itc_mbox_id_t to, int32_t tmo);
+
+/*
+*  Send a reply *rsp back to the sender of the request req, which was sent by itc_call().
+*       If req was sent by an ordinary itc_send(), *rsp is sent as an ordinary message. req is not freed.
+*/
+extern bool itc_reply(union itc_msg *req, union itc_msg **rsp);
+
+/*
+*  Reply by sending the received request *req itself back to its sender, retagged as new_msgno of new_size bytes.
+*       Fill in the reply into *req before calling. If new_size fits in the request, the same buffer is sent back
+*       and no alloc/free takes place, otherwise a new message is allocated, the request payload is copied over and
+*       the request is freed. On success *req is set to NULL, on failure it is left to the caller as it was before
+*       the call, still addressed and sized as the request.
+*/
+extern bool itc_reply_reuse(union itc_msg **req, uint32_t new_msgno, size_t new_size);
+
+
+
+/*****************************************************************************\/
+*****                       HELPER API DECLARATIONS                        *****
+*******************************************************************************/
+/*
+*  Mailbox the message was sent from. For messages from other processes on this host this is the mailbox that
+*  sent it in that process, not the transport rx thread that forwarded it here, so itc_send() to it reaches the
+*  original sender. Messages coming over itcgw from other hosts still show the gateway mailbox.
+*/
+extern itc_mbox_id_t itc_sender(union itc_msg *msg);
+extern itc_mbox_id_t itc_receiver(union itc_msg *msg);
+/* For scatter-gather messages, this is the total length of the head and all segments */
+extern size_t itc_size(union itc_msg *msg);
+/* The first element of returned array is the number of active mailboxes in this thread, following elements respectively are those mailbox ids */
+extern itc_mbox_id_t itc_current_mbox(void);
+
+/*
+*  Locate a mailbox across the entire universe.
+*       1. First search for local mailboxes in the current process.
+*       2. If cannot find, send a message ITC_LOCATE_MBOX_SYNC_REQ to itc_coord asking for seeking across processes.
+*       3. If still cannot find, itc_coord will help send a message ITC_LOCATE_OVER_HOST to itc_gw asking for
+*       broadcasting this message to all hosts on LAN network for locating the requested mailbox.
+*
+*       Note that: this may block your thread for some time, so please consider using itc_locate_async instead
+*       if you're not sure the target mailbox is inside or outside your host.
+*
+*       Improvement: add one more input, let's say, uint32_t wheretofind. You're be able to select where to find
+*       the target mailbox. Locally, or over processes, or even over hosts???
+*/
+extern itc_mbox_id_t itc_locate_sync(int32_t timeout, const char *name, bool find_only_internal, bool *is_external, char *ns);
+// extern itc_mbox_id_t itc_locate_sync(const char *name, uint32_t wheretofind);
+
+/*
+*  NOT IMPLEMENTED YET
+*  Locate asynchronously a mailbox across the entire universe.
+*       Same behaviour as itc_locate_sync() but you will give ITC system an itc_msg buffer **msg which will be filled
+*       in when a mailbox is located, and ITC_LOCATE_NOT_FOUND if no mailbox is found. You also need to give your 
+*       mailbox id to let ITC system send back to you
+*/
+// extern itc_mbox_id_t itc_locate_async(const char *name, union itc_msg **msg, itc_mbox_id_t from);
+
+/*
+*  Return file descriptor for the mailbox of the current thread.
+*       Each thread has its own one itc mailbox. Each process (or the first default thread of a process) may have some
+*       other mailboxes for socket, sysvmq, local_coordinator, which are shared for all threads.
+*
+*       Each mailbox has its own one eventfd instance which is used for notifying receiver regarding some message
+*       has been sent to it. This is async mechanism for notification. Additionally, Pthread condition variable is
+*       for sync mechanism instead.
+*
+*       By default the fd is readable as long as the mailbox has messages, which costs a write() when the rx queue
+*       becomes non-empty and a read() when it becomes empty again. Mailboxes created with ITC_EDGE_TRIGGERED_FD
+*       only pay one write() per batch of messages the owner drains.
+*/
+extern int itc_get_fd();
+
+extern bool itc_get_name(itc_mbox_id_t mbox_id, char *name);
+
+extern bool itc_get_namespace(int32_t timeout, char *ns);
+
+/*
+*  NOT IMPLEMENTED YET
+*  Monitor "alive" status of a mailbox.
+*       1. By calling this function, you will register with the target mailbox. Right before the target mailbox is
+*       deleted or its thread exits, target mailbox will send back a message to you to notify that.
+*       2. You will manage two lists, one is monitored "alive" mailboxes, another is deleted mailboxes that
+*       have notified you or mailboxes are unmonitored by itc_unmonitor() call.
+*/
+// extern itc_monitor_id_t itc_monitor(itc_mbox_id_t mbox_id, union itc_msg **msg);
+// extern void itc_unmonitor(itc_mbox_id_t mbox_id);
+
+
+
+/*****************************************************************************\/
+*****                      DISPATCHER API DECLARATIONS                     *****
+*******************************************************************************/
+/*
+*  Handler of one msgno. The dispatcher frees *msg after the handler returns, unless the handler took it over,
+*  e.g. by itc_send() or itc_free(), which leaves *msg NULL.
+*/
+typedef void (*itc_handler_fn)(union itc_msg **msg, void *ctx);
+
+struct itc_handler {
+	uint32_t		msgno;
+	itc_handler_fn		fn;
+	const char*		name;
+};
+
+/* Usually handler tables are static const arrays:
+	static const struct itc_handler my_handlers[] = {
+		ITC_HANDLER(MY_FOO_REQ, handle_foo_req),
+		ITC_HANDLER(MY_BAR_IND, handle_bar_ind),
+	}; */
+#define ITC_HANDLER(msgno, fn)	{ (msgno), (fn), #fn }
+
+struct itc_handler_stats {
+	uint32_t		msgno;
+	const char*		name;
+	uint64_t		count;
+	uint64_t		total_ns;
+	uint64_t		max_ns;
+};
+
+struct itc_dispatcher;
+
+/* Credits of this process towards one ITC_FLOW_CONTROL process */
+struct itc_credit_stats {
+	itc_mbox_id_t		process;	// The receiving process, i.e. its mailbox ids & 0xFFF00000
+	uint64_t		nr_stalls;	// Sends that found no credit, including failed ones
+	uint64_t		stall_ns;
+	uint64_t		max_stall_ns;
+	uint64_t		nr_failed;	// Sends that got no credit in time
+};
+
+/*
+*  Create a dispatcher for the mailbox of the current thread.
+*       ctx is passed to every handler. fallback, if not NULL, gets messages nobody registered for,
+*       otherwise they are traced and freed.
+*/
+extern struct itc_dispatcher *itc_dispatcher_create(void *ctx, itc_handler_fn fallback);
+
+extern void itc_dispatcher_delete(struct itc_dispatcher **dispatcher);
+
+/*
+*  Register a handler table, typically all messages of one *_MSG_BASE range.
+*       The table is turned into a dense jump table indexed by msgno - lowest msgno, so a table must not span more
+*       than ITC_DISPATCH_MAX_SPAN msgnos. Tables must not overlap each other.
+*/
+extern bool itc_dispatcher_register(struct itc_dispatcher *dispatcher, const struct itc_handler *handlers, uint32_t nr_handlers);
+
+/*
+*  Wait up to tmo for a message, then dispatch it together with whatever else is already queued, at most
+*  ITC_DISPATCH_BATCH messages. Return the number of dispatched messages, 0 on timeout.
+*/
+extern int itc_dispatch(struct itc_dispatcher *dispatcher, int32_t tmo);
+
+/* Copy per-handler counters (message count, total and max time spent in the handler) to stats, return the number of
+entries copied. With stats == NULL, return the number of registered handlers. */
+extern uint32_t itc_dispatcher_get_stats(struct itc_dispatcher *dispatcher, struct itc_handler_stats *stats, uint32_t nr_stats);
+
+/* Copy credit counters of this process to stats, one entry per ITC_FLOW_CONTROL process that we ever ran out of credits
+towards, return the number of entries copied. With stats == NULL, return the number of such processes. */
+extern uint32_t itc_get_credit_stats(struct itc_credit_stats *stats, uint32_t nr_stats);
+
+
+
+/*****************************************************************************\/
+*****                    MAP TO BACKEND IMPLEMENTATION                     *****
+*******************************************************************************/
+extern bool itc_init_zz(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme, uint32_t init_flags);
+#define itc_init(nr_mboxes, alloc_scheme, init_flags) itc_init_zz((nr_mboxes), (alloc_scheme), (init_flags))
+
+extern bool itc_exit_zz(void);
+#define itc_exit() itc_exit_zz()
+
+extern union itc_msg *itc_alloc_zz(size_t size, uint32_t msgno);
+#define itc_alloc(size, msgno) itc_alloc_zz((size), (msgno))
+
+extern bool itc_free_zz(union itc_msg **msg);
+#define itc_free(msg) itc_free_zz((msg))
+
+extern union itc_msg *itc_alloc_sg_zz(size_t size, uint32_t msgno);
+#define itc_alloc_sg(size, msgno) itc_alloc_sg_zz((size), (msgno))
+
+extern bool itc_append_segment_zz(union itc_msg *msg, void *buf, size_t len, void (*release)(void *buf));
+#define itc_append_segment(msg, buf, len, release) itc_append_segment_zz((msg), (buf), (len), (release))
+
+extern bool itc_flatten_zz(union itc_msg **msg);
+#define itc_flatten(msg) itc_flatten_zz((msg))
+
+extern int itc_get_segments_zz(union itc_msg *msg, struct iovec *iov, int iovcnt);
+#define itc_get_segments(msg, iov, iovcnt) itc_get_segments_zz((msg), (iov), (iovcnt))
+
+extern itc_mbox_id_t itc_create_mailbox_zz(const char *name, uint32_t flags);
+#define itc_create_mailbox(name, flags) itc_create_mailbox_zz((name), (flags))
+
+extern bool itc_delete_mailbox_zz(itc_mbox_id_t mbox_id);
+#define itc_delete_mailbox(mbox_id) itc_delete_mailbox_zz((mbox_id))
+
+extern bool itc_send_zz(union itc_msg **msg, itc_mbox_id_t to, itc_mbox_id_t from, char *ns);
+#define itc_send(msg, to, from, ns) itc_send_zz((msg), (to), (from), (ns))
+
+extern union itc_msg *itc_receive_zz(int32_t tmo);
+#define itc_receive(tmo) itc_receive_zz(tmo)
+
+extern bool itc_receive_into_zz(void *buf, size_t cap, int32_t tmo, struct itc_msg_info *info);
+#define itc_receive_into(buf, cap, tmo, info) itc_receive_into_zz((buf), (cap), (tmo), (info))
+
+extern union itc_msg *itc_call_zz(union itc_msg **msg, itc_mbox_id_t to, int32_t tmo);
+#define itc_call(msg, to, tmo) itc_call_zz((msg), (to), (tmo))
+
+extern bool itc_reply_zz(union itc_msg *req, union itc_msg **rsp);
+#define itc_reply(req, rsp) itc_reply_zz((req), (rsp))
+
+extern bool itc_reply_reuse_zz(union itc_msg **req, uint32_t new_msgno, size_t new_size);
+#define itc_reply_reuse(req, new_msgno, new_size) itc_reply_reuse_zz((req), (new_msgno), (new_size))
+
+extern itc_mbox_id_t itc_sender_zz(union itc_msg *msg);
+#define itc_sender(msg) itc_sender_zz((msg))
+
+extern itc_mbox_id_t itc_receiver_zz(union itc_msg *msg);
+#define itc_receiver(msg) itc_receiver_zz((msg))
+
+extern size_t itc_size_zz(union itc_msg *msg);
+#define itc_size(msg) itc_size_zz((msg))
+
+extern itc_mbox_id_t itc_current_mbox_zz(void);
+#define itc_current_mbox() itc_current_mbox_zz()
+
+extern itc_mbox_id_t itc_locate_sync_zz(int32_t timeout, const char *name, bool find_only_internal, bool *is_external, char *ns);
+#define itc_locate_sync(timeout, name, find_only_internal, is_external, ns) itc_locate_sync_zz((timeout), (name), (find_only_internal), (is_external), (ns))
+
+extern int itc_get_fd_zz();
+#define itc_get_fd() itc_get_fd_zz()
+
+extern bool itc_get_name_zz(itc_mbox_id_t mbox_id, char *name);
+#define itc_get_name(mbox_id, name) itc_get_name_zz((mbox_id), (name))
+
+extern bool itc_get_namespace_zz(int32_t timeout, char *name);
+#define itc_get_namespace(timeout, name) itc_get_namespace_zz((timeout), (name))
+
+extern struct itc_dispatcher *itc_dispatcher_create_zz(void *ctx, itc_handler_fn fallback);
+#define itc_dispatcher_create(ctx, fallback) itc_dispatcher_create_zz((ctx), (fallback))
+
+extern void itc_dispatcher_delete_zz(struct itc_dispatcher **dispatcher);
+#define itc_dispatcher_delete(dispatcher) itc_dispatcher_delete_zz((dispatcher))
+
+extern bool itc_dispatcher_register_zz(struct itc_dispatcher *dispatcher, const struct itc_handler *handlers, uint32_t nr_handlers);
+#define itc_dispatcher_register(dispatcher, handlers, nr_handlers) itc_dispatcher_register_zz((dispatcher), (handlers), (nr_handlers))
+
+extern int itc_dispatch_zz(struct itc_dispatcher *dispatcher, int32_t tmo);
+#define itc_dispatch(dispatcher, tmo) itc_dispatch_zz((dispatcher), (tmo))
+
+extern uint32_t itc_dispatcher_get_stats_zz(struct itc_dispatcher *dispatcher, struct itc_handler_stats *stats, uint32_t nr_stats);
+#define itc_dispatcher_get_stats(dispatcher, stats, nr_stats) itc_dispatcher_get_stats_zz((dispatcher), (stats), (nr_stats))
+
+extern uint32_t itc_get_credit_stats_zz(struct itc_credit_stats *stats, uint32_t nr_stats);
+#define itc_get_credit_stats(stats, nr_stats) itc_get_credit_stats_zz((stats), (nr_stats))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ITC_H__
\ No newline at end of file
@@ -10,8 +10,11 @@
 #include <pthread.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <time.h>
 
 #include <sys/stat.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/select.h>
@@ -35,12 +38,14 @@
 ** 1. To be simple, itccoord in first version only manages free_list and used_list of processes that are running with ITC system.
 ** 2. At ITC initialization of each process, they must locate itccoord firstly.
 ** 3. Itccoord will run a while true loop in order to:
-** 	+ After seeing something is coming to itccoord by select(), itcoord will call handle_locate_coord_request() to dequeue a process from free_list, add to used_list and open a socket connection ready for connect() from lsock_init.
-** 	+ Next, it will check all processes in used_list to if any process want to release or any new process which has just been found by select().
-**	+ If process state is LISTENING -> it's been locating itccoord -> connect to it.
-**	+ If process state is CONNECTED -> it want to release (process is gonna be killed) -> disconnect from it.
-**	+ There are some cases where a process in used_list (added after locating but killed during lsock_init) -> cause it's to be zombie (still in used_list but not exist anymore and will never talk/connect to itccoord to change its state to CONNECTED).
-**	+ So, in that case, if after 10 while loop or free_list_count <= a threshold, we still see the process state stays at LISTENING, we need to validate the process aliveness */
+** 	+ After seeing something is coming to itccoord by select(), itcoord will call handle_locate_coord_request() to dequeue a process from free_list, add to used_list and reply with mailbox mask and itccoord mailbox id.
+**	+ The accepted connection is not closed after the reply, it is kept as the keep-alive channel of the process (state CONNECTED) so attaching costs only one connect/send/recv.
+** 	+ Next, it will check all processes in used_list to see if any of their keep-alive channels becomes readable, which means the process has exited or been killed -> disconnect from it.
+**	+ Since the kernel closes the channel for us whenever a process dies, no zombie process can be left behind in used_list.
+** 4. A process started with ITC_LAZY_TRANSPORTS sends ITC_LAZY_TRANSPORTS_NOTIFY on its keep-alive channel. Before another process is
+**	told where one of its mailboxes is, itccoord sends it ITC_START_TRANSPORTS_REQUEST and holds the answer back until the reply
+**	comes in or START_TRANSPORTS_TMO has passed, so the locating process can send to it right away. Meanwhile the select() loop
+**	goes on serving everybody else. */
 
 /* Sequence:
 itccoord	:	itccoord_inst.sockfd = socket(AF_LOCAL, SOCK_STREAM,, 0)
@@ -49,33 +54,25 @@ itccoord	:	listen(itccoord_inst.sockfd, 10)
 
 process (lsock)	: 	sd = socket(AF_LOCAL, SOCK_STREAM, 0)
 process (lsock)	:	res = connect(sd, (struct sockaddr*)&coord_addr, sizeof(coord_addr)) ---> /tmp/itc/itccoord/itc_coordinator
-process (lsock)	:	res = send(sd, lrequest, sizeof(struct itc_locate_coord_request), 0)
+process (lsock)	:	res = send(sd, &lrequest, sizeof(struct itc_locate_coord_request), 0)
 
 itccoord	:	handle_locate_coord_request()
 itccoord	:	tmp_sd = accept(sd, (struct sockaddr *)&addr, &addr_len)
-itccoord	:	len = recv(tmp_sd, lrequest, RXLEN, 0)
-itccoord	:	tmp->sockfd = socket(AF_LOCAL, SOCK_STREAM, 0) 
-itccoord	:	res = bind(tmp->sockfd, (struct sockaddr*)&tmp->sockaddr, sizeof(tmp->sockaddr)) ---> /tmp/itc/socket/lsocket_0x...
-itccoord	:	res = listen(tmp->sockfd, 1)
+itccoord	:	len = recv(tmp_sd, &lrequest, sizeof(struct itc_locate_coord_request), MSG_WAITALL)
+itccoord	:	tmp->sockfd = tmp_sd, tmp->state = PROC_CONNECTED
+itccoord	:	res = send(tmp_sd, &lreply, sizeof(struct itc_locate_coord_reply), 0)
 
-process (lsock)	:	rx_len = recv(sd, lreply, RXBUF_LEN, 0) ---> itc_locate_coord_reply
-process (lsock)	:	close(sd) ---> LOCATING ITCCOORD DONE!
+process (lsock)	:	rx_len = recv(sd, &lreply, sizeof(struct itc_locate_coord_reply), MSG_WAITALL) ---> itc_locate_coord_reply
+process (lsock)	:	lsock_inst.sd = sd ---> LOCATING ITCCOORD AND CONNECTING KEEP-ALIVE CHANNEL DONE!
 
-process (lsock)	:	sd = socket(AF_LOCAL, SOCK_STREAM, 0) ---> lsock_init()
-process (lsock)	:	res = connect(sd, (struct sockaddr*)&coord_addr, sizeof(struct sockaddr)) ---> /tmp/itc/socket/lsocket_0x...
-
-itccoord	:	connect_to_process()
-itccoord	:	tmp_sd = accept(proc->sockfd, (struct sockaddr *)addr, &addr_len)
-itccoord	:	res = send(tmp_sd, "ack", 4, 0) ---> /tmp/itc/socket/lsocket_0x...
-
-process (lsock)	:	rx_len = recv(sd, str_ack, 4, 0) ---> CONNECTING TO A PROCESS DONE FROM ITCCOORD SIDE!
+process (lsock)	:	close(lsock_inst.sd) ---> lsock_exit()
+itccoord	:	select() sees tmp_sd readable ---> disconnect_from_process()
 */
 
 /*****************************************************************************\/
 *****                      INTERNAL TYPES IN ITC.C                         *****
 *******************************************************************************/
-#define NR_PROC_ALIVENESS_CHECK_RETRIES	10 // After 10 while true loop of itccoord main function, check zombie processes.
-#define FREELIST_LOW_THRESHOLD		10 // When number of processes remaining in free_list decreases down to 10 -> used_list count should be 255 - 10 = 245, check zombie processes.
+#define START_TRANSPORTS_TMO	1000 // ms a lazy process gets to start its IPC transports before locates are answered anyway
 
 union itc_msg {
 	uint32_t					msgno;
@@ -91,8 +88,7 @@ union itc_msg {
 
 typedef enum {
 	PROC_UNUSED = 0,
-	PROC_LISTENING, // After a process called lsock_locate_coord, state is changed to LISTENING so that waiting for connect from the process by lsock_init
-	PROC_CONNECTED, // After a process called lsock_init
+	PROC_CONNECTED, // After a process called lsock_locate_coord, its locate connection is kept as keep-alive channel
 	PROC_INVALID
 } process_state_e;
 
@@ -101,12 +97,22 @@ struct itc_mbox_info {
 	char			mbox_name[1];
 };
 
+/* A locate of a mailbox whose process is still starting its IPC transports */
+struct itc_pending_locate {
+	union itc_msg			*req; // ITC_LOCATE_MBOX_SYNC_REQUEST, the locating process waits in itc_call()
+	union itc_msg			*reply;
+	struct itc_pending_locate	*next;
+};
+
 struct itc_process {
 	itc_mbox_id_t		mbox_id_in_itccoord; // Mailbox id of the process in itccoord, should be only masked with 3 left-most hexes 0xFFF00000
 	pid_t			pid; // PID of the process
-	int			sockfd; // socket fd of the process
-	struct sockaddr_un	sockaddr;
+	int			sockfd; // keep-alive socket fd of the process, the connection accepted in handle_locate_coord_request
 	process_state_e		state;
+	bool			lazy; // Its IPC transports are not running yet, see ITC_LAZY_TRANSPORTS
+	bool			starting; // Sent ITC_START_TRANSPORTS_REQUEST at start_time, pending locates wait for the reply
+	struct timespec		start_time;
+	struct itc_pending_locate *pending;
 	void			*list_mboxes_tree;
 };
 
@@ -118,6 +124,7 @@ struct itccoord_instance {
 
 	itc_mbox_id_t		mbox_id;
 	int			mbox_fd;
+	struct itc_dispatcher	*dispatcher; // Dispatch incoming ITC_PROTO_MSG_BASE requests to handlers below
 	int			sockfd;
 	uint32_t		freelist_count;
 
@@ -142,6 +149,7 @@ static __thread struct result_code* rc = NULL; // A thread only owns one return
 static void itccoord_init(void);
 static void itccoord_sig_handler(int signo);
 static void itccoord_exit_handler(void);
+static void remove_large_sysvshm(void);
 static bool setup_log_file(void);
 static bool setup_rc(void);
 static bool is_itccoord_running(void); // A function to see if itccoord is already running or not
@@ -150,16 +158,28 @@ static bool handle_locate_coord_request(int sd); // Handle itc_locate_coord_requ
 static bool disconnect_from_process(struct itc_process *proc); // Disconnect from a process that has called lsock_exit or by any reason its socket is closed
 static bool close_socket_connection(struct itc_process *proc);
 static struct itc_process *find_process(itc_mbox_id_t mbox_id);
-static bool connect_to_process(struct itc_process *proc);
+static bool read_keepalive_channel(struct itc_process *proc); // Handle what a process has sent on its keep-alive channel, false if closed
+static bool start_lazy_process(struct itc_process *proc); // Ask a lazy process to start its IPC transports, false if it cannot be asked
+static void answer_pending_locates(struct itc_process *proc, bool gone);
+static struct timeval *expire_lazy_starts(struct timeval *tmo); // Answer locates that waited long enough, time until the next one is due
 static void handle_incoming_request(void);
+static void handle_notify_add_mbox(union itc_msg **msg, void *ctx);
+static void handle_notify_rmv_mbox(union itc_msg **msg, void *ctx);
+static void handle_locate_mbox_sync_request(union itc_msg **msg, void *ctx);
 static void handle_add_mbox(itc_mbox_id_t mbox_id, char *mbox_name);
 static void handle_remove_mbox(itc_mbox_id_t mbox_id, char *mbox_name);
-static void handle_locate_mbox(itc_mbox_id_t from_mbox, int32_t timeout, bool find_only_internal, char *mbox_name);
+static void handle_locate_mbox(union itc_msg **req_msg, itc_mbox_id_t from_mbox, int32_t timeout, bool find_only_internal, char *mbox_name);
 static int mbox_name_cmpfunc(const void *pa, const void *pb); // char *mbox_name vs struct itc_mbox_info *mbox2
 static int mbox_name_cmpfunc2(const void *pa, const void *pb); // struct itc_mbox_info *mbox1 vs struct itc_mbox_info *mbox2
 static void do_nothing(void *tree_node_data);
 void delete_counterpart_mailboxes_in_mailboxtree(const void *nodep, const VISIT which, const int depth);
 
+static const struct itc_handler itccoord_handlers[] = {
+	ITC_HANDLER(ITC_NOTIFY_COORD_ADD_MBOX,		handle_notify_add_mbox),
+	ITC_HANDLER(ITC_NOTIFY_COORD_RMV_MBOX,		handle_notify_rmv_mbox),
+	ITC_HANDLER(ITC_LOCATE_MBOX_SYNC_REQUEST,	handle_locate_mbox_sync_request)
+};
+
 
 /*****************************************************************************\/
 *****                        FUNCTION DEFINITIONS                          *****
@@ -250,6 +270,13 @@ int main(int argc, char* argv[])
 
 	itccoord_inst.mbox_fd = itc_get_fd();
 
+	itccoord_inst.dispatcher = itc_dispatcher_create(NULL, NULL);
+	if(itccoord_inst.dispatcher == NULL || itc_dispatcher_register(itccoord_inst.dispatcher, itccoord_handlers, sizeof(itccoord_handlers) / sizeof(itccoord_handlers[0])) == false)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to set up itccoord dispatcher!");
+		exit(EXIT_FAILURE);
+	}
+
 	itccoord_inst.free_list = q_init(rc);
 	CHECK_RC_EXIT(rc);
 	itccoord_inst.used_list = q_init(rc);
@@ -323,13 +350,13 @@ int main(int argc, char* argv[])
 	}
 
 	fd_set proc_fd_list;
+	struct timeval tmo;
 	int max_fd;
 	struct itcq_node *iter;
 	struct itc_process *proc;
-	int zc_counter = 0; // Zombie process check
 	while(true)
 	{
-		/* We use FD_... macros to manage a set of file desciptors that are actually sock fd created by lsock_init function */
+		/* We use FD_... macros to manage a set of file desciptors that are actually keep-alive sock fd accepted by handle_locate_coord_request() */
 		FD_ZERO(&proc_fd_list); // Clear all fd in the set
 		FD_SET(itccoord_inst.sockfd, &proc_fd_list); // Add itccoord socket fd
 		max_fd = itccoord_inst.sockfd + 1;
@@ -339,7 +366,7 @@ int main(int argc, char* argv[])
 			max_fd = itccoord_inst.mbox_fd + 1;
 		}
 
-		/* Iterating through the used queue and add sockfd created by processes that have just called lsock_init to the fd set */
+		/* Iterating through the used queue and add keep-alive sockfd of all attached processes to the fd set */
 		for(iter = itccoord_inst.used_list->head; iter != NULL; iter = iter->next)
 		{
 			proc = (struct itc_process *)iter->p_data;
@@ -353,9 +380,12 @@ int main(int argc, char* argv[])
 			}
 		}
 
-		// Monitor those fd to see if any incoming data on them
-		res = select(max_fd, &proc_fd_list, NULL, NULL, NULL);
-		if(res < 0)
+		// Monitor those fd to see if any incoming data on them, or until a lazy process has had long enough to start
+		res = select(max_fd, &proc_fd_list, NULL, NULL, expire_lazy_starts(&tmo));
+		if(res < 0 && errno == EINTR)
+		{
+			continue;
+		} else if(res < 0)
 		{
 			TPT_TRACE(TRACE_ERROR, "Failed to select(), errno = %d!", errno);
 			exit(EXIT_FAILURE);
@@ -373,39 +403,14 @@ int main(int argc, char* argv[])
 			for(iter = itccoord_inst.used_list->head; iter != NULL; iter = iter->next)
 			{
 				proc = (struct itc_process *)iter->p_data;
-				if(proc->sockfd != -1 && FD_ISSET(proc->sockfd, &proc_fd_list))
+				if(proc->sockfd != -1 && FD_ISSET(proc->sockfd, &proc_fd_list) && !read_keepalive_channel(proc))
 				{
-					if(proc->state == PROC_LISTENING)
+					TPT_TRACE(TRACE_INFO, "Process with fd %d, pid = %d closed its keep-alive channel!", proc->sockfd, proc->pid);
+					if(disconnect_from_process(proc) == false)
 					{
-						TPT_TRACE(TRACE_INFO, "Process with fd %d is in state PROC_LISTENING!", proc->sockfd);
-						if(connect_to_process(proc) == false)
-						{
-							exit(EXIT_FAILURE);
-						}
-					} else if(proc->state == PROC_CONNECTED)
-					{
-						TPT_TRACE(TRACE_INFO, "Process with fd %d is in state PROC_CONNECTED!", proc->sockfd);
-						if(disconnect_from_process(proc) == false)
-						{
-							exit(EXIT_FAILURE);
-						}
-						break;
-					} else
-					{
-						TPT_TRACE(TRACE_ERROR, "Wrong process state = %d, pid = %d!", proc->state, proc->pid);
 						exit(EXIT_FAILURE);
 					}
-				} else if((zc_counter == (NR_PROC_ALIVENESS_CHECK_RETRIES - 1) || itccoord_inst.freelist_count < FREELIST_LOW_THRESHOLD) && \
-					proc->state == PROC_LISTENING && proc->pid > 0)
-				{
-					/* Try killing the process but received errno no such process */
-					if(kill(proc->pid, 0) == -1 && errno == ESRCH)
-					{
-						TPT_TRACE(TRACE_ABN, "Zomebie process detected, pid = %d!", proc->pid);
-						disconnect_from_process(proc);
-						zc_counter--;
-						break;
-					}
+					break;
 				}
 			}
 
@@ -414,9 +419,6 @@ int main(int argc, char* argv[])
 				TPT_TRACE(TRACE_INFO, "Calling handle_incoming_request()!");
 				handle_incoming_request(); // Such as ADD, RMV mailboxes,...
 			}
-
-			zc_counter++;
-			zc_counter %= NR_PROC_ALIVENESS_CHECK_RETRIES; // Keep it in range of 0-9
 		}
 	}
 
@@ -486,10 +488,7 @@ static void itccoord_exit_handler(void)
 	remove(ITC_SYSVMSQ_FILENAME);
 	rmdir(ITC_SYSVMSQ_FOLDER);
 	remove(ITC_SYSVSHM_FILENAME);
-	remove(ITC_SYSVSHM_UNLIMIT_FILENAME);
-	remove(ITC_SYSVSHM_SEM_MUTEX);
-	remove(ITC_SYSVSHM_SEM_NOTIFY);
-	remove(ITC_SYSVSHM_SEM_SLOT);
+	remove_large_sysvshm();
 	rmdir(ITC_SYSVSHM_FOLDER);
 	rmdir(ITC_BASE_PATH);
 	TPT_TRACE(TRACE_INFO, "Remove all directories successfully!");
@@ -502,6 +501,7 @@ static void itccoord_exit_handler(void)
 	TPT_TRACE(TRACE_INFO, "Removing processes in used_list, count = %u!", 253 - itccoord_inst.freelist_count);
 	q_exit(rc, itccoord_inst.used_list);
 
+	itc_dispatcher_delete(&itccoord_inst.dispatcher);
 	itc_delete_mailbox(itccoord_inst.mbox_id);
 	itc_exit();
 
@@ -509,6 +509,34 @@ static void itccoord_exit_handler(void)
 	TPT_TRACE(TRACE_INFO, "ITCCOORD exit handler finished!");
 }
 
+/* Segments of sysvshm large slots are created by senders and outlive a receiver that crashed. Their keys are lost along
+with the files they are made from, so remove whatever is left before */
+static void remove_large_sysvshm(void)
+{
+	char path[64];
+
+	for(int i = 0; i < MAX_SUPPORTED_PROCESSES; i++)
+	{
+		snprintf(path, sizeof(path), "%s%d", ITC_SYSVSHM_LARGE_FILENAME, i);
+		if(access(path, F_OK) != 0)
+		{
+			continue;
+		}
+
+		for(int whichslot = 0; whichslot < ITC_SYSVSHM_LARGE_SLOTS; whichslot++)
+		{
+			key_t key = ftok(path, whichslot + 1);
+			int shmid = (key != -1) ? shmget(key, 0, 0) : -1;
+
+			if(shmid != -1 && shmctl(shmid, IPC_RMID, NULL) == -1)
+			{
+				TPT_TRACE(TRACE_ERROR, "Failed to remove large segment %d of process %d, errno = %d", whichslot, i, errno);
+			}
+		}
+		unlink(path);
+	}
+}
+
 static bool setup_log_file(void)
 {
 	/* Setup a log file for our itcgws daemon */
@@ -611,13 +639,13 @@ static bool create_itccoord_dir(void)
 
 static bool handle_locate_coord_request(int sd)
 {
-	struct itc_locate_coord_reply *lreply;
-	struct itc_locate_coord_request *lrequest;
+	struct itc_locate_coord_reply lreply;
+	struct itc_locate_coord_request lrequest;
 	struct itc_process *tmp;
 	struct sockaddr_un addr;
 	socklen_t addr_len = sizeof(struct sockaddr_un);
 	int tmp_sd, res;
-	long unsigned int len;
+	ssize_t len;
 
 	tmp_sd = accept(sd, (struct sockaddr *)&addr, &addr_len); // Create a socket connection on the file descriptor of itccoord to communicate with the process
 	if(tmp_sd < 0)
@@ -634,32 +662,33 @@ static bool handle_locate_coord_request(int sd)
 		return false;
 	}
 
-	size_t RXLEN = 1024;
-	lrequest = (struct itc_locate_coord_request*)malloc(RXLEN); // Allocate a rx buffer to receive the request from the process
-	if(lrequest == NULL)
+	do
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to malloc itc_locate_coord_request due to out of memory!");
-		return false;
-	}
+		len = recv(tmp_sd, &lrequest, sizeof(struct itc_locate_coord_request), MSG_WAITALL);
+	} while(len < 0 && errno == EINTR);
 
-	len = recv(tmp_sd, lrequest, RXLEN, 0);
-	if(len < (size_t)sizeof(struct itc_locate_coord_request))
+	if(len < (ssize_t)sizeof(struct itc_locate_coord_request))
 	{
-		if(errno == EIDRM || errno == ENOENT || errno == EINVAL)
-		{
-			/* The reason could be that the socket connection of the process was just closed 
-			** So ignore the request */
-			TPT_TRACE(TRACE_ABN, "The process's socket has just closed, OK!");
-			free(lrequest);
-			return true;
-		}
-
-		/* Not a big problem here so not return */
-		lrequest->my_pid = -1;
-	} else if(lrequest->msgno != ITC_LOCATE_COORD_REQUEST)
+		/* The process has closed its socket before its request could be read, just ignore the request */
+		TPT_TRACE(TRACE_ABN, "The process's socket has just closed, len = %zd, errno = %d, OK!", len, errno);
+		close(tmp_sd);
+		return true;
+	} else if(lrequest.msgno == ITC_LOCATE_COORD_REQUEST_V1)
+	{
+		/* Built against the 16-byte itc_message header, it would misread every message of ours. ITC_NO_MBOX_ID makes it give up */
+		TPT_TRACE(TRACE_ERROR, "Process pid = %d uses itc_message header version 1, not %d, turn it away!", lrequest.my_pid, ITC_WIRE_VERSION);
+		lreply.msgno			= ITC_LOCATE_COORD_REPLY;
+		lreply.my_mbox_id_in_itccoord	= ITC_NO_MBOX_ID;
+		lreply.itccoord_mask		= ITC_COORD_MASK;
+		lreply.itccoord_mbox_id		= itccoord_inst.mbox_id;
+		(void)send(tmp_sd, &lreply, sizeof(struct itc_locate_coord_reply), MSG_NOSIGNAL);
+		close(tmp_sd);
+		return true;
+	} else if(lrequest.msgno != ITC_LOCATE_COORD_REQUEST)
 	{
 		/* Received unknown request from the process */
 		TPT_TRACE(TRACE_ERROR, "Unknown message received, expected ITC_LOCATE_COORD_REQUEST!");
+		close(tmp_sd);
 		return false;
 	}
 
@@ -668,6 +697,7 @@ static bool handle_locate_coord_request(int sd)
 	if(rc->flags != ITC_OK)
 	{
 		TPT_TRACE(TRACE_ERROR, "Failed to dequeue a process from free_list, rc = %u!", rc->flags);
+		close(tmp_sd);
 		return false;
 	}
 
@@ -679,99 +709,72 @@ static bool handle_locate_coord_request(int sd)
 		if(rc->flags != ITC_OK)
 		{
 			TPT_TRACE(TRACE_ERROR, "Failed to enqueue a process to used_list, rc = %u!", rc->flags);
+			close(tmp_sd);
 			return false;
 		}
 
-
-		tmp->pid = lrequest->my_pid;
-
-		/* Create a new socket to keep communication with the process later on */
-		tmp->sockfd = socket(AF_LOCAL, SOCK_STREAM, 0);
-		if(tmp->sockfd < 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to create socket, errno = %d!", errno);
-			return false;
-		}
-		memset(&tmp->sockaddr, 0, sizeof(struct sockaddr_un));
-		tmp->sockaddr.sun_family = AF_LOCAL;
-		sprintf(tmp->sockaddr.sun_path, "%s_0x%08x", ITC_LSOCKET_FILENAME, tmp->mbox_id_in_itccoord);
-
-		res = bind(tmp->sockfd, (struct sockaddr*)&tmp->sockaddr, sizeof(tmp->sockaddr));
-		if(res < 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to bind socket, errno = %d!", errno);
-			return false;
-		}
-
-		res = chmod(tmp->sockaddr.sun_path, 0777);
-		if(res < 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to chmod %s, errno = %d!", tmp->sockaddr.sun_path, errno);
-			return false;
-		}
-
-		res = listen(tmp->sockfd, 1);
-		if(res < 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to listen, errno = %d!", errno);
-			return false;
-		}
-
-		tmp->state = PROC_LISTENING;
+		/* The accepted connection itself is the keep-alive channel with the process from now on,
+		** when it is closed (process exited or crashed) select() wakes us up to disconnect_from_process() */
+		tmp->pid	= lrequest.my_pid;
+		tmp->sockfd	= tmp_sd;
+		tmp->state	= PROC_CONNECTED;
+		tmp->lazy	= false;
 	}
 
 	/* Send back response to the process */
-	lreply = (struct itc_locate_coord_reply*)malloc(sizeof(struct itc_locate_coord_reply));
-	if(lreply == NULL)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to malloc lreply due to out of memory!");
-		return false;
-	}
-
-	lreply->msgno = ITC_LOCATE_COORD_REPLY;
+	lreply.msgno = ITC_LOCATE_COORD_REPLY;
 	if(tmp == NULL)
 	{
 		TPT_TRACE(TRACE_ABN, "No more process to allocate for this ITC_LOCATE_COORD_REQUEST!");
-		lreply->my_mbox_id_in_itccoord = ITC_NO_MBOX_ID;
+		lreply.my_mbox_id_in_itccoord = ITC_NO_MBOX_ID;
 	} else
 	{
-		lreply->my_mbox_id_in_itccoord = tmp->mbox_id_in_itccoord;
+		lreply.my_mbox_id_in_itccoord = tmp->mbox_id_in_itccoord;
 	}
 
-	lreply->itccoord_mask = ITC_COORD_MASK;
-	lreply->itccoord_mbox_id = itccoord_inst.mbox_id;
+	lreply.itccoord_mask = ITC_COORD_MASK;
+	lreply.itccoord_mbox_id = itccoord_inst.mbox_id;
+
+	do
+	{
+		res = send(tmp_sd, &lreply, sizeof(struct itc_locate_coord_reply), 0);
+	} while(res < 0 && errno == EINTR);
 
-	res = send(tmp_sd, lreply, sizeof(struct itc_locate_coord_reply), 0);
 	if(res < 0)
 	{
 		if(errno == EPIPE)
 		{
-			TPT_TRACE(TRACE_ERROR, "Failed to send itc_locate_coord_reply to process pid = %d due to EPIPE!", tmp->pid);
-			free(lreply);
-			free(lrequest);
+			/* The process socket has just closed, discard its locate request */
+			TPT_TRACE(TRACE_ABN, "Failed to send itc_locate_coord_reply to process pid = %d due to EPIPE!", lrequest.my_pid);
 			if(tmp != NULL)
 			{
-				disconnect_from_process(tmp);
+				return disconnect_from_process(tmp);
 			}
 
-			TPT_TRACE(TRACE_ERROR, "Failed to send itc_locate_coord_reply, EPIPE!");
-			return false;
+			close(tmp_sd);
+			return true;
 		}
 
-		TPT_TRACE(TRACE_ERROR, "Failed to send itc_locate_coord_reply, res < 0!");
+		TPT_TRACE(TRACE_ERROR, "Failed to send itc_locate_coord_reply, errno = %d!", errno);
+		if(tmp == NULL)
+		{
+			/* Not owned by any process slot, nobody else will ever close it */
+			close(tmp_sd);
+		}
 		return false;
 	}
 
 	TPT_TRACE(TRACE_INFO, "Sent itc_locate_coord_reply successfully!");
 
-	free(lreply);
-	free(lrequest);
-
-	res = close(tmp_sd);
-	if(res < 0)
+	if(tmp == NULL)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to close, res = %d, errno = %d!", res, errno);
-		return false;
+		/* Nothing to keep alive, the process will give up on ITC_NO_MBOX_ID */
+		res = close(tmp_sd);
+		if(res < 0)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to close, res = %d, errno = %d!", res, errno);
+			return false;
+		}
 	}
 
 	return true;
@@ -785,6 +788,8 @@ static bool disconnect_from_process(struct itc_process *proc)
 	q_remove(rc, itccoord_inst.used_list, proc);
 	proc->state = PROC_UNUSED;
 	proc->pid = -1;
+	proc->lazy = false;
+	answer_pending_locates(proc, true);
 
 	/* Close socket connection is for the corresponding process */
 	if(close_socket_connection(proc) == false)
@@ -795,8 +800,8 @@ static bool disconnect_from_process(struct itc_process *proc)
 
 	twalk(proc->list_mboxes_tree, delete_counterpart_mailboxes_in_mailboxtree);
 	tdestroy(proc->list_mboxes_tree, free);
+	proc->list_mboxes_tree = NULL; // The slot will be handed out to another process later on
 
-	memset(&proc->sockaddr, 0, sizeof(struct sockaddr_un));
 	TPT_TRACE(TRACE_INFO, "Enqueue process mbox_id = 0x%08x to free_list!", proc->mbox_id_in_itccoord);
 	q_enqueue(rc, itccoord_inst.free_list, proc);
 	itccoord_inst.freelist_count++;
@@ -806,7 +811,6 @@ static bool disconnect_from_process(struct itc_process *proc)
 static bool close_socket_connection(struct itc_process *proc)
 {
 	int res, tmp_sd;
-	char socket_name[256];
 
 	if(proc->sockfd != -1)
 	{
@@ -838,22 +842,6 @@ static bool close_socket_connection(struct itc_process *proc)
 				break;
 			}
 		}
-
-		sprintf(socket_name, "%s_0x%08x", ITC_LSOCKET_FILENAME, proc->mbox_id_in_itccoord);
-		if(unlink(socket_name) == -1)
-		{
-			if(errno != ENOENT)
-			{
-				TPT_TRACE(TRACE_ERROR, "Failed to unlink socket address, errno = %d!", errno);
-				return false;
-			} else
-			{
-				TPT_TRACE(TRACE_ABN, "No such file or directory, not unlink socket address %s!", ITC_LSOCKET_FILENAME);
-			}
-		} else
-		{
-			TPT_TRACE(TRACE_INFO, "Unlink %s successfully!", ITC_LSOCKET_FILENAME);
-		}
 	}
 
 	return true;
@@ -874,102 +862,181 @@ static struct itc_process *find_process(itc_mbox_id_t mbox_id)
 	return &itccoord_inst.processes[index];
 }
 
-static bool connect_to_process(struct itc_process *proc)
+static bool read_keepalive_channel(struct itc_process *proc)
 {
-	struct sockaddr_un addr;
-	socklen_t addr_len = sizeof(struct sockaddr_un);
-	int tmp_sd, res;
+	struct itc_keepalive_msg msg;
+	int rx_len;
 
-	TPT_TRACE(TRACE_INFO, "Connecting to the process with pid = %d", proc->pid);
+	if(proc->sockfd == -1)
+	{
+		return false;
+	}
 
-	tmp_sd = accept(proc->sockfd, (struct sockaddr *)&addr, &addr_len);
-	if(tmp_sd < 0)
+	do
 	{
-		if(errno == ECONNABORTED)
-		{
-			/* The process socket has just closed, discard its connect request */
-			TPT_TRACE(TRACE_ABN, "The process's socket has just closed, discard its connect request!");
-			if(proc != NULL)
-			{
-				disconnect_from_process(proc);
-			}
-			return true;
-		}
+		rx_len = recv(proc->sockfd, &msg, sizeof(struct itc_keepalive_msg), MSG_DONTWAIT);
+	} while(rx_len < 0 && errno == EINTR);
+
+	if(rx_len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+		return true;
+	} else if(rx_len != (int)sizeof(struct itc_keepalive_msg))
+	{
+		/* Closed, or something we do not understand, either way we are done with this process */
+		return false;
+	}
 
-		TPT_TRACE(TRACE_ERROR, "Failed to accept socket connection on address %s!", proc->sockaddr.sun_path);
+	if(msg.msgno == ITC_LAZY_TRANSPORTS_NOTIFY)
+	{
+		TPT_TRACE(TRACE_INFO, "Process pid = %d starts its IPC transports lazily!", proc->pid);
+		proc->lazy = true;
+	} else if(msg.msgno == ITC_START_TRANSPORTS_REPLY && proc->starting)
+	{
+		TPT_TRACE(TRACE_INFO, "Process pid = %d started its IPC transports!", proc->pid);
+		answer_pending_locates(proc, false);
+	} else if(msg.msgno == ITC_START_TRANSPORTS_REPLY)
+	{
+		/* Came in after expire_lazy_starts() gave up waiting for it */
+		TPT_TRACE(TRACE_ABN, "Late ITC_START_TRANSPORTS_REPLY from process pid = %d!", proc->pid);
+	} else
+	{
+		TPT_TRACE(TRACE_ABN, "Unknown message 0x%08x on keep-alive channel of process pid = %d!", msg.msgno, proc->pid);
 		return false;
 	}
 
-	res = close(proc->sockfd);
+	return true;
+}
+
+static bool start_lazy_process(struct itc_process *proc)
+{
+	struct itc_keepalive_msg msg;
+	int res;
+
+	/* Whatever happens we only ask once, the process only listens for one request */
+	proc->lazy = false;
+
+	msg.msgno = ITC_START_TRANSPORTS_REQUEST;
+	do
+	{
+		res = send(proc->sockfd, &msg, sizeof(struct itc_keepalive_msg), MSG_NOSIGNAL);
+	} while(res < 0 && errno == EINTR);
+
 	if(res < 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to close socket connection on address %s!", proc->sockaddr.sun_path);
+		/* Closed, select() will see it and disconnect_from_process() */
+		TPT_TRACE(TRACE_ABN, "Failed to send ITC_START_TRANSPORTS_REQUEST to process pid = %d, errno = %d!", proc->pid, errno);
+		return false;
 	}
-	proc->sockfd = tmp_sd;
 
-	res = send(tmp_sd, "ack", 4, 0);
-	while(res < 0 && errno == EINTR)
+	proc->starting = true;
+	clock_gettime(CLOCK_MONOTONIC, &proc->start_time);
+	return true;
+}
+
+/* In the order they came in. If the process has gone, so have its mailboxes */
+static void answer_pending_locates(struct itc_process *proc, bool gone)
+{
+	struct itc_pending_locate *pending;
+
+	proc->starting = false;
+	while(proc->pending != NULL)
 	{
-		res = send(tmp_sd, "ack", 4, 0);
+		pending = proc->pending;
+		proc->pending = pending->next;
+
+		if(gone)
+		{
+			pending->reply->itc_locate_mbox_sync_reply.mbox_id	= ITC_NO_MBOX_ID;
+			pending->reply->itc_locate_mbox_sync_reply.pid		= -1;
+		}
+
+		if(itc_reply(pending->req, &pending->reply) == false)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to send ITC_LOCATE_MBOX_SYNC_REPLY to mailbox 0x%08x", pending->req->itc_locate_mbox_sync_request.from_mbox);
+			itc_free(&pending->reply);
+		}
+		itc_free(&pending->req);
+		free(pending);
 	}
-	if(res < 0)
+}
+
+static struct timeval *expire_lazy_starts(struct timeval *tmo)
+{
+	uint64_t tmo_ns = START_TRANSPORTS_TMO * 1000000ULL;
+	uint64_t next_ns = UINT64_MAX;
+	struct itc_process *proc;
+	struct itcq_node *iter;
+	struct timespec now;
+	uint64_t waited;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for(iter = itccoord_inst.used_list->head; iter != NULL; iter = iter->next)
 	{
-		if(errno == EPIPE)
+		proc = (struct itc_process *)iter->p_data;
+		if(!proc->starting)
 		{
-			/* The process socket has just closed, discard its connect request */
-			TPT_TRACE(TRACE_ABN, "The process's socket has just closed, will not send ACK!");
-			if(proc != NULL)
-			{
-				disconnect_from_process(proc);
-			}
-			return true;
+			continue;
 		}
 
-		TPT_TRACE(TRACE_ERROR, "Failed to send ACK to the process, pid = %d", proc->pid);
-		return false;
+		waited = calc_time_diff(proc->start_time, now);
+		if(waited >= tmo_ns)
+		{
+			TPT_TRACE(TRACE_ABN, "Process pid = %d did not start its IPC transports within %d ms!", proc->pid, START_TRANSPORTS_TMO);
+			answer_pending_locates(proc, false);
+		} else if(tmo_ns - waited < next_ns)
+		{
+			next_ns = tmo_ns - waited;
+		}
 	}
 
-	TPT_TRACE(TRACE_INFO, "Sending ACK signature to the process successfully, pid = %d", proc->pid);
-	proc->state = PROC_CONNECTED;
-	return true;
+	if(next_ns == UINT64_MAX)
+	{
+		return NULL;
+	}
+
+	/* Round up, a select() that comes back early just goes round once more */
+	next_ns += 999;
+	tmo->tv_sec = next_ns / 1000000000ULL;
+	tmo->tv_usec = (next_ns % 1000000000ULL) / 1000;
+	return tmo;
 }
 
 static void handle_incoming_request(void)
 {
-	union itc_msg *msg;
+	/* Handle everything queued so far, not just one message per epoll wakeup */
+	itc_dispatch(itccoord_inst.dispatcher, ITC_NO_WAIT);
+}
 
-	msg = itc_receive(ITC_NO_WAIT);
-	switch(msg->msgno)
-	{
-		case ITC_NOTIFY_COORD_ADD_MBOX:
-			TPT_TRACE(TRACE_INFO, "ITC_NOTIFY_COORD_ADD_MBOX received!");
-			TPT_TRACE(TRACE_INFO, "ITC_NOTIFY_COORD_ADD_MBOX mbox_id = 0x%08x", msg->itc_notify_coord_add_rmv_mbox.mbox_id);
-			TPT_TRACE(TRACE_INFO, "ITC_NOTIFY_COORD_ADD_MBOX mbox_name = %s!", msg->itc_notify_coord_add_rmv_mbox.mbox_name);
-			handle_add_mbox(msg->itc_notify_coord_add_rmv_mbox.mbox_id, msg->itc_notify_coord_add_rmv_mbox.mbox_name);
-			break;
-		
-		case ITC_NOTIFY_COORD_RMV_MBOX:
-			TPT_TRACE(TRACE_INFO, "ITC_NOTIFY_COORD_RMV_MBOX received!");
-			TPT_TRACE(TRACE_INFO, "ITC_NOTIFY_COORD_RMV_MBOX mbox_id = 0x%08x", msg->itc_notify_coord_add_rmv_mbox.mbox_id);
-			TPT_TRACE(TRACE_INFO, "ITC_NOTIFY_COORD_RMV_MBOX mbox_name = %s!", msg->itc_notify_coord_add_rmv_mbox.mbox_name);
-			handle_remove_mbox(msg->itc_notify_coord_add_rmv_mbox.mbox_id, msg->itc_notify_coord_add_rmv_mbox.mbox_name);
-			break;
-		
-		case ITC_LOCATE_MBOX_SYNC_REQUEST:
-			TPT_TRACE(TRACE_INFO, "ITC_LOCATE_MBOX_SYNC_REQUEST received!");
-			TPT_TRACE(TRACE_INFO, "ITC_LOCATE_MBOX_SYNC_REQUEST from_mbox = 0x%08x", msg->itc_locate_mbox_sync_request.from_mbox);
-			TPT_TRACE(TRACE_INFO, "ITC_LOCATE_MBOX_SYNC_REQUEST timeout = %d ms", msg->itc_locate_mbox_sync_request.timeout);
-			TPT_TRACE(TRACE_INFO, "ITC_LOCATE_MBOX_SYNC_REQUEST find_only_internal = %s", msg->itc_locate_mbox_sync_request.find_only_internal ? "true" : "false");
-			TPT_TRACE(TRACE_INFO, "ITC_LOCATE_MBOX_SYNC_REQUEST mbox_name = %s!", msg->itc_locate_mbox_sync_request.mbox_name);
-			handle_locate_mbox(msg->itc_locate_mbox_sync_request.from_mbox, msg->itc_locate_mbox_sync_request.timeout, msg->itc_locate_mbox_sync_request.find_only_internal, msg->itc_locate_mbox_sync_request.mbox_name);
-			break;
+static void handle_notify_add_mbox(union itc_msg **msg, void *ctx)
+{
+	(void)ctx;
 
-		default:
-			TPT_TRACE(TRACE_ABN, "Unknown signal 0x%08x received, discard it!", msg->msgno);
-			break;
-	}
+	TPT_TRACE(TRACE_INFO, "ITC_NOTIFY_COORD_ADD_MBOX received!");
+	TPT_TRACE(TRACE_INFO, "ITC_NOTIFY_COORD_ADD_MBOX mbox_id = 0x%08x", (*msg)->itc_notify_coord_add_rmv_mbox.mbox_id);
+	TPT_TRACE(TRACE_INFO, "ITC_NOTIFY_COORD_ADD_MBOX mbox_name = %s!", (*msg)->itc_notify_coord_add_rmv_mbox.mbox_name);
+	handle_add_mbox((*msg)->itc_notify_coord_add_rmv_mbox.mbox_id, (*msg)->itc_notify_coord_add_rmv_mbox.mbox_name);
+}
+
+static void handle_notify_rmv_mbox(union itc_msg **msg, void *ctx)
+{
+	(void)ctx;
+
+	TPT_TRACE(TRACE_INFO, "ITC_NOTIFY_COORD_RMV_MBOX received!");
+	TPT_TRACE(TRACE_INFO, "ITC_NOTIFY_COORD_RMV_MBOX mbox_id = 0x%08x", (*msg)->itc_notify_coord_add_rmv_mbox.mbox_id);
+	TPT_TRACE(TRACE_INFO, "ITC_NOTIFY_COORD_RMV_MBOX mbox_name = %s!", (*msg)->itc_notify_coord_add_rmv_mbox.mbox_name);
+	handle_remove_mbox((*msg)->itc_notify_coord_add_rmv_mbox.mbox_id, (*msg)->itc_notify_coord_add_rmv_mbox.mbox_name);
+}
 
-	itc_free(&msg);
+static void handle_locate_mbox_sync_request(union itc_msg **msg, void *ctx)
+{
+	(void)ctx;
+
+	TPT_TRACE(TRACE_INFO, "ITC_LOCATE_MBOX_SYNC_REQUEST received!");
+	TPT_TRACE(TRACE_INFO, "ITC_LOCATE_MBOX_SYNC_REQUEST from_mbox = 0x%08x", (*msg)->itc_locate_mbox_sync_request.from_mbox);
+	TPT_TRACE(TRACE_INFO, "ITC_LOCATE_MBOX_SYNC_REQUEST timeout = %d ms", (*msg)->itc_locate_mbox_sync_request.timeout);
+	TPT_TRACE(TRACE_INFO, "ITC_LOCATE_MBOX_SYNC_REQUEST find_only_internal = %s", (*msg)->itc_locate_mbox_sync_request.find_only_internal ? "true" : "false");
+	TPT_TRACE(TRACE_INFO, "ITC_LOCATE_MBOX_SYNC_REQUEST mbox_name = %s!", (*msg)->itc_locate_mbox_sync_request.mbox_name);
+	handle_locate_mbox(msg, (*msg)->itc_locate_mbox_sync_request.from_mbox, (*msg)->itc_locate_mbox_sync_request.timeout, (*msg)->itc_locate_mbox_sync_request.find_only_internal, (*msg)->itc_locate_mbox_sync_request.mbox_name);
 }
 
 static void handle_add_mbox(itc_mbox_id_t mbox_id, char *mbox_name)
@@ -1039,10 +1106,12 @@ static void handle_remove_mbox(itc_mbox_id_t mbox_id, char *mbox_name)
 	free(mbox);
 }
 
-static void handle_locate_mbox(itc_mbox_id_t from_mbox, int32_t timeout, bool find_only_internal, char *mbox_name)
+static void handle_locate_mbox(union itc_msg **req_msg, itc_mbox_id_t from_mbox, int32_t timeout, bool find_only_internal, char *mbox_name)
 {
 	struct itc_process *proc;
 	struct itc_mbox_info **iter;
+	struct itc_pending_locate *pending;
+	struct itc_process *starting = NULL;
 	pid_t pid;
 	itc_mbox_id_t mbox_id;
 	itc_mbox_id_t itcgw_mboxid = ITC_NO_MBOX_ID;
@@ -1121,6 +1190,23 @@ static void handle_locate_mbox(itc_mbox_id_t from_mbox, int32_t timeout, bool fi
 		}
 
 		pid = proc->pid;
+
+		/* The locating process is going to send to this mailbox, so its owner must be reachable by then. Its notify may
+		** still be unread on the keep-alive channel if it created the mailbox right after itc_init() */
+		if(!read_keepalive_channel(proc))
+		{
+			TPT_TRACE(TRACE_INFO, "Process with fd %d, pid = %d closed its keep-alive channel!", proc->sockfd, pid);
+			if(disconnect_from_process(proc) == false)
+			{
+				exit(EXIT_FAILURE);
+			}
+			mbox_id = ITC_NO_MBOX_ID;
+			pid = -1;
+		} else if(find_process(from_mbox) != proc && (proc->starting || (proc->lazy && start_lazy_process(proc))))
+		{
+			/* Answered once it has started, see answer_pending_locates() */
+			starting = proc;
+		}
 	}
 
 	union itc_msg *msg;
@@ -1131,8 +1217,25 @@ static void handle_locate_mbox(itc_mbox_id_t from_mbox, int32_t timeout, bool fi
 	msg->itc_locate_mbox_sync_reply.is_external 	= is_external;
 	strcpy(msg->itc_locate_mbox_sync_reply.namespace, namespace);
 
-	/* Send back response to the process */
-	if(itc_send(&msg, from_mbox, ITC_MY_MBOX_ID, NULL) == false)
+	pending = (starting != NULL) ? (struct itc_pending_locate *)malloc(sizeof(struct itc_pending_locate)) : NULL;
+	if(pending != NULL)
+	{
+		struct itc_pending_locate **last = &starting->pending;
+
+		while(*last != NULL)
+		{
+			last = &(*last)->next;
+		}
+		pending->req = *req_msg;
+		pending->reply = msg;
+		pending->next = NULL;
+		*last = pending;
+		*req_msg = NULL;
+		return;
+	}
+
+	/* Send back response to the process, itc_reply() wakes up its itc_call() directly */
+	if(itc_reply(*req_msg, &msg) == false)
 	{
 		TPT_TRACE(TRACE_ERROR, "Failed to send ITC_LOCATE_MBOX_SYNC_REPLY to mailbox 0x%08x", from_mbox);
 		itc_free(&msg);
@@ -155,7 +155,8 @@ static bool handle_locate_mbox_request(union itc_msg *msg);
 static bool handle_receive_itcmsg_at_udp(int mbox_fd);
 static bool handle_udp_rmv_peer(char *addr);
 static int recv_data(int sockfd, void *rx_buff, int nr_bytes_to_read);
-static bool handle_udp_get_namespace_request(itc_mbox_id_t mbox_id);
+static bool send_iov(int sockfd, struct iovec *iov, int iovcnt);
+static bool handle_udp_get_namespace_request(union itc_msg *req, itc_mbox_id_t mbox_id);
 static bool handle_receive_data_fwd(int sockfd, struct itcgw_header *header);
 static bool handle_receive_locate_mbox(int sockfd, struct itcgw_header *header);
 static bool send_locate_mbox_reply(int sockfd, itc_mbox_id_t mbox_id);
@@ -1451,24 +1452,24 @@ static bool handle_tcp_client_rmv_peer(int sockfd)
 
 static bool handle_fwd_data_out(union itc_msg *msg)
 {
-	size_t msg_len = offsetof(struct itcgw_msg, payload) + offsetof(struct itcgw_itc_data_fwd, payload) + msg->itc_fwd_data_to_itcgws.payload_length;
-	struct itcgw_msg *rep = malloc(msg_len);
-	if(rep == NULL)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to malloc get namespace request message!");
-		return false;
-	}
+	struct itcgw_msg rep;
+	struct iovec iov[2];
 
 	uint32_t payload_length = offsetof(struct itcgw_itc_data_fwd, payload) + msg->itc_fwd_data_to_itcgws.payload_length;
-	rep->header.sender 					= htonl((uint32_t)getpid());
-	rep->header.receiver 					= htonl(222);
-	rep->header.protRev 					= htonl(15);
-	rep->header.msgno 					= htonl(ITCGW_ITC_DATA_FWD);
-	rep->header.payloadLen 					= htonl(payload_length);
+	rep.header.sender 					= htonl((uint32_t)getpid());
+	rep.header.receiver 					= htonl(222);
+	rep.header.protRev 					= htonl(ITCGW_PROT_REV);
+	rep.header.msgno 					= htonl(ITCGW_ITC_DATA_FWD);
+	rep.header.payloadLen 					= htonl(payload_length);
 
-	rep->payload.itcgw_itc_data_fwd.errorcode	= htonl(ITCGW_STATUS_OK);
-	rep->payload.itcgw_itc_data_fwd.payload_length 	= htonl(msg->itc_fwd_data_to_itcgws.payload_length);
-	memcpy(rep->payload.itcgw_itc_data_fwd.payload, msg->itc_fwd_data_to_itcgws.payload, msg->itc_fwd_data_to_itcgws.payload_length);
+	rep.payload.itcgw_itc_data_fwd.errorcode		= htonl(ITCGW_STATUS_OK);
+	rep.payload.itcgw_itc_data_fwd.payload_length 	= htonl(msg->itc_fwd_data_to_itcgws.payload_length);
+
+	/* Headers go out from the stack and the forwarded itc message from where it was received, no copy in between */
+	iov[0].iov_base	= &rep;
+	iov[0].iov_len	= offsetof(struct itcgw_msg, payload) + offsetof(struct itcgw_itc_data_fwd, payload);
+	iov[1].iov_base	= msg->itc_fwd_data_to_itcgws.payload;
+	iov[1].iov_len	= msg->itc_fwd_data_to_itcgws.payload_length;
 
 	// TODO: Find respective namespace -> corresponding sockfd
 	struct tcp_peer_info **iter;
@@ -1479,14 +1480,12 @@ static bool handle_fwd_data_out(union itc_msg *msg)
 		return true;
 	}
 
-	int res = send((*iter)->fd, rep, msg_len, 0);
-	if(res < 0)
+	if(!send_iov((*iter)->fd, iov, 2))
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to send ITCGW_GET_NAMESPACE_REPLY, errno = %d!", errno);
+		TPT_TRACE(TRACE_ERROR, "Failed to send ITCGW_ITC_DATA_FWD, errno = %d!", errno);
 		return false;
 	}
 
-	free(rep);
 	// TPT_TRACE(TRACE_INFO, "Sent ITCGW_ITC_DATA_FWD to peer with namespace \"%s\" successfully!", (*iter)->namespace); // TBD
 	return true;
 }
@@ -1513,7 +1512,7 @@ static bool handle_receive_itcmsg_at_udp(int mbox_fd)
 
 	case ITC_GET_NAMESPACE_REQUEST:
 		TPT_TRACE(TRACE_INFO, "Received ITC_GET_NAMESPACE_REQUEST from mbox 0x%08x", msg->itc_get_namespace_request.mbox_id);
-		handle_udp_get_namespace_request(msg->itc_get_namespace_request.mbox_id);
+		handle_udp_get_namespace_request(msg, msg->itc_get_namespace_request.mbox_id);
 		break;
 
 	default:
@@ -1563,13 +1562,53 @@ static int recv_data(int sockfd, void *rx_buff, int nr_bytes_to_read)
 	return read_count;
 }
 
-static bool handle_udp_get_namespace_request(itc_mbox_id_t mbox_id)
+/* sendmsg() until the whole iovec is out, a stream socket may take only part of it per call */
+static bool send_iov(int sockfd, struct iovec *iov, int iovcnt)
+{
+	struct msghdr mhdr;
+	ssize_t length;
+
+	memset(&mhdr, 0, sizeof(struct msghdr));
+	mhdr.msg_iov	= iov;
+	mhdr.msg_iovlen	= iovcnt;
+
+	while(mhdr.msg_iovlen > 0)
+	{
+		length = sendmsg(sockfd, &mhdr, 0);
+		if(length < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		while(mhdr.msg_iovlen > 0 && (size_t)length >= mhdr.msg_iov->iov_len)
+		{
+			length -= mhdr.msg_iov->iov_len;
+			mhdr.msg_iov++;
+			mhdr.msg_iovlen--;
+		}
+
+		if(mhdr.msg_iovlen > 0)
+		{
+			mhdr.msg_iov->iov_base	= (char *)mhdr.msg_iov->iov_base + length;
+			mhdr.msg_iov->iov_len	-= length;
+		}
+	}
+
+	return true;
+}
+
+static bool handle_udp_get_namespace_request(union itc_msg *req, itc_mbox_id_t mbox_id)
 {
 	union itc_msg *rep;
 	rep = itc_alloc(offsetof(struct itc_get_namespace_reply, namespace) + strlen(itcgw_inst.namespace) + 1, ITC_GET_NAMESPACE_REPLY);
 	strcpy(rep->itc_get_namespace_reply.namespace, itcgw_inst.namespace);
 
-	if(itc_send(&rep, mbox_id, ITC_MY_MBOX_ID, NULL) == false)
+	if(itc_reply(req, &rep) == false)
 	{
 		TPT_TRACE(TRACE_ERROR, "Failed to send ITC_GET_NAMESPACE_REPLY to mailbox 0x%08x", mbox_id);
 		itc_free(&rep);
@@ -1595,6 +1634,13 @@ static bool handle_receive_data_fwd(int sockfd, struct itcgw_header *header)
 		return false;
 	}
 
+	if(header->protRev != ITCGW_PROT_REV)
+	{
+		/* Its itc_message header is not ours */
+		TPT_TRACE(TRACE_ERROR, "Drop forwarded data of protRev %u from fd %d, expected %u!", header->protRev, sockfd, ITCGW_PROT_REV);
+		return false;
+	}
+
 	rep = (struct itcgw_itc_data_fwd *)rxbuff;
 	rep->errorcode			= ntohl(rep->errorcode);
 	rep->payload_length 		= ntohl(rep->payload_length);
@@ -1607,7 +1653,7 @@ static bool handle_receive_data_fwd(int sockfd, struct itcgw_header *header)
 	msg = itc_alloc(((struct itc_message *)&rep->payload)->size, ((struct itc_message *)&rep->payload)->msgno);
 	struct itc_message *message = CONVERT_TO_MESSAGE(msg);
 
-	memcpy(message, ((struct itc_message *)&rep->payload), rep->payload_length);
+	itc_copy(message, ((struct itc_message *)&rep->payload), rep->payload_length);
 
 	// TPT_TRACE(TRACE_INFO, "Received not-known-yet message msgno 0x%08x, from a mbox 0x%08x outside our host!", message->msgno, message->sender); // TBD
 
@@ -1634,7 +1680,7 @@ static bool handle_locate_mbox_request(union itc_msg *msg)
 	uint32_t payload_length = offsetof(struct itcgw_locate_mbox_request, mboxname) + strlen(msg->itc_locate_mbox_from_itcgws_request.mboxname) + 1;
 	rep->header.sender 					= htonl((uint32_t)getpid());
 	rep->header.receiver 					= htonl(111);
-	rep->header.protRev 					= htonl(15);
+	rep->header.protRev 					= htonl(ITCGW_PROT_REV);
 	rep->header.msgno 					= htonl(ITCGW_LOCATE_MBOX_REQUEST);
 	rep->header.payloadLen 					= htonl(payload_length);
 
@@ -1737,7 +1783,7 @@ static bool send_locate_mbox_reply(int sockfd, itc_mbox_id_t mbox_id)
 	uint32_t payload_length = sizeof(struct itcgw_locate_mbox_reply);
 	rep->header.sender 					= htonl((uint32_t)getpid());
 	rep->header.receiver 					= htonl(111);
-	rep->header.protRev 					= htonl(15);
+	rep->header.protRev 					= htonl(ITCGW_PROT_REV);
 	rep->header.msgno 					= htonl(ITCGW_LOCATE_MBOX_REPLY);
 	rep->header.payloadLen 					= htonl(payload_length);
 
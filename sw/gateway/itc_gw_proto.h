@@ -69,6 +69,10 @@ typedef enum {
 } status_e;
 
 
+/* protRev of what itcgws send each other. ITCGW_ITC_DATA_FWD carries an itc_message header as it is, so it follows
+ITC_WIRE_VERSION: 15 was the 16-byte header. */
+#define ITCGW_PROT_REV				(14 + ITC_WIRE_VERSION)
+
 struct itcgw_header {
 	uint32_t	sender;
 	uint32_t	receiver;
@@ -30,10 +30,30 @@ extern "C" {
 *****                     VARIABLE/FUNCTIONS MACROS                        *****
 *******************************************************************************/
 #define ENDPOINT (char)0xAA
-#define ITC_HEADER_SIZE 16 // itc_message: flags + receiver + sender + size. Also is the offset between
+#define ITC_HEADER_SIZE 24 // itc_message: flags + call_id + credit_src + receiver + sender + size. Also is the offset between
                                 // the starting of itc_message and the starting of itc_msg.
+/* The header goes over the wire as it is, any change to it must bump ITC_WIRE_VERSION. Processes and itcgws of different
+versions cannot talk to each other, itccoord and itcgws refuse them. Version 1 had no call_id and credit_src. */
+#define ITC_WIRE_VERSION 2
 #define ITC_MAX_MSGSIZE	(10*1024*1024)
 
+/* itc_msg alignment of ITC_MALLOC_ALIGNED. Transports also place received messages, shared memory slots included,
+* ITC_MSG_ALIGN_PAD bytes into a 64-byte aligned buffer so their msgno lines up with the one of an aligned itc_msg */
+#define ITC_MSG_ALIGN		64
+#define ITC_MSG_ALIGN_PAD	(ITC_MSG_ALIGN - ITC_HEADER_SIZE)
+
+/* Every allocator leaves this many bytes free in front of an itc_message, so transports can put their own framing there,
+* e.g. the mtype of sysvmq, and hand the message to the send syscall as it is. Must not exceed ITC_MSG_ALIGN_PAD */
+#ifdef UNITTEST
+#define ITC_MSG_HEADROOM	0 // Transports release messages with plain free() in unit tests
+#else
+#define ITC_MSG_HEADROOM	16
+#endif
+
+/* From this size on itc_copy() uses non-temporal stores, so a large message passing through shared memory does not
+* evict the working sets of the sender and the receiver from cache */
+#define ITC_NT_COPY_THRESHOLD	(256*1024)
+
 #define ITC_COORD_MASK			0xFFF00000
 #define ITC_COORD_SHIFT			20
 #define ITC_COORD_MBOX_NAME		"itc_coord_mailbox"
@@ -52,6 +72,13 @@ extern "C" {
 #define MAX_OF(a, b)		(a) > (b) ? (a) : (b)
 #define MIN_OF(a, b)		(a) < (b) ? (a) : (b)
 
+#define ITC_CACHE_LINE			64
+
+/* Mailbox table grows by chunks of 2^ITC_MBOX_CHUNK_SHIFT mailboxes, up to ITC_MAX_MAILBOXES per process */
+#define ITC_MBOX_CHUNK_SHIFT		6
+#define ITC_MBOX_CHUNK_SIZE		(1 << ITC_MBOX_CHUNK_SHIFT)
+#define ITC_MAX_MBOX_CHUNKS		((ITC_MAX_MAILBOXES + ITC_MBOX_CHUNK_SIZE - 1) >> ITC_MBOX_CHUNK_SHIFT)
+
 #ifndef MAX_SUPPORTED_PROCESSES
 #define	MAX_SUPPORTED_PROCESSES	255
 #endif
@@ -84,6 +111,10 @@ extern "C" {
 #define ITC_SYSVMSQ_FILENAME 		"/tmp/itc/sysvmsq/sysvmsq_file"
 #endif
 
+#ifndef ITC_SYSVMSQ_DIRECT_FILENAME
+#define ITC_SYSVMSQ_DIRECT_FILENAME 	"/tmp/itc/sysvmsq/direct_rx_" // Followed by the project id of the queue
+#endif
+
 #ifndef ITC_SYSVSHM_FOLDER
 #define ITC_SYSVSHM_FOLDER 		"/tmp/itc/sysvshm/"
 #endif
@@ -92,20 +123,13 @@ extern "C" {
 #define ITC_SYSVSHM_FILENAME 		"/tmp/itc/sysvshm/sysvshm_file"
 #endif
 
-#ifndef ITC_SYSVSHM_UNLIMIT_FILENAME
-#define ITC_SYSVSHM_UNLIMIT_FILENAME 	"/tmp/itc/sysvshm/sysvshm_large_file"
+#ifndef ITC_SYSVSHM_LARGE_FILENAME
+#define ITC_SYSVSHM_LARGE_FILENAME 	"/tmp/itc/sysvshm/large_" // Followed by the project id, ftok() of it with slot + 1 keys a large slot
 #endif
+#define ITC_SYSVSHM_LARGE_SLOTS		4 // Large slots per sysvshm receiver, each with a segment of its own
 
-#ifndef ITC_SYSVSHM_SEM_MUTEX
-#define ITC_SYSVSHM_SEM_MUTEX 		"/tmp/itc/sysvshm/sem_mutex"
-#endif
-
-#ifndef ITC_SYSVSHM_SEM_NOTIFY
-#define ITC_SYSVSHM_SEM_NOTIFY 		"/tmp/itc/sysvshm/sem_notify"
-#endif
-
-#ifndef ITC_SYSVSHM_SEM_SLOT
-#define ITC_SYSVSHM_SEM_SLOT 		"/tmp/itc/sysvshm/sem_slot"
+#ifndef ITC_CREDIT_FILENAME
+#define ITC_CREDIT_FILENAME 		"/tmp/itc/credits_" // Followed by the process index of the ITC_FLOW_CONTROL process
 #endif
 
 #ifndef ITC_ITCGWS_LOGFILE
@@ -116,6 +140,46 @@ extern "C" {
 #define ITC_ITCCOORD_LOGFILE 		"itccoord.log"
 #endif
 
+/* Comma separated IPC transports in order of preference, e.g. "sysvshm,sysvmq". Read once by itc_init().
+** Sending to another process uses the first transport in this list that the receiving process has enabled as well. */
+#define ITC_TRANSPORTS_ENV		"ITC_TRANSPORTS"
+
+/* Always enabled after the ones from ITC_TRANSPORTS_ENV, so itccoord stays reachable. Unit tests that only link one
+** transport pick it by UT_..._PLUGIN */
+#ifndef ITC_DEFAULT_TRANSPORTS
+#if defined UT_POSIXMQ_PLUGIN
+#define ITC_DEFAULT_TRANSPORTS		"posixmq"
+#elif defined UT_POSIXSHM_PLUGIN
+#define ITC_DEFAULT_TRANSPORTS		"posixshm"
+#elif defined UT_SYSVSHM_PLUGIN
+#define ITC_DEFAULT_TRANSPORTS		"sysvshm"
+#else
+#define ITC_DEFAULT_TRANSPORTS		"sysvmq"
+#endif
+#endif
+
+/* Path of a transport profile, lines of "<max message bytes> <transport>" telling which transport carries messages up to
+** that size. Loaded by itc_init() if it exists, written by itc_init() after a calibration. */
+#define ITC_TRANSPORT_PROFILE_ENV	"ITC_TRANSPORT_PROFILE"
+
+/* If set and no profile could be loaded, itc_init() times a short ping-pong to itself on every enabled IPC transport */
+#define ITC_TRANSPORT_CALIBRATE_ENV	"ITC_TRANSPORT_CALIBRATE"
+
+/* Milliseconds that a send to an ITC_FLOW_CONTROL process waits for a credit before it fails, 0 to fail fast and -1 to
+** wait forever. ITC_CREDIT_DEFAULT_TMO if not set. Read once by itc_init(). */
+#define ITC_CREDIT_TMO_ENV		"ITC_CREDIT_TMO"
+#define ITC_CREDIT_DEFAULT_TMO		1000
+#define ITC_CREDIT_BATCH		16 // Credits are handed back this many at a time, at most ITC_CREDIT_WINDOW
+#define ITC_CREDIT_RECHECK		100 // Milliseconds between looks for a restarted receiver while waiting for credits
+/* Milliseconds a sender waits for everything it sent to a process to be delivered before it moves on to another transport
+** towards it. If that takes longer it keeps using the current one, or fails the send if the message does not fit it. */
+#define ITC_TRANS_DRAIN_TMO		1000
+
+#define ITC_NR_SIZE_CLASSES		32 // Size class c holds messages of (2^(c-1), 2^c] bytes on the wire
+#define ITC_CALIBRATE_MIN_CLASS		6 // 64 bytes
+#define ITC_CALIBRATE_MAX_CLASS		20 // 1MB
+#define ITC_CALIBRATE_ROUNDS		16 // Round trips per transport and size, the median is taken
+
 #ifdef LOCAL_TRANS_UNITTEST
 #define ITC_NR_INTERNAL_USED_MBOXES 0 // Unittest for local trans so sock and sysvmq not used yet
 #else
@@ -123,7 +187,8 @@ extern "C" {
 #endif
 
 #define CLZ(val) __builtin_clz(val)
-#define CONVERT_TO_MESSAGE(msg) (struct itc_message*)((unsigned long)msg - ITC_HEADER_SIZE) // See itc_message in README
+// See itc_message in README. ITC_MALLOC_ALIGNED pads in front of the header, not between header and msgno, so this holds for it too
+#define CONVERT_TO_MESSAGE(msg) (struct itc_message*)((unsigned long)msg - ITC_HEADER_SIZE)
 
 #define CONVERT_TO_MSG(message) (union itc_msg*)(&message->msgno)
 
@@ -230,8 +295,24 @@ unsigned long int calc_time_diff(struct timespec t_start, struct timespec t_end)
 #define ITC_FLAGS_I_AM_ITC_COORD 0x00000001
 // Force to redo itc_init() for a process
 #define ITC_FLAGS_FORCE_REINIT  0x00000100
+// Shared memory transports prefault and lock their segments (itc_init() with ITC_PREFAULT_SHM)
+#define ITC_FLAGS_SHM_PREFAULT	0x00000200
+// Rx threads of IPC transports are only started on first use (itc_init() with ITC_LAZY_TRANSPORTS)
+#define ITC_FLAGS_LAZY_IPC	0x00000400
+// Mailbox of a transport rx thread, which re-sends messages on behalf of their original sender (used by itc_create_mailbox() call)
+#define ITC_FLAGS_MBOX_FORWARDER	0x00010000
 // Indicate a message are in a rx queue of some mailbox.
 #define ITC_FLAGS_MSG_INRXQUEUE 0x0001
+// Indicate a message was allocated by itc_alloc_sg() and may carry payload segments out of line.
+#define ITC_FLAGS_MSG_SG	0x0002
+// Marks a sysvmq fragment on the wire, where the flags of an itc_message would be. Never set on an itc_message.
+#define ITC_FLAGS_MSG_FRAGMENT	0x0004
+// Set in call_id of a message sent by itc_reply(), the remaining bits are the call_id of the matching itc_call() request.
+#define ITC_CALL_ID_REPLY	0x80000000
+// Set in credit_src of a message that holds a credit of its receiving process.
+#define ITC_CREDIT_TAG		0x80000000
+// Set in credit_src of every message sent to another process, the bits below ITC_CREDIT_SRC are the process index of the sender.
+#define ITC_CREDIT_SRC		0x40000000
 // Normally, Linux allows us to have Real-time Processes's priority in range of 1-99, but it should be only 40. That's enough!
 #define ITC_HIGH_PRIORITY	40
 
@@ -270,17 +351,10 @@ typedef	enum {
 	ITC_INVALID_TRANS = -1,
 	ITC_TRANS_LOCAL	= 0,
 	ITC_TRANS_LSOCK,
-#if defined UT_POSIXMQ_PLUGIN
+	ITC_TRANS_SYSVMQ, // From here on are IPC transports, any of them can be enabled at itc_init() by ITC_TRANSPORTS_ENV
 	ITC_TRANS_POSIXMQ,
-#elif defined UT_SYSVMQ_PLUGIN
-	ITC_TRANS_SYSVMQ,
-#elif defined UT_POSIXSHM_PLUGIN
 	ITC_TRANS_POSIXSHM,
-#elif defined UT_SYSVSHM_PLUGIN
 	ITC_TRANS_SYSVSHM,
-#else
-	ITC_TRANS_SYSVMQ,
-#endif
 	ITC_NUM_TRANS
 } itc_transport_e;
 
@@ -313,32 +387,53 @@ struct itc_alloc_info {
 *****                         TYPE DEFINITIONS                             *****
 *******************************************************************************/
 struct mbox_rxq_info {
-	pthread_mutexattr_t		rxq_attr;
-	pthread_mutex_t			rxq_mtx;
-	pthread_cond_t			rxq_cond;
-
+	long				rxq_len;
 	int				rxq_fd;
 	bool				is_fd_created;
-	long				rxq_len;
 	bool				is_in_rx;
+	bool				fd_edge;	// Mailbox created with ITC_EDGE_TRIGGERED_FD
+	bool				fd_armed;	// fd_edge only, owner saw the rx queue empty since the last write()
+
+	pthread_mutex_t			rxq_mtx;
+	pthread_cond_t			rxq_cond;
 };
 
+/* Mailboxes live in ITC_MBOX_CHUNK_SIZE sized chunks that are added when the free list runs dry, so pointers to them stay
+* valid. Each one starts on its own cache line with the fields that send/receive check first, the rx queue lock and
+* condition follow. The name is only needed at create/delete/locate time and is kept out of line. */
 struct itc_mailbox {
-        uint32_t                    	flags;
-	struct mbox_rxq_info		rxq_info;
+	uint32_t			mbox_id;
+	uint32_t			flags;
+	mbox_state_e			mbox_state;
+	pid_t				tid;
 	struct mbox_rxq_info*		p_rxq_info;
 
-        uint32_t                    	mbox_id;
-	mbox_state_e			mbox_state;
-        pid_t                       	tid;
-        char                        	name[ITC_MAX_NAME_LENGTH];
-};
+	/* Reply slot of an on-going itc_call(), protected by rxq_mtx */
+	uint32_t			wait_call_id;
+	struct itc_message*		reply_slot;
+
+	/* Caller buffer of an on-going itc_receive_into(), protected by rxq_mtx */
+	bool				into_done;
+	void*				into_buf;
+	size_t				into_cap;
+	struct itc_msg_info*		into_info;
+
+	/* Owner of an ITC_DIRECT_IPC_RX mailbox blocked in itci_trans_wait() of sysvmq, protected by rxq_mtx */
+	bool				in_trans_wait;
+	void*				trans_rx; // Per mailbox state of sysvmq for ITC_DIRECT_IPC_RX
+
+	struct mbox_rxq_info		rxq_info;
+
+	char*				name;
+} __attribute__((aligned(ITC_CACHE_LINE)));
 
 struct itc_message {
-/* Any change in itc_message struct size must lead to re-calculation of ITC_HEADER_SIZE as well */
+/* Any change in itc_message struct size must lead to re-calculation of ITC_HEADER_SIZE and a new ITC_WIRE_VERSION as well */
 /* itc_message is only used for controlling itc system through below admin information,
 do not access user data via itc_message but use itc_msg instead */
         uint32_t               	flags;
+	uint32_t			call_id;	// Correlation id of itc_call()/itc_reply(), 0 for ordinary messages
+	uint32_t			credit_src;	// ITC_CREDIT_SRC | sender process index, ITC_CREDIT_TAG if it holds a credit. Keeps msgno 8-byte aligned
 
         /* DO NOT change anything in the remainder - this is a core part - to avoid breaking the whole ITC system. */
         itc_mbox_id_t          	receiver;
@@ -363,6 +458,109 @@ do not access user data via itc_message but use itc_msg instead */
 };
 
 
+/* Scatter-gather messages keep a segment list right behind the ENDPOINT of the head, aligned to 8 bytes,
+so that only one allocation is needed per message. Segment buffers themselves are owned by users. */
+struct itc_sg_segment {
+	void				*base;
+	size_t				len;
+	void				(*release)(void *base);
+};
+
+struct itc_sg_list {
+	uint32_t			nr_segs;
+	size_t				total_len; // Sum of all segment lengths, not including the head
+	struct itc_sg_segment		segs[ITC_MAX_SG_SEGMENTS];
+};
+
+#define ITC_SG_LIST_OFFSET(size)	((ITC_HEADER_SIZE + (size) + 1 + 7) & ~((size_t)7))
+#define ITC_SG_LIST(message)		((struct itc_sg_list *)((unsigned long)(message) + ITC_SG_LIST_OFFSET((message)->size)))
+
+/* Size of the itc_msg part once all segments are laid out contiguously */
+static inline size_t itc_msg_payload_size(struct itc_message *message)
+{
+	if(message->flags & ITC_FLAGS_MSG_SG)
+	{
+		return message->size + ITC_SG_LIST(message)->total_len;
+	}
+
+	return message->size;
+}
+
+/* Number of bytes a transport has to carry for this message, header and ENDPOINT included */
+static inline size_t itc_msg_wire_size(struct itc_message *message)
+{
+	return ITC_HEADER_SIZE + itc_msg_payload_size(message) + 1;
+}
+
+/* memcpy() that switches to AVX2/SSE2 non-temporal stores, picked at runtime via CPUID, from ITC_NT_COPY_THRESHOLD bytes on.
+Meant for copies into or out of memory shared with another process, the destination is not expected to be read soon. */
+void *itc_copy(void *dst, const void *src, size_t len);
+
+/* Name of the kernel itc_copy() uses above the threshold on this CPU: "avx2", "sse2" or "memcpy" */
+const char *itc_copy_kernel_name(void);
+
+static inline size_t itc_msg_gather_with(struct itc_message *message, void *dst, void *(*copy)(void *, const void *, size_t))
+{
+	struct itc_message *out = (struct itc_message *)dst;
+	char *pos;
+
+	if(!(message->flags & ITC_FLAGS_MSG_SG))
+	{
+		copy(dst, message, message->size + ITC_HEADER_SIZE + 1);
+		return message->size + ITC_HEADER_SIZE + 1;
+	}
+
+	struct itc_sg_list *sgl = ITC_SG_LIST(message);
+
+	memcpy(dst, message, message->size + ITC_HEADER_SIZE);
+	out->flags &= ~ITC_FLAGS_MSG_SG;
+	out->size = message->size + sgl->total_len;
+
+	pos = (char *)dst + ITC_HEADER_SIZE + message->size;
+	for(uint32_t i = 0; i < sgl->nr_segs; i++)
+	{
+		copy(pos, sgl->segs[i].base, sgl->segs[i].len);
+		pos += sgl->segs[i].len;
+	}
+	*pos = ENDPOINT;
+
+	return (size_t)(pos - (char *)dst) + 1;
+}
+
+/* Copy a message into a contiguous buffer of at least itc_msg_wire_size() bytes. Segments are gathered on the fly,
+so transports never need to flatten a scatter-gather message first. The copy is always an ordinary message. */
+static inline size_t itc_msg_gather(struct itc_message *message, void *dst)
+{
+	return itc_msg_gather_with(message, dst, memcpy);
+}
+
+/* Same as itc_msg_gather() but through itc_copy(), for shared memory transports */
+static inline size_t itc_msg_gather_shm(struct itc_message *message, void *dst)
+{
+	return itc_msg_gather_with(message, dst, itc_copy);
+}
+
+/* Wake up the owner of mbox waiting for its rx queue, rxq_mtx must be held */
+void itc_rxq_wakeup(struct itc_mailbox *mbox);
+
+/* Used by transport rx threads, queue an itc_alloc()ed message from another process straight onto its local receiver
+without the checks and transport lookup of itc_send(). The message belongs to the receiver on success. */
+bool itc_deliver_local(struct itc_message *message);
+
+/* Used by transport rx threads, hand a received message to a receiver blocked in itc_receive_into() if there is one */
+bool itc_deliver_into_waiting_mbox(struct itc_message *rxmsg);
+
+/* Used by the lsocket transport of an ITC_LAZY_TRANSPORTS process when itccoord asks it to, because another process is
+locating one of its mailboxes and will send to it. Does nothing if the transports are already running. */
+bool itc_start_ipc_transports(void);
+
+/* Used by transport rx paths once a message from another process is done with, i.e. delivered into its receiver or dropped.
+Counts it as delivered for its sender, see send_over_transports(), and hands its credit back, see ITC_FLOW_CONTROL.
+itc_deliver_local() and itc_deliver_into_waiting_mbox() call it themselves. */
+void itc_credit_return(const struct itc_message *message);
+
+/* Signal the eventfd of a mailbox about a message being added to its rx queue, called with rxq_mtx held before rxq_len++ */
+void itc_rxq_fd_notify(struct mbox_rxq_info *rxq_info);
 
 struct llqueue_item {
 	struct llqueue_item*	next;
@@ -0,0 +1,73 @@
+#ifndef __ITC_NAMETABLE_H__
+#define __ITC_NAMETABLE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+
+#include "itc_impl.h"
+
+/* Name -> mailbox id hash table, open addressing with linear probing.
+* Readers never lock, they retry if a writer bumped seq in the meantime (seqlock). Writers are serialised by nt_mtx.
+* The probed array only holds 8-byte {hash, mbox_id} slots, names live in their own allocations behind a parallel array
+* of pointers and are only touched on a hash hit, so lookup cost stays flat with the number of entries.
+* When half of the slots are used the table is rehashed into one twice as big. Readers may still be walking a replaced
+* table or a removed name, so both are retired and only freed once every reader that entered before has left (epochs).
+* Every thread announces the epoch it reads in on a cache line of its own, so concurrent readers share nothing they write. */
+struct nt_slot {
+	uint32_t		hash;	// 0 means never used
+	itc_mbox_id_t		mbox_id;	// ITC_NO_MBOX_ID with hash != 0 means removed (tombstone)
+};
+
+struct nt_table {
+	uint32_t		mask;	// Capacity - 1, capacity is a power of two
+	struct nt_slot*		slots;
+	char**			names;	// Never changed once published, NULL for empty slots and tombstones
+};
+
+struct nt_retired {
+	struct nt_retired*	next;
+	uint32_t		epoch;	// nt->epoch when it was retired
+	struct nt_table*	tab;	// A replaced table, its names were moved on to the new one
+	char*			name;	// Or the name of a removed entry
+};
+
+/* One per thread that ever looked something up, handed on to a later thread once its own has exited */
+struct nt_reader {
+	uint32_t		state;	// NT_READING(epoch) while inside nt_lookup(), 0 otherwise
+	bool			in_use;	// Owned by a live thread, protected by nt_mtx
+	struct nt_reader*	next;
+	struct itc_nametable*	nt;
+} __attribute__((aligned(ITC_CACHE_LINE)));
+
+#define NT_READING(epoch)	(((epoch) << 1) | 1)
+
+struct itc_nametable {
+	uint32_t		seq;	// Odd while a writer is modifying the table
+	uint32_t		epoch;	// Only moved on by writers once every reader inside nt_lookup() has seen the current one
+	uint32_t		nr_used;
+	uint32_t		nr_tombstones;
+
+	struct nt_table*	tab;
+	struct nt_retired*	retired;	// Newest first
+	struct nt_reader*	readers;	// Protected by nt_mtx, never shrinks until nt_exit()
+	pthread_key_t		reader_key;	// The nt_reader of the calling thread
+
+	pthread_mutex_t		nt_mtx;
+};
+
+/* capacity is the initial number of names, the table allocates twice that many slots and grows later on */
+extern struct itc_nametable* nt_init(struct result_code* rc, uint32_t capacity);
+extern void nt_exit(struct result_code* rc, struct itc_nametable* nt);
+extern void nt_insert(struct result_code* rc, struct itc_nametable* nt, const char* name, itc_mbox_id_t mbox_id);
+extern void nt_remove(struct result_code* rc, struct itc_nametable* nt, const char* name);
+extern itc_mbox_id_t nt_lookup(struct itc_nametable* nt, const char* name);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ITC_NAMETABLE_H__
@@ -19,7 +19,10 @@ extern "C" {
 
 #define ITC_PROTO_MSG_BASE			(ITC_MSG_BASE + 0x500)
 
-#define ITC_LOCATE_COORD_REQUEST		(ITC_PROTO_MSG_BASE + 0x1)
+/* ITC_WIRE_VERSION is part of the msgno, so itccoord turns away a process built against another itc_message header
+** instead of letting the two misread each other's messages, and an older itccoord does not even know the request. */
+#define ITC_LOCATE_COORD_REQUEST_V1		(ITC_PROTO_MSG_BASE + 0x1) // 16-byte header, no call_id and credit_src
+#define ITC_LOCATE_COORD_REQUEST		(ITC_LOCATE_COORD_REQUEST_V1 + ((ITC_WIRE_VERSION - 1) << 8))
 struct itc_locate_coord_request {
 	uint32_t	msgno;
 	pid_t		my_pid;
@@ -93,6 +96,22 @@ struct itc_locate_mbox_from_itcgws_reply {
 	char		namespace[1];
 };
 
+/* Sent by itc_init() to its own temporary mailbox over each IPC transport to time them, never leaves the process */
+#define ITC_CALIBRATE_TRANSPORT			(ITC_PROTO_MSG_BASE + 0xC)
+struct itc_calibrate_transport {
+	uint32_t	msgno;
+	char		payload[1];
+};
+
+/* Sent on the keep-alive channel between a process and itccoord. A process started with ITC_LAZY_TRANSPORTS announces
+** itself, then itccoord asks it to start its IPC transports before it tells another process where one of its mailboxes is */
+#define ITC_LAZY_TRANSPORTS_NOTIFY		(ITC_PROTO_MSG_BASE + 0xD)
+#define ITC_START_TRANSPORTS_REQUEST		(ITC_PROTO_MSG_BASE + 0xE)
+#define ITC_START_TRANSPORTS_REPLY		(ITC_PROTO_MSG_BASE + 0xF)
+struct itc_keepalive_msg {
+	uint32_t	msgno;
+};
+
 
 #ifdef __cplusplus
 }
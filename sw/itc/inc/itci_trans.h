@@ -41,6 +41,8 @@ typedef struct itc_message *(itci_trans_remove)(struct result_code* rc, struct i
 			     struct itc_message *removemessage);
 
 typedef long (itci_trans_maxmsgsize)(struct result_code* rc);
+typedef struct itc_message *(itci_trans_wait)(struct result_code* rc, struct itc_mailbox *my_mbox, const struct timespec *ts);
+typedef void (itci_trans_wakeup)(struct result_code* rc, struct itc_mailbox *mbox);
 
 /*
 *  1. Local trans: implemented as a rx message queue for each mailbox. Only manage message passing within a process and
@@ -68,6 +70,10 @@ struct itci_transport_apis {
         itci_trans_receive              *itci_trans_receive;            // API to receive a message
         itci_trans_remove               *itci_trans_remove;             // API to remove a message from rx queue
         itci_trans_maxmsgsize           *itci_trans_maxmsgsize;         // API to get max supported msgsize
+        itci_trans_wait                 *itci_trans_wait;               // API to block the owner of an ITC_DIRECT_IPC_RX
+                                                                        // mailbox until a message for it arrives, it is
+                                                                        // woken up or ts passes (NULL waits forever)
+        itci_trans_wakeup               *itci_trans_wakeup;             // API to wake up an owner blocked in above API
 };
 
 
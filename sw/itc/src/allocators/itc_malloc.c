@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "itc.h"
 #include "itc_impl.h"
@@ -17,12 +18,14 @@
    By default, it's 1024*1024 ~ 10MB size. No limit for local and socket, but for sysvmq it's limited by msgctl()
    (normally it's one page size 4KB).
 
-   TODO: There is something wrong in systemization here. Why did we choose max_msgsize only once at itc_init()
-   and limit msg size of local and socket trans functions as same as sysvmq???
-   What we should do is that we will choose which trans functions should be used depending on message size.
+   This is the largest limit of all transports. Each message is then sent over a transport that can carry its size,
+   see send_to_peer() in itc.c, so local and socket are not limited to what sysvmq can carry.
 */
 static long max_mallocsize = 0;
 
+/* ITC_MALLOC_ALIGNED blocks get their headroom from the alignment pad */
+_Static_assert(ITC_MSG_HEADROOM <= ITC_MSG_ALIGN_PAD, "ITC_MSG_HEADROOM does not fit into ITC_MSG_ALIGN_PAD");
+
 
 
 /*****************************************************************************\/
@@ -33,6 +36,9 @@ static void malloc_exit(struct result_code* rc);
 static struct itc_message* malloc_alloc(struct result_code* rc, size_t size);
 static void malloc_free(struct result_code* rc, struct itc_message** message);
 static struct itc_alloc_info malloc_getinfo(struct result_code* rc);
+static struct itc_message* malloc_aligned_alloc(struct result_code* rc, size_t size);
+static void malloc_aligned_free(struct result_code* rc, struct itc_message** message);
+static struct itc_alloc_info malloc_aligned_getinfo(struct result_code* rc);
 
 struct itci_alloc_apis malloc_apis = {  malloc_init,
 					malloc_exit,
@@ -41,6 +47,15 @@ struct itci_alloc_apis malloc_apis = {  malloc_init,
 					malloc_getinfo
 };
 
+/* ITC_MALLOC_ALIGNED, the itc_message is put ITC_MSG_ALIGN_PAD bytes into an ITC_MSG_ALIGN aligned block, so that msgno
+   starts a cache line. The block start is recovered by rounding the itc_message address down, nothing else is stored */
+struct itci_alloc_apis malloc_aligned_apis = {	malloc_init,
+						malloc_exit,
+						malloc_aligned_alloc,
+						malloc_aligned_free,
+						malloc_aligned_getinfo
+};
+
 
 
 /*****************************************************************************\/
@@ -81,7 +96,7 @@ static struct itc_message *malloc_alloc(struct result_code* rc, size_t size)
                 return NULL;
         }
 
-        retmessage = (struct itc_message *)malloc(size);
+        retmessage = (struct itc_message *)malloc(ITC_MSG_HEADROOM + size);
         if(retmessage == NULL)
         {
                 // Logging malloc() failed to allocate memory needed.
@@ -90,6 +105,7 @@ static struct itc_message *malloc_alloc(struct result_code* rc, size_t size)
                 return NULL;
         }
 
+	retmessage = (struct itc_message *)((char *)retmessage + ITC_MSG_HEADROOM);
 	memset(retmessage, 0, size);
         return retmessage;
 }
@@ -103,7 +119,7 @@ static void malloc_free(struct result_code* rc, struct itc_message** message)
 		return;
 	}
 
-        free(*message);
+        free((char *)(*message) - ITC_MSG_HEADROOM);
 	/* Using: malloc_free(struct result_code* rc, struct itc_message* message)
 
 	   Idk why but even if I assign this message = NULL. but after malloc_free return, in the context of the caller,
@@ -133,4 +149,47 @@ static struct itc_alloc_info malloc_getinfo(struct result_code* rc)
         // of itc_msg, not itc_message which is used for internal control purposes.
                                                                 
         return info;
+}
+
+static struct itc_message *malloc_aligned_alloc(struct result_code* rc, size_t size)
+{
+	void *block;
+
+	if(size > (size_t)max_mallocsize)
+	{
+		TPT_TRACE(TRACE_ABN, "Requested msg size too large, size = %lu bytes, max allowed size = %lu bytes!", size, (size_t)max_mallocsize);
+		rc->flags |= ITC_INVALID_ARGUMENTS;
+		return NULL;
+	}
+
+	if(posix_memalign(&block, ITC_MSG_ALIGN, ITC_MSG_ALIGN_PAD + size) != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to malloc_aligned_alloc due to out of memory!");
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return NULL;
+	}
+
+	memset((char *)block + ITC_MSG_ALIGN_PAD, 0, size);
+	return (struct itc_message *)((char *)block + ITC_MSG_ALIGN_PAD);
+}
+
+static void malloc_aligned_free(struct result_code* rc, struct itc_message** message)
+{
+	if(message == NULL || *message == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Double free!");
+		rc->flags |= ITC_FREE_NULL_PTR;
+		return;
+	}
+
+	free((void *)((unsigned long)(*message) & ~((unsigned long)ITC_MSG_ALIGN - 1)));
+	*message = NULL;
+}
+
+static struct itc_alloc_info malloc_aligned_getinfo(struct result_code* rc)
+{
+	struct itc_alloc_info info = malloc_getinfo(rc);
+
+	info.scheme = ITC_MALLOC_ALIGNED;
+	return info;
 }
\ No newline at end of file
@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "itc_impl.h"
+
+
+
+/*****************************************************************************\/
+*****                           INTERNAL TYPES                             *****
+*******************************************************************************/
+typedef void *(*copy_kernel_t)(void *dst, const void *src, size_t len);
+
+
+
+/*****************************************************************************\/
+*****                          INTERNAL VARIABLES                          *****
+*******************************************************************************/
+static void *copy_resolve(void *dst, const void *src, size_t len);
+
+/* Points to copy_resolve() until the first large copy, then to the best kernel this CPU supports */
+static copy_kernel_t large_copy = copy_resolve;
+
+
+
+/*****************************************************************************\/
+*****                   INTERNAL FUNCTIONS PROTOTYPES                      *****
+*******************************************************************************/
+static copy_kernel_t select_kernel(void);
+#if defined(__x86_64__) || defined(__i386__)
+static void *copy_stream_avx2(void *dst, const void *src, size_t len);
+static void *copy_stream_sse2(void *dst, const void *src, size_t len);
+#endif
+
+
+
+/*****************************************************************************\/
+*****                        FUNCTION DEFINITIONS                          *****
+*******************************************************************************/
+void *itc_copy(void *dst, const void *src, size_t len)
+{
+	if(len < ITC_NT_COPY_THRESHOLD)
+	{
+		return memcpy(dst, src, len);
+	}
+
+	return __atomic_load_n(&large_copy, __ATOMIC_RELAXED)(dst, src, len);
+}
+
+const char *itc_copy_kernel_name(void)
+{
+	copy_kernel_t kernel = select_kernel();
+
+#if defined(__x86_64__) || defined(__i386__)
+	if(kernel == copy_stream_avx2)
+	{
+		return "avx2";
+	} else if(kernel == copy_stream_sse2)
+	{
+		return "sse2";
+	}
+#endif
+
+	return "memcpy";
+}
+
+
+
+/*****************************************************************************\/
+*****                  INTERNAL FUNCTIONS IMPLEMENTATION                   *****
+*******************************************************************************/
+/* Every thread that gets here before the pointer is published picks the same kernel, so no locking is needed */
+static void *copy_resolve(void *dst, const void *src, size_t len)
+{
+	copy_kernel_t kernel = select_kernel();
+
+	__atomic_store_n(&large_copy, kernel, __ATOMIC_RELAXED);
+	return kernel(dst, src, len);
+}
+
+static copy_kernel_t select_kernel(void)
+{
+	copy_kernel_t kernel = memcpy;
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		kernel = copy_stream_avx2;
+	} else if(__builtin_cpu_supports("sse2"))
+	{
+		kernel = copy_stream_sse2;
+	}
+#endif
+
+	return kernel;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Non-temporal stores need an aligned destination, so copy up to the first 32-byte boundary with memcpy, stream 128 bytes
+per iteration and memcpy the tail. Source loads are unaligned and cached as usual. The sfence makes the streamed data
+globally visible before the caller publishes it to the other process, e.g. by posting a semaphore. */
+__attribute__((target("avx2")))
+static void *copy_stream_avx2(void *dst, const void *src, size_t len)
+{
+	char *d = (char *)dst;
+	const char *s = (const char *)src;
+	size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+
+	if(len < head)
+	{
+		return memcpy(dst, src, len);
+	}
+
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	len -= head;
+
+	for(; len >= 128; len -= 128, d += 128, s += 128)
+	{
+		__m256i y0 = _mm256_loadu_si256((const __m256i *)(s + 0));
+		__m256i y1 = _mm256_loadu_si256((const __m256i *)(s + 32));
+		__m256i y2 = _mm256_loadu_si256((const __m256i *)(s + 64));
+		__m256i y3 = _mm256_loadu_si256((const __m256i *)(s + 96));
+
+		_mm256_stream_si256((__m256i *)(d + 0), y0);
+		_mm256_stream_si256((__m256i *)(d + 32), y1);
+		_mm256_stream_si256((__m256i *)(d + 64), y2);
+		_mm256_stream_si256((__m256i *)(d + 96), y3);
+	}
+
+	for(; len >= 32; len -= 32, d += 32, s += 32)
+	{
+		_mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+	}
+
+	_mm_sfence();
+	memcpy(d, s, len);
+
+	return dst;
+}
+
+/* Same as copy_stream_avx2() with 16-byte stores */
+__attribute__((target("sse2")))
+static void *copy_stream_sse2(void *dst, const void *src, size_t len)
+{
+	char *d = (char *)dst;
+	const char *s = (const char *)src;
+	size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+
+	if(len < head)
+	{
+		return memcpy(dst, src, len);
+	}
+
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	len -= head;
+
+	for(; len >= 64; len -= 64, d += 64, s += 64)
+	{
+		__m128i x0 = _mm_loadu_si128((const __m128i *)(s + 0));
+		__m128i x1 = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i x2 = _mm_loadu_si128((const __m128i *)(s + 32));
+		__m128i x3 = _mm_loadu_si128((const __m128i *)(s + 48));
+
+		_mm_stream_si128((__m128i *)(d + 0), x0);
+		_mm_stream_si128((__m128i *)(d + 16), x1);
+		_mm_stream_si128((__m128i *)(d + 32), x2);
+		_mm_stream_si128((__m128i *)(d + 48), x3);
+	}
+
+	for(; len >= 16; len -= 16, d += 16, s += 16)
+	{
+		_mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+	}
+
+	_mm_sfence();
+	memcpy(d, s, len);
+
+	return dst;
+}
+#endif
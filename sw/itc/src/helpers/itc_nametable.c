@@ -0,0 +1,650 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "itc_nametable.h"
+#include "itc_impl.h"
+
+#include "itc_tpt_provider.h"
+#include "traceIf.h"
+
+
+
+/*****************************************************************************\/
+*****                           INTERNAL TYPES                             *****
+*******************************************************************************/
+
+
+/*****************************************************************************\/
+*****                          INTERNAL VARIABLES                          *****
+*******************************************************************************/
+
+
+
+/*****************************************************************************\/
+*****                   INTERNAL FUNCTIONS PROTOTYPES                      *****
+*******************************************************************************/
+static uint32_t nt_hash(const char* name);
+static int32_t nt_find_slot(struct itc_nametable* nt, const char* name, uint32_t hash);
+static void nt_write_begin(struct itc_nametable* nt);
+static void nt_write_end(struct itc_nametable* nt);
+static struct nt_reader* nt_get_reader(struct itc_nametable* nt);
+static void nt_reader_destructor(void* data);
+static void nt_read_begin(struct itc_nametable* nt, struct nt_reader* reader);
+static void nt_read_end(struct nt_reader* reader);
+static void nt_retire(struct itc_nametable* nt, struct nt_table* tab, char* name);
+static void nt_reclaim(struct itc_nametable* nt);
+static void nt_purge_tombstones(struct itc_nametable* nt);
+static struct nt_table* nt_alloc_table(uint32_t nr_slots);
+static void nt_free_table(struct nt_table* tab, bool free_names);
+static bool nt_grow(struct itc_nametable* nt);
+
+
+
+/*****************************************************************************\/
+*****                        FUNCTION DEFINITIONS                          *****
+*******************************************************************************/
+struct itc_nametable* nt_init(struct result_code* rc, uint32_t capacity)
+{
+	struct itc_nametable* nt;
+	uint32_t nr_slots = 2;
+
+	/* Keep load factor at 50% or below so probe sequences stay short */
+	while(nr_slots < 2 * capacity)
+	{
+		nr_slots <<= 1;
+	}
+
+	nt = (struct itc_nametable*)malloc(sizeof(struct itc_nametable));
+	if(nt == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to malloc name table due to out of memory!");
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return NULL;
+	}
+
+	nt->seq			= 0;
+	nt->epoch		= 0;
+	nt->nr_used		= 0;
+	nt->nr_tombstones	= 0;
+	nt->retired		= NULL;
+	nt->readers		= NULL;
+	nt->tab			= nt_alloc_table(nr_slots);
+	if(nt->tab == NULL)
+	{
+		free(nt);
+		TPT_TRACE(TRACE_ERROR, "Failed to malloc %u name table slots due to out of memory!", nr_slots);
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return NULL;
+	}
+
+	int ret = pthread_mutex_init(&nt->nt_mtx, NULL);
+	if(ret != 0)
+	{
+		nt_free_table(nt->tab, true);
+		free(nt);
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutex_init, error code = %d", ret);
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return NULL;
+	}
+
+	ret = pthread_key_create(&nt->reader_key, nt_reader_destructor);
+	if(ret != 0)
+	{
+		pthread_mutex_destroy(&nt->nt_mtx);
+		nt_free_table(nt->tab, true);
+		free(nt);
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_key_create, error code = %d", ret);
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return NULL;
+	}
+
+	return nt;
+}
+
+void nt_exit(struct result_code* rc, struct itc_nametable* nt)
+{
+	if(nt == NULL)
+	{
+		TPT_TRACE(TRACE_ABN, "Name table null!");
+		rc->flags |= ITC_QUEUE_NULL;
+		return;
+	}
+
+	int ret = pthread_mutex_destroy(&nt->nt_mtx);
+	if(ret != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutex_destroy, error code = %d", ret);
+		rc->flags |= ITC_SYSCALL_ERROR;
+	}
+
+	/* Threads exiting from now on leave their reader alone */
+	ret = pthread_key_delete(nt->reader_key);
+	if(ret != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_key_delete, error code = %d", ret);
+		rc->flags |= ITC_SYSCALL_ERROR;
+	}
+
+	while(nt->readers != NULL)
+	{
+		struct nt_reader* next = nt->readers->next;
+
+		free(nt->readers);
+		nt->readers = next;
+	}
+
+	/* Nobody may look anything up any more, retired memory can go right away */
+	while(nt->retired != NULL)
+	{
+		struct nt_retired* next = nt->retired->next;
+
+		nt_free_table(nt->retired->tab, false);
+		free(nt->retired->name);
+		free(nt->retired);
+		nt->retired = next;
+	}
+
+	nt_free_table(nt->tab, true);
+	free(nt);
+}
+
+void nt_insert(struct result_code* rc, struct itc_nametable* nt, const char* name, itc_mbox_id_t mbox_id)
+{
+	uint32_t hash = nt_hash(name);
+	struct nt_table* tab;
+	size_t len = strlen(name);
+	char* copy;
+	uint32_t idx;
+
+	if(len > ITC_MAX_NAME_LENGTH || mbox_id == ITC_NO_MBOX_ID)
+	{
+		TPT_TRACE(TRACE_ABN, "Invalid name table entry \"%s\" 0x%08x!", name, mbox_id);
+		rc->flags |= ITC_INVALID_ARGUMENTS;
+		return;
+	}
+
+	MUTEX_LOCK(&nt->nt_mtx);
+
+	if(nt_find_slot(nt, name, hash) >= 0)
+	{
+		MUTEX_UNLOCK(&nt->nt_mtx);
+		rc->flags |= ITC_ALREADY_USED;
+		return;
+	}
+
+	if(nt->nr_used >= (nt->tab->mask + 1) / 2 && !nt_grow(nt))
+	{
+		MUTEX_UNLOCK(&nt->nt_mtx);
+		TPT_TRACE(TRACE_ABN, "Name table full, %u entries!", nt->nr_used);
+		rc->flags |= ITC_OUT_OF_RANGE;
+		return;
+	}
+
+	copy = malloc(len + 1);
+	if(copy == NULL)
+	{
+		MUTEX_UNLOCK(&nt->nt_mtx);
+		TPT_TRACE(TRACE_ERROR, "Failed to malloc name \"%s\" due to out of memory!", name);
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return;
+	}
+	memcpy(copy, name, len + 1);
+
+	nt_write_begin(nt);
+
+	/* Too many tombstones make misses walk long probe sequences, clean them up once in a while */
+	tab = nt->tab;
+	if(nt->nr_used + nt->nr_tombstones >= ((tab->mask + 1) / 4) * 3)
+	{
+		nt_purge_tombstones(nt);
+	}
+
+	/* Reuse the first tombstone or empty slot on the probe sequence */
+	for(idx = hash & tab->mask; tab->slots[idx].mbox_id != ITC_NO_MBOX_ID; idx = (idx + 1) & tab->mask);
+
+	if(tab->slots[idx].hash != 0)
+	{
+		nt->nr_tombstones--;
+	}
+
+	__atomic_store_n(&tab->names[idx], copy, __ATOMIC_RELAXED);
+	__atomic_store_n(&tab->slots[idx].mbox_id, mbox_id, __ATOMIC_RELAXED);
+	__atomic_store_n(&tab->slots[idx].hash, hash, __ATOMIC_RELAXED);
+	nt->nr_used++;
+
+	nt_write_end(nt);
+	nt_reclaim(nt);
+
+	MUTEX_UNLOCK(&nt->nt_mtx);
+}
+
+void nt_remove(struct result_code* rc, struct itc_nametable* nt, const char* name)
+{
+	int32_t idx;
+	char* old_name;
+
+	MUTEX_LOCK(&nt->nt_mtx);
+
+	idx = nt_find_slot(nt, name, nt_hash(name));
+	if(idx < 0)
+	{
+		MUTEX_UNLOCK(&nt->nt_mtx);
+		rc->flags |= ITC_QUEUE_EMPTY;
+		return;
+	}
+
+	old_name = nt->tab->names[idx];
+
+	nt_write_begin(nt);
+	/* Keep the hash so that probe sequences running through this slot are not cut short */
+	__atomic_store_n(&nt->tab->slots[idx].mbox_id, ITC_NO_MBOX_ID, __ATOMIC_RELAXED);
+	__atomic_store_n(&nt->tab->names[idx], NULL, __ATOMIC_RELAXED);
+	nt->nr_used--;
+	nt->nr_tombstones++;
+	nt_write_end(nt);
+
+	/* Readers may have picked up the name just before */
+	nt_retire(nt, NULL, old_name);
+	nt_reclaim(nt);
+
+	MUTEX_UNLOCK(&nt->nt_mtx);
+}
+
+itc_mbox_id_t nt_lookup(struct itc_nametable* nt, const char* name)
+{
+	uint32_t hash = nt_hash(name);
+	struct nt_table* tab;
+	struct nt_reader* reader;
+	itc_mbox_id_t mbox_id;
+	uint32_t seq;
+	int32_t idx;
+
+	reader = nt_get_reader(nt);
+	if(reader == NULL)
+	{
+		/* No reader of our own, keep writers out instead */
+		MUTEX_LOCK(&nt->nt_mtx);
+		idx = nt_find_slot(nt, name, hash);
+		mbox_id = (idx < 0) ? ITC_NO_MBOX_ID : nt->tab->slots[idx].mbox_id;
+		MUTEX_UNLOCK(&nt->nt_mtx);
+		return mbox_id;
+	}
+
+	/* Keeps every table and name we may pick up below from being freed until we are done */
+	nt_read_begin(nt, reader);
+	do
+	{
+		seq = __atomic_load_n(&nt->seq, __ATOMIC_ACQUIRE);
+		if(seq & 1)
+		{
+			/* A writer is in the middle of an update, which only takes a few stores */
+			continue;
+		}
+
+		/* mask, slots and names must come from the same table, a concurrent nt_grow() may swap it */
+		tab = __atomic_load_n(&nt->tab, __ATOMIC_ACQUIRE);
+		mbox_id = ITC_NO_MBOX_ID;
+		for(uint32_t idx = hash & tab->mask, n = 0; n <= tab->mask; idx = (idx + 1) & tab->mask, n++)
+		{
+			uint32_t slot_hash = __atomic_load_n(&tab->slots[idx].hash, __ATOMIC_RELAXED);
+			if(slot_hash == 0)
+			{
+				break;
+			}
+
+			if(slot_hash == hash)
+			{
+				itc_mbox_id_t slot_mbox_id = __atomic_load_n(&tab->slots[idx].mbox_id, __ATOMIC_RELAXED);
+				const char* slot_name = __atomic_load_n(&tab->names[idx], __ATOMIC_RELAXED);
+				if(slot_mbox_id == ITC_NO_MBOX_ID || slot_name == NULL)
+				{
+					continue;
+				}
+
+				/* Names are never written to once published, but this one may belong to an entry that a
+				* writer just replaced, the seq check below throws away whatever the comparison said */
+				if(strcmp(slot_name, name) == 0)
+				{
+					mbox_id = slot_mbox_id;
+					break;
+				}
+			}
+		}
+
+		/* Whatever was read above is only valid if no writer came in between */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while((seq & 1) || __atomic_load_n(&nt->seq, __ATOMIC_RELAXED) != seq);
+	nt_read_end(reader);
+
+	return mbox_id;
+}
+
+
+
+/*****************************************************************************\/
+*****                  INTERNAL FUNCTIONS IMPLEMENTATION                   *****
+*******************************************************************************/
+/* FNV-1a, 0 is reserved for empty slots */
+static uint32_t nt_hash(const char* name)
+{
+	uint32_t hash = 2166136261u;
+
+	while(*name)
+	{
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+
+	return (hash == 0) ? 1 : hash;
+}
+
+/* Only called with nt_mtx held, so no need to care about seq */
+static int32_t nt_find_slot(struct itc_nametable* nt, const char* name, uint32_t hash)
+{
+	struct nt_table* tab = nt->tab;
+
+	for(uint32_t idx = hash & tab->mask, n = 0; n <= tab->mask; idx = (idx + 1) & tab->mask, n++)
+	{
+		if(tab->slots[idx].hash == 0)
+		{
+			return -1;
+		}
+
+		if(tab->slots[idx].hash == hash && tab->slots[idx].mbox_id != ITC_NO_MBOX_ID && strcmp(tab->names[idx], name) == 0)
+		{
+			return (int32_t)idx;
+		}
+	}
+
+	return -1;
+}
+
+static void nt_write_begin(struct itc_nametable* nt)
+{
+	__atomic_store_n(&nt->seq, nt->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void nt_write_end(struct itc_nametable* nt)
+{
+	__atomic_store_n(&nt->seq, nt->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* The reader of the calling thread, taken over from an exited thread or allocated on its first lookup */
+static struct nt_reader* nt_get_reader(struct itc_nametable* nt)
+{
+	struct nt_reader* reader;
+
+	reader = (struct nt_reader*)pthread_getspecific(nt->reader_key);
+	if(reader != NULL)
+	{
+		return reader;
+	}
+
+	MUTEX_LOCK(&nt->nt_mtx);
+	for(reader = nt->readers; reader != NULL && reader->in_use; reader = reader->next)
+	{
+	}
+
+	if(reader == NULL)
+	{
+		if(posix_memalign((void**)&reader, ITC_CACHE_LINE, sizeof(struct nt_reader)) != 0)
+		{
+			MUTEX_UNLOCK(&nt->nt_mtx);
+			TPT_TRACE(TRACE_ABN, "Failed to allocate name table reader due to out of memory!");
+			return NULL;
+		}
+
+		reader->state	= 0;
+		reader->nt	= nt;
+		reader->next	= nt->readers;
+		nt->readers	= reader;
+	}
+	reader->in_use = true;
+	MUTEX_UNLOCK(&nt->nt_mtx);
+
+	if(pthread_setspecific(nt->reader_key, reader) != 0)
+	{
+		TPT_TRACE(TRACE_ABN, "Failed to pthread_setspecific name table reader!");
+		MUTEX_LOCK(&nt->nt_mtx);
+		reader->in_use = false;
+		MUTEX_UNLOCK(&nt->nt_mtx);
+		return NULL;
+	}
+
+	return reader;
+}
+
+/* The thread has exited, so it is not inside nt_lookup() */
+static void nt_reader_destructor(void* data)
+{
+	struct nt_reader* reader = (struct nt_reader*)data;
+
+	MUTEX_LOCK(&reader->nt->nt_mtx);
+	reader->in_use = false;
+	MUTEX_UNLOCK(&reader->nt->nt_mtx);
+}
+
+/* Announce the epoch we read in before picking up any pointer. A writer that still saw us idle can only have moved on
+* to the next epoch since we read it, and then it waits for us to leave before it moves on again */
+static void nt_read_begin(struct itc_nametable* nt, struct nt_reader* reader)
+{
+	__atomic_store_n(&reader->state, NT_READING(__atomic_load_n(&nt->epoch, __ATOMIC_SEQ_CST)), __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void nt_read_end(struct nt_reader* reader)
+{
+	__atomic_store_n(&reader->state, 0, __ATOMIC_RELEASE);
+}
+
+/* Only called with nt_mtx held, after tab or name can no longer be reached from nt->tab */
+static void nt_retire(struct itc_nametable* nt, struct nt_table* tab, char* name)
+{
+	struct nt_retired* retired;
+
+	retired = (struct nt_retired*)malloc(sizeof(struct nt_retired));
+	if(retired == NULL)
+	{
+		/* Freeing it now could pull it from under a reader, rather leak it */
+		TPT_TRACE(TRACE_ABN, "Failed to malloc for retiring name table memory, leaking it!");
+		return;
+	}
+
+	retired->epoch	= nt->epoch;
+	retired->tab	= tab;
+	retired->name	= name;
+	retired->next	= nt->retired;
+	nt->retired	= retired;
+}
+
+/* Only called with nt_mtx held. The epoch is only moved on from E to E + 1 once every reader inside nt_lookup() has
+* announced E. Memory retired in E was unreachable before that, so once the epoch is E + 2 every reader that could still
+* hold it has left, and it can go */
+static void nt_reclaim(struct itc_nametable* nt)
+{
+	struct nt_retired **iter, *next;
+	struct nt_reader* reader;
+	uint32_t epoch = nt->epoch;
+
+	if(nt->retired == NULL)
+	{
+		return;
+	}
+
+	/* Pairs with the fence in nt_read_begin(), a reader we see idle sees what we unlinked */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for(reader = nt->readers; reader != NULL; reader = reader->next)
+	{
+		uint32_t state = __atomic_load_n(&reader->state, __ATOMIC_RELAXED);
+		if(state != 0 && state != NT_READING(epoch))
+		{
+			break;
+		}
+	}
+
+	if(reader == NULL)
+	{
+		epoch++;
+		__atomic_store_n(&nt->epoch, epoch, __ATOMIC_SEQ_CST);
+	}
+
+	for(iter = &nt->retired; *iter != NULL;)
+	{
+		if(epoch - (*iter)->epoch < 2)
+		{
+			iter = &(*iter)->next;
+			continue;
+		}
+
+		next = (*iter)->next;
+		nt_free_table((*iter)->tab, false);
+		free((*iter)->name);
+		free(*iter);
+		*iter = next;
+	}
+}
+
+/* Rehash live entries in place. Called between nt_write_begin() and nt_write_end(), readers retry meanwhile */
+static void nt_purge_tombstones(struct itc_nametable* nt)
+{
+	struct nt_table* tab = nt->tab;
+	uint32_t nr_slots = tab->mask + 1;
+	struct nt_slot* old_slots;
+	char** old_names;
+
+	old_slots = malloc(nr_slots * sizeof(struct nt_slot));
+	old_names = malloc(nr_slots * sizeof(*old_names));
+	if(old_slots == NULL || old_names == NULL)
+	{
+		/* Not a big problem, lookups only get slower */
+		free(old_slots);
+		free(old_names);
+		TPT_TRACE(TRACE_ABN, "Failed to malloc for purging name table tombstones!");
+		return;
+	}
+
+	memcpy(old_slots, tab->slots, nr_slots * sizeof(struct nt_slot));
+	memcpy(old_names, tab->names, nr_slots * sizeof(*old_names));
+
+	for(uint32_t i = 0; i < nr_slots; i++)
+	{
+		__atomic_store_n(&tab->slots[i].hash, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&tab->slots[i].mbox_id, ITC_NO_MBOX_ID, __ATOMIC_RELAXED);
+		__atomic_store_n(&tab->names[i], NULL, __ATOMIC_RELAXED);
+	}
+
+	for(uint32_t i = 0; i < nr_slots; i++)
+	{
+		uint32_t idx;
+
+		if(old_slots[i].mbox_id == ITC_NO_MBOX_ID)
+		{
+			continue;
+		}
+
+		for(idx = old_slots[i].hash & tab->mask; tab->slots[idx].hash != 0; idx = (idx + 1) & tab->mask);
+
+		__atomic_store_n(&tab->names[idx], old_names[i], __ATOMIC_RELAXED);
+		__atomic_store_n(&tab->slots[idx].mbox_id, old_slots[i].mbox_id, __ATOMIC_RELAXED);
+		__atomic_store_n(&tab->slots[idx].hash, old_slots[i].hash, __ATOMIC_RELAXED);
+	}
+
+	nt->nr_tombstones = 0;
+	free(old_slots);
+	free(old_names);
+}
+
+static struct nt_table* nt_alloc_table(uint32_t nr_slots)
+{
+	struct nt_table* tab;
+
+	tab = (struct nt_table*)malloc(sizeof(struct nt_table));
+	if(tab == NULL)
+	{
+		return NULL;
+	}
+
+	tab->mask	= nr_slots - 1;
+	tab->slots	= calloc(nr_slots, sizeof(struct nt_slot));
+	tab->names	= calloc(nr_slots, sizeof(*tab->names));
+	if(tab->slots == NULL || tab->names == NULL)
+	{
+		free(tab->slots);
+		free(tab->names);
+		free(tab);
+		return NULL;
+	}
+
+	for(uint32_t i = 0; i < nr_slots; i++)
+	{
+		tab->slots[i].mbox_id = ITC_NO_MBOX_ID;
+	}
+
+	return tab;
+}
+
+/* Names are shared with the table that replaced this one, so a retired table leaves them alone */
+static void nt_free_table(struct nt_table* tab, bool free_names)
+{
+	if(tab == NULL)
+	{
+		return;
+	}
+
+	for(uint32_t i = 0; free_names && i <= tab->mask; i++)
+	{
+		free(tab->names[i]);
+	}
+
+	free(tab->slots);
+	free(tab->names);
+	free(tab);
+}
+
+/* Only called with nt_mtx held. The new table is filled in before it is published, so readers either see the old
+* table or the complete new one. Tombstones are left behind */
+static bool nt_grow(struct itc_nametable* nt)
+{
+	struct nt_table* old_tab = nt->tab;
+	struct nt_table* new_tab;
+	uint32_t nr_slots = (old_tab->mask + 1) * 2;
+
+	if(nr_slots > 2 * (ITC_MAX_MAILBOXES + 1))
+	{
+		return false;
+	}
+
+	new_tab = nt_alloc_table(nr_slots);
+	if(new_tab == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to malloc %u name table slots due to out of memory!", nr_slots);
+		return false;
+	}
+
+	for(uint32_t i = 0; i <= old_tab->mask; i++)
+	{
+		uint32_t idx;
+
+		if(old_tab->slots[i].mbox_id == ITC_NO_MBOX_ID)
+		{
+			continue;
+		}
+
+		for(idx = old_tab->slots[i].hash & new_tab->mask; new_tab->slots[idx].hash != 0; idx = (idx + 1) & new_tab->mask);
+
+		new_tab->names[idx] = old_tab->names[i];
+		new_tab->slots[idx] = old_tab->slots[i];
+	}
+
+	nt_write_begin(nt);
+	__atomic_store_n(&nt->tab, new_tab, __ATOMIC_RELEASE);
+	nt->nr_tombstones = 0;
+	nt_write_end(nt);
+
+	nt_retire(nt, old_tab, NULL);
+
+	TPT_TRACE(TRACE_INFO, "Name table grown to %u slots for %u entries!", nr_slots, nt->nr_used);
+	return true;
+}
@@ -135,8 +135,17 @@ void terminate_itcthreads(struct result_code* rc)
 
 	MUTEX_LOCK(&thrman_inst.thrlist_mtx);
 	thr = thrman_inst.thread_list;
-	while(thr != NULL && thr->is_running)
+	while(thr != NULL)
 	{
+		/* Threads of lazily started transports may never have run, just drop them */
+		if(!thr->is_running)
+		{
+			thrtmp = thr;
+			thr = thr->next;
+			free(thrtmp);
+			continue;
+		}
+
 		/* To let the created thread trigger thread-specific data destructor, and clean up resources */
 		int ret = pthread_cancel(thr->tid);
 		if(ret != 0)
@@ -162,6 +171,7 @@ void terminate_itcthreads(struct result_code* rc)
 		thrtmp = NULL;
 	}
 
+	thrman_inst.thread_list = thr; // Only threads that failed to terminate are left
 	MUTEX_UNLOCK(&thrman_inst.thrlist_mtx);
 }
 
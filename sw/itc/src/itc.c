@@ -7,15 +7,19 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <pthread.h>
-#include <search.h>
 #include <unistd.h>
 #include <time.h>
+#include <fcntl.h>
+#include <limits.h>
 
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/eventfd.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/futex.h>
 
 #include "itc.h"
 #include "itc_impl.h"
@@ -24,6 +28,7 @@
 #include "itc_threadmanager.h"
 #include "itc_proto.h"
 #include "itc_queue.h"
+#include "itc_nametable.h"
 
 #include "itc_tpt_provider.h"
 #include "traceIf.h"
@@ -42,6 +47,28 @@ union itc_msg {
 	struct itc_get_namespace_reply		itc_get_namespace_reply;
 };
 
+/* Messages of one sender process towards a receiving process. All counters live with the receiver, so what is on its
+way, sent - returned and queued - delivered, survives a restart of the sender */
+struct itc_credit_slot {
+	uint32_t			sent;		// By the sender, messages that took a credit
+	uint32_t			returned;	// By the receiver, in steps of ITC_CREDIT_BATCH. Senders futex wait on it
+	uint32_t			waiters;	// Senders waiting for returned to move
+	uint32_t			queued;		// By the sender, messages handed to a transport
+	uint32_t			delivered;	// By the receiver, messages taken off transports. Senders futex wait on it
+	uint32_t			drain_waiters;	// Senders waiting for delivered to catch up with queued
+	pid_t				owner;		// Sender process that counts in the slot, see adopt_credit_slot()
+} __attribute__((aligned(ITC_CACHE_LINE)));
+
+/* Layout of the ITC_CREDIT_FILENAME file that every process keeps, slots are indexed by the process index of the sender.
+Credits are only taken towards ITC_FLOW_CONTROL processes. */
+struct itc_credit_map {
+	uint32_t			flow_control;
+	struct itc_credit_slot		slots[MAX_SUPPORTED_PROCESSES];
+};
+
+#define ITC_CREDIT_NO_MAP		((struct itc_credit_map*)-1) // The process has no file we could map
+#define ITC_SWITCHING_TRANS		(-2) // In peer_trans while a sender waits to move a process on to another transport
+
 struct itc_instance {
 	struct itc_queue*		free_mboxes_queue; // a queue of free/has-been-deleted mailboxes that can be re-used later
 
@@ -52,20 +79,46 @@ struct itc_instance {
 	struct itc_threads*		thread_list;	// manage a list of threads that is started by itc.c via itc_init() such as sysvmq_rx_thread,...
 	pthread_mutex_t			thread_list_mtx;
 
-	pthread_mutex_t			local_locating_mbox_mtx;
-	void				*local_locating_mbox_tree;
+	struct itc_nametable*		local_locating_nt; // Mailbox name -> mailbox id of this process, lock-free for readers
 
 	pthread_key_t			destruct_key;
 
 	pid_t				pid;
 
-	uint32_t			nr_mboxes;
+	uint32_t			nr_mboxes; // Mailboxes allocated so far, grows by ITC_MBOX_CHUNK_SIZE, 0 if not initialized
 	uint32_t			local_mbox_mask; // mask for local mailbox id
-	struct itc_mailbox*		mboxes; // List of mailboxes allocated by malloc
+	struct itc_mailbox*		mbox_chunks[ITC_MAX_MBOX_CHUNKS]; // Mailbox i is mbox_chunks[i >> ITC_MBOX_CHUNK_SHIFT][i & (ITC_MBOX_CHUNK_SIZE - 1)]
 
 	itc_mbox_id_t 			itcgw_mboxid;
 
 	char				namespace[ITC_MAX_NAME_LENGTH];	
+
+	itc_transport_e			ipc_trans[ITC_NUM_TRANS]; // Enabled IPC transports in order of preference
+	uint32_t			nr_ipc_trans;
+	int8_t				peer_trans[MAX_SUPPORTED_PROCESSES]; // Transport the latest messages towards each process took, ITC_INVALID_TRANS if none yet
+	uint32_t			peer_busy[MAX_SUPPORTED_PROCESSES]; // Sends in progress over peer_trans
+	uint8_t				peer_lacks[MAX_SUPPORTED_PROCESSES]; // Bit per transport that the process has no endpoint for
+	uint8_t				peer_used[MAX_SUPPORTED_PROCESSES]; // Bit per transport that carried a message to the process
+
+	uint32_t			ipc_started; // Rx threads of IPC transports are running, see ITC_LAZY_TRANSPORTS
+
+	long				trans_maxsize[ITC_NUM_TRANS]; // Largest message on the wire a transport can carry, 0 if unlimited
+	int8_t				size_class_trans[ITC_NR_SIZE_CLASSES]; // Fastest transport per message size, from profile or calibration
+
+	struct itc_credit_map*		credit_map; // Our own credit file
+	uint32_t			credits_taken[MAX_SUPPORTED_PROCESSES]; // Per sender, messages taken off transports, returned per ITC_CREDIT_BATCH
+	struct itc_credit_map*		peer_credit_maps[MAX_SUPPORTED_PROCESSES]; // Credit files of receivers, NULL if not looked up yet
+	ino_t				peer_credit_inos[MAX_SUPPORTED_PROCESSES]; // To tell that a receiver restarted with a new credit file
+	pthread_mutex_t			peer_credit_mtx; // Serialises mapping the credit files of receivers
+	int32_t				credit_tmo; // From ITC_CREDIT_TMO_ENV
+	struct itc_credit_stats		credit_stats[MAX_SUPPORTED_PROCESSES]; // Per receiver, updated atomically
+};
+
+/* All IPC transports are built into libitc, but unit tests may only link one of them, hence weak symbols */
+struct ipc_transport_desc {
+	const char*			name;
+	itc_transport_e			trans;
+	struct itci_transport_apis*	apis;
 };
 
 /*****************************************************************************\/
@@ -78,38 +131,79 @@ static struct itci_alloc_apis	alloc_mechanisms;
 /* When a thread requests for creating a mailbox, there is a itc_mailbox pointer to their mailbox and only it owns its pointer */
 static __thread struct itc_mailbox*	my_threadlocal_mbox = NULL; // A thread only owns one mailbox
 static __thread struct result_code* rc = NULL; // A thread only owns one return code
+static pthread_mutex_t ipc_start_mtx = PTHREAD_MUTEX_INITIALIZER; // Serialises lazy start of IPC transports
+static pthread_mutex_t mbox_grow_mtx = PTHREAD_MUTEX_INITIALIZER; // Serialises growing the mailbox table
+static pthread_mutex_t peer_trans_mtx = PTHREAD_MUTEX_INITIALIZER; // Serialises moving a process on to another transport
+static pthread_cond_t peer_trans_cond = PTHREAD_COND_INITIALIZER; // Signalled when a process is no longer ITC_SWITCHING_TRANS
+static __thread uint32_t		last_call_id = 0; // Correlation id of the latest itc_call() of this thread
 
 extern struct itci_transport_apis local_trans_apis;
 extern struct itci_transport_apis lsock_trans_apis;
-#if defined UT_POSIXMQ_PLUGIN
-extern struct itci_transport_apis posixmq_trans_apis;
-#elif defined UT_SYSVMQ_PLUGIN
-extern struct itci_transport_apis sysvmq_trans_apis;
-#elif defined UT_POSIXSHM_PLUGIN
-extern struct itci_transport_apis posixshm_trans_apis;
-#elif defined UT_SYSVSHM_PLUGIN
-extern struct itci_transport_apis sysvshm_trans_apis;
-#else
-extern struct itci_transport_apis sysvmq_trans_apis;
-#endif
+extern struct itci_transport_apis sysvmq_trans_apis __attribute__((weak));
+extern struct itci_transport_apis posixmq_trans_apis __attribute__((weak));
+extern struct itci_transport_apis posixshm_trans_apis __attribute__((weak));
+extern struct itci_transport_apis sysvshm_trans_apis __attribute__((weak));
+
+static const struct ipc_transport_desc ipc_transports[] = {
+	{ "sysvmq",	ITC_TRANS_SYSVMQ,	&sysvmq_trans_apis },
+	{ "posixmq",	ITC_TRANS_POSIXMQ,	&posixmq_trans_apis },
+	{ "posixshm",	ITC_TRANS_POSIXSHM,	&posixshm_trans_apis },
+	{ "sysvshm",	ITC_TRANS_SYSVSHM,	&sysvshm_trans_apis }
+};
 
 extern struct itci_alloc_apis malloc_apis;
+extern struct itci_alloc_apis malloc_aligned_apis;
 
 /*****************************************************************************\/
 *****                   INTERNAL FUNCTIONS PROTOTYPES                      *****
 *******************************************************************************/
 static void release_all_itc_resources(void);
 static void mailbox_destructor_at_thread_exit(void* data);
+static bool enqueue_local(struct itc_mailbox *to_mbox, struct itc_message *message);
+static bool enqueue_locked(struct itc_mailbox *to_mbox, struct itc_message *message);
+static int wait_rxq(struct itc_mailbox *mbox, const struct timespec *ts);
 static struct itc_mailbox* find_mbox(itc_mbox_id_t mbox_id);
+static struct itc_mailbox* mbox_at(uint32_t index);
+static bool add_mbox_chunk(void);
+static struct itc_mailbox* grow_mboxes(void);
 static void calc_abs_time(struct timespec* ts, unsigned long tmo);
 static struct itc_mailbox *locate_local_mbox(const char *name);
-static int mbox_name_cmpfunc(const void *pa, const void *pb); // char *name vs struct itc_mailbox *mbox
-static void do_nothing(void *a);
-static bool remove_mbox_from_tree(void **tree, pthread_mutex_t *tree_mtx, struct itc_mailbox *mbox);
-static int mbox_name_cmpfunc2(const void *pa, const void *pb); // struct itc_mailbox *mbox1 vs struct itc_mailbox *mbox2
-static bool insert_mbox_to_tree(void **tree, pthread_mutex_t *tree_mtx, struct itc_mailbox *mbox);
 static bool handle_forward_itc_msg_to_itcgw(union itc_msg **msg, itc_mbox_id_t to, char *namespace);
 static void change_system_rlimit(void);
+static void release_sg_segments(struct itc_message *message);
+static void copy_msg_into(struct itc_message *message, void *buf, size_t cap, struct itc_msg_info *info);
+static void select_ipc_transports(void);
+static void enable_ipc_transports(const char *names);
+static bool send_to_peer(struct itc_message *message, itc_mbox_id_t to);
+static uint32_t size_class(size_t size);
+static bool trans_fits(itc_transport_e trans, size_t size);
+static bool start_ipc_transports(bool calibrate);
+static bool needs_ipc_rx(struct itc_message *message, itc_mbox_id_t to);
+static void setup_size_classes(bool calibrate);
+static bool load_transport_profile(const char *path);
+static void save_transport_profile(const char *path);
+static void calibrate_transports(void);
+static uint64_t time_transport(itc_transport_e trans, itc_mbox_id_t mbox_id, uint32_t size);
+static int compare_u64(const void *a, const void *b);
+static bool init_credits(bool flow_control);
+static void release_credits(bool remove_file);
+static uint32_t my_process_index(void);
+static void credit_filename(char *path, size_t len, uint32_t process);
+static struct itc_credit_map* peer_credit_map(uint32_t peer);
+static bool is_stale_credit_map(uint32_t peer);
+static void adopt_credit_slot(struct itc_credit_map *map, uint32_t peer);
+static bool take_credit(struct itc_message *message, uint32_t peer);
+static bool wait_for_credit(struct itc_credit_slot *slot, uint32_t ticket, uint32_t peer, bool *stale);
+static void give_back_credit(struct itc_message *message, uint32_t peer);
+static void return_credit(uint32_t credit_src);
+static void update_max(uint64_t *max, uint64_t val);
+static bool send_over_transports(struct itc_message *message, itc_mbox_id_t to);
+static int8_t pick_transport(uint32_t peer, size_t size);
+static int8_t enter_transport(uint32_t peer, int8_t want, size_t size);
+static void leave_transport(uint32_t peer);
+static int8_t switch_transport(uint32_t peer, int8_t cur, int8_t want, size_t size);
+static bool wait_for_delivery(uint32_t peer);
+static void lost_transport(uint32_t peer, int8_t trans);
 
 /*****************************************************************************\/
 *****                        FUNCTION DEFINITIONS                          *****
@@ -134,7 +228,7 @@ bool itc_init_zz(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme, uint32_t init
 	}
 
 	/* Re-init */
-	if(itc_inst.mboxes != NULL)
+	if(itc_inst.nr_mboxes != 0)
 	{
 		if(getpid() == itc_inst.pid)
 		{
@@ -156,6 +250,16 @@ bool itc_init_zz(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme, uint32_t init
 		}
 	}
 
+	if(init_flags & ITC_PREFAULT_SHM)
+	{
+		flags |= ITC_FLAGS_SHM_PREFAULT;
+	}
+
+	if((init_flags & ITC_LAZY_TRANSPORTS) && !(init_flags & ITC_FLAGS_I_AM_ITC_COORD))
+	{
+		flags |= ITC_FLAGS_LAZY_IPC;
+	}
+
 	itc_inst.pid = getpid();
 
 	itc_inst.itcgw_mboxid = ITC_NO_MBOX_ID;
@@ -170,25 +274,19 @@ bool itc_init_zz(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme, uint32_t init
 		return false;
 	}
 
-	nr_mboxes += 1; // We will need 1 extra mailboxes for sysvmq
-
+	memset(trans_mechanisms, 0, sizeof(trans_mechanisms));
 	trans_mechanisms[ITC_TRANS_LOCAL]	= local_trans_apis;
 	trans_mechanisms[ITC_TRANS_LSOCK]	= lsock_trans_apis;
-#if defined UT_POSIXMQ_PLUGIN
-	trans_mechanisms[ITC_TRANS_POSIXMQ]	= posixmq_trans_apis;
-#elif defined UT_SYSVMQ_PLUGIN
-	trans_mechanisms[ITC_TRANS_SYSVMQ]	= sysvmq_trans_apis;
-#elif defined UT_POSIXSHM_PLUGIN
-	trans_mechanisms[ITC_TRANS_POSIXSHM]	= posixshm_trans_apis;
-#elif defined UT_SYSVSHM_PLUGIN
-	trans_mechanisms[ITC_TRANS_SYSVSHM]	= sysvshm_trans_apis;
-#else
-	trans_mechanisms[ITC_TRANS_SYSVMQ]	= sysvmq_trans_apis;
-#endif
+	select_ipc_transports();
+
+	nr_mboxes += itc_inst.nr_ipc_trans; // We will need 1 extra mailbox for each IPC transport's rx thread
 
 	if(alloc_scheme == ITC_MALLOC)
 	{
 		alloc_mechanisms = malloc_apis;
+	} else if(alloc_scheme == ITC_MALLOC_ALIGNED)
+	{
+		alloc_mechanisms = malloc_aligned_apis;
 	} // else if ... for memory pooling,...
 
 	for(uint32_t i = 0; i < ITC_NUM_TRANS; i++)
@@ -199,6 +297,7 @@ bool itc_init_zz(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme, uint32_t init
 
 			msgsize = trans_mechanisms[i].itci_trans_maxmsgsize(rc);
 			rc->flags = ITC_OK;
+			itc_inst.trans_maxsize[i] = msgsize;
 			if(msgsize > max_msgsize)
 			{
 				max_msgsize = msgsize;
@@ -255,85 +354,32 @@ bool itc_init_zz(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme, uint32_t init
 		rc->flags = ITC_OK;
 	}
 
-	itc_inst.mboxes = (struct itc_mailbox*)malloc(nr_mboxes*sizeof(struct itc_mailbox));
-	if(itc_inst.mboxes == NULL)
+	itc_inst.local_mbox_mask = ~itc_inst.itccoord_mask;
+	if(!init_credits((init_flags & ITC_FLOW_CONTROL) != 0))
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to malloc mailboxes for ict_init()!");
+		TPT_TRACE(TRACE_ERROR, "Failed to set up flow control!");
 		free(rc);
 		return false;
 	}
-	memset(itc_inst.mboxes, 0, nr_mboxes*sizeof(struct itc_mailbox));
 
-	itc_inst.local_mbox_mask = 0xFFFFFFFF >> CLZ(nr_mboxes);
-	itc_inst.nr_mboxes = nr_mboxes;
-
-	struct itc_mailbox* mbox_iter;
-	pthread_condattr_t condattr;
-	for(uint32_t i=0; i < itc_inst.nr_mboxes; i++)
+	itc_inst.free_mboxes_queue = q_init(rc);
+	if(itc_inst.free_mboxes_queue == NULL)
 	{
-		mbox_iter = &itc_inst.mboxes[i];
-		mbox_iter->mbox_id = itc_inst.my_mbox_id_in_itccoord | i;
-
-		ret = pthread_mutexattr_init(&(mbox_iter->rxq_info.rxq_attr));
-		if(ret != 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutexattr_init, error code = %d", ret);
-			free(rc);
-			return false;
-		}
-
-		/* Use this type of mutex is safetest, check man7 page for details */
-		ret = pthread_mutexattr_settype(&(mbox_iter->rxq_info.rxq_attr), PTHREAD_MUTEX_ERRORCHECK);
-		if(ret != 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutexattr_settype, error code = %d", ret);
-			free(rc);
-			return false;
-		}
-		
-		ret = pthread_mutex_init(&(mbox_iter->rxq_info.rxq_mtx), &(mbox_iter->rxq_info.rxq_attr));
-		if(ret != 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutex_init, error code = %d", ret);
-			free(rc);
-			return false;
-		}
-
-		ret = pthread_condattr_init(&condattr);
-		if(ret != 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to pthread_condattr_init, error code = %d", ret);
-			free(rc);
-			return false;
-		}
-
-		/* Use clock that indicates the period of time in second from when the system is booted to measure time serving for pthread_cond_timedwait */
-		ret = pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
-		if(ret != 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to pthread_condattr_setclock, error code = %d", ret);
-			free(rc);
-			return false;
-		}
+		TPT_TRACE(TRACE_ERROR, "Failed to q_init free_mboxes_queue!");
+		free(rc);
+		return false;
+	}
+	rc->flags = ITC_OK;
 
-		ret = pthread_cond_init(&(mbox_iter->rxq_info.rxq_cond), &condattr);
-		if(ret != 0)
+	/* Only reserve what was asked for here, itc_create_mailbox() adds more chunks if needed */
+	while(itc_inst.nr_mboxes < (uint32_t)nr_mboxes)
+	{
+		if(!add_mbox_chunk())
 		{
-			TPT_TRACE(TRACE_ERROR, "Failed to pthread_cond_init, error code = %d", ret);
+			TPT_TRACE(TRACE_ERROR, "Failed to allocate mailboxes for itc_init()!");
 			free(rc);
 			return false;
 		}
-		
-		if(i == 0)
-		{
-			TPT_TRACE(TRACE_INFO, "Running q_init for the first mailbox to itc_inst.free_mbox_queue!");
-			itc_inst.free_mboxes_queue = q_init(rc);
-			rc->flags = ITC_OK;
-		}
-
-		TPT_TRACE(TRACE_INFO, "Running q_enqueue mailbox %u to itc_inst.free_mbox_queue!", i);
-		q_enqueue(rc, itc_inst.free_mboxes_queue, mbox_iter);
-		rc->flags = ITC_OK;
 	}
 
 	ret = pthread_key_create(&itc_inst.destruct_key, mailbox_destructor_at_thread_exit);
@@ -344,10 +390,11 @@ bool itc_init_zz(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme, uint32_t init
 		return false;
 	}
 
-	ret = pthread_mutex_init(&itc_inst.local_locating_mbox_mtx, NULL);
-	if(ret != 0)
+	rc->flags = ITC_OK;
+	itc_inst.local_locating_nt = nt_init(rc, nr_mboxes);
+	if(rc->flags != ITC_OK)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to init local_locating_tree mutex, error code = %d", ret);
+		TPT_TRACE(TRACE_ERROR, "Failed to init local_locating_nt!");
 		free(rc);
 		return false;
 	}
@@ -358,7 +405,7 @@ bool itc_init_zz(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme, uint32_t init
 		{
 			rc->flags = ITC_OK;
 			trans_mechanisms[i].itci_trans_init(rc, itc_inst.my_mbox_id_in_itccoord, \
-						itc_inst.itccoord_mask, itc_inst.nr_mboxes, flags);
+						itc_inst.itccoord_mask, nr_mboxes, flags);
 			if(rc->flags != ITC_OK)
 			{
 				// ERROR trace is needed here
@@ -369,8 +416,15 @@ bool itc_init_zz(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme, uint32_t init
 		}
 	}
 
-	start_itcthreads(rc); // Start sysvmq_rx_thread
-	if(rc->flags != ITC_OK)
+	/* itccoord must always be reachable, others may defer rx threads and their IPC objects to first cross-process use */
+	itc_inst.ipc_started = 0;
+	if((init_flags & ITC_LAZY_TRANSPORTS) && !(init_flags & ITC_FLAGS_I_AM_ITC_COORD))
+	{
+		TPT_TRACE(TRACE_INFO, "Defer starting IPC transports to first cross-process use!");
+		return true;
+	}
+
+	if(!start_ipc_transports(true)) // Start sysvmq_rx_thread
 	{
 		// ERROR trace is needed here
 		TPT_TRACE(TRACE_ERROR, "Failed to start_itcthreads!");
@@ -386,12 +440,12 @@ bool itc_exit_zz()
 	struct itc_mailbox* mbox;
 	int running_mboxes = 0;
 
-	/* If itc_inst.mboxes == NULL, only two possible cases. One is mutex_init failed, or failed to locate itccoord */
-	if(itc_inst.mboxes == NULL)
+	/* If itc_inst.nr_mboxes == 0, only two possible cases. One is mutex_init failed, or failed to locate itccoord */
+	if(itc_inst.nr_mboxes == 0)
 	{
 		// Not initialized yet
 		// ERROR trace is needed
-		TPT_TRACE(TRACE_ABN, "itc_inst.mboxes == NULL!");
+		TPT_TRACE(TRACE_ABN, "itc_inst.nr_mboxes == 0!");
 		return false;
 	}
 
@@ -408,19 +462,20 @@ bool itc_exit_zz()
 	rc->flags = ITC_OK;
 	for(uint32_t i = 0; i < itc_inst.nr_mboxes; i++)
 	{
-		mbox = &itc_inst.mboxes[i];
+		mbox = mbox_at(i);
 
 		MUTEX_LOCK(&mbox->rxq_info.rxq_mtx);
 
 
-		if(mbox->mbox_state == MBOX_INUSE)
+		/* Rx thread mailboxes of IPC transports are released by terminate_itcthreads() below */
+		if(mbox->mbox_state == MBOX_INUSE && !(mbox->flags & ITC_FLAGS_MBOX_FORWARDER))
 		{
 			running_mboxes++;
 		}
 
 		MUTEX_UNLOCK(&mbox->rxq_info.rxq_mtx);
 
-		if(running_mboxes > ITC_NR_INTERNAL_USED_MBOXES)
+		if(running_mboxes > 0)
 		{
 			// ERROR trace is needed here
 			TPT_TRACE(TRACE_ABN, "Still had %u remaining open mailboxes!", running_mboxes);
@@ -440,7 +495,7 @@ bool itc_exit_zz()
 	int ret = 0;
 	for(uint32_t i = 0; i < itc_inst.nr_mboxes; i++)
 	{
-		mbox = &itc_inst.mboxes[i];
+		mbox = mbox_at(i);
 
 		ret = pthread_cond_destroy(&(mbox->rxq_info.rxq_cond));
 		if(ret != 0)
@@ -458,13 +513,8 @@ bool itc_exit_zz()
 			return false;
 		}
 
-		ret = pthread_mutexattr_destroy(&(mbox->rxq_info.rxq_attr));
-		if(ret != 0)
-		{
-			// ERROR trace is needed here
-			TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutexattr_destroy, error code = %d", ret);
-			return false;
-		}
+		free(mbox->name);
+		mbox->name = NULL;
 	}
 
 	for(uint32_t i = 0; i < ITC_NUM_TRANS; i++)
@@ -482,6 +532,8 @@ bool itc_exit_zz()
 		}
 	}
 
+	release_credits(true);
+
 	ret = pthread_key_delete(itc_inst.destruct_key);
 	if(ret != 0)
 	{
@@ -490,15 +542,13 @@ bool itc_exit_zz()
 		return false;
 	}
 
-	/* Destroy local_locating_tree */
-	MUTEX_LOCK(&itc_inst.local_locating_mbox_mtx);
-	tdestroy(itc_inst.local_locating_mbox_tree, do_nothing);
-	MUTEX_UNLOCK(&itc_inst.local_locating_mbox_mtx);
-
-	ret = pthread_mutex_destroy(&itc_inst.local_locating_mbox_mtx);
-	if(ret != 0)
+	/* Destroy local_locating_nt */
+	rc->flags = ITC_OK;
+	nt_exit(rc, itc_inst.local_locating_nt);
+	itc_inst.local_locating_nt = NULL;
+	if(rc->flags != ITC_OK)
 	{
-		TPT_TRACE(TRACE_ERROR, "pthread_mutex_destroy error code = %d", ret);
+		TPT_TRACE(TRACE_ERROR, "nt_exit!");
 		return false;
 	}
 
@@ -514,7 +564,12 @@ bool itc_exit_zz()
 		alloc_mechanisms.itci_alloc_exit(rc);
 	}
 
-	free(itc_inst.mboxes);
+	for(uint32_t i = 0; i < (itc_inst.nr_mboxes >> ITC_MBOX_CHUNK_SHIFT); i++)
+	{
+		free(itc_inst.mbox_chunks[i]);
+		itc_inst.mbox_chunks[i] = NULL;
+	}
+	itc_inst.nr_mboxes = 0;
 
 	rc->flags = ITC_OK;
 	TPT_TRACE(TRACE_INFO, "Removing mailboxes from free_mboxes_queue, count = %u!", itc_inst.free_mboxes_queue->size);
@@ -544,7 +599,7 @@ union itc_msg *itc_alloc_zz(size_t size, uint32_t msgno)
 		size = sizeof(msgno);
 	}
 
-	if(itc_inst.mboxes == NULL)
+	if(itc_inst.nr_mboxes == 0)
 	{
 		// Not initialized yet
 		// ERROR trace is needed
@@ -576,6 +631,8 @@ union itc_msg *itc_alloc_zz(size_t size, uint32_t msgno)
 	message->receiver = ITC_NO_MBOX_ID;
 	message->size = size;
 	message->flags = 0;
+	message->call_id = 0;
+	message->credit_src = 0;
 	endpoint = (char*)((unsigned long)(&message->msgno) + size);
 	*endpoint = ENDPOINT;
 
@@ -589,7 +646,7 @@ bool itc_free_zz(union itc_msg **msg)
 
 	// TPT_TRACE(TRACE_INFO, "Freeing itc msg msgno 0x%08x", (*msg)->msgno); // TBD
 
-	if(itc_inst.mboxes == NULL)
+	if(itc_inst.nr_mboxes == 0)
 	{
 		// Not initialized yet
 		// ERROR trace is needed
@@ -626,6 +683,11 @@ bool itc_free_zz(union itc_msg **msg)
 		}	
 	}
 
+	if(message->flags & ITC_FLAGS_MSG_SG)
+	{
+		release_sg_segments(message);
+	}
+
 	rc->flags = ITC_OK;
 	alloc_mechanisms.itci_alloc_free(rc, &message);
 	if(rc->flags != ITC_OK)
@@ -639,6 +701,184 @@ bool itc_free_zz(union itc_msg **msg)
 	return true;
 }
 
+union itc_msg *itc_alloc_sg_zz(size_t size, uint32_t msgno)
+{
+	struct itc_message* message;
+	struct itc_sg_list* sgl;
+	char* endpoint;
+
+	if(size < sizeof(msgno))
+	{
+		size = sizeof(msgno);
+	}
+
+	if(itc_inst.nr_mboxes == 0)
+	{
+		// Not initialized yet
+		TPT_TRACE(TRACE_ERROR, "Not initialized yet!");
+		return NULL;
+	}
+
+	if(rc == NULL)
+	{
+		rc = (struct result_code*)malloc(sizeof(struct result_code));
+		if(rc == NULL)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to malloc rc for itc_alloc_sg_zz()!");
+			return NULL;
+		}
+	}
+
+	/* Head and segment list are allocated in one go, the list sits right after the ENDPOINT */
+	rc->flags = ITC_OK;
+	message = alloc_mechanisms.itci_alloc_alloc(rc, ITC_SG_LIST_OFFSET(size) + sizeof(struct itc_sg_list));
+	rc->flags = ITC_OK;
+	if(message == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to allocate scatter-gather message!");
+		return NULL;
+	}
+
+	message->msgno = msgno;
+	message->sender = ITC_NO_MBOX_ID;
+	message->receiver = ITC_NO_MBOX_ID;
+	message->size = size;
+	message->flags = ITC_FLAGS_MSG_SG;
+	message->call_id = 0;
+	message->credit_src = 0;
+	endpoint = (char*)((unsigned long)(&message->msgno) + size);
+	*endpoint = ENDPOINT;
+
+	sgl = ITC_SG_LIST(message);
+	sgl->nr_segs = 0;
+	sgl->total_len = 0;
+
+	return (union itc_msg*)&(message->msgno);
+}
+
+bool itc_append_segment_zz(union itc_msg *msg, void *buf, size_t len, void (*release)(void *buf))
+{
+	struct itc_message* message;
+	struct itc_sg_list* sgl;
+
+	if(msg == NULL || (buf == NULL && len != 0))
+	{
+		TPT_TRACE(TRACE_ERROR, "Invalid arguments, msg = 0x%08lx, buf = 0x%08lx!", (unsigned long)msg, (unsigned long)buf);
+		return false;
+	}
+
+	message = CONVERT_TO_MESSAGE(msg);
+	if(!(message->flags & ITC_FLAGS_MSG_SG))
+	{
+		TPT_TRACE(TRACE_ABN, "Message was not allocated by itc_alloc_sg(), msgno = 0x%08x!", message->msgno);
+		return false;
+	} else if(message->flags & ITC_FLAGS_MSG_INRXQUEUE)
+	{
+		TPT_TRACE(TRACE_ABN, "Message still in rx queue!");
+		return false;
+	}
+
+	sgl = ITC_SG_LIST(message);
+	if(sgl->nr_segs >= ITC_MAX_SG_SEGMENTS)
+	{
+		TPT_TRACE(TRACE_ABN, "Too many segments, max = %d!", ITC_MAX_SG_SEGMENTS);
+		return false;
+	}
+
+	if(message->size + sgl->total_len + len > ITC_MAX_MSGSIZE)
+	{
+		TPT_TRACE(TRACE_ABN, "Message too large, size = %lu bytes, max = %d bytes!", message->size + sgl->total_len + len, ITC_MAX_MSGSIZE);
+		return false;
+	}
+
+	sgl->segs[sgl->nr_segs].base = buf;
+	sgl->segs[sgl->nr_segs].len = len;
+	sgl->segs[sgl->nr_segs].release = release;
+	sgl->nr_segs++;
+	sgl->total_len += len;
+
+	return true;
+}
+
+bool itc_flatten_zz(union itc_msg **msg)
+{
+	struct itc_message* message;
+	struct itc_message* new_message;
+	union itc_msg* new_msg;
+	uint32_t flags;
+
+	if(msg == NULL || *msg == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "The flattening message is NULL!");
+		return false;
+	}
+
+	message = CONVERT_TO_MESSAGE(*msg);
+	if(!(message->flags & ITC_FLAGS_MSG_SG))
+	{
+		/* Already contiguous */
+		return true;
+	}
+
+	new_msg = itc_alloc(itc_msg_payload_size(message), message->msgno);
+	if(new_msg == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to allocate flattened message!");
+		return false;
+	}
+
+	new_message = CONVERT_TO_MESSAGE(new_msg);
+	flags = new_message->flags;
+	(void)itc_msg_gather(message, new_message); // Sender and receiver are carried over as well
+	new_message->flags = flags;
+
+	if(itc_free(msg) == false)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to free scatter-gather message!");
+		itc_free(&new_msg);
+		return false;
+	}
+
+	*msg = new_msg;
+	return true;
+}
+
+int itc_get_segments_zz(union itc_msg *msg, struct iovec *iov, int iovcnt)
+{
+	struct itc_message* message;
+	struct itc_sg_list* sgl;
+
+	if(msg == NULL || iov == NULL || iovcnt < 1)
+	{
+		TPT_TRACE(TRACE_ERROR, "Invalid arguments!");
+		return -1;
+	}
+
+	message = CONVERT_TO_MESSAGE(msg);
+	iov[0].iov_base = (void*)msg;
+	iov[0].iov_len = message->size;
+
+	if(!(message->flags & ITC_FLAGS_MSG_SG))
+	{
+		return 1;
+	}
+
+	sgl = ITC_SG_LIST(message);
+	if((uint32_t)iovcnt < sgl->nr_segs + 1)
+	{
+		TPT_TRACE(TRACE_ABN, "Not enough iovec entries, iovcnt = %d, needed = %u!", iovcnt, sgl->nr_segs + 1);
+		return -1;
+	}
+
+	for(uint32_t i = 0; i < sgl->nr_segs; i++)
+	{
+		iov[i + 1].iov_base = sgl->segs[i].base;
+		iov[i + 1].iov_len = sgl->segs[i].len;
+	}
+
+	return (int)sgl->nr_segs + 1;
+}
+
 itc_mbox_id_t itc_create_mailbox_zz(const char *name, uint32_t flags)
 {
 	struct itc_mailbox* new_mbox;
@@ -646,7 +886,7 @@ itc_mbox_id_t itc_create_mailbox_zz(const char *name, uint32_t flags)
 
 	TPT_TRACE(TRACE_INFO, "Creating mailbox name %s", name);
 
-	if(itc_inst.mboxes == NULL)
+	if(itc_inst.nr_mboxes == 0)
 	{
 		// Not initialized yet
 		// ERROR trace is needed
@@ -670,26 +910,50 @@ itc_mbox_id_t itc_create_mailbox_zz(const char *name, uint32_t flags)
 		}	
 	}
 
+	if(strlen(name) > (ITC_MAX_NAME_LENGTH))
+	{
+		TPT_TRACE(TRACE_ABN, "Requested mailbox name too long!");
+		return ITC_NO_MBOX_ID;
+	}
+
 	rc->flags = ITC_OK;
 	new_mbox = q_dequeue(rc, itc_inst.free_mboxes_queue);
 	rc->flags = ITC_OK;
 	if(new_mbox == NULL)
 	{
-		TPT_TRACE(TRACE_ABN, "Not enough available mailbox to create!");
-		return ITC_NO_MBOX_ID;
+		new_mbox = grow_mboxes();
+		if(new_mbox == NULL)
+		{
+			TPT_TRACE(TRACE_ABN, "Not enough available mailbox to create!");
+			return ITC_NO_MBOX_ID;
+		}
 	}
 
-	if(strlen(name) > (ITC_MAX_NAME_LENGTH))
+	new_mbox->name = strdup(name);
+	if(new_mbox->name == NULL)
 	{
-		TPT_TRACE(TRACE_ABN, "Requested mailbox name too long!");
+		TPT_TRACE(TRACE_ERROR, "Failed to malloc mailbox name due to out of memory!");
+		q_enqueue(rc, itc_inst.free_mboxes_queue, new_mbox);
+		rc->flags = ITC_OK;
 		return ITC_NO_MBOX_ID;
 	}
-	strcpy(new_mbox->name, name);
 
 	new_mbox->flags			= flags;
 	new_mbox->p_rxq_info		= &new_mbox->rxq_info;
 	new_mbox->p_rxq_info->rxq_len	= 0;
 	new_mbox->p_rxq_info->is_in_rx	= 0;
+	new_mbox->p_rxq_info->fd_edge	= (flags & ITC_EDGE_TRIGGERED_FD) != 0;
+	new_mbox->p_rxq_info->fd_armed	= true;
+	new_mbox->wait_call_id		= 0;
+	new_mbox->reply_slot		= NULL;
+	new_mbox->into_buf		= NULL;
+	new_mbox->into_done		= false;
+	new_mbox->in_trans_wait		= false;
+	new_mbox->trans_rx		= NULL;
+	if(trans_mechanisms[ITC_TRANS_SYSVMQ].itci_trans_wait == NULL)
+	{
+		new_mbox->flags &= ~ITC_DIRECT_IPC_RX; // sysvmq is not running (yet), messages come through its rx thread
+	}
 
 	MUTEX_LOCK(&(new_mbox->p_rxq_info->rxq_mtx));
 
@@ -721,11 +985,13 @@ itc_mbox_id_t itc_create_mailbox_zz(const char *name, uint32_t flags)
 		return ITC_NO_MBOX_ID;
 	}
 
-	/* Insert mailbox to local_locating_tree */
-	if(insert_mbox_to_tree(&itc_inst.local_locating_mbox_tree, &itc_inst.local_locating_mbox_mtx, new_mbox) == false)
+	/* Insert mailbox to local_locating_nt */
+	rc->flags = ITC_OK;
+	nt_insert(rc, itc_inst.local_locating_nt, new_mbox->name, new_mbox->mbox_id);
+	if(rc->flags != ITC_OK)
 	{
 		/* Not a big problem, will not return. User may only not be able to get precise mbox_id from name in the future for this mailbox by itc_locate_sync() request */
-		TPT_TRACE(TRACE_ABN, "Mailbox id 0x%08x already exists in local_locating_tree!", new_mbox->mbox_id);
+		TPT_TRACE(TRACE_ABN, "Mailbox id 0x%08x already exists in local_locating_nt!", new_mbox->mbox_id);
 	}
 
 	my_threadlocal_mbox = new_mbox;
@@ -761,7 +1027,7 @@ bool itc_delete_mailbox_zz(itc_mbox_id_t mbox_id)
 
 	TPT_TRACE(TRACE_INFO, "Deleting mailbox id 0x%08x", mbox_id);
 
-	if(itc_inst.mboxes == NULL || my_threadlocal_mbox == NULL)
+	if(itc_inst.nr_mboxes == 0 || my_threadlocal_mbox == NULL)
 	{
 		// Not initialized yet
 		// ERROR trace is needed
@@ -778,11 +1044,13 @@ bool itc_delete_mailbox_zz(itc_mbox_id_t mbox_id)
 
 	mbox = my_threadlocal_mbox;
 
-	/* Remove mailbox from local_locating_tree */
-	if(remove_mbox_from_tree(&itc_inst.local_locating_mbox_tree, &itc_inst.local_locating_mbox_mtx, mbox) == false)
+	/* Remove mailbox from local_locating_nt */
+	rc->flags = ITC_OK;
+	nt_remove(rc, itc_inst.local_locating_nt, mbox->name);
+	if(rc->flags != ITC_OK)
 	{
 		/* Not a too big problem, will not return here */
-		TPT_TRACE(TRACE_ABN, "Failed to delete mbox_id = 0x%08x which is not found in local locating tree, something was messed up!", mbox_id);
+		TPT_TRACE(TRACE_ABN, "Failed to delete mbox_id = 0x%08x which is not found in local locating table, something was messed up!", mbox_id);
 	}
 
 	rxq_mtx = &(mbox->p_rxq_info->rxq_mtx);
@@ -883,7 +1151,8 @@ bool itc_delete_mailbox_zz(itc_mbox_id_t mbox_id)
 	}
 
 	mbox->p_rxq_info = NULL;
-	strcpy(mbox->name, "");
+	free(mbox->name);
+	mbox->name = NULL;
 	mbox->tid = 0;
 
 	rc->flags = ITC_OK;
@@ -908,7 +1177,7 @@ bool itc_send_zz(union itc_msg **msg, itc_mbox_id_t to, itc_mbox_id_t from, char
 	struct itc_mailbox* to_mbox;
 
 	TPT_TRACE(TRACE_INFO, "ENTER: itc_send_zz!");
-	if(itc_inst.mboxes == NULL || my_threadlocal_mbox == NULL)
+	if(itc_inst.nr_mboxes == 0 || my_threadlocal_mbox == NULL)
 	{
 		// Not initialized yet
 		// ERROR trace is needed
@@ -953,7 +1222,11 @@ bool itc_send_zz(union itc_msg **msg, itc_mbox_id_t to, itc_mbox_id_t from, char
 	// TPT_TRACE(TRACE_INFO, "Prepare to send message from 0x%08x to 0x%08x, msgno = 0x%08x", from, to, (*msg)->msgno); // TBD
 
 	message = CONVERT_TO_MESSAGE(*msg);
-	message->sender = my_threadlocal_mbox->mbox_id;
+	/* Transport rx threads forward messages from other processes, keep the original sender so that replies find their way back */
+	if(!(my_threadlocal_mbox->flags & ITC_FLAGS_MBOX_FORWARDER) || message->sender == ITC_NO_MBOX_ID)
+	{
+		message->sender = my_threadlocal_mbox->mbox_id;
+	}
 	message->receiver = to;
 
 	if(rc == NULL)
@@ -977,68 +1250,22 @@ bool itc_send_zz(union itc_msg **msg, itc_mbox_id_t to, itc_mbox_id_t from, char
 			TPT_TRACE(TRACE_ABN, "Sending message to a non-active mailbox!");
 			return false;
 		}
-		MUTEX_LOCK(&(to_mbox->rxq_info.rxq_mtx));
-	}
 
-	int idx = 0;
-	for(; idx < ITC_NUM_TRANS; idx++)
-	{
-		if(trans_mechanisms[idx].itci_trans_send != NULL)
+		if(!enqueue_local(to_mbox, message))
 		{
-			rc->flags = ITC_OK;
-			trans_mechanisms[idx].itci_trans_send(rc, message, to);
-			if(rc->flags != ITC_OK)
-			{
-				if(to_mbox != NULL)
-				{
-					MUTEX_UNLOCK(&(to_mbox->p_rxq_info->rxq_mtx));
-				}
-			} else
-			{
-				// TPT_TRACE(TRACE_INFO, "Sent successfully on trans_mechanism[%u]!", idx); // TBD
-				break;
-			}
+			return false;
 		}
-	}
-
-	if(idx == ITC_NUM_TRANS)
+	} else if(!__atomic_load_n(&itc_inst.ipc_started, __ATOMIC_ACQUIRE) && needs_ipc_rx(message, to) && !start_ipc_transports(false))
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to start IPC transports!");
+		return false;
+	} else if(!send_to_peer(message, to))
 	{
-		if(to_mbox != NULL)
-		{
-			MUTEX_UNLOCK(&(to_mbox->p_rxq_info->rxq_mtx));
-		}
 		// ERROR trace is needed here. Failed to send the message on all mechanisms
 		TPT_TRACE(TRACE_ERROR, "Failed to send message by all transport mechanisms!");
 		return false;
 	}
 
-	uint64_t one = 1;
-	/* If this is local mailbox, trigger synchronization by two methods:
-	* 1. Write to an FD of receiving mailbox -> trigger epoll/poll/select 
-	* 2. Release condition variable of receiving mailbox -> unblock pthread_cond_wait of receiving mailbox on itc_receive() */
-	if(to_mbox != NULL && to_mbox->p_rxq_info != NULL)
-	{
-		int saved_cancel_state;
-
-		/* System call write() below will create a cancellation point that can cause this thread get cancelled unexpectedly */
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &saved_cancel_state);
-
-		if(to_mbox->p_rxq_info->is_fd_created && to_mbox->p_rxq_info->rxq_len == 0)
-		{
-			if(write(to_mbox->p_rxq_info->rxq_fd, &one, 8) < 0)
-			{
-				TPT_TRACE(TRACE_ERROR, "Failed to write()!");
-			}
-		}
-
-		to_mbox->p_rxq_info->rxq_len++;
-		pthread_cond_signal(&(to_mbox->p_rxq_info->rxq_cond));
-		MUTEX_UNLOCK(&(to_mbox->p_rxq_info->rxq_mtx));
-
-		pthread_setcancelstate(saved_cancel_state, NULL);
-		// TPT_TRACE(TRACE_INFO, "Notify receiver about sent messages!"); // TBD
-	}
-
 	// TPT_TRACE(TRACE_INFO, "EXIT: itc_send_zz!"); // TBD
 	*msg = NULL;
 	return true;
@@ -1051,7 +1278,7 @@ union itc_msg *itc_receive_zz(int32_t tmo)
 	struct timespec ts;
 
 	// TPT_TRACE(TRACE_INFO, "ENTER: itc_receive_zz!"); // TBD
-	if(itc_inst.mboxes == NULL || my_threadlocal_mbox == NULL)
+	if(itc_inst.nr_mboxes == 0 || my_threadlocal_mbox == NULL)
 	{
 		// Not initialized yet
 		// ERROR trace is needed
@@ -1099,6 +1326,9 @@ union itc_msg *itc_receive_zz(int32_t tmo)
 
 		if(message == NULL)
 		{
+			/* Rx queue is drained, the next message must make an edge triggered fd readable again */
+			mbox->p_rxq_info->fd_armed = true;
+
 			if(tmo == ITC_NO_WAIT)
 			{
 				/* If nothing in rx queue, return immediately */
@@ -1109,7 +1339,7 @@ union itc_msg *itc_receive_zz(int32_t tmo)
 			{
 				/* Wait undefinitely until we receive something from rx queue */
 				// TPT_TRACE(TRACE_INFO, "Waiting for incoming messages...!"); // TBD
-				int ret = pthread_cond_wait(&(mbox->p_rxq_info->rxq_cond), &(mbox->p_rxq_info->rxq_mtx));
+				int ret = wait_rxq(mbox, NULL);
 				if(ret != 0)
 				{
 					// ERROR trace is needed here
@@ -1119,7 +1349,7 @@ union itc_msg *itc_receive_zz(int32_t tmo)
 				}
 			} else
 			{
-				int ret = pthread_cond_timedwait(&(mbox->p_rxq_info->rxq_cond), &(mbox->p_rxq_info->rxq_mtx), &ts);
+				int ret = wait_rxq(mbox, &ts);
 				if(ret == ETIMEDOUT)
 				{
 					TPT_TRACE(TRACE_ERROR, "Timeout when expecting message, timeout = %u ms!", tmo);
@@ -1137,7 +1367,7 @@ union itc_msg *itc_receive_zz(int32_t tmo)
 		} else
 		{
 			mbox->p_rxq_info->rxq_len--;
-			if(mbox->p_rxq_info->is_fd_created && mbox->p_rxq_info->rxq_len == 0)
+			if(mbox->p_rxq_info->is_fd_created && !mbox->p_rxq_info->fd_edge && mbox->p_rxq_info->rxq_len == 0)
 			{
 				char readbuf[8];
 				if(read(mbox->p_rxq_info->rxq_fd, &readbuf, 8) < 0)
@@ -1161,6 +1391,323 @@ union itc_msg *itc_receive_zz(int32_t tmo)
 	return (union itc_msg*)((message == NULL) ? NULL : CONVERT_TO_MSG(message));
 }
 
+bool itc_receive_into_zz(void *buf, size_t cap, int32_t tmo, struct itc_msg_info *info)
+{
+	struct itc_message* message = NULL;
+	struct itc_mailbox* mbox;
+	struct timespec ts;
+	bool delivered = false;
+
+	if(itc_inst.nr_mboxes == 0 || my_threadlocal_mbox == NULL)
+	{
+		// Not initialized yet
+		TPT_TRACE(TRACE_ERROR, "Not initialized yet!");
+		return false;
+	}
+
+	if(buf == NULL || info == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Receiving buffer or info is NULL!");
+		return false;
+	}
+
+	if(rc == NULL)
+	{
+		rc = (struct result_code*)malloc(sizeof(struct result_code));
+		if(rc == NULL)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to malloc rc for itc_receive_into_zz()!");
+			return false;
+		}
+	}
+
+	mbox = my_threadlocal_mbox;
+
+	if(tmo != ITC_WAIT_FOREVER && tmo != ITC_NO_WAIT && tmo > 0)
+	{
+		calc_abs_time(&ts, tmo);
+	}
+
+	MUTEX_LOCK(&(mbox->p_rxq_info->rxq_mtx));
+	mbox->p_rxq_info->is_in_rx = true;
+
+	while(!mbox->into_done)
+	{
+		int ret;
+
+		/* Messages already queued go first to keep the ordering */
+		for(uint32_t i = 0; i < ITC_NUM_TRANS; i++)
+		{
+			if(trans_mechanisms[i].itci_trans_receive != NULL)
+			{
+				rc->flags = ITC_OK;
+				message = trans_mechanisms[i].itci_trans_receive(rc, mbox);
+				if(message != NULL)
+				{
+					break;
+				}
+			}
+		}
+
+		if(message != NULL)
+		{
+			mbox->p_rxq_info->rxq_len--;
+			if(mbox->p_rxq_info->is_fd_created && !mbox->p_rxq_info->fd_edge && mbox->p_rxq_info->rxq_len == 0)
+			{
+				char readbuf[8];
+				if(read(mbox->p_rxq_info->rxq_fd, &readbuf, 8) < 0)
+				{
+					TPT_TRACE(TRACE_ERROR, "Failed to read()!");
+				}
+			}
+			break;
+		}
+
+		mbox->p_rxq_info->fd_armed = true;
+		if(tmo == ITC_NO_WAIT)
+		{
+			break;
+		}
+
+		/* Nothing queued, let transport rx threads copy the next message directly into buf */
+		mbox->into_buf	= buf;
+		mbox->into_cap	= cap;
+		mbox->into_info	= info;
+
+		if(tmo == ITC_WAIT_FOREVER)
+		{
+			ret = wait_rxq(mbox, NULL);
+		} else
+		{
+			ret = wait_rxq(mbox, &ts);
+		}
+
+		if(ret == ETIMEDOUT)
+		{
+			TPT_TRACE(TRACE_ERROR, "Timeout when expecting message, timeout = %d ms!", tmo);
+			break;
+		} else if(ret != 0)
+		{
+			TPT_TRACE(TRACE_ERROR, "pthread_cond_wait error code = %d", ret);
+			break;
+		}
+	}
+
+	delivered = mbox->into_done;
+	mbox->into_buf = NULL;
+	mbox->into_done = false;
+	mbox->p_rxq_info->is_in_rx = false;
+	MUTEX_UNLOCK(&(mbox->p_rxq_info->rxq_mtx));
+
+	if(message != NULL)
+	{
+		copy_msg_into(message, buf, cap, info);
+		union itc_msg *msg = CONVERT_TO_MSG(message);
+		itc_free(&msg);
+		return true;
+	}
+
+	return delivered;
+}
+
+union itc_msg *itc_call_zz(union itc_msg **msg, itc_mbox_id_t to, int32_t tmo)
+{
+	struct itc_message* message;
+	struct itc_message* reply = NULL;
+	struct itc_mailbox* mbox;
+	struct timespec ts;
+	uint32_t call_id;
+
+	if(itc_inst.nr_mboxes == 0 || my_threadlocal_mbox == NULL)
+	{
+		// Not initialized yet
+		TPT_TRACE(TRACE_ERROR, "Not initialized yet!");
+		return NULL;
+	}
+
+	if(msg == NULL || *msg == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "The calling message is NULL!");
+		return NULL;
+	}
+
+	mbox = my_threadlocal_mbox;
+
+	/* 0 means "not a call" and the top bit marks replies, so both are skipped */
+	last_call_id = (last_call_id + 1) & ~ITC_CALL_ID_REPLY;
+	if(last_call_id == 0)
+	{
+		last_call_id = 1;
+	}
+	call_id = last_call_id;
+
+	message = CONVERT_TO_MESSAGE(*msg);
+	message->call_id = call_id;
+
+	/* Arm the reply slot before sending, the reply may come back before itc_send() even returns */
+	MUTEX_LOCK(&(mbox->p_rxq_info->rxq_mtx));
+	mbox->wait_call_id = call_id;
+	mbox->reply_slot = NULL;
+	MUTEX_UNLOCK(&(mbox->p_rxq_info->rxq_mtx));
+
+	if(itc_send(msg, to, ITC_MY_MBOX_ID, NULL) == false)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to send call request to mailbox 0x%08x!", to);
+		MUTEX_LOCK(&(mbox->p_rxq_info->rxq_mtx));
+		mbox->wait_call_id = 0;
+		MUTEX_UNLOCK(&(mbox->p_rxq_info->rxq_mtx));
+		message->call_id = 0;
+		return NULL;
+	}
+
+	if(tmo != ITC_WAIT_FOREVER && tmo != ITC_NO_WAIT && tmo > 0)
+	{
+		calc_abs_time(&ts, tmo);
+	}
+
+	MUTEX_LOCK(&(mbox->p_rxq_info->rxq_mtx));
+	while(mbox->reply_slot == NULL)
+	{
+		int ret;
+
+		if(tmo == ITC_NO_WAIT)
+		{
+			break;
+		} else if(tmo == ITC_WAIT_FOREVER)
+		{
+			ret = wait_rxq(mbox, NULL);
+		} else
+		{
+			ret = wait_rxq(mbox, &ts);
+		}
+
+		if(ret == ETIMEDOUT)
+		{
+			TPT_TRACE(TRACE_ERROR, "Timeout when expecting reply call_id = 0x%08x, timeout = %d ms!", call_id, tmo);
+			break;
+		} else if(ret != 0)
+		{
+			TPT_TRACE(TRACE_ERROR, "pthread_cond_wait error code = %d", ret);
+			break;
+		}
+	}
+
+	reply = mbox->reply_slot;
+	mbox->reply_slot = NULL;
+	mbox->wait_call_id = 0;
+	MUTEX_UNLOCK(&(mbox->p_rxq_info->rxq_mtx));
+
+	if(reply == NULL)
+	{
+		return NULL;
+	}
+
+	reply->call_id = 0;
+	return CONVERT_TO_MSG(reply);
+}
+
+bool itc_reply_zz(union itc_msg *req, union itc_msg **rsp)
+{
+	struct itc_message* req_message;
+	struct itc_message* rsp_message;
+
+	if(req == NULL || rsp == NULL || *rsp == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "The request or reply message is NULL!");
+		return false;
+	}
+
+	req_message = CONVERT_TO_MESSAGE(req);
+	if(req_message->call_id != 0)
+	{
+		rsp_message = CONVERT_TO_MESSAGE(*rsp);
+		rsp_message->call_id = req_message->call_id | ITC_CALL_ID_REPLY;
+	}
+
+	return itc_send(rsp, req_message->sender, ITC_MY_MBOX_ID, NULL);
+}
+
+bool itc_reply_reuse_zz(union itc_msg **req, uint32_t new_msgno, size_t new_size)
+{
+	struct itc_message* message;
+	union itc_msg* rsp;
+	itc_mbox_id_t to;
+	char* endpoint;
+	char saved_header[ITC_HEADER_SIZE + sizeof(uint32_t)];
+	char saved_byte;
+	size_t keep;
+
+	if(itc_inst.nr_mboxes == 0 || my_threadlocal_mbox == NULL)
+	{
+		// Not initialized yet
+		TPT_TRACE(TRACE_ERROR, "Not initialized yet!");
+		return false;
+	}
+
+	if(req == NULL || *req == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "The request message is NULL!");
+		return false;
+	}
+
+	if(new_size < sizeof(new_msgno))
+	{
+		new_size = sizeof(new_msgno);
+	}
+
+	message = CONVERT_TO_MESSAGE(*req);
+
+	/* Does not fit, fall back to a fresh message carrying over what the caller already wrote into the request */
+	if((message->flags & ITC_FLAGS_MSG_SG) || new_size > message->size)
+	{
+		rsp = itc_alloc(new_size, new_msgno);
+		if(rsp == NULL)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to allocate reply msgno 0x%08x!", new_msgno);
+			return false;
+		}
+
+		/* A scatter-gather request may be shrunk as well, its head alone can be larger than new_size */
+		keep = MIN(new_size, message->size);
+		memcpy((char *)rsp + sizeof(new_msgno), (char *)(*req) + sizeof(new_msgno), keep - sizeof(new_msgno));
+		if(itc_reply(*req, &rsp) == false)
+		{
+			itc_free(&rsp);
+			return false;
+		}
+
+		itc_free(req);
+		return true;
+	}
+
+	/* Turn the request around in place. The new ENDPOINT may land on request payload and itc_send() rewrites
+	sender and receiver, so keep what is needed to hand the request back untouched if the send fails */
+	memcpy(saved_header, message, sizeof(saved_header));
+	saved_byte = *(char*)((unsigned long)(&message->msgno) + new_size);
+
+	to = message->sender;
+	message->sender = message->receiver;
+	message->receiver = to;
+	message->msgno = new_msgno;
+	message->size = new_size;
+	endpoint = (char*)((unsigned long)(&message->msgno) + new_size);
+	*endpoint = ENDPOINT;
+
+	if(message->call_id != 0)
+	{
+		message->call_id |= ITC_CALL_ID_REPLY;
+	}
+
+	if(itc_send(req, to, ITC_MY_MBOX_ID, NULL) == false)
+	{
+		memcpy(message, saved_header, sizeof(saved_header));
+		*endpoint = saved_byte;
+		return false;
+	}
+
+	return true;
+}
+
 itc_mbox_id_t itc_sender_zz(union itc_msg *msg)
 {
 	struct itc_message* message;
@@ -1200,7 +1747,7 @@ size_t itc_size_zz(union itc_msg *msg)
 	}
 
 	message = CONVERT_TO_MESSAGE(msg);
-	return message->size;
+	return itc_msg_payload_size(message);
 }
 
 itc_mbox_id_t itc_current_mbox_zz()
@@ -1219,7 +1766,7 @@ int itc_get_fd_zz()
 {
 	struct itc_mailbox* mbox = my_threadlocal_mbox;
 
-	if(itc_inst.mboxes == NULL || my_threadlocal_mbox == NULL)
+	if(itc_inst.nr_mboxes == 0 || my_threadlocal_mbox == NULL)
 	{
 		// Not initialized yet
 		// ERROR trace is needed
@@ -1238,12 +1785,20 @@ int itc_get_fd_zz()
 	}
 
 	rc->flags = ITC_OK;
+
+	if(mbox->flags & ITC_DIRECT_IPC_RX)
+	{
+		// Owner waits in sysvmq for messages from other processes, nobody would wake up an epoll on our fd for those
+		TPT_TRACE(TRACE_ERROR, "Mailbox 0x%08x is created with ITC_DIRECT_IPC_RX, no fd available!", mbox->mbox_id);
+		return -1;
+	}
+
 	MUTEX_LOCK(&(mbox->p_rxq_info->rxq_mtx));
 
 	uint64_t one = 1;
 	if(!mbox->p_rxq_info->is_fd_created)
 	{
-		mbox->p_rxq_info->rxq_fd = eventfd(0, 0);
+		mbox->p_rxq_info->rxq_fd = eventfd(0, mbox->p_rxq_info->fd_edge ? EFD_NONBLOCK : 0);
 		if(mbox->p_rxq_info->rxq_fd == -1)
 		{
 			TPT_TRACE(TRACE_ERROR, "Failed to eventfd()!");
@@ -1251,6 +1806,7 @@ int itc_get_fd_zz()
 			return -1;
 		}
 		mbox->p_rxq_info->is_fd_created = true;
+		mbox->p_rxq_info->fd_armed = (mbox->p_rxq_info->rxq_len == 0);
 		if(mbox->p_rxq_info->rxq_len != 0)
 		{
 			if(write(mbox->p_rxq_info->rxq_fd, &one, 8) < 0)
@@ -1268,7 +1824,7 @@ int itc_get_fd_zz()
 
 bool itc_get_name_zz(itc_mbox_id_t mbox_id, char *name)
 {
-	if(itc_inst.mboxes == NULL || my_threadlocal_mbox == NULL)
+	if(itc_inst.nr_mboxes == 0 || my_threadlocal_mbox == NULL)
 	{
 		// Not initialized yet
 		// ERROR trace is needed
@@ -1294,7 +1850,7 @@ itc_mbox_id_t itc_locate_sync_zz(int32_t timeout, const char *name, bool find_on
 	union itc_msg *msg;
 	// pid_t pid; // TBD
 
-	if(itc_inst.mboxes == NULL || my_threadlocal_mbox == NULL)
+	if(itc_inst.nr_mboxes == 0 || my_threadlocal_mbox == NULL)
 	{
 		// Not initialized yet
 		// ERROR trace is needed
@@ -1322,18 +1878,17 @@ itc_mbox_id_t itc_locate_sync_zz(int32_t timeout, const char *name, bool find_on
 	msg->itc_locate_mbox_sync_request.timeout = timeout;
 	msg->itc_locate_mbox_sync_request.find_only_internal = find_only_internal;
 	strcpy(msg->itc_locate_mbox_sync_request.mbox_name, name);
-	if(itc_send(&msg, itc_inst.itccoord_mbox_id, ITC_MY_MBOX_ID, NULL) == false)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to send ITC_LOCATE_MBOX_SYNC_REQUEST to itccoord!");
-		itc_free(&msg);
-		return ITC_NO_MBOX_ID;
-	}
-
-	msg = itc_receive(timeout);
+	union itc_msg *req = msg;
+	msg = itc_call(&req, itc_inst.itccoord_mbox_id, timeout);
 	if(msg == NULL)
 	{
 		TPT_TRACE(TRACE_ERROR, "Failed to receive ITC_LOCATE_MBOX_SYNC_REPLY from itccoord even after %d ms!", timeout);
-		return false;
+		if(req != NULL)
+		{
+			/* Still ours if it could not be sent */
+			itc_free(&req);
+		}
+		return ITC_NO_MBOX_ID;
 	} else if(msg->msgno != ITC_LOCATE_MBOX_SYNC_REPLY)
 	{
 		TPT_TRACE(TRACE_ABN, "Received unknown message 0x%08x, expecting ITC_LOCATE_MBOX_SYNC_REPLY!", msg->msgno);
@@ -1357,7 +1912,7 @@ itc_mbox_id_t itc_locate_sync_zz(int32_t timeout, const char *name, bool find_on
 
 bool itc_get_namespace_zz(int32_t timeout, char *name)
 {
-	if(itc_inst.mboxes == NULL || my_threadlocal_mbox == NULL)
+	if(itc_inst.nr_mboxes == 0 || my_threadlocal_mbox == NULL)
 	{
 		// Not initialized yet
 		// ERROR trace is needed
@@ -1386,19 +1941,17 @@ bool itc_get_namespace_zz(int32_t timeout, char *name)
 		return false;
 	}
 
-	if(itc_send(&req, itcgw_udp_mboxid, ITC_MY_MBOX_ID, NULL) == false)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to send message to mailbox %s!", ITC_GATEWAY_MBOX_UDP_NAME);
-		itc_free(&req);
-		return false;
-	}
-
 	union itc_msg *rep;
-	rep = itc_receive(timeout);
+	rep = itc_call(&req, itcgw_udp_mboxid, timeout);
 
 	if(rep == NULL)
 	{
 		TPT_TRACE(TRACE_ERROR, "Failed to retrieve namespace from itc gateway even after %d ms!", timeout);
+		if(req != NULL)
+		{
+			/* Still ours if it could not be sent */
+			itc_free(&req);
+		}
 		return false;
 	} else if(rep->msgno != ITC_GET_NAMESPACE_REPLY)
 	{
@@ -1414,40 +1967,195 @@ bool itc_get_namespace_zz(int32_t timeout, char *name)
 	return true;
 }
 
-
-/*****************************************************************************\/
-*****                  INTERNAL FUNCTIONS IMPLEMENTATION                   *****
-*******************************************************************************/
-static void release_all_itc_resources()
+uint32_t itc_get_credit_stats_zz(struct itc_credit_stats *stats, uint32_t nr_stats)
 {
-	int ret = pthread_key_delete(itc_inst.destruct_key);
-	if(ret != 0)
+	uint32_t count = 0;
+
+	for(uint32_t i = 0; i < MAX_SUPPORTED_PROCESSES; i++)
 	{
-		TPT_TRACE(TRACE_ERROR, "pthread_key_delete error code = %d", ret);
-		return;
+		struct itc_credit_stats *cs = &itc_inst.credit_stats[i];
+
+		if(__atomic_load_n(&cs->nr_stalls, __ATOMIC_RELAXED) == 0)
+		{
+			continue;
+		} else if(stats != NULL)
+		{
+			if(count == nr_stats)
+			{
+				break;
+			}
+
+			stats[count].process		= i << ITC_COORD_SHIFT;
+			stats[count].nr_stalls		= __atomic_load_n(&cs->nr_stalls, __ATOMIC_RELAXED);
+			stats[count].stall_ns		= __atomic_load_n(&cs->stall_ns, __ATOMIC_RELAXED);
+			stats[count].max_stall_ns	= __atomic_load_n(&cs->max_stall_ns, __ATOMIC_RELAXED);
+			stats[count].nr_failed		= __atomic_load_n(&cs->nr_failed, __ATOMIC_RELAXED);
+		}
+		count++;
 	}
 
-	// if(itc_inst.name_space)
-	// {
-	// 	free(itc_inst.name_space);
-	// }
+	return count;
+}
 
-	tdestroy(itc_inst.local_locating_mbox_tree, do_nothing);
 
-	free(itc_inst.mboxes);
+/*****************************************************************************\/
+*****                  INTERNAL FUNCTIONS IMPLEMENTATION                   *****
+*******************************************************************************/
+/* Queue a message onto a mailbox of this process and wake its owner up. Replies of itc_call() skip the rx queue and go
+straight into the reply slot of the waiting thread, stale ones are dropped. The message belongs to the receiver on success. */
+static bool enqueue_local(struct itc_mailbox *to_mbox, struct itc_message *message)
+{
+	int saved_cancel_state;
+	bool result;
 
-	if(rc != NULL)
-	{
-		free(rc);
-		rc = NULL;
-	}
-	memset(&itc_inst, 0, sizeof(struct itc_instance));
+	/* System calls write() and msgsnd() below will create a cancellation point that can cause this thread get cancelled unexpectedly */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &saved_cancel_state);
 
-	my_threadlocal_mbox = NULL;
+	MUTEX_LOCK(&(to_mbox->p_rxq_info->rxq_mtx));
+	result = enqueue_locked(to_mbox, message);
+	MUTEX_UNLOCK(&(to_mbox->p_rxq_info->rxq_mtx));
+
+	pthread_setcancelstate(saved_cancel_state, NULL);
+	return result;
 }
 
-/* By any reason, a thread in a process is terminated, the thread-specific local data that is associated with a pthread destruct key
-* (key is linked to a destructor function) will call its respective destructor function */
+/* enqueue_local() with rxq_mtx of to_mbox already held */
+static bool enqueue_locked(struct itc_mailbox *to_mbox, struct itc_message *message)
+{
+	struct result_code local_rc = { .flags = ITC_OK };
+	union itc_msg *msg;
+
+	if(message->call_id & ITC_CALL_ID_REPLY)
+	{
+		if(to_mbox->wait_call_id == (message->call_id & ~ITC_CALL_ID_REPLY) && to_mbox->reply_slot == NULL)
+		{
+			to_mbox->reply_slot = message;
+			itc_rxq_wakeup(to_mbox);
+		} else
+		{
+			TPT_TRACE(TRACE_ABN, "Drop stale reply call_id = 0x%08x to mailbox 0x%08x, nobody is waiting for it!", message->call_id, to_mbox->mbox_id);
+			msg = CONVERT_TO_MSG(message);
+			itc_free(&msg);
+		}
+
+		return true;
+	}
+
+	trans_mechanisms[ITC_TRANS_LOCAL].itci_trans_send(&local_rc, message, to_mbox->mbox_id);
+	if(local_rc.flags != ITC_OK)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to send message to local mailbox 0x%08x!", to_mbox->mbox_id);
+		return false;
+	}
+
+	/* Trigger synchronization by two methods:
+	* 1. Write to an FD of receiving mailbox -> trigger epoll/poll/select
+	* 2. Release condition variable of receiving mailbox -> unblock pthread_cond_wait of receiving mailbox on itc_receive() */
+	itc_rxq_fd_notify(to_mbox->p_rxq_info);
+	to_mbox->p_rxq_info->rxq_len++;
+	itc_rxq_wakeup(to_mbox);
+
+	return true;
+}
+
+/* Wait on the rx queue condition of my mailbox with rxq_mtx held, returns as pthread_cond_(timed)wait() does. Owners of
+ITC_DIRECT_IPC_RX mailboxes wait in sysvmq instead, which receives their messages from other processes itself and is
+woken up by itc_rxq_wakeup() for everything else. ts NULL waits forever. */
+static int wait_rxq(struct itc_mailbox *mbox, const struct timespec *ts)
+{
+	struct result_code local_rc = { .flags = ITC_OK };
+	struct itc_message *message;
+	struct timespec now;
+
+	if(!(mbox->flags & ITC_DIRECT_IPC_RX))
+	{
+		return (ts == NULL) ? pthread_cond_wait(&(mbox->p_rxq_info->rxq_cond), &(mbox->p_rxq_info->rxq_mtx)) :
+				      pthread_cond_timedwait(&(mbox->p_rxq_info->rxq_cond), &(mbox->p_rxq_info->rxq_mtx), ts);
+	}
+
+	mbox->in_trans_wait = true;
+	MUTEX_UNLOCK(&(mbox->p_rxq_info->rxq_mtx));
+	message = trans_mechanisms[ITC_TRANS_SYSVMQ].itci_trans_wait(&local_rc, mbox, ts);
+	MUTEX_LOCK(&(mbox->p_rxq_info->rxq_mtx));
+	mbox->in_trans_wait = false;
+
+	if(message != NULL)
+	{
+		/* Goes wherever the rx thread would have put it, our caller then finds it there */
+		if(!(message->call_id & ITC_CALL_ID_REPLY) && mbox->into_buf != NULL && !mbox->into_done && mbox->p_rxq_info->rxq_len == 0)
+		{
+			union itc_msg *msg = CONVERT_TO_MSG(message);
+
+			copy_msg_into(message, mbox->into_buf, mbox->into_cap, mbox->into_info);
+			mbox->into_buf = NULL;
+			mbox->into_done = true;
+			itc_free(&msg);
+		} else if(!enqueue_locked(mbox, message))
+		{
+			union itc_msg *msg = CONVERT_TO_MSG(message);
+			itc_free(&msg);
+		}
+		return 0;
+	} else if(local_rc.flags != ITC_OK)
+	{
+		return EIO;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(ts != NULL && (now.tv_sec > ts->tv_sec || (now.tv_sec == ts->tv_sec && now.tv_nsec >= ts->tv_nsec)))
+	{
+		return ETIMEDOUT;
+	}
+
+	return 0; // Woken up
+}
+
+static void release_all_itc_resources()
+{
+	int ret = pthread_key_delete(itc_inst.destruct_key);
+	if(ret != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "pthread_key_delete error code = %d", ret);
+		return;
+	}
+
+	// if(itc_inst.name_space)
+	// {
+	// 	free(itc_inst.name_space);
+	// }
+
+	if(itc_inst.local_locating_nt != NULL)
+	{
+		struct result_code rc_tmp = { ITC_OK };
+		nt_exit(&rc_tmp, itc_inst.local_locating_nt);
+		itc_inst.local_locating_nt = NULL;
+	}
+
+	/* Mutexes may be held by threads that did not survive fork(), so only the memory is released */
+	for(uint32_t i = 0; i < (itc_inst.nr_mboxes >> ITC_MBOX_CHUNK_SHIFT); i++)
+	{
+		for(uint32_t j = 0; j < ITC_MBOX_CHUNK_SIZE; j++)
+		{
+			free(itc_inst.mbox_chunks[i][j].name);
+		}
+		free(itc_inst.mbox_chunks[i]);
+	}
+
+	if(rc != NULL)
+	{
+		free(rc);
+		rc = NULL;
+	}
+
+	/* The credit file belongs to the process that we were forked from */
+	release_credits(false);
+	memset(&itc_inst, 0, sizeof(struct itc_instance));
+
+	my_threadlocal_mbox = NULL;
+}
+
+/* By any reason, a thread in a process is terminated, the thread-specific local data that is associated with a pthread destruct key
+* (key is linked to a destructor function) will call its respective destructor function */
 /* This function is assigned to "itc_mailbox*" of a thread */
 /* Here "void* data" is the thread-local data */
 static void mailbox_destructor_at_thread_exit(void* data)
@@ -1455,7 +2163,7 @@ static void mailbox_destructor_at_thread_exit(void* data)
 	struct itc_mailbox* mbox = (struct itc_mailbox*)data;
 
 	TPT_TRACE(TRACE_INFO, "Thread-local mailbox destructor called by tid = %d, mbox_id = 0x%08x", mbox->tid, mbox->mbox_id);
-	if(itc_inst.mboxes != NULL && mbox->mbox_state == MBOX_INUSE)
+	if(itc_inst.nr_mboxes != 0 && mbox->mbox_state == MBOX_INUSE)
 	{
 		if(my_threadlocal_mbox == mbox)
 		{
@@ -1477,9 +2185,9 @@ static struct itc_mailbox* find_mbox(itc_mbox_id_t mbox_id)
 	if((mbox_id & itc_inst.itccoord_mask) == itc_inst.my_mbox_id_in_itccoord)
 	{
 		uint32_t mbox_index = (uint32_t)(mbox_id & itc_inst.local_mbox_mask);
-		if(mbox_index < (uint32_t)itc_inst.nr_mboxes)
+		if(mbox_index < __atomic_load_n(&itc_inst.nr_mboxes, __ATOMIC_ACQUIRE))
 		{
-			return &itc_inst.mboxes[mbox_index];
+			return mbox_at(mbox_index);
 		}
 	}
 
@@ -1487,6 +2195,132 @@ static struct itc_mailbox* find_mbox(itc_mbox_id_t mbox_id)
 	return NULL;
 }
 
+/* Caller must have checked index against nr_mboxes, chunks below it are never moved or freed until itc_exit() */
+static struct itc_mailbox* mbox_at(uint32_t index)
+{
+	return &itc_inst.mbox_chunks[index >> ITC_MBOX_CHUNK_SHIFT][index & (ITC_MBOX_CHUNK_SIZE - 1)];
+}
+
+/* Allocate and initialise one more chunk of mailboxes and put them on free_mboxes_queue. Called from itc_init() or
+* with mbox_grow_mtx held, so there is only one writer of nr_mboxes */
+static bool add_mbox_chunk(void)
+{
+	struct itc_mailbox* chunk;
+	pthread_mutexattr_t mtxattr;
+	pthread_condattr_t condattr;
+	uint32_t first = itc_inst.nr_mboxes;
+	int ret;
+
+	if(first + ITC_MBOX_CHUNK_SIZE > (ITC_MAX_MBOX_CHUNKS << ITC_MBOX_CHUNK_SHIFT))
+	{
+		TPT_TRACE(TRACE_ABN, "Already had max %u mailboxes!", first);
+		return false;
+	}
+
+	ret = posix_memalign((void**)&chunk, ITC_CACHE_LINE, ITC_MBOX_CHUNK_SIZE * sizeof(struct itc_mailbox));
+	if(ret != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to malloc mailboxes due to out of memory!");
+		return false;
+	}
+	memset(chunk, 0, ITC_MBOX_CHUNK_SIZE * sizeof(struct itc_mailbox));
+
+	ret = pthread_mutexattr_init(&mtxattr);
+	if(ret != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutexattr_init, error code = %d", ret);
+		free(chunk);
+		return false;
+	}
+
+	/* Use this type of mutex is safetest, check man7 page for details */
+	pthread_mutexattr_settype(&mtxattr, PTHREAD_MUTEX_ERRORCHECK);
+
+	ret = pthread_condattr_init(&condattr);
+	if(ret != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_condattr_init, error code = %d", ret);
+		pthread_mutexattr_destroy(&mtxattr);
+		free(chunk);
+		return false;
+	}
+
+	/* Use clock that indicates the period of time in second from when the system is booted to measure time serving for pthread_cond_timedwait */
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+
+	for(uint32_t i = 0; i < ITC_MBOX_CHUNK_SIZE; i++)
+	{
+		chunk[i].mbox_id = itc_inst.my_mbox_id_in_itccoord | (first + i);
+
+		ret = pthread_mutex_init(&(chunk[i].rxq_info.rxq_mtx), &mtxattr);
+		if(ret == 0)
+		{
+			ret = pthread_cond_init(&(chunk[i].rxq_info.rxq_cond), &condattr);
+			if(ret != 0)
+			{
+				pthread_mutex_destroy(&(chunk[i].rxq_info.rxq_mtx));
+			}
+		}
+
+		if(ret != 0)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to init mailbox mutex/cond, error code = %d", ret);
+			/* Mailboxes before this one are fully initialised */
+			for(uint32_t j = 0; j < i; j++)
+			{
+				pthread_cond_destroy(&(chunk[j].rxq_info.rxq_cond));
+				pthread_mutex_destroy(&(chunk[j].rxq_info.rxq_mtx));
+			}
+			pthread_condattr_destroy(&condattr);
+			pthread_mutexattr_destroy(&mtxattr);
+			free(chunk);
+			return false;
+		}
+	}
+
+	pthread_condattr_destroy(&condattr);
+	pthread_mutexattr_destroy(&mtxattr);
+
+	/* Publish the chunk before the count, find_mbox() checks the count first */
+	itc_inst.mbox_chunks[first >> ITC_MBOX_CHUNK_SHIFT] = chunk;
+	__atomic_store_n(&itc_inst.nr_mboxes, first + ITC_MBOX_CHUNK_SIZE, __ATOMIC_RELEASE);
+
+	rc->flags = ITC_OK;
+	for(uint32_t i = 0; i < ITC_MBOX_CHUNK_SIZE; i++)
+	{
+		if(first + i < ITC_MAX_MAILBOXES)
+		{
+			q_enqueue(rc, itc_inst.free_mboxes_queue, &chunk[i]);
+			rc->flags = ITC_OK;
+		}
+	}
+
+	TPT_TRACE(TRACE_INFO, "Added mailboxes %u - %u to free_mboxes_queue!", first, first + ITC_MBOX_CHUNK_SIZE - 1);
+	return true;
+}
+
+/* Free queue ran dry, another thread may have grown the table meanwhile so try once more before adding a chunk */
+static struct itc_mailbox* grow_mboxes(void)
+{
+	struct itc_mailbox* mbox;
+
+	MUTEX_LOCK(&mbox_grow_mtx);
+
+	rc->flags = ITC_OK;
+	mbox = q_dequeue(rc, itc_inst.free_mboxes_queue);
+	rc->flags = ITC_OK;
+	if(mbox == NULL && add_mbox_chunk())
+	{
+		rc->flags = ITC_OK;
+		mbox = q_dequeue(rc, itc_inst.free_mboxes_queue);
+	}
+	rc->flags = ITC_OK;
+
+	MUTEX_UNLOCK(&mbox_grow_mtx);
+
+	return mbox;
+}
+
 static void calc_abs_time(struct timespec* ts, unsigned long tmo)
 {
 	clock_gettime(CLOCK_MONOTONIC, ts);
@@ -1516,83 +2350,113 @@ unsigned long int calc_time_diff(struct timespec t_start, struct timespec t_end)
 	return diff; 
 }
 
-static struct itc_mailbox *locate_local_mbox(const char *name)
+void itc_rxq_fd_notify(struct mbox_rxq_info *rxq_info)
 {
-	struct itc_mailbox **iter, *mbox;
-
-	MUTEX_LOCK(&itc_inst.local_locating_mbox_mtx);
+	uint64_t one = 1;
 
-	iter = tfind(name, &itc_inst.local_locating_mbox_tree, mbox_name_cmpfunc);
-	mbox = iter ? *iter : NULL;
+	if(!rxq_info->is_fd_created)
+	{
+		return;
+	}
 
-	MUTEX_UNLOCK(&itc_inst.local_locating_mbox_mtx);
+	/* Level: readable while the rx queue is non-empty. Edge: one write() until the owner has drained the rx queue again,
+	the counter is never read back and a non-blocking write() can only fail with EAGAIN once it is about to overflow. */
+	if(rxq_info->fd_edge ? !rxq_info->fd_armed : rxq_info->rxq_len != 0)
+	{
+		return;
+	}
 
-	return mbox;
+	rxq_info->fd_armed = false;
+	if(write(rxq_info->rxq_fd, &one, 8) < 0 && errno != EAGAIN)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to write(), errno = %d!", errno);
+	}
 }
 
-static int mbox_name_cmpfunc(const void *pa, const void *pb)
+void itc_rxq_wakeup(struct itc_mailbox *mbox)
 {
-	const char *name = pa;
-	const struct itc_mailbox *mbox = pb;
+	if(mbox->in_trans_wait)
+	{
+		struct result_code local_rc = { .flags = ITC_OK };
 
-	return strcmp(name, mbox->name);
-}
+		trans_mechanisms[ITC_TRANS_SYSVMQ].itci_trans_wakeup(&local_rc, mbox);
+		return;
+	}
 
-static void do_nothing(void *a)
-{
-	(void)a;
+	pthread_cond_signal(&(mbox->p_rxq_info->rxq_cond));
 }
 
-static bool remove_mbox_from_tree(void **tree, pthread_mutex_t *tree_mtx, struct itc_mailbox *mbox)
+bool itc_deliver_local(struct itc_message *message)
 {
-	struct itc_mailbox **iter;
-	bool found = true;
-
-	MUTEX_LOCK(tree_mtx);
+	struct itc_mailbox* to_mbox;
+	uint32_t credit_src = message->credit_src;
+	bool ok = false;
 
-	iter = tfind(mbox, tree, mbox_name_cmpfunc2);
-	if(iter == NULL)
+	to_mbox = find_mbox(message->receiver);
+	if(to_mbox == NULL || to_mbox->mbox_state != MBOX_INUSE)
 	{
-		found = false;
+		TPT_TRACE(TRACE_ABN, "Receiver mailbox 0x%08x is not active, sender = 0x%08x!", message->receiver, message->sender);
 	} else
 	{
-		tdelete(mbox, tree, mbox_name_cmpfunc2);
+		ok = enqueue_local(to_mbox, message);
 	}
 
-	MUTEX_UNLOCK(tree_mtx);
-
-	return found;
+	/* Not before it is in the rx queue, what the sender sends next over another transport must not overtake it */
+	return_credit(credit_src);
+	return ok;
 }
 
-static int mbox_name_cmpfunc2(const void *pa, const void *pb)
+bool itc_start_ipc_transports(void)
 {
-	const struct itc_mailbox *mbox1 = pa;
-	const struct itc_mailbox *mbox2 = pb;
+	if(__atomic_load_n(&itc_inst.ipc_started, __ATOMIC_ACQUIRE))
+	{
+		return true;
+	}
 
-	return strcmp(mbox1->name, mbox2->name);
+	return start_ipc_transports(false);
 }
 
-static bool insert_mbox_to_tree(void **tree, pthread_mutex_t *tree_mtx, struct itc_mailbox *mbox)
+bool itc_deliver_into_waiting_mbox(struct itc_message *rxmsg)
 {
-	struct itc_mailbox **iter;
-	bool found = false;
+	struct itc_mailbox* to_mbox;
 
-	MUTEX_LOCK(tree_mtx);
+	if(rxmsg->call_id & ITC_CALL_ID_REPLY)
+	{
+		/* Replies belong to the reply slot */
+		return false;
+	}
 
-	iter = tfind(mbox, tree, mbox_name_cmpfunc2);
-	if(iter != NULL)
+	to_mbox = find_mbox(rxmsg->receiver);
+	if(to_mbox == NULL || to_mbox->mbox_state != MBOX_INUSE)
 	{
-		found = true;
-	} else
+		return false;
+	}
+
+	MUTEX_LOCK(&(to_mbox->p_rxq_info->rxq_mtx));
+	if(to_mbox->into_buf == NULL || to_mbox->into_done || to_mbox->p_rxq_info->rxq_len != 0)
 	{
-		TPT_TRACE(TRACE_INFO, "Adding mailbox \"%s\" 0x%08x into local_locating_mbox_tree!", mbox->name, mbox->mbox_id);
-		tsearch(mbox, tree, mbox_name_cmpfunc2);
+		MUTEX_UNLOCK(&(to_mbox->p_rxq_info->rxq_mtx));
+		return false;
 	}
 
-	MUTEX_UNLOCK(tree_mtx);
+	copy_msg_into(rxmsg, to_mbox->into_buf, to_mbox->into_cap, to_mbox->into_info);
+	to_mbox->into_buf = NULL;
+	to_mbox->into_done = true;
+	itc_rxq_wakeup(to_mbox);
+	MUTEX_UNLOCK(&(to_mbox->p_rxq_info->rxq_mtx));
+
+	itc_credit_return(rxmsg);
+	return true;
+}
+
+static struct itc_mailbox *locate_local_mbox(const char *name)
+{
+	itc_mbox_id_t mbox_id;
+
+	/* No lock here, concurrent create/delete mailbox only make us retry the lookup */
+	mbox_id = nt_lookup(itc_inst.local_locating_nt, name);
 
-	/* This function will fail when mbox is already exist in the tree. We expect it should not be in tree instead. */
-	return !found;
+	return (mbox_id == ITC_NO_MBOX_ID) ? NULL : find_mbox(mbox_id);
 }
 
 static bool handle_forward_itc_msg_to_itcgw(union itc_msg **msg, itc_mbox_id_t to, char *namespace)
@@ -1603,7 +2467,7 @@ static bool handle_forward_itc_msg_to_itcgw(union itc_msg **msg, itc_mbox_id_t t
 	message->sender 	= my_threadlocal_mbox->mbox_id;
 	message->receiver 	= to;
 
-	size_t payload_len = message->size + ITC_HEADER_SIZE; // No need to carry the ENDPOINT
+	size_t payload_len = itc_msg_wire_size(message) - 1; // No need to carry the ENDPOINT
 
 	/* Tech debt: add a solution into itcgws in order to truncate byte stream into chunk of 1500 bytes and send over TCP */
 	if(payload_len > ITC_GATEWAY_ETH_PACKET_SIZE)
@@ -1613,7 +2477,8 @@ static bool handle_forward_itc_msg_to_itcgw(union itc_msg **msg, itc_mbox_id_t t
 	}
 
 	union itc_msg *req;
-	req = itc_alloc(offsetof(struct itc_fwd_data_to_itcgws, payload) + payload_len, ITC_FWD_DATA_TO_ITCGWS);
+	/* One more byte since itc_msg_gather() always terminates the copy by an ENDPOINT */
+	req = itc_alloc(offsetof(struct itc_fwd_data_to_itcgws, payload) + payload_len + 1, ITC_FWD_DATA_TO_ITCGWS);
 
 	strcpy(req->itc_fwd_data_to_itcgws.to_namespace, namespace);
 	// Fix valgrind using of uninitialized bytes
@@ -1621,7 +2486,7 @@ static bool handle_forward_itc_msg_to_itcgw(union itc_msg **msg, itc_mbox_id_t t
 	memset(req->itc_fwd_data_to_itcgws.to_namespace + strlen(namespace) + 1, 0, ns_unfilled_size);
 	
 	req->itc_fwd_data_to_itcgws.payload_length = payload_len;
-	memcpy(req->itc_fwd_data_to_itcgws.payload, message, payload_len);
+	(void)itc_msg_gather(message, req->itc_fwd_data_to_itcgws.payload);
 
 	if(itc_inst.itcgw_mboxid == ITC_NO_MBOX_ID)
 	{
@@ -1677,3 +2542,1050 @@ static void change_system_rlimit(void)
 		TPT_TRACE(TRACE_INFO, "Increase system-wide resource limit successfully!");
 	}
 }
+
+static void release_sg_segments(struct itc_message *message)
+{
+	struct itc_sg_list *sgl = ITC_SG_LIST(message);
+
+	for(uint32_t i = 0; i < sgl->nr_segs; i++)
+	{
+		if(sgl->segs[i].release != NULL)
+		{
+			sgl->segs[i].release(sgl->segs[i].base);
+		}
+	}
+
+	sgl->nr_segs = 0;
+	sgl->total_len = 0;
+}
+
+static void copy_msg_into(struct itc_message *message, void *buf, size_t cap, struct itc_msg_info *info)
+{
+	size_t len;
+	char *pos = buf;
+
+	info->msgno	= message->msgno;
+	info->sender	= message->sender;
+	info->receiver	= message->receiver;
+	info->size	= itc_msg_payload_size(message);
+	info->truncated	= info->size > cap;
+
+	len = (message->size < cap) ? message->size : cap;
+	memcpy(pos, &message->msgno, len);
+	pos += len;
+	cap -= len;
+
+	if(message->flags & ITC_FLAGS_MSG_SG)
+	{
+		struct itc_sg_list *sgl = ITC_SG_LIST(message);
+
+		for(uint32_t i = 0; i < sgl->nr_segs && cap > 0; i++)
+		{
+			len = (sgl->segs[i].len < cap) ? sgl->segs[i].len : cap;
+			memcpy(pos, sgl->segs[i].base, len);
+			pos += len;
+			cap -= len;
+		}
+	}
+}
+
+static void select_ipc_transports(void)
+{
+	const char *env;
+
+	itc_inst.nr_ipc_trans = 0;
+	memset(itc_inst.peer_trans, ITC_INVALID_TRANS, sizeof(itc_inst.peer_trans));
+	memset(itc_inst.peer_busy, 0, sizeof(itc_inst.peer_busy));
+	memset(itc_inst.peer_lacks, 0, sizeof(itc_inst.peer_lacks));
+	memset(itc_inst.peer_used, 0, sizeof(itc_inst.peer_used));
+	memset(itc_inst.trans_maxsize, 0, sizeof(itc_inst.trans_maxsize));
+	memset(itc_inst.size_class_trans, ITC_INVALID_TRANS, sizeof(itc_inst.size_class_trans));
+
+	env = getenv(ITC_TRANSPORTS_ENV);
+	if(env != NULL)
+	{
+		enable_ipc_transports(env);
+	}
+
+	/* Default transports always come last, itccoord and processes without ITC_TRANSPORTS only speak those */
+	enable_ipc_transports(ITC_DEFAULT_TRANSPORTS);
+}
+
+static void enable_ipc_transports(const char *names)
+{
+	char list[128];
+	char *saveptr = NULL;
+	char *name;
+
+	snprintf(list, sizeof(list), "%s", names);
+	for(name = strtok_r(list, ", ", &saveptr); name != NULL; name = strtok_r(NULL, ", ", &saveptr))
+	{
+		uint32_t i = 0;
+		for(; i < sizeof(ipc_transports) / sizeof(ipc_transports[0]); i++)
+		{
+			if(strcmp(name, ipc_transports[i].name) == 0)
+			{
+				break;
+			}
+		}
+
+		if(i == sizeof(ipc_transports) / sizeof(ipc_transports[0]))
+		{
+			TPT_TRACE(TRACE_ABN, "Unknown transport \"%s\" in %s, ignore it!", name, ITC_TRANSPORTS_ENV);
+			continue;
+		} else if(ipc_transports[i].apis == NULL)
+		{
+			TPT_TRACE(TRACE_ABN, "Transport \"%s\" is not linked into this binary, ignore it!", name);
+			continue;
+		} else if(trans_mechanisms[ipc_transports[i].trans].itci_trans_send != NULL)
+		{
+			/* Listed twice, the first occurrence decides its preference */
+			continue;
+		}
+
+		trans_mechanisms[ipc_transports[i].trans] = *ipc_transports[i].apis;
+		itc_inst.ipc_trans[itc_inst.nr_ipc_trans++] = ipc_transports[i].trans;
+		TPT_TRACE(TRACE_INFO, "Enabled IPC transport \"%s\" with preference %u", name, itc_inst.nr_ipc_trans);
+	}
+}
+
+/* Credits are taken above the transports, so that flow control works the same whichever of them carries the message */
+static bool send_to_peer(struct itc_message *message, itc_mbox_id_t to)
+{
+	uint32_t peer = (to & itc_inst.itccoord_mask) >> ITC_COORD_SHIFT;
+
+	message->credit_src = ITC_CREDIT_SRC | my_process_index();
+	if(!take_credit(message, peer))
+	{
+		TPT_TRACE(TRACE_ABN, "No credit towards process %u for message 0x%08x!", peer, message->msgno);
+		return false;
+	}
+
+	if(!send_over_transports(message, to))
+	{
+		give_back_credit(message, peer);
+		return false;
+	}
+
+	return true;
+}
+
+/* Every message goes over the fastest transport for its size that the process has, otherwise over the most preferred of
+* ours that it has and that can carry it. Transports have their own rx threads and do not order against each other, so a
+* process is only moved on to another transport once everything sent to it so far has been delivered, see
+* switch_transport(). A transport fails with ITC_QUEUE_NULL if the process has no endpoint for it, only then the next
+* one is tried. Any other failure fails the send. */
+static bool send_over_transports(struct itc_message *message, itc_mbox_id_t to)
+{
+	struct result_code rc_tmp_stack;
+	uint32_t peer = (to & itc_inst.itccoord_mask) >> ITC_COORD_SHIFT;
+	size_t size = itc_msg_wire_size(message);
+	struct itc_credit_map* map;
+	int8_t want, trans;
+
+	if(peer >= MAX_SUPPORTED_PROCESSES)
+	{
+		TPT_TRACE(TRACE_ABN, "No such process %u for mailbox 0x%08x!", peer, to);
+		return false;
+	}
+
+	for(;;)
+	{
+		want = pick_transport(peer, size);
+		if(want == ITC_INVALID_TRANS)
+		{
+			TPT_TRACE(TRACE_ABN, "No transport could carry %zu bytes to process %u!", size, peer);
+			return false;
+		}
+
+		trans = enter_transport(peer, want, size);
+		if(trans == ITC_INVALID_TRANS)
+		{
+			return false;
+		}
+
+		rc_tmp_stack.flags = ITC_OK;
+		trans_mechanisms[trans].itci_trans_send(&rc_tmp_stack, message, to);
+		if(rc_tmp_stack.flags == ITC_OK)
+		{
+			/* Counted before we leave, a sender waiting for us to leave then waits for it to be delivered */
+			map = peer_credit_map(peer);
+			if(map != NULL)
+			{
+				__atomic_add_fetch(&map->slots[my_process_index()].queued, 1, __ATOMIC_SEQ_CST);
+			}
+
+			if(!(__atomic_load_n(&itc_inst.peer_used[peer], __ATOMIC_RELAXED) & (1 << trans)))
+			{
+				__atomic_or_fetch(&itc_inst.peer_used[peer], (uint8_t)(1 << trans), __ATOMIC_RELAXED);
+			}
+			leave_transport(peer);
+			return true;
+		}
+
+		leave_transport(peer);
+		if(!(rc_tmp_stack.flags & ITC_QUEUE_NULL))
+		{
+			TPT_TRACE(TRACE_ABN, "Transport %d towards process %u failed, rc = %u!", trans, peer, rc_tmp_stack.flags);
+			return false;
+		}
+
+		lost_transport(peer, trans);
+	}
+}
+
+static int8_t pick_transport(uint32_t peer, size_t size)
+{
+	uint8_t lacks = __atomic_load_n(&itc_inst.peer_lacks[peer], __ATOMIC_RELAXED);
+	uint32_t cls = size_class(size);
+	int8_t best = ITC_INVALID_TRANS;
+
+	if(cls < ITC_NR_SIZE_CLASSES)
+	{
+		best = itc_inst.size_class_trans[cls];
+	}
+
+	if(best != ITC_INVALID_TRANS && !(lacks & (1 << best)) && trans_fits(best, size))
+	{
+		return best;
+	}
+
+	for(uint32_t i = 0; i < itc_inst.nr_ipc_trans; i++)
+	{
+		int8_t trans = (int8_t)itc_inst.ipc_trans[i];
+		if(!(lacks & (1 << trans)) && trans_fits(trans, size))
+		{
+			return trans;
+		}
+	}
+
+	return ITC_INVALID_TRANS;
+}
+
+/* Counts us in as sending towards the process over the returned transport, which is want unless what was sent before
+* could not be delivered in time. ITC_INVALID_TRANS if the message cannot go anywhere without overtaking it. */
+static int8_t enter_transport(uint32_t peer, int8_t want, size_t size)
+{
+	int8_t cur;
+
+	for(;;)
+	{
+		if(__atomic_load_n(&itc_inst.peer_trans[peer], __ATOMIC_SEQ_CST) == want)
+		{
+			/* A sender moving the process on waits for us to leave, unless it started before we were counted */
+			__atomic_add_fetch(&itc_inst.peer_busy[peer], 1, __ATOMIC_SEQ_CST);
+			if(__atomic_load_n(&itc_inst.peer_trans[peer], __ATOMIC_SEQ_CST) == want)
+			{
+				return want;
+			}
+			leave_transport(peer);
+		}
+
+		MUTEX_LOCK(&peer_trans_mtx);
+		cur = itc_inst.peer_trans[peer];
+		if(cur == ITC_SWITCHING_TRANS)
+		{
+			pthread_cond_wait(&peer_trans_cond, &peer_trans_mtx);
+			MUTEX_UNLOCK(&peer_trans_mtx);
+			continue;
+		} else if(cur == want)
+		{
+			MUTEX_UNLOCK(&peer_trans_mtx);
+			continue;
+		} else if(cur == ITC_INVALID_TRANS)
+		{
+			/* Nothing of ours is on its way to the process */
+			__atomic_add_fetch(&itc_inst.peer_busy[peer], 1, __ATOMIC_SEQ_CST);
+			__atomic_store_n(&itc_inst.peer_trans[peer], want, __ATOMIC_SEQ_CST);
+			MUTEX_UNLOCK(&peer_trans_mtx);
+			return want;
+		}
+
+		__atomic_store_n(&itc_inst.peer_trans[peer], ITC_SWITCHING_TRANS, __ATOMIC_SEQ_CST);
+		MUTEX_UNLOCK(&peer_trans_mtx);
+		return switch_transport(peer, cur, want, size);
+	}
+}
+
+static void leave_transport(uint32_t peer)
+{
+	if(__atomic_sub_fetch(&itc_inst.peer_busy[peer], 1, __ATOMIC_SEQ_CST) == 0 &&
+	   __atomic_load_n(&itc_inst.peer_trans[peer], __ATOMIC_SEQ_CST) == ITC_SWITCHING_TRANS)
+	{
+		syscall(SYS_futex, &itc_inst.peer_busy[peer], FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+/* Called with the process ITC_SWITCHING_TRANS away from cur, which holds back new senders towards it. Nothing is sent
+* while we wait, senders of other processes are not held up. */
+static int8_t switch_transport(uint32_t peer, int8_t cur, int8_t want, size_t size)
+{
+	int8_t next = want;
+	bool drained;
+
+	drained = wait_for_delivery(peer);
+	if(!drained)
+	{
+		TPT_TRACE(TRACE_ABN, "Messages over transport %d not delivered to process %u within %d ms, stay on it!", cur, peer, ITC_TRANS_DRAIN_TMO);
+		next = trans_fits(cur, size) ? cur : ITC_INVALID_TRANS;
+	}
+
+	MUTEX_LOCK(&peer_trans_mtx);
+	if(next != ITC_INVALID_TRANS)
+	{
+		__atomic_add_fetch(&itc_inst.peer_busy[peer], 1, __ATOMIC_SEQ_CST);
+	}
+	__atomic_store_n(&itc_inst.peer_trans[peer], drained ? want : cur, __ATOMIC_SEQ_CST);
+	pthread_cond_broadcast(&peer_trans_cond);
+	MUTEX_UNLOCK(&peer_trans_mtx);
+
+	if(next == ITC_INVALID_TRANS)
+	{
+		TPT_TRACE(TRACE_ABN, "%zu bytes do not fit transport %d towards process %u!", size, cur, peer);
+	}
+
+	return next;
+}
+
+/* Whether everything sent to the process so far has been delivered. The process is ITC_SWITCHING_TRANS, so once the sends
+* in progress are done queued no longer moves. Without its credit file there is no telling. */
+static bool wait_for_delivery(uint32_t peer)
+{
+	uint64_t tmo_ns = ITC_TRANS_DRAIN_TMO * 1000000ULL;
+	struct timespec t_start, t_now, ts;
+	struct itc_credit_slot* slot;
+	struct itc_credit_map* map;
+	uint32_t busy, queued, delivered;
+	uint64_t waited = 0;
+
+	map = peer_credit_map(peer);
+	if(map == NULL)
+	{
+		return false;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	while((busy = __atomic_load_n(&itc_inst.peer_busy[peer], __ATOMIC_SEQ_CST)) != 0)
+	{
+		if(waited >= tmo_ns)
+		{
+			return false;
+		}
+
+		ts.tv_sec = (tmo_ns - waited) / 1000000000ULL;
+		ts.tv_nsec = (tmo_ns - waited) % 1000000000ULL;
+		syscall(SYS_futex, &itc_inst.peer_busy[peer], FUTEX_WAIT, busy, &ts, NULL, 0);
+
+		clock_gettime(CLOCK_MONOTONIC, &t_now);
+		waited = calc_time_diff(t_start, t_now);
+	}
+
+	slot = &map->slots[my_process_index()];
+	queued = __atomic_load_n(&slot->queued, __ATOMIC_SEQ_CST);
+	for(;;)
+	{
+		delivered = __atomic_load_n(&slot->delivered, __ATOMIC_SEQ_CST);
+		if((int32_t)(delivered - queued) >= 0)
+		{
+			return true;
+		} else if(waited >= tmo_ns)
+		{
+			return false;
+		}
+
+		/* Nobody moves delivered of a receiver that died, so wake up now and then to look for its successor */
+		uint64_t slice = MIN(ITC_CREDIT_RECHECK * 1000000ULL, tmo_ns - waited);
+		ts.tv_sec = slice / 1000000000ULL;
+		ts.tv_nsec = slice % 1000000000ULL;
+
+		/* The receiver only wakes us if it sees waiters after moving delivered */
+		__atomic_fetch_add(&slot->drain_waiters, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &slot->delivered, FUTEX_WAIT, delivered, &ts, NULL, 0);
+		__atomic_fetch_sub(&slot->drain_waiters, 1, __ATOMIC_SEQ_CST);
+
+		clock_gettime(CLOCK_MONOTONIC, &t_now);
+		waited = calc_time_diff(t_start, t_now);
+
+		if((int32_t)(__atomic_load_n(&slot->delivered, __ATOMIC_SEQ_CST) - queued) < 0 && is_stale_credit_map(peer))
+		{
+			/* Whatever was on its way went with the previous process */
+			return true;
+		}
+	}
+}
+
+/* The process has no endpoint for trans. If trans carried messages to it before, the process has restarted and nothing
+* of ours is on its way to it, so forget what we learnt about the previous one. */
+static void lost_transport(uint32_t peer, int8_t trans)
+{
+	uint8_t bit = (uint8_t)(1 << trans);
+
+	MUTEX_LOCK(&peer_trans_mtx);
+	if(itc_inst.peer_used[peer] & bit)
+	{
+		TPT_TRACE(TRACE_ABN, "Transport %d towards process %u is gone, renegotiate!", trans, peer);
+		__atomic_store_n(&itc_inst.peer_used[peer], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&itc_inst.peer_lacks[peer], bit, __ATOMIC_RELAXED);
+		if(itc_inst.peer_trans[peer] == trans)
+		{
+			__atomic_store_n(&itc_inst.peer_trans[peer], ITC_INVALID_TRANS, __ATOMIC_SEQ_CST);
+		}
+
+		if(__atomic_load_n(&itc_inst.peer_credit_maps[peer], __ATOMIC_ACQUIRE) == ITC_CREDIT_NO_MAP)
+		{
+			/* And it may have a credit file now */
+			__atomic_store_n(&itc_inst.peer_credit_maps[peer], NULL, __ATOMIC_RELEASE);
+		}
+	} else
+	{
+		__atomic_or_fetch(&itc_inst.peer_lacks[peer], bit, __ATOMIC_RELAXED);
+	}
+	MUTEX_UNLOCK(&peer_trans_mtx);
+}
+
+static uint32_t size_class(size_t size)
+{
+	if(size <= 1)
+	{
+		return 0;
+	} else if(size > (1UL << 31))
+	{
+		return ITC_NR_SIZE_CLASSES;
+	}
+
+	return 32 - CLZ((uint32_t)(size - 1));
+}
+
+static bool trans_fits(itc_transport_e trans, size_t size)
+{
+	return itc_inst.trans_maxsize[trans] <= 0 || size <= (size_t)itc_inst.trans_maxsize[trans];
+}
+
+static bool start_ipc_transports(bool calibrate)
+{
+	struct result_code rc_tmp_stack;
+
+	MUTEX_LOCK(&ipc_start_mtx);
+	if(itc_inst.ipc_started)
+	{
+		MUTEX_UNLOCK(&ipc_start_mtx);
+		return true;
+	}
+
+	rc_tmp_stack.flags = ITC_OK;
+	start_itcthreads(&rc_tmp_stack);
+	if(rc_tmp_stack.flags != ITC_OK)
+	{
+		MUTEX_UNLOCK(&ipc_start_mtx);
+		return false;
+	}
+
+	__atomic_store_n(&itc_inst.ipc_started, 1, __ATOMIC_RELEASE);
+	setup_size_classes(calibrate);
+	MUTEX_UNLOCK(&ipc_start_mtx);
+
+	TPT_TRACE(TRACE_INFO, "Started IPC transports!");
+	return true;
+}
+
+/* Whether sending this message means that we may hear back from the other process, so our rx threads have to be up.
+* Rx threads themselves announce their mailboxes to itccoord while being started, and mailbox notifications are one-way. */
+static bool needs_ipc_rx(struct itc_message *message, itc_mbox_id_t to)
+{
+	if(my_threadlocal_mbox->flags & ITC_FLAGS_MBOX_FORWARDER)
+	{
+		return false;
+	}
+
+	return !(to == itc_inst.itccoord_mbox_id && (message->msgno == ITC_NOTIFY_COORD_ADD_MBOX || message->msgno == ITC_NOTIFY_COORD_RMV_MBOX));
+}
+
+static void setup_size_classes(bool calibrate)
+{
+	const char *profile = getenv(ITC_TRANSPORT_PROFILE_ENV);
+
+	if(profile != NULL && load_transport_profile(profile))
+	{
+		return;
+	}
+
+	/* Calibration needs a mailbox of its own on this thread, so it only runs from itc_init() */
+	if(!calibrate || getenv(ITC_TRANSPORT_CALIBRATE_ENV) == NULL || itc_inst.nr_ipc_trans < 2)
+	{
+		return;
+	}
+
+	calibrate_transports();
+	if(profile != NULL)
+	{
+		save_transport_profile(profile);
+	}
+}
+
+static bool load_transport_profile(const char *path)
+{
+	int8_t classes[ITC_NR_SIZE_CLASSES];
+	unsigned long upto;
+	char line[128];
+	char name[16];
+	uint32_t next = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if(fp == NULL)
+	{
+		TPT_TRACE(TRACE_INFO, "No transport profile at %s yet", path);
+		return false;
+	}
+
+	memset(classes, ITC_INVALID_TRANS, sizeof(classes));
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		uint32_t last, i = 0;
+		int8_t trans = ITC_INVALID_TRANS;
+
+		line[strcspn(line, "\n")] = '\0';
+		if(line[0] == '#' || line[0] == '\0')
+		{
+			continue;
+		} else if(sscanf(line, "%lu %15s", &upto, name) != 2)
+		{
+			TPT_TRACE(TRACE_ERROR, "Malformed line \"%s\" in transport profile %s, ignore the profile!", line, path);
+			fclose(fp);
+			return false;
+		}
+
+		for(; i < sizeof(ipc_transports) / sizeof(ipc_transports[0]); i++)
+		{
+			if(strcmp(name, ipc_transports[i].name) == 0)
+			{
+				break;
+			}
+		}
+
+		/* Size classes of transports we have not enabled stay on the negotiated path */
+		if(i < sizeof(ipc_transports) / sizeof(ipc_transports[0]) && trans_mechanisms[ipc_transports[i].trans].itci_trans_send != NULL)
+		{
+			trans = ipc_transports[i].trans;
+		} else
+		{
+			TPT_TRACE(TRACE_ABN, "Transport \"%s\" in %s is not enabled, ignore it!", name, path);
+		}
+
+		last = size_class(upto);
+		for(; next <= last && next < ITC_NR_SIZE_CLASSES; next++)
+		{
+			classes[next] = (trans != ITC_INVALID_TRANS && trans_fits(trans, 1UL << next)) ? trans : ITC_INVALID_TRANS;
+		}
+	}
+
+	fclose(fp);
+	memcpy(itc_inst.size_class_trans, classes, sizeof(classes));
+	TPT_TRACE(TRACE_INFO, "Loaded transport profile %s", path);
+	return true;
+}
+
+static void save_transport_profile(const char *path)
+{
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if(fp == NULL)
+	{
+		TPT_TRACE(TRACE_ABN, "Failed to open %s to save transport profile, errno = %d!", path, errno);
+		return;
+	}
+
+	fprintf(fp, "# <max message bytes> <transport>\n");
+	for(uint32_t c = 0; c < ITC_NR_SIZE_CLASSES; c++)
+	{
+		int8_t trans = itc_inst.size_class_trans[c];
+		if(trans == ITC_INVALID_TRANS || (c + 1 < ITC_NR_SIZE_CLASSES && itc_inst.size_class_trans[c + 1] == trans))
+		{
+			continue;
+		}
+
+		for(uint32_t i = 0; i < sizeof(ipc_transports) / sizeof(ipc_transports[0]); i++)
+		{
+			if(ipc_transports[i].trans == trans)
+			{
+				fprintf(fp, "%lu %s\n", 1UL << c, ipc_transports[i].name);
+			}
+		}
+	}
+
+	fclose(fp);
+	TPT_TRACE(TRACE_INFO, "Saved transport profile %s", path);
+}
+
+/* Ping ourselves through every enabled IPC transport for sizes from ITC_CALIBRATE_MIN_CLASS to ITC_CALIBRATE_MAX_CLASS.
+* Each calibrated size also decides the class below it, smaller classes follow the smallest calibrated size. */
+static void calibrate_transports(void)
+{
+	char name[ITC_MAX_NAME_LENGTH];
+	itc_mbox_id_t mbox_id;
+	int8_t winner = ITC_INVALID_TRANS;
+	uint32_t next = 0;
+
+	sprintf(name, "itc_calibrate_0x%08x", itc_inst.my_mbox_id_in_itccoord);
+	mbox_id = itc_create_mailbox(name, ITC_NO_NAMESPACE);
+	if(mbox_id == ITC_NO_MBOX_ID)
+	{
+		TPT_TRACE(TRACE_ABN, "Failed to create calibration mailbox, skip calibration!");
+		return;
+	}
+
+	for(uint32_t c = ITC_CALIBRATE_MIN_CLASS; c <= ITC_CALIBRATE_MAX_CLASS; c += 2)
+	{
+		uint32_t size = (1U << c) - ITC_HEADER_SIZE - 1; // So that the message is exactly 2^c bytes on the wire
+		uint64_t best_ns = UINT64_MAX;
+
+		winner = ITC_INVALID_TRANS;
+		for(uint32_t i = 0; i < itc_inst.nr_ipc_trans; i++)
+		{
+			itc_transport_e trans = itc_inst.ipc_trans[i];
+			if(!trans_fits(trans, 1UL << c))
+			{
+				continue;
+			}
+
+			uint64_t ns = time_transport(trans, mbox_id, size);
+			TPT_TRACE(TRACE_INFO, "Calibrate transport %d, %lu bytes, median round trip %lu ns", trans, 1UL << c, ns);
+			if(ns < best_ns)
+			{
+				best_ns = ns;
+				winner = trans;
+			}
+		}
+
+		for(; next <= c; next++)
+		{
+			itc_inst.size_class_trans[next] = winner;
+		}
+	}
+
+	/* Larger messages stay with the winner of the largest calibrated size, if it can carry them */
+	for(; next < ITC_NR_SIZE_CLASSES; next++)
+	{
+		itc_inst.size_class_trans[next] = (winner != ITC_INVALID_TRANS && trans_fits(winner, 1UL << next)) ? winner : ITC_INVALID_TRANS;
+	}
+
+	itc_delete_mailbox(mbox_id);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint64_t time_transport(itc_transport_e trans, itc_mbox_id_t mbox_id, uint32_t size)
+{
+	uint64_t samples[ITC_CALIBRATE_ROUNDS];
+	struct result_code rc_tmp_stack;
+	struct timespec t0, t1;
+	union itc_msg *msg;
+
+	for(uint32_t r = 0; r < ITC_CALIBRATE_ROUNDS; r++)
+	{
+		struct itc_message *message;
+
+		msg = itc_alloc(size, ITC_CALIBRATE_TRANSPORT);
+		if(msg == NULL)
+		{
+			return UINT64_MAX;
+		}
+
+		message = CONVERT_TO_MESSAGE(msg);
+		message->sender = mbox_id;
+		message->receiver = mbox_id;
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		rc_tmp_stack.flags = ITC_OK;
+		trans_mechanisms[trans].itci_trans_send(&rc_tmp_stack, message, mbox_id);
+		if(rc_tmp_stack.flags != ITC_OK)
+		{
+			itc_free(&msg);
+			return UINT64_MAX;
+		}
+
+		msg = itc_receive(1000);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if(msg == NULL)
+		{
+			TPT_TRACE(TRACE_ABN, "Calibration message on transport %d got lost!", trans);
+			return UINT64_MAX;
+		}
+
+		itc_free(&msg);
+		samples[r] = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ULL + (uint64_t)(t1.tv_nsec - t0.tv_nsec);
+	}
+
+	qsort(samples, ITC_CALIBRATE_ROUNDS, sizeof(uint64_t), compare_u64);
+	return samples[ITC_CALIBRATE_ROUNDS / 2];
+}
+
+/* Every process drops a credit file that a previous process with its index may have left behind and creates a fresh one.
+Senders count there what they queued to us and we count what we delivered, credits are only taken with ITC_FLOW_CONTROL. */
+static bool init_credits(bool flow_control)
+{
+	const char *env;
+	char path[64];
+	int fd;
+
+	env = getenv(ITC_CREDIT_TMO_ENV);
+	itc_inst.credit_tmo = (env != NULL) ? (int32_t)strtol(env, NULL, 10) : ITC_CREDIT_DEFAULT_TMO;
+	itc_inst.credit_map = NULL;
+	memset(itc_inst.credits_taken, 0, sizeof(itc_inst.credits_taken));
+	memset(itc_inst.peer_credit_maps, 0, sizeof(itc_inst.peer_credit_maps));
+	memset(itc_inst.credit_stats, 0, sizeof(itc_inst.credit_stats));
+
+	if(pthread_mutex_init(&itc_inst.peer_credit_mtx, NULL) != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to init peer_credit_mtx!");
+		return false;
+	}
+
+	credit_filename(path, sizeof(path), my_process_index());
+	unlink(path);
+
+	/* Only flow control needs it, without it senders just never move us on to another transport. Senders of other users
+	cannot open it and send to us without flow control. */
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd < 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to create %s, errno = %d!", path, errno);
+		return !flow_control;
+	}
+
+	if(ftruncate(fd, sizeof(struct itc_credit_map)) < 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to set up %s, errno = %d!", path, errno);
+		close(fd);
+		unlink(path);
+		return !flow_control;
+	}
+
+	itc_inst.credit_map = mmap(NULL, sizeof(struct itc_credit_map), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(itc_inst.credit_map == MAP_FAILED)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to mmap %s, errno = %d!", path, errno);
+		itc_inst.credit_map = NULL;
+		unlink(path);
+		return !flow_control;
+	}
+
+	if(flow_control)
+	{
+		__atomic_store_n(&itc_inst.credit_map->flow_control, 1, __ATOMIC_RELEASE);
+		TPT_TRACE(TRACE_INFO, "Flow control on, window of %u messages per sender!", ITC_CREDIT_WINDOW);
+	}
+	return true;
+}
+
+static void release_credits(bool remove_file)
+{
+	char path[64];
+
+	for(uint32_t i = 0; i < MAX_SUPPORTED_PROCESSES; i++)
+	{
+		if(itc_inst.peer_credit_maps[i] != NULL && itc_inst.peer_credit_maps[i] != ITC_CREDIT_NO_MAP)
+		{
+			munmap(itc_inst.peer_credit_maps[i], sizeof(struct itc_credit_map));
+		}
+		itc_inst.peer_credit_maps[i] = NULL;
+	}
+
+	if(itc_inst.credit_map != NULL)
+	{
+		munmap(itc_inst.credit_map, sizeof(struct itc_credit_map));
+		itc_inst.credit_map = NULL;
+
+		if(remove_file)
+		{
+			credit_filename(path, sizeof(path), my_process_index());
+			unlink(path);
+		}
+	}
+}
+
+static uint32_t my_process_index(void)
+{
+	return (itc_inst.my_mbox_id_in_itccoord & itc_inst.itccoord_mask) >> ITC_COORD_SHIFT;
+}
+
+static void credit_filename(char *path, size_t len, uint32_t process)
+{
+	snprintf(path, len, "%s%u", ITC_CREDIT_FILENAME, process);
+}
+
+/* Credit file of a receiving process, NULL if it has none. Looked up once, until the process turns out to have restarted */
+static struct itc_credit_map* peer_credit_map(uint32_t peer)
+{
+	struct itc_credit_map* map;
+	struct stat st;
+	char path[64];
+	int fd;
+
+	if(peer >= MAX_SUPPORTED_PROCESSES)
+	{
+		return NULL;
+	}
+
+	map = __atomic_load_n(&itc_inst.peer_credit_maps[peer], __ATOMIC_ACQUIRE);
+	if(map != NULL)
+	{
+		return (map == ITC_CREDIT_NO_MAP) ? NULL : map;
+	}
+
+	MUTEX_LOCK(&itc_inst.peer_credit_mtx);
+	map = itc_inst.peer_credit_maps[peer];
+	if(map != NULL)
+	{
+		MUTEX_UNLOCK(&itc_inst.peer_credit_mtx);
+		return (map == ITC_CREDIT_NO_MAP) ? NULL : map;
+	}
+
+	map = ITC_CREDIT_NO_MAP;
+	credit_filename(path, sizeof(path), peer);
+	fd = open(path, O_RDWR);
+	if(fd >= 0)
+	{
+		if(fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(struct itc_credit_map))
+		{
+			void *addr = mmap(NULL, sizeof(struct itc_credit_map), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(addr != MAP_FAILED)
+			{
+				map = (struct itc_credit_map*)addr;
+				itc_inst.peer_credit_inos[peer] = st.st_ino;
+				adopt_credit_slot(map, peer);
+			}
+		}
+		close(fd);
+	}
+
+	if(map == ITC_CREDIT_NO_MAP && fd >= 0)
+	{
+		TPT_TRACE(TRACE_ABN, "Failed to map %s, no flow control towards process %u!", path, peer);
+	}
+
+	__atomic_store_n(&itc_inst.peer_credit_maps[peer], map, __ATOMIC_RELEASE);
+	MUTEX_UNLOCK(&itc_inst.peer_credit_mtx);
+	return (map == ITC_CREDIT_NO_MAP) ? NULL : map;
+}
+
+/* Whether the receiver went away or restarted since we mapped its credit file, so its counters are no longer looked at.
+The old mapping is left in place as other threads may still use it. */
+static bool is_stale_credit_map(uint32_t peer)
+{
+	struct stat st;
+	char path[64];
+
+	credit_filename(path, sizeof(path), peer);
+	if(stat(path, &st) == 0 && st.st_ino == itc_inst.peer_credit_inos[peer])
+	{
+		return false;
+	}
+
+	MUTEX_LOCK(&itc_inst.peer_credit_mtx);
+	__atomic_store_n(&itc_inst.peer_credit_maps[peer], NULL, __ATOMIC_RELEASE);
+	MUTEX_UNLOCK(&itc_inst.peer_credit_mtx);
+	return true;
+}
+
+/* Our slot may still hold the counts of a previous process with our index. If it died with messages on their way, it took
+credits that never come back and queued messages that are never delivered. As no two live processes have the same index,
+we start over from what the receiver has handed back and delivered so far. Whatever of the previous process still comes
+through moves returned and delivered past sent and queued, which only gives us a few spare credits. Nobody else of ours
+uses the map before it is published. */
+static void adopt_credit_slot(struct itc_credit_map *map, uint32_t peer)
+{
+	struct itc_credit_slot* slot = &map->slots[my_process_index()];
+	pid_t owner = __atomic_load_n(&slot->owner, __ATOMIC_SEQ_CST);
+	uint32_t lost;
+
+	if(owner == itc_inst.pid)
+	{
+		return;
+	}
+
+	lost = __atomic_load_n(&slot->sent, __ATOMIC_SEQ_CST) - __atomic_load_n(&slot->returned, __ATOMIC_SEQ_CST);
+	if(owner != 0 && (int32_t)lost > 0)
+	{
+		TPT_TRACE(TRACE_INFO, "Taking over %u credits towards process %u from previous sender %d", lost, peer, owner);
+	}
+
+	__atomic_store_n(&slot->sent, __atomic_load_n(&slot->returned, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+	__atomic_store_n(&slot->queued, __atomic_load_n(&slot->delivered, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+	__atomic_store_n(&slot->owner, itc_inst.pid, __ATOMIC_SEQ_CST);
+}
+
+/* Take a ticket, it is good as long as fewer than ITC_CREDIT_WINDOW earlier tickets have not been returned yet. Compared
+signed, as returned may run ahead of sent, see adopt_credit_slot(). */
+static bool take_credit(struct itc_message *message, uint32_t peer)
+{
+	struct itc_credit_slot* slot;
+	struct itc_credit_map* map;
+	uint32_t ticket;
+
+	for(;;)
+	{
+		map = peer_credit_map(peer);
+		if(map == NULL || !__atomic_load_n(&map->flow_control, __ATOMIC_ACQUIRE))
+		{
+			return true;
+		}
+
+		slot = &map->slots[my_process_index()];
+		ticket = __atomic_fetch_add(&slot->sent, 1, __ATOMIC_SEQ_CST);
+		if((int32_t)(ticket - __atomic_load_n(&slot->returned, __ATOMIC_SEQ_CST)) < ITC_CREDIT_WINDOW)
+		{
+			break;
+		}
+
+		/* Only worth a look when out of credits */
+		bool stale = is_stale_credit_map(peer);
+		if(!stale && wait_for_credit(slot, ticket, peer, &stale))
+		{
+			break;
+		}
+
+		__atomic_fetch_sub(&slot->sent, 1, __ATOMIC_SEQ_CST);
+		if(!stale)
+		{
+			return false;
+		}
+	}
+
+	message->credit_src |= ITC_CREDIT_TAG;
+	return true;
+}
+
+/* Also gives up as soon as the receiver turns out to have restarted, *stale tells the caller to take a ticket afresh */
+static bool wait_for_credit(struct itc_credit_slot *slot, uint32_t ticket, uint32_t peer, bool *stale)
+{
+	struct itc_credit_stats* cs = &itc_inst.credit_stats[peer];
+	uint64_t tmo_ns = (uint64_t)itc_inst.credit_tmo * 1000000ULL;
+	struct timespec t_start, t_now, ts;
+	uint64_t waited = 0;
+	bool ok = true;
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	for(;;)
+	{
+		uint32_t returned = __atomic_load_n(&slot->returned, __ATOMIC_SEQ_CST);
+		if((int32_t)(ticket - returned) < ITC_CREDIT_WINDOW)
+		{
+			break;
+		} else if(itc_inst.credit_tmo >= 0 && waited >= tmo_ns)
+		{
+			ok = false;
+			break;
+		}
+
+		/* Nobody moves returned of a receiver that died, so wake up now and then to look for its successor */
+		uint64_t slice = ITC_CREDIT_RECHECK * 1000000ULL;
+		if(itc_inst.credit_tmo >= 0 && tmo_ns - waited < slice)
+		{
+			slice = tmo_ns - waited;
+		}
+		ts.tv_sec = slice / 1000000000ULL;
+		ts.tv_nsec = slice % 1000000000ULL;
+
+		/* The receiver only wakes us if it sees waiters after moving returned, and the futex does not sleep once it moved */
+		__atomic_fetch_add(&slot->waiters, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &slot->returned, FUTEX_WAIT, returned, &ts, NULL, 0);
+		__atomic_fetch_sub(&slot->waiters, 1, __ATOMIC_SEQ_CST);
+
+		clock_gettime(CLOCK_MONOTONIC, &t_now);
+		waited = calc_time_diff(t_start, t_now);
+
+		if((int32_t)(ticket - __atomic_load_n(&slot->returned, __ATOMIC_SEQ_CST)) >= ITC_CREDIT_WINDOW && is_stale_credit_map(peer))
+		{
+			TPT_TRACE(TRACE_ABN, "Process %u restarted while we waited for credits, take a new ticket!", peer);
+			*stale = true;
+			ok = false;
+			break;
+		}
+	}
+
+	__atomic_fetch_add(&cs->nr_stalls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&cs->stall_ns, waited, __ATOMIC_RELAXED);
+	update_max(&cs->max_stall_ns, waited);
+	if(!ok && !*stale)
+	{
+		__atomic_fetch_add(&cs->nr_failed, 1, __ATOMIC_RELAXED);
+	}
+
+	return ok;
+}
+
+/* The message did not go out after all */
+static void give_back_credit(struct itc_message *message, uint32_t peer)
+{
+	struct itc_credit_map* map;
+
+	if(!(message->credit_src & ITC_CREDIT_TAG))
+	{
+		return;
+	}
+
+	message->credit_src &= ~ITC_CREDIT_TAG;
+	map = peer_credit_map(peer);
+	if(map != NULL)
+	{
+		__atomic_fetch_sub(&map->slots[my_process_index()].sent, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static void update_max(uint64_t *max, uint64_t val)
+{
+	uint64_t cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+	while(val > cur && !__atomic_compare_exchange_n(max, &cur, val, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+	}
+}
+
+void itc_credit_return(const struct itc_message *message)
+{
+	return_credit(message->credit_src);
+}
+
+static void return_credit(uint32_t credit_src)
+{
+	struct itc_credit_slot* slot;
+	uint32_t src = credit_src & (ITC_CREDIT_SRC - 1);
+
+	if(!(credit_src & ITC_CREDIT_SRC) || itc_inst.credit_map == NULL || src >= MAX_SUPPORTED_PROCESSES)
+	{
+		return;
+	}
+
+	/* A sender that moves us on to another transport waits for this */
+	slot = &itc_inst.credit_map->slots[src];
+	__atomic_add_fetch(&slot->delivered, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&slot->drain_waiters, __ATOMIC_SEQ_CST) != 0)
+	{
+		syscall(SYS_futex, &slot->delivered, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+
+	if(!(credit_src & ITC_CREDIT_TAG))
+	{
+		return;
+	}
+
+	/* Whoever takes the last message of a batch hands the whole batch back */
+	if(__atomic_add_fetch(&itc_inst.credits_taken[src], 1, __ATOMIC_RELAXED) % ITC_CREDIT_BATCH != 0)
+	{
+		return;
+	}
+
+	__atomic_fetch_add(&slot->returned, ITC_CREDIT_BATCH, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&slot->waiters, __ATOMIC_SEQ_CST) != 0)
+	{
+		syscall(SYS_futex, &slot->returned, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+}
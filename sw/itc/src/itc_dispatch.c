@@ -0,0 +1,293 @@
+/* msgno dispatcher on top of itc_receive(). Handler tables registered per msgno range are turned into dense jump tables,
+* so dispatching is a short scan over a few ranges plus one array lookup, no switch(msg->msgno) in every daemon. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "itc.h"
+#include "itc_impl.h"
+
+#include "itc_tpt_provider.h"
+#include "traceIf.h"
+
+/*****************************************************************************\/
+*****                           INTERNAL TYPES                             *****
+*******************************************************************************/
+union itc_msg {
+	uint32_t			msgno;
+};
+
+struct dispatch_entry {
+	itc_handler_fn			fn;
+	struct itc_handler_stats	stats;
+};
+
+/* One registered handler table, slots[msgno - base] points into entries, NULL if no handler */
+struct dispatch_range {
+	uint32_t			base;
+	uint32_t			span;
+	struct dispatch_entry**		slots;
+	struct dispatch_entry*		entries;
+	uint32_t			nr_entries;
+};
+
+struct itc_dispatcher {
+	void*				ctx;
+	itc_handler_fn			fallback;
+
+	struct dispatch_range*		ranges;
+	uint32_t			nr_ranges;
+};
+
+
+
+/*****************************************************************************\/
+*****                   INTERNAL FUNCTIONS PROTOTYPES                      *****
+*******************************************************************************/
+static struct dispatch_entry *find_entry(struct itc_dispatcher *dispatcher, uint32_t msgno);
+static void dispatch_one(struct itc_dispatcher *dispatcher, union itc_msg *msg);
+static uint64_t now_ns(void);
+
+
+
+/*****************************************************************************\/
+*****                        FUNCTION DEFINITIONS                          *****
+*******************************************************************************/
+struct itc_dispatcher *itc_dispatcher_create_zz(void *ctx, itc_handler_fn fallback)
+{
+	struct itc_dispatcher *dispatcher;
+
+	dispatcher = (struct itc_dispatcher *)malloc(sizeof(struct itc_dispatcher));
+	if(dispatcher == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to malloc dispatcher!");
+		return NULL;
+	}
+
+	dispatcher->ctx		= ctx;
+	dispatcher->fallback	= fallback;
+	dispatcher->ranges	= NULL;
+	dispatcher->nr_ranges	= 0;
+
+	return dispatcher;
+}
+
+void itc_dispatcher_delete_zz(struct itc_dispatcher **dispatcher)
+{
+	if(dispatcher == NULL || *dispatcher == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Dispatcher is NULL!");
+		return;
+	}
+
+	for(uint32_t i = 0; i < (*dispatcher)->nr_ranges; i++)
+	{
+		free((*dispatcher)->ranges[i].slots);
+		free((*dispatcher)->ranges[i].entries);
+	}
+
+	free((*dispatcher)->ranges);
+	free(*dispatcher);
+	*dispatcher = NULL;
+}
+
+bool itc_dispatcher_register_zz(struct itc_dispatcher *dispatcher, const struct itc_handler *handlers, uint32_t nr_handlers)
+{
+	struct dispatch_range *ranges;
+	struct dispatch_range range;
+	uint32_t lowest, highest;
+
+	if(dispatcher == NULL || handlers == NULL || nr_handlers == 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Invalid arguments!");
+		return false;
+	}
+
+	lowest = highest = handlers[0].msgno;
+	for(uint32_t i = 1; i < nr_handlers; i++)
+	{
+		lowest = (handlers[i].msgno < lowest) ? handlers[i].msgno : lowest;
+		highest = (handlers[i].msgno > highest) ? handlers[i].msgno : highest;
+	}
+
+	if(highest - lowest >= ITC_DISPATCH_MAX_SPAN)
+	{
+		TPT_TRACE(TRACE_ERROR, "Handler table spans 0x%08x - 0x%08x, more than %d msgnos!", lowest, highest, ITC_DISPATCH_MAX_SPAN);
+		return false;
+	}
+
+	for(uint32_t i = 0; i < dispatcher->nr_ranges; i++)
+	{
+		struct dispatch_range *r = &dispatcher->ranges[i];
+		if(lowest < r->base + r->span && r->base <= highest)
+		{
+			TPT_TRACE(TRACE_ERROR, "Handler table 0x%08x - 0x%08x overlaps an already registered one!", lowest, highest);
+			return false;
+		}
+	}
+
+	range.base		= lowest;
+	range.span		= highest - lowest + 1;
+	range.nr_entries	= nr_handlers;
+	range.slots		= (struct dispatch_entry **)calloc(range.span, sizeof(struct dispatch_entry *));
+	range.entries		= (struct dispatch_entry *)calloc(nr_handlers, sizeof(struct dispatch_entry));
+	if(range.slots == NULL || range.entries == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to malloc jump table for 0x%08x - 0x%08x!", lowest, highest);
+		free(range.slots);
+		free(range.entries);
+		return false;
+	}
+
+	for(uint32_t i = 0; i < nr_handlers; i++)
+	{
+		if(range.slots[handlers[i].msgno - lowest] != NULL)
+		{
+			TPT_TRACE(TRACE_ERROR, "Duplicated handler for msgno 0x%08x!", handlers[i].msgno);
+			free(range.slots);
+			free(range.entries);
+			return false;
+		}
+
+		range.entries[i].fn		= handlers[i].fn;
+		range.entries[i].stats.msgno	= handlers[i].msgno;
+		range.entries[i].stats.name	= handlers[i].name;
+		range.slots[handlers[i].msgno - lowest] = &range.entries[i];
+	}
+
+	ranges = (struct dispatch_range *)realloc(dispatcher->ranges, (dispatcher->nr_ranges + 1) * sizeof(struct dispatch_range));
+	if(ranges == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to realloc dispatcher ranges!");
+		free(range.slots);
+		free(range.entries);
+		return false;
+	}
+
+	ranges[dispatcher->nr_ranges] = range;
+	dispatcher->ranges = ranges;
+	dispatcher->nr_ranges++;
+
+	TPT_TRACE(TRACE_INFO, "Registered %u handlers for msgno 0x%08x - 0x%08x", nr_handlers, lowest, highest);
+	return true;
+}
+
+int itc_dispatch_zz(struct itc_dispatcher *dispatcher, int32_t tmo)
+{
+	union itc_msg *msg;
+	int count = 0;
+
+	if(dispatcher == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Dispatcher is NULL!");
+		return 0;
+	}
+
+	/* Only the first receive may block, the rest of the batch is whatever is already queued */
+	msg = itc_receive(tmo);
+	while(msg != NULL)
+	{
+		dispatch_one(dispatcher, msg);
+		if(++count == ITC_DISPATCH_BATCH)
+		{
+			break;
+		}
+
+		msg = itc_receive(ITC_NO_WAIT);
+	}
+
+	return count;
+}
+
+uint32_t itc_dispatcher_get_stats_zz(struct itc_dispatcher *dispatcher, struct itc_handler_stats *stats, uint32_t nr_stats)
+{
+	uint32_t count = 0;
+
+	if(dispatcher == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Dispatcher is NULL!");
+		return 0;
+	}
+
+	for(uint32_t i = 0; i < dispatcher->nr_ranges; i++)
+	{
+		for(uint32_t j = 0; j < dispatcher->ranges[i].nr_entries; j++)
+		{
+			if(stats != NULL)
+			{
+				if(count == nr_stats)
+				{
+					return count;
+				}
+				stats[count] = dispatcher->ranges[i].entries[j].stats;
+			}
+			count++;
+		}
+	}
+
+	return count;
+}
+
+
+
+/*****************************************************************************\/
+*****                  INTERNAL FUNCTIONS IMPLEMENTATION                   *****
+*******************************************************************************/
+static struct dispatch_entry *find_entry(struct itc_dispatcher *dispatcher, uint32_t msgno)
+{
+	for(uint32_t i = 0; i < dispatcher->nr_ranges; i++)
+	{
+		/* Unsigned wrap-around makes msgnos below base fail the check as well */
+		uint32_t idx = msgno - dispatcher->ranges[i].base;
+		if(idx < dispatcher->ranges[i].span)
+		{
+			return dispatcher->ranges[i].slots[idx];
+		}
+	}
+
+	return NULL;
+}
+
+static void dispatch_one(struct itc_dispatcher *dispatcher, union itc_msg *msg)
+{
+	struct dispatch_entry *entry;
+	uint64_t t_start, elapsed;
+
+	entry = find_entry(dispatcher, msg->msgno);
+	if(entry == NULL)
+	{
+		if(dispatcher->fallback != NULL)
+		{
+			dispatcher->fallback(&msg, dispatcher->ctx);
+		} else
+		{
+			TPT_TRACE(TRACE_ABN, "No handler for msgno 0x%08x, discard it!", msg->msgno);
+		}
+	} else
+	{
+		t_start = now_ns();
+		entry->fn(&msg, dispatcher->ctx);
+		elapsed = now_ns() - t_start;
+
+		entry->stats.count++;
+		entry->stats.total_ns += elapsed;
+		if(elapsed > entry->stats.max_ns)
+		{
+			entry->stats.max_ns = elapsed;
+		}
+	}
+
+	if(msg != NULL)
+	{
+		itc_free(&msg);
+	}
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
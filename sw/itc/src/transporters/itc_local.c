@@ -45,13 +45,14 @@ struct local_mbox_data {
         struct rxqueue        	*rxq;  // from itc_impl.h
 };
 
+/* Same chunked layout as the mailbox table in itc.c, so that a mailbox id indexes its data directly */
 struct local_instance {
         itc_mbox_id_t           my_mbox_id_in_itccoord;
         itc_mbox_id_t           itccoord_mask;
         itc_mbox_id_t           local_mbox_mask;
 
-        uint32_t                nr_localmbx_datas;
-        struct local_mbox_data  *localmbx_data;
+        uint32_t                nr_localmbx_datas; // 0 if not initialized yet
+        struct local_mbox_data  *localmbx_chunks[ITC_MAX_MBOX_CHUNKS];
 };
 
 
@@ -60,6 +61,7 @@ struct local_instance {
 *****                  INTERNAL VARIABLES IN LOCAL-ATOR                    *****
 *******************************************************************************/
 static struct local_instance local_inst; // One instance per a process, multiple threads all use this one.
+static pthread_mutex_t local_grow_mtx = PTHREAD_MUTEX_INITIALIZER; // Serialises adding chunks to local_inst
 
 
 
@@ -68,6 +70,8 @@ static struct local_instance local_inst; // One instance per a process, multiple
 *******************************************************************************/
 static struct local_mbox_data *find_localmbx_data(struct result_code* rc, itc_mbox_id_t mbox_id);
 static void release_localmbx_resources(struct result_code* rc);
+static bool grow_localmbx_data(uint32_t nr_localmb_data);
+static void free_localmbx_chunks(void);
 static struct rxqueue* init_queue(struct result_code* rc); // Used at mailbox creation to initialize rxqueue for the mailbox.
 static void enqueue_message(struct result_code* rc, struct rxqueue* q, struct itc_message* message);
 static struct itc_message* dequeue_message(struct result_code* rc, struct rxqueue *q);
@@ -110,6 +114,8 @@ struct itci_transport_apis local_trans_apis = { NULL,
                                             	local_send,
                                             	local_receive,
                                             	local_remove,
+                                            	NULL,
+                                            	NULL,
                                             	NULL };
 
 
@@ -120,11 +126,9 @@ struct itci_transport_apis local_trans_apis = { NULL,
 static void local_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itccoord, itc_mbox_id_t itccoord_mask, \
 		      int nr_mboxes, uint32_t flags)
 {
-        uint32_t mask, nr_localmb_data;
-
 	TPT_TRACE(TRACE_INFO, "ENTER local_init()!");
-        /* If localmbx_data is not NULL, that means itc_init() was already run for this process. */
-        if(local_inst.localmbx_data != NULL)
+        /* If nr_localmbx_datas is not 0, that means itc_init() was already run for this process. */
+        if(local_inst.nr_localmbx_datas != 0)
         {
                 if(flags & ITC_FLAGS_FORCE_REINIT)
                 {
@@ -142,26 +146,18 @@ static void local_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itcco
         /*      1. Store the my_mbox_id_in_itccoord and itccoord_mask */
         local_inst.my_mbox_id_in_itccoord = my_mbox_id_in_itccoord;
         local_inst.itccoord_mask = itccoord_mask;
+        local_inst.local_mbox_mask = ~itccoord_mask;
 
-        /*      2. itc_init has allocated nr_mboxes in heap memory, we will allocate respective local_mbox_datas,
-                but some more for reservation, you know, excess better than lack */
-        /*      For example: if itc_init() already allocated 13 mailboxes -> then mask = 15
-                (21->mask=31, 51->mask=63, 99->mask=127,...)
-                So, we generously allocate local_mbox_datas up to mask + 1 for later uses */
-        mask = 0xFFFFFFFF >> CLZ(nr_mboxes);
-        local_inst.local_mbox_mask = mask;
-        nr_localmb_data = mask + 1;
-
-        local_inst.localmbx_data = (struct local_mbox_data *)malloc(nr_localmb_data*sizeof(struct local_mbox_data));
-        if(local_inst.localmbx_data == NULL)
+        /*      2. Allocate local_mbox_datas for the nr_mboxes that itc_init() reserved, local_create_mbox() adds more
+                chunks later on if itc.c grows its mailbox table */
+        if(!grow_localmbx_data(nr_mboxes > 0 ? (uint32_t)nr_mboxes : 1))
         {
                 // Print a trace malloc() failed to allocate memory needed.
 		TPT_TRACE(TRACE_ERROR, "Failed to malloc local mbox data due to out of memory!");
+		free_localmbx_chunks();
 		rc->flags |= ITC_SYSCALL_ERROR;
                 return;
         }
-        memset(local_inst.localmbx_data, 0, (nr_localmb_data*sizeof(struct local_mbox_data)));
-        local_inst.nr_localmbx_datas = nr_localmb_data;
 }
 
 /* ITC infrastructure needs 2 more mailboxes for socket and sysv transports usage */
@@ -171,7 +167,7 @@ static void local_exit(struct result_code* rc)
 	struct local_mbox_data* lc_mb_data;
 	uint32_t i, running_mboxes = 0;
 
-	if(local_inst.localmbx_data == NULL)
+	if(local_inst.nr_localmbx_datas == 0)
 	{
 		// If not init yet, it's ok and just return, not a problem so not set ITC_NOT_INIT_YET here
 		TPT_TRACE(TRACE_ABN, "Not initialized yet, but it's ok to exit!");
@@ -205,9 +201,7 @@ static void local_exit(struct result_code* rc)
 		}
 	}
 
-	free(local_inst.localmbx_data);
-	local_inst.localmbx_data = NULL;
-	memset(&local_inst, 0, sizeof(struct local_instance));
+	free_localmbx_chunks();
 }
 
 static void local_create_mbox(struct result_code* rc, struct itc_mailbox *mailbox, uint32_t flags)
@@ -216,6 +210,13 @@ static void local_create_mbox(struct result_code* rc, struct itc_mailbox *mailbo
 	struct local_mbox_data* new_lc_mb_data;
 
 	new_lc_mb_data = find_localmbx_data(rc, mailbox->mbox_id);
+	if(rc->flags == ITC_OUT_OF_RANGE && grow_localmbx_data((mailbox->mbox_id & local_inst.local_mbox_mask) + 1))
+	{
+		/* itc.c has grown its mailbox table beyond what we have so far */
+		rc->flags = ITC_OK;
+		new_lc_mb_data = find_localmbx_data(rc, mailbox->mbox_id);
+	}
+
 	if(rc->flags != ITC_OK)
 	{
 		// Not init yet, or not belong to this process or mbox_id out of range
@@ -405,14 +406,56 @@ static void release_localmbx_resources(struct result_code* rc)
                 lc_mb_data->rxq = NULL;
         }
 
-        free(local_inst.localmbx_data);
-	local_inst.localmbx_data = NULL;
+	free_localmbx_chunks();
+}
+
+/* Add chunks until there is data for at least nr_localmb_data mailboxes */
+static bool grow_localmbx_data(uint32_t nr_localmb_data)
+{
+	struct local_mbox_data* chunk;
+	uint32_t nr;
+
+	MUTEX_LOCK(&local_grow_mtx);
+
+	for(nr = local_inst.nr_localmbx_datas; nr < nr_localmb_data; nr += ITC_MBOX_CHUNK_SIZE)
+	{
+		if((nr >> ITC_MBOX_CHUNK_SHIFT) >= ITC_MAX_MBOX_CHUNKS)
+		{
+			break;
+		}
+
+		chunk = (struct local_mbox_data *)calloc(ITC_MBOX_CHUNK_SIZE, sizeof(struct local_mbox_data));
+		if(chunk == NULL)
+		{
+			break;
+		}
+
+		/* Publish the chunk before the count, find_localmbx_data() checks the count first */
+		local_inst.localmbx_chunks[nr >> ITC_MBOX_CHUNK_SHIFT] = chunk;
+		__atomic_store_n(&local_inst.nr_localmbx_datas, nr + ITC_MBOX_CHUNK_SIZE, __ATOMIC_RELEASE);
+	}
+
+	MUTEX_UNLOCK(&local_grow_mtx);
+
+	return nr >= nr_localmb_data;
+}
+
+static void free_localmbx_chunks(void)
+{
+	for(uint32_t i = 0; i < (local_inst.nr_localmbx_datas >> ITC_MBOX_CHUNK_SHIFT); i++)
+	{
+		free(local_inst.localmbx_chunks[i]);
+	}
+
 	memset(&local_inst, 0, sizeof(struct local_instance));
 }
 
 static struct local_mbox_data* find_localmbx_data(struct result_code* rc, itc_mbox_id_t mbox_id)
 {
-	if(local_inst.localmbx_data == NULL)
+	uint32_t index, nr_localmb_data;
+
+	nr_localmb_data = __atomic_load_n(&local_inst.nr_localmbx_datas, __ATOMIC_ACQUIRE);
+	if(nr_localmb_data == 0)
 	{
 		TPT_TRACE(TRACE_ABN, "Not initialized yet!");
 		rc->flags |= ITC_NOT_INIT_YET;
@@ -426,21 +469,15 @@ static struct local_mbox_data* find_localmbx_data(struct result_code* rc, itc_mb
 		return NULL;
 	}
 
-	/* Verify if the mbox_id belongs to this process or not out of range
-	   AND mbox_id vs local_inst.local_mbox_mask was not working as expected
-	   We couldn't get correctly local_mb_id
-	   For example, mailbox_id = 0x0050000A with number of mailboxes was requested by local_init() is 5 mailboxes,
-	   so the local_mask is 7 -> local_inst.nr_localmbx_datas = 8
-	   But when AND 0x0050000A vs local_mask=7 -> we get local_mb_id=2 which is wrong, we expect it's 10
-	   Therefore, masking mbox_id with ITC_MAX_MAILBOXES is a good workaround but not absolutely correct */
-	if((mbox_id & ITC_MAX_MAILBOXES) >= local_inst.nr_localmbx_datas)
+	index = mbox_id & local_inst.local_mbox_mask;
+	if(index >= nr_localmb_data)
 	{
-		TPT_TRACE(TRACE_ABN, "Mailbox ID exceeded nr_mboxes, local mbox_id = 0x%08x, nr_mboxes = %u!", (mbox_id & ITC_MAX_MAILBOXES), local_inst.nr_localmbx_datas);
+		TPT_TRACE(TRACE_ABN, "Mailbox ID exceeded nr_mboxes, local mbox_id = 0x%08x, nr_mboxes = %u!", index, nr_localmb_data);
 		rc->flags |= ITC_OUT_OF_RANGE;
 		return NULL;
 	}
-	
-	return &(local_inst.localmbx_data[mbox_id & local_inst.local_mbox_mask]);
+
+	return &(local_inst.localmbx_chunks[index >> ITC_MBOX_CHUNK_SHIFT][index & (ITC_MBOX_CHUNK_SIZE - 1)]);
 }
 
 static struct rxqueue* init_queue(struct result_code* rc)
@@ -8,7 +8,6 @@
 
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <sys/stat.h>
 
 #include <pthread.h>
 #include <search.h>
@@ -30,7 +29,9 @@
 struct lsock_instance {
 	int			sd; // socket descriptor
 	bool			is_coord_running; // to see if itccoord is running, which is received in locate_cfm
-	bool			is_path_created;
+
+	bool			has_watcher; // ITC_LAZY_TRANSPORTS, watcher waits for itccoord to ask us to start transports
+	pthread_t		watcher;
 };
 
 
@@ -40,12 +41,6 @@ struct lsock_instance {
 static struct lsock_instance lsock_inst;
 
 
-/*****************************************************************************\/
-*****                   INTERNAL FUNCTIONS PROTOTYPES                      *****
-*******************************************************************************/
-static void generate_lsockpath(struct result_code* rc);
-
-
 /*****************************************************************************\/
 *****                   TRANS INTERFACE IMPLEMENTATION                     *****
 *******************************************************************************/
@@ -57,6 +52,9 @@ static void lsock_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itcco
 
 static void lsock_exit(struct result_code* rc);
 
+static void* lsock_watcher(void* data);
+static void stop_watcher(void);
+
 struct itci_transport_apis lsock_trans_apis = {	lsock_locate_coord,
 						lsock_init,
 						lsock_exit,
@@ -65,6 +63,8 @@ struct itci_transport_apis lsock_trans_apis = {	lsock_locate_coord,
 						NULL,
 						NULL,
 						NULL,
+						NULL,
+						NULL,
 						NULL };
 
 
@@ -76,9 +76,18 @@ static bool lsock_locate_coord(struct result_code* rc, itc_mbox_id_t* my_mbox_id
 {
 	int sd, res, rx_len;
 	struct sockaddr_un coord_addr;
-	struct itc_locate_coord_request* lrequest;
-	struct itc_locate_coord_reply* lreply;
-	
+	struct itc_locate_coord_request lrequest;
+	struct itc_locate_coord_reply lreply;
+
+	if(lsock_inst.is_coord_running)
+	{
+		/* Locating again after a failed itc_init(), drop the old channel so itccoord can release our previous slot */
+		TPT_TRACE(TRACE_ABN, "Already attached to itccoord, close old sd = %d!", lsock_inst.sd);
+		stop_watcher();
+		close(lsock_inst.sd);
+		memset(&lsock_inst, 0, sizeof(struct lsock_instance));
+	}
+
 	sd = socket(AF_LOCAL, SOCK_STREAM, 0);
 	if(sd < 0)
 	{
@@ -96,144 +105,116 @@ static bool lsock_locate_coord(struct result_code* rc, itc_mbox_id_t* my_mbox_id
 	{
 		TPT_TRACE(TRACE_ERROR, "Failed to connect(), errno = %d!", errno);
 		rc->flags |= ITC_SYSCALL_ERROR;
+		close(sd);
 		return false;
 	}
 
-	lrequest = (struct itc_locate_coord_request*)malloc(sizeof(struct itc_locate_coord_request));
-	if(lrequest == NULL)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to malloc locate_coord_request due to out of memory!");
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return false;
-	}
+	lrequest.msgno		= ITC_LOCATE_COORD_REQUEST;
+	lrequest.my_pid		= getpid();
 
-	lrequest->msgno		= ITC_LOCATE_COORD_REQUEST;
-	lrequest->my_pid	= getpid();
+	do
+	{
+		res = send(sd, &lrequest, sizeof(struct itc_locate_coord_request), 0);
+	} while(res < 0 && errno == EINTR);
 
-	res = send(sd, lrequest, sizeof(struct itc_locate_coord_request), 0);
-	free(lrequest);
 	if(res < 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to send locate_coord_request!");
+		TPT_TRACE(TRACE_ERROR, "Failed to send locate_coord_request, errno = %d!", errno);
 		rc->flags |= ITC_SYSCALL_ERROR;
+		close(sd);
 		return false;
 	}
 
-	lreply = (struct itc_locate_coord_reply*)malloc(RXBUF_LEN);
-	if(lreply == NULL)
+	do
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to malloc locate_coord_reply due to out of memory!");
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return false;
-	}
+		rx_len = recv(sd, &lreply, sizeof(struct itc_locate_coord_reply), MSG_WAITALL);
+	} while(rx_len < 0 && errno == EINTR);
 
-	rx_len = recv(sd, lreply, RXBUF_LEN, 0);
 	if(rx_len < (int)sizeof(struct itc_locate_coord_reply))
 	{
-		TPT_TRACE(TRACE_ABN, "Message received too small, rx_len = %u!", rx_len);
-		free(lreply);
+		/* An itccoord of another ITC_WIRE_VERSION does not know our request and just hangs up */
+		TPT_TRACE(TRACE_ABN, "Message received too small, rx_len = %d, is itccoord of itc_message header version %d?", rx_len, ITC_WIRE_VERSION);
 		rc->flags |= ITC_INVALID_MSG_SIZE;
+		close(sd);
 		return false;
 	}
-	close(sd);
 
 	/* Done communication, start analyzing the response */
-	if(lreply->msgno == ITC_LOCATE_COORD_REPLY && lreply->my_mbox_id_in_itccoord != ITC_NO_MBOX_ID)
-	{
-		if(lreply->my_mbox_id_in_itccoord != ITC_NO_MBOX_ID)
-		{
-			*my_mbox_id_in_itccoord 	= lreply->my_mbox_id_in_itccoord;
-			*itccoord_mask			= lreply->itccoord_mask;
-			*itccoord_mbox_id		= lreply->itccoord_mbox_id;
-			lsock_inst.is_coord_running	= true;
-		} else
-		{
-			/* Indicate that no more process can be added, limited number of processes 255 has been reached */
-			TPT_TRACE(TRACE_ABN, "No more process can be added by itccoord!");
-			rc->flags |= ITC_OUT_OF_RANGE;
-			free(lreply);
-			return false;
-		}
-		
-	} else
+	if(lreply.msgno != ITC_LOCATE_COORD_REPLY)
 	{
 		/* Indicate that we have received a strange message type in response */
 		TPT_TRACE(TRACE_ABN, "Unknown message received!");
 		rc->flags |= ITC_INVALID_ARGUMENTS;
-		free(lreply);
+		close(sd);
 		return false;
 	}
 
-	free(lreply);
+	if(lreply.my_mbox_id_in_itccoord == ITC_NO_MBOX_ID)
+	{
+		/* Indicate that no more process can be added, limited number of processes 255 has been reached */
+		TPT_TRACE(TRACE_ABN, "No more process can be added by itccoord!");
+		rc->flags |= ITC_OUT_OF_RANGE;
+		close(sd);
+		return false;
+	}
+
+	*my_mbox_id_in_itccoord 	= lreply.my_mbox_id_in_itccoord;
+	*itccoord_mask			= lreply.itccoord_mask;
+	*itccoord_mbox_id		= lreply.itccoord_mbox_id;
+
+	/* Keep this connection open, itccoord holds the other end as our keep-alive channel and releases
+	** everything we own as soon as it sees the socket closed, no second connect() is needed in lsock_init */
+	lsock_inst.sd			= sd;
+	lsock_inst.is_coord_running	= true;
 	return true;
 }
 
 static void lsock_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itccoord, itc_mbox_id_t itccoord_mask, \
 		      	int nr_mboxes, uint32_t flags)
 {
+	struct itc_keepalive_msg notify;
+	int res;
+
+	(void)my_mbox_id_in_itccoord;
 	(void)nr_mboxes;
-	(void)flags;
 	(void)itccoord_mask;
 
-	int sd, res, rx_len;
-	struct sockaddr_un coord_addr;
-	char* str_ack;
-
-	if(lsock_inst.is_coord_running)
+	/* Keep-alive channel was already set up by lsock_locate_coord */
+	if(!lsock_inst.is_coord_running)
 	{
-		TPT_TRACE(TRACE_INFO, "itccoord is running!");
-		if(!lsock_inst.is_path_created)
-		{
-			TPT_TRACE(TRACE_INFO, "lsockpath not created yet, create it!");
-			generate_lsockpath(rc);
-			if(rc->flags != ITC_OK)
-			{
-				TPT_TRACE(TRACE_ERROR, "Failed to generate lsockpath!");
-				return;
-			}
-		}	
-
-		sd = socket(AF_LOCAL, SOCK_STREAM, 0);
-		if(sd < 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to socket()!");
-			rc->flags |= ITC_SYSCALL_ERROR;
-			return;
-		}
+		return;
+	}
 
-		memset(&coord_addr, 0, sizeof(struct sockaddr_un));
-		coord_addr.sun_family = AF_LOCAL;
-		sprintf(coord_addr.sun_path, "%s_0x%08x", ITC_LSOCKET_FILENAME, my_mbox_id_in_itccoord);
+	TPT_TRACE(TRACE_INFO, "itccoord is running, keep-alive sd = %d!", lsock_inst.sd);
+	if(!(flags & ITC_FLAGS_LAZY_IPC) || lsock_inst.has_watcher)
+	{
+		return;
+	}
 
-		// When using connect() remember must use sizeof(coord_addr) here.
-		// If you use sizeof(struct sockaddr) instead, there will be a bug that no such file or directory even though it's existing, Idk why!!!
-		res = connect(sd, (struct sockaddr*)&coord_addr, sizeof(coord_addr));
-		if(res < 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to connect to address %s, res = %d, errno = %d!", coord_addr.sun_path, res, errno);
-			rc->flags |= ITC_SYSCALL_ERROR;
-			return;
-		}
+	/* Our IPC transports are not running yet. Tell itccoord, so it asks us to start them before it tells
+	** another process where our mailboxes are, otherwise that process could not send to us */
+	notify.msgno = ITC_LAZY_TRANSPORTS_NOTIFY;
+	do
+	{
+		res = send(lsock_inst.sd, &notify, sizeof(struct itc_keepalive_msg), MSG_NOSIGNAL);
+	} while(res < 0 && errno == EINTR);
 
-		str_ack = (char *)malloc(4); // Only enough space for 'a' 'c' 'k' '\0'
-		do
-		{
-			/* When this socket file descriptor is created, itccoord will scan it and try to connect to it, and then send back to us an string "ack" */
-			rx_len = recv(sd, str_ack, 4, 0);
-		} while (rx_len < 0 && errno == EINTR);
-		
-		if(rx_len < 0)
-		{
-			TPT_TRACE(TRACE_ABN, "ACK from itccoord not received, rx_len = %u!", rx_len);
-			rc->flags |= ITC_SYSCALL_ERROR;
-		} else if(rx_len != 4 && strcmp("ack", str_ack) != 0)
-		{
-			rc->flags |= ITC_INVALID_RESPONSE;
-		}
+	if(res < 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to send lazy_transports_notify, errno = %d!", errno);
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return;
+	}
 
-		lsock_inst.sd = sd;
-		free(str_ack);
+	res = pthread_create(&lsock_inst.watcher, NULL, lsock_watcher, NULL);
+	if(res != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_create() watcher, res = %d!", res);
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return;
 	}
+
+	lsock_inst.has_watcher = true;
 }
 
 static void lsock_exit(struct result_code* rc)
@@ -242,6 +223,7 @@ static void lsock_exit(struct result_code* rc)
 
 	if(lsock_inst.is_coord_running)
 	{
+		stop_watcher();
 		res = close(lsock_inst.sd);
 		if(res < 0)
 		{
@@ -254,33 +236,61 @@ static void lsock_exit(struct result_code* rc)
 	memset(&lsock_inst, 0, sizeof(struct lsock_instance));
 }
 
-
-
-/*****************************************************************************\/
-*****                  INTERNAL FUNCTIONS IMPLEMENTATION                   *****
-*******************************************************************************/
-static void generate_lsockpath(struct result_code* rc)
+/* Only requests from itccoord ever arrive on the keep-alive channel, and only while we are lazy. One request is
+** enough, after it our transports are running and itccoord forgets that we were lazy */
+static void* lsock_watcher(void* data)
 {
-	int res;
+	struct itc_keepalive_msg msg;
+	int rx_len, res;
 
-	res = mkdir(ITC_SOCKET_FOLDER, 0777);
+	(void)data;
+	do
+	{
+		rx_len = recv(lsock_inst.sd, &msg, sizeof(struct itc_keepalive_msg), MSG_WAITALL);
+	} while(rx_len < 0 && errno == EINTR);
 
-	if(res < 0 && errno != EEXIST)
+	if(rx_len < (int)sizeof(struct itc_keepalive_msg))
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to mkdir() %s", ITC_SOCKET_FOLDER);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	} else if(res < 0 && errno == EEXIST)
+		/* itccoord is gone or lsock_exit() shut the socket down */
+		TPT_TRACE(TRACE_INFO, "Keep-alive channel closed, rx_len = %d", rx_len);
+		return NULL;
+	}
+
+	if(msg.msgno != ITC_START_TRANSPORTS_REQUEST)
+	{
+		TPT_TRACE(TRACE_ABN, "Unknown message 0x%08x received on keep-alive channel!", msg.msgno);
+		return NULL;
+	}
+
+	if(!itc_start_ipc_transports())
 	{
-		TPT_TRACE(TRACE_INFO, "lsockpath %s already exists!", ITC_SOCKET_FOLDER);
+		TPT_TRACE(TRACE_ERROR, "Failed to start IPC transports on request from itccoord!");
 	}
 
-	res = chmod(ITC_SOCKET_FOLDER, 0777);
+	/* Reply even if starting failed, itccoord must not wait for us any longer than needed */
+	msg.msgno = ITC_START_TRANSPORTS_REPLY;
+	do
+	{
+		res = send(lsock_inst.sd, &msg, sizeof(struct itc_keepalive_msg), MSG_NOSIGNAL);
+	} while(res < 0 && errno == EINTR);
+
 	if(res < 0)
 	{
-		TPT_TRACE(TRACE_ABN, "Failed to chmod %s, errno = %d!", ITC_SOCKET_FOLDER, errno);
+		TPT_TRACE(TRACE_ERROR, "Failed to send start_transports_reply, errno = %d!", errno);
+	}
+
+	return NULL;
+}
+
+static void stop_watcher(void)
+{
+	if(!lsock_inst.has_watcher)
+	{
 		return;
 	}
 
-	lsock_inst.is_path_created = true;
-}
\ No newline at end of file
+	/* Wakes the watcher up from recv(), itccoord sees the channel closed right after anyway */
+	shutdown(lsock_inst.sd, SHUT_RDWR);
+	pthread_join(lsock_inst.watcher, NULL);
+	lsock_inst.has_watcher = false;
+}
@@ -5,12 +5,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
-#include <search.h>
 #include <limits.h>
 #include <signal.h>
 #include <pthread.h>
 #include <fcntl.h>
 #include <sys/prctl.h>
+#include <sys/epoll.h>
 
 #include <mqueue.h>
 #include <sys/types.h>
@@ -20,6 +20,7 @@
 #include "itc.h"
 #include "itc_impl.h"
 #include "itci_trans.h"
+#include "itc_threadmanager.h"
 
 #include "itc_tpt_provider.h"
 #include "traceIf.h"
@@ -27,7 +28,7 @@
 /*****************************************************************************\/
 *****                    INTERNAL TYPES IN SYSV-ATOR                       *****
 *******************************************************************************/
-#define MAX_NUM_MESSAGES_ALLOWED_IN_TREE	100
+#define POSIXMQ_RX_BATCH			32 // Max messages received per wakeup of posixmq_rx_thread
 
 struct posixmq_contactlist {
 	itc_mbox_id_t	mbox_id_in_itccoord;
@@ -40,17 +41,13 @@ struct posixmq_instance {
 
 	mqd_t				my_posix_mqd; // POSIX message queue descriptor
 	char				my_posixmq_name[64];
+	int				epoll_fd; // Watches my_posix_mqd for posixmq_rx_thread
+	pthread_mutex_t			thread_mtx;
 
 	int				is_initialized;
 	long				max_msgsize;
-	char*				rx_buffer;
-
-	pthread_mutex_t			itc_message_buffer_mtx;
-	void				*itc_message_buffer_tree;
-	unsigned int			num_messages;
-
-	void				*m_active_mbox_tree;
-	pthread_mutex_t			m_active_mbox_tree_mtx;
+	char*				rx_block;
+	char*				rx_buffer; // Placed in rx_block so that msgno of the received itc_message starts a cache line
 
 	struct posixmq_contactlist	posixmq_cl[MAX_SUPPORTED_PROCESSES];
 };
@@ -73,15 +70,8 @@ static struct posixmq_contactlist* find_cl(struct result_code* rc, itc_mbox_id_t
 static void add_posixmq_cl(struct result_code* rc, struct posixmq_contactlist* cl, itc_mbox_id_t mbox_id);
 static mqd_t get_posix_mqd(struct result_code* rc, itc_mbox_id_t mbox_id);
 // static void remove_posixmq_cl(struct result_code* rc, itc_mbox_id_t mbox_id);
-static int compare_mboxid_in_itcmessage_tree(const void *pa, const void *pb);
-static int compare_msg_in_itcmessage_tree(const void *pa, const void *pb);
-static void notify_receiver_about_msg_arrival(struct itc_mailbox* mbox);
-static int compare_mboxid_in_itcmailbox_tree(const void *pa, const void *pb);
-static int compare_mbox_in_itcmailbox_tree(const void *pa, const void *pb);
-static void do_nothing(void *tree_node_data);
-static void posix_msq_rx_thread_func(union sigval sv);
-static void register_notification(mqd_t *p_msqd);
-static void free_itc_message_in_tree(void *tree_node_data);
+static void init_posixmq_rx_thread(struct result_code* rc);
+static bool drain_posixmq(void);
 // static void print_queue();
 static void process_received_message(char *rx_buffer, ssize_t num);
 static void release_posixmq_contactlist();
@@ -97,25 +87,23 @@ static void posixmq_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itc
 
 static void posixmq_exit(struct result_code* rc);
 
-static void posixmq_create_mbox(struct result_code* rc, struct itc_mailbox *mailbox, uint32_t flags);
-
-static void posixmq_delete_mbox(struct result_code* rc, struct itc_mailbox *mailbox);
-
 static void posixmq_send(struct result_code* rc, struct itc_message *message, itc_mbox_id_t to);
 
-static struct itc_message *posixmq_receive(struct result_code* rc, struct itc_mailbox *my_mbox);
-
 static long posixmq_maxmsgsize(struct result_code* rc);
 
+static void* posixmq_rx_thread(void *data);
+
 struct itci_transport_apis posixmq_trans_apis = { NULL,
                                             	posixmq_init,
                                             	posixmq_exit,
-                                            	posixmq_create_mbox,
-                                            	posixmq_delete_mbox,
+                                            	NULL,
+                                            	NULL,
                                             	posixmq_send,
-                                            	posixmq_receive,
                                             	NULL,
-                                            	posixmq_maxmsgsize };
+                                            	NULL,
+                                            	posixmq_maxmsgsize,
+                                            	NULL,
+                                            	NULL };
 
 
 
@@ -148,7 +136,7 @@ void posixmq_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itccoord,
 		}
 	}
 
-	posixmq_inst.num_messages = 0;
+	posixmq_inst.epoll_fd = -1;
 
 	// Calculate itccoord_shift value
 	int tmp_shift, tmp_mask;
@@ -194,35 +182,28 @@ void posixmq_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itccoord,
 		return;
 	}
 
-	posixmq_inst.rx_buffer = malloc(posixmq_inst.max_msgsize);
-	if(posixmq_inst.rx_buffer == NULL)
+	/* Copying out of the rx buffer then runs in step with an ITC_MALLOC_ALIGNED destination */
+	posixmq_inst.rx_block = NULL;
+	if(posix_memalign((void **)&posixmq_inst.rx_block, ITC_MSG_ALIGN, posixmq_inst.max_msgsize + ITC_MSG_ALIGN) == 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to malloc posixmq_inst.rx_buffer!");
-		remove_posixmq();
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		posixmq_inst.rx_buffer = posixmq_inst.rx_block + ITC_MSG_ALIGN_PAD;
 	}
 
-	res = pthread_mutex_init(&posixmq_inst.itc_message_buffer_mtx, NULL);
-	if(res != 0)
+	if(posixmq_inst.rx_block == NULL)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutex_init, error code = %d", res);
+		TPT_TRACE(TRACE_ERROR, "Failed to malloc posixmq_inst.rx_buffer!");
 		remove_posixmq();
 		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
-	
-	res = pthread_mutex_init(&posixmq_inst.m_active_mbox_tree_mtx, NULL);
-	if(res != 0)
+
+	init_posixmq_rx_thread(rc);
+	if(rc->flags != ITC_OK)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutex_init, error code = %d", res);
 		remove_posixmq();
-		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
 
-	register_notification(&posixmq_inst.my_posix_mqd);
-
 	posixmq_inst.is_initialized = 1;
 }
 
@@ -238,43 +219,6 @@ static void posixmq_exit(struct result_code* rc)
 	release_posixmq_resources(rc);
 }
 
-static void posixmq_create_mbox(struct result_code* rc, struct itc_mailbox *mailbox, uint32_t flags)
-{
-	(void)rc;
-	(void)flags;
-
-	MUTEX_LOCK(&posixmq_inst.m_active_mbox_tree_mtx);
-	struct itc_mailbox **iter = NULL;
-	iter = tfind(&mailbox->mbox_id, &posixmq_inst.m_active_mbox_tree, compare_mboxid_in_itcmailbox_tree);
-	if(iter != NULL)
-	{
-		TPT_TRACE(TRACE_ABN, "Mailbox \"%s\" 0x%08x already exists in tree, something abnormal!", mailbox->name, mailbox->mbox_id);
-		return;
-	}
-
-	tsearch(mailbox, &posixmq_inst.m_active_mbox_tree, compare_mbox_in_itcmailbox_tree);
-	MUTEX_UNLOCK(&posixmq_inst.m_active_mbox_tree_mtx);
-
-	TPT_TRACE(TRACE_INFO, "Adding mailbox \"%s\" 0x%08x into posixmq_tree!", mailbox->name, mailbox->mbox_id);
-}
-
-static void posixmq_delete_mbox(struct result_code* rc, struct itc_mailbox *mailbox)
-{
-	(void)rc;
-
-	MUTEX_LOCK(&posixmq_inst.m_active_mbox_tree_mtx);
-	struct itc_mailbox **iter = NULL;
-	iter = tfind(&mailbox->mbox_id, &posixmq_inst.m_active_mbox_tree, compare_mboxid_in_itcmailbox_tree);
-	if(iter == NULL)
-	{
-		TPT_TRACE(TRACE_ABN, "Mailbox \"%s\" 0x%08x not found in tree, something abnormal!", mailbox->name, mailbox->mbox_id);
-		return;
-	}
-
-	tdelete(mailbox, &posixmq_inst.m_active_mbox_tree, compare_mbox_in_itcmailbox_tree);
-	MUTEX_UNLOCK(&posixmq_inst.m_active_mbox_tree_mtx);
-}
-
 static void posixmq_send(struct result_code* rc, struct itc_message *message, itc_mbox_id_t to)
 {
 	struct posixmq_contactlist* cl;
@@ -296,8 +240,23 @@ static void posixmq_send(struct result_code* rc, struct itc_message *message, it
 		return;
 	}
 
+	/* mq_send() needs a contiguous buffer, so only scatter-gather messages are gathered into a temporary one */
+	const char *txbuf = (const char *)message;
+	size_t txlen = itc_msg_wire_size(message);
+	if(message->flags & ITC_FLAGS_MSG_SG)
+	{
+		txbuf = malloc(txlen);
+		if(txbuf == NULL)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to malloc tx buffer for scatter-gather message!");
+			rc->flags |= ITC_SYSCALL_ERROR;
+			return;
+		}
+		(void)itc_msg_gather(message, (void *)txbuf);
+	}
+
 	int num_retries = 100;
-	while(mq_send(cl->posix_mqd, (const char *)message, message->size + ITC_HEADER_SIZE + 1, 0) == -1) // Will send ENDPOINT as well for sanity check on receiver side
+	while(mq_send(cl->posix_mqd, txbuf, txlen, 0) == -1) // Will send ENDPOINT as well for sanity check on receiver side
 	{
 		if(errno == EINTR || errno == EAGAIN || num_retries > 0)
 		{
@@ -313,6 +272,11 @@ static void posixmq_send(struct result_code* rc, struct itc_message *message, it
 		}
 	}
 
+	if(txbuf != (const char *)message)
+	{
+		free((void *)txbuf);
+	}
+
 	union itc_msg* msg;
 #ifdef UNITTEST
 	free(message);
@@ -323,28 +287,6 @@ static void posixmq_send(struct result_code* rc, struct itc_message *message, it
 #endif
 }
 
-static struct itc_message *posixmq_receive(struct result_code* rc, struct itc_mailbox *my_mbox)
-{
-	(void)rc;
-	struct itc_message* ret_message;
-	struct itc_message** iter = NULL;
-
-	MUTEX_LOCK(&posixmq_inst.itc_message_buffer_mtx);
-	iter = tfind(&(my_mbox->mbox_id), &posixmq_inst.itc_message_buffer_tree, compare_mboxid_in_itcmessage_tree);
-	if(iter != NULL)
-	{
-		ret_message = (struct itc_message*)(*iter);
-		--posixmq_inst.num_messages;
-		tdelete(&(my_mbox->mbox_id), &posixmq_inst.itc_message_buffer_tree, compare_mboxid_in_itcmessage_tree);
-		// TPT_TRACE(TRACE_INFO, "Found itc message in POSIX message queue's buffer!"); // TBD
-		MUTEX_UNLOCK(&posixmq_inst.itc_message_buffer_mtx);
-		return ret_message;
-	}
-	MUTEX_UNLOCK(&posixmq_inst.itc_message_buffer_mtx);
-
-	return NULL;
-}
-
 static long posixmq_maxmsgsize(struct result_code* rc)
 {
 	(void)rc;
@@ -392,6 +334,53 @@ static long posixmq_maxmsgsize(struct result_code* rc)
 
 
 
+static void* posixmq_rx_thread(void *data)
+{
+	(void)data;
+
+	struct epoll_event event;
+	int saved_cancel_state;
+
+	if(prctl(PR_SET_NAME, "itc_rx_posixmq", 0, 0, 0) == -1)
+	{
+		// ERROR trace is needed here
+		TPT_TRACE(TRACE_ERROR, "Failed to prctl()!");
+		return NULL;
+	}
+
+	TPT_TRACE(TRACE_INFO, "Starting posixmq_rx_thread, my_posix_mqd = %d!", posixmq_inst.my_posix_mqd);
+
+	MUTEX_UNLOCK(&posixmq_inst.thread_mtx);
+	for(;;)
+	{
+		/* epoll_wait() is where itc_exit() cancels us, never in the middle of a message */
+		int num_events = epoll_wait(posixmq_inst.epoll_fd, &event, 1, -1);
+		if(num_events < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			TPT_TRACE(TRACE_ERROR, "Failed to epoll_wait(), errno = %d", errno);
+			break;
+		}
+
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &saved_cancel_state);
+		bool ok = drain_posixmq();
+		pthread_setcancelstate(saved_cancel_state, NULL);
+		if(!ok)
+		{
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+
+
+
 /*****************************************************************************\/
 *****                  INTERNAL FUNCTIONS IMPLEMENTATION                   *****
 *******************************************************************************/
@@ -403,27 +392,27 @@ static void release_posixmq_resources(struct result_code* rc)
 		remove_posixmq();
 	}
 
-	if(posixmq_inst.rx_buffer != NULL)
+	if(posixmq_inst.rx_block != NULL)
 	{
-		free(posixmq_inst.rx_buffer);
+		free(posixmq_inst.rx_block);
+		posixmq_inst.rx_block = NULL;
+		posixmq_inst.rx_buffer = NULL;
 	}
 
-	release_posixmq_contactlist();
-
-	int ret = pthread_mutex_destroy(&posixmq_inst.itc_message_buffer_mtx);
-	if(ret != 0)
+	if(posixmq_inst.epoll_fd != -1)
 	{
-		TPT_TRACE(TRACE_ERROR, "pthread_mutex_destroy error code = %d", ret);
+		close(posixmq_inst.epoll_fd);
+		posixmq_inst.epoll_fd = -1;
 	}
-	
-	ret = pthread_mutex_destroy(&posixmq_inst.m_active_mbox_tree_mtx);
+
+	release_posixmq_contactlist();
+
+	int ret = pthread_mutex_destroy(&posixmq_inst.thread_mtx);
 	if(ret != 0)
 	{
 		TPT_TRACE(TRACE_ERROR, "pthread_mutex_destroy error code = %d", ret);
 	}
 
-	tdestroy(posixmq_inst.itc_message_buffer_tree, free_itc_message_in_tree);
-	tdestroy(posixmq_inst.m_active_mbox_tree, do_nothing);
 
 	posixmq_inst.is_initialized = -1;
 	memset(&posixmq_inst, 0, sizeof(struct posixmq_instance));
@@ -520,177 +509,75 @@ static mqd_t get_posix_mqd(struct result_code* rc, itc_mbox_id_t mbox_id)
 // 	cl->posix_mqd = 0;
 // }
 
-static void free_itc_message_in_tree(void *tree_node_data)
-{
-	struct itc_message *message = *((struct itc_message **)tree_node_data);
-
-#ifdef UNITTEST
-	free(message);
-#else
-	union itc_msg *msg = CONVERT_TO_MSG(message);
-	itc_free(&msg);
-#endif
-
-	
-}
-
-static int compare_mboxid_in_itcmessage_tree(const void *pa, const void *pb)
+static void init_posixmq_rx_thread(struct result_code* rc)
 {
-	const itc_mbox_id_t *mboxid = pa;
-	const struct itc_message *message = pb;
+	struct epoll_event event;
 
-	if(*mboxid == message->receiver)
-	{
-		return 0;
-	} else if(*mboxid > message->receiver)
-	{
-		return 1;
-	} else
-	{
-		return -1;
-	}
-}
-
-static int compare_msg_in_itcmessage_tree(const void *pa, const void *pb)
-{
-	if((unsigned long)pa == (unsigned long)pb)
-	{
-		return 0;
-	} else if((unsigned long)pa > (unsigned long)pb)
-	{
-		return 1;
-	} else
+	posixmq_inst.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(posixmq_inst.epoll_fd == -1)
 	{
-		return -1;
-	}
-}
-
-static void notify_receiver_about_msg_arrival(struct itc_mailbox* mbox)
-{
-	MUTEX_LOCK(&(mbox->rxq_info.rxq_mtx));
-	int saved_cancel_state;
-
-	/* System call write() below will create a cancellation point that can cause this thread get cancelled unexpectedly */
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &saved_cancel_state);
-
-	uint64_t one = 1;
-	if(mbox->p_rxq_info->is_fd_created && mbox->p_rxq_info->rxq_len == 0)
-	{
-		if(write(mbox->p_rxq_info->rxq_fd, &one, 8) < 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to write()!");
-		}
+		TPT_TRACE(TRACE_ERROR, "Failed to epoll_create1(), errno = %d", errno);
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return;
 	}
 
-	mbox->p_rxq_info->rxq_len++;
-	pthread_cond_signal(&(mbox->p_rxq_info->rxq_cond));
-	MUTEX_UNLOCK(&(mbox->p_rxq_info->rxq_mtx));
-
-	pthread_setcancelstate(saved_cancel_state, NULL);
-	// TPT_TRACE(TRACE_INFO, "Notify mailbox receiver 0x%08x about an incoming messages!", mbox->mbox_id); // TBD
-}
-
-static int compare_mboxid_in_itcmailbox_tree(const void *pa, const void *pb)
-{
-	const itc_mbox_id_t *mboxid = pa;
-	const struct itc_mailbox *mbox = pb;
-
-	if(*mboxid == mbox->mbox_id)
+	/* On Linux an mqd is a file descriptor that polls readable while the queue holds messages */
+	event.events = EPOLLIN;
+	event.data.fd = posixmq_inst.my_posix_mqd;
+	if(epoll_ctl(posixmq_inst.epoll_fd, EPOLL_CTL_ADD, posixmq_inst.my_posix_mqd, &event) == -1)
 	{
-		return 0;
-	} else if(*mboxid > mbox->mbox_id)
-	{
-		return 1;
-	} else
-	{
-		return -1;
+		TPT_TRACE(TRACE_ERROR, "Failed to epoll_ctl(EPOLL_CTL_ADD), errno = %d", errno);
+		close(posixmq_inst.epoll_fd);
+		posixmq_inst.epoll_fd = -1;
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return;
 	}
-}
-
-static int compare_mbox_in_itcmailbox_tree(const void *pa, const void *pb)
-{
-	const struct itc_mailbox *mbox1 = pa;
-	const struct itc_mailbox *mbox2 = pb;
 
-	if(mbox1->mbox_id == mbox2->mbox_id)
-	{
-		return 0;
-	} else if(mbox1->mbox_id > mbox2->mbox_id)
-	{
-		return 1;
-	} else
+	int res = pthread_mutex_init(&posixmq_inst.thread_mtx, NULL);
+	if(res != 0)
 	{
-		return -1;
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutex_init, error code = %d", res);
+		close(posixmq_inst.epoll_fd);
+		posixmq_inst.epoll_fd = -1;
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return;
 	}
-}
 
-static void do_nothing(void *tree_node_data)
-{
-	(void)tree_node_data;
+	add_itcthread(rc, posixmq_rx_thread, NULL, true, &posixmq_inst.thread_mtx);
 }
 
-static void posix_msq_rx_thread_func(union sigval sv)
+/* Receive up to POSIXMQ_RX_BATCH messages, fewer if the queue runs empty first. my_posix_mqd is watched level-triggered,
+* so whatever is left over just wakes posixmq_rx_thread up again, there is nothing to re-arm as with mq_notify(). */
+static bool drain_posixmq(void)
 {
-	ssize_t numRead;
-	mqd_t *mqdp = NULL;
-
-	/* Optimize send-receive latency */
-	// char tn[20];
-	// sprintf(tn, "POSIXMQ(%ld)", syscall(SYS_gettid));
-	// prctl(PR_SET_NAME, tn, 0, 0, 0);
-
-	// TPT_TRACE(TRACE_INFO, "START: New thread to receive POSIX message!"); // TBD
-
-	mqdp = sv.sival_ptr;
+	ssize_t num_read;
 	int num_retries = 100;
-	while (1)
-	{
-		// print_queue();
-		numRead = mq_receive(*mqdp, posixmq_inst.rx_buffer, posixmq_inst.max_msgsize, NULL);		
 
-		if(numRead < 0)
+	for(int i = 0; i < POSIXMQ_RX_BATCH; )
+	{
+		num_read = mq_receive(posixmq_inst.my_posix_mqd, posixmq_inst.rx_buffer, posixmq_inst.max_msgsize, NULL);
+		if(num_read >= 0)
 		{
-			if(errno == EINTR || num_retries > 0)
-			{
-				/* The call mq_receive was just interrupted
-				by an incoming signal to our process during reading received bytes, let's do some retries */
-				--num_retries;
-				continue;
-			} else if(errno == EAGAIN)
-			{
-				/* Non blocking mode, EAGAIN returned if msg queue was just empty */
-				register_notification(mqdp);
-				/* DO NOT perform any extra actions here to prevent a situation,
-				where there's probably a new message coming into the queue at this point, then it will be never processed then */
-				return;
-				// print_queue();
-				// TPT_TRACE(TRACE_ABN, "POSIX message queue has been emptied!");
-				// break;
-			} else
-			{
-				// ERROR trace is needed here
-				TPT_TRACE(TRACE_ERROR, "Failed to msgsnd(), num_retries = %d, errno = %d", num_retries, errno);
-				break;
-			}
+			process_received_message(posixmq_inst.rx_buffer, num_read);
+			i++;
+		} else if(errno == EAGAIN)
+		{
+			/* Non blocking mode, EAGAIN returned if msg queue was just empty */
+			break;
+		} else if(errno == EINTR || num_retries > 0)
+		{
+			/* The call mq_receive was just interrupted by an incoming signal to our process during reading received bytes,
+			let's do some retries */
+			--num_retries;
 		} else
 		{
-			process_received_message(posixmq_inst.rx_buffer, numRead);
+			// ERROR trace is needed here
+			TPT_TRACE(TRACE_ERROR, "Failed to mq_receive(), num_retries = %d, errno = %d", num_retries, errno);
+			return false;
 		}
 	}
-}
 
-static void register_notification(mqd_t *p_msqd)
-{
-	struct sigevent sev;
-	sev.sigev_value.sival_ptr = p_msqd;
-	sev.sigev_notify = SIGEV_THREAD;
-	sev.sigev_notify_function = posix_msq_rx_thread_func;
-	sev.sigev_notify_attributes = NULL;
-
-	if(mq_notify(*p_msqd, &sev) == -1)
- 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to mq_notify(), errno = %d", errno);
-	}
+	return true;
 }
 
 
@@ -753,6 +640,12 @@ static void process_received_message(char *rx_buffer, ssize_t num)
 	tmp_message->flags = 0;
 	msg = CONVERT_TO_MSG(tmp_message);
 #else
+	/* Receiver is blocked in itc_receive_into(), copy straight from our rx buffer and skip itc_alloc() */
+	if(itc_deliver_into_waiting_mbox(rxmsg))
+	{
+		return;
+	}
+
 	msg = itc_alloc(rxmsg->size, 0);
 #endif
 	
@@ -762,43 +655,16 @@ static void process_received_message(char *rx_buffer, ssize_t num)
 	memcpy(message, rxmsg, (rxmsg->size + ITC_HEADER_SIZE + 1));
 	message->flags = flags; // Retored flags
 
-	if(posixmq_inst.num_messages > MAX_NUM_MESSAGES_ALLOWED_IN_TREE)
-	{
-		TPT_TRACE(TRACE_ERROR, "POSIX MQ message tree-buffer overflow with %u un-handled itc messages!", posixmq_inst.num_messages);
 #ifdef UNITTEST
-		free(message);
-		message = NULL;
+	free(message);
+	(void)msg;
 #else
+	/* Straight onto the FIFO rx queue of the receiver, as messages arrive, like for a local itc_send() */
+	if(!itc_deliver_local(message))
+	{
 		itc_free(&msg);
-#endif
-		return;
 	}
-
-	/* First save the incoming message into our tree buffer */
-	MUTEX_LOCK(&posixmq_inst.itc_message_buffer_mtx);
-	// TPT_TRACE(TRACE_INFO, "Inserting this itc message into tree-buffer, msgno = 0x%08x, receiver = 0x%08x", message->msgno, message->receiver); // TBD
-	tsearch(message, &posixmq_inst.itc_message_buffer_tree, compare_msg_in_itcmessage_tree);
-	++posixmq_inst.num_messages;
-	MUTEX_UNLOCK(&posixmq_inst.itc_message_buffer_mtx);
-
-	/* Try to find if any active mbox in this process matches receiver field of the incoming message 
-	If yes, notify them to pick up the message
-	If they are active but did not pick up the message, so highly possible that receiver not waiting on either
-	itc_receive() or monitor on mbox_fd using epoll/poll/select */
-	MUTEX_LOCK(&posixmq_inst.m_active_mbox_tree_mtx);
-	struct itc_mailbox **mbox_iter = NULL;
-	mbox_iter = tfind(&message->receiver, &posixmq_inst.m_active_mbox_tree, compare_mboxid_in_itcmailbox_tree);
-	if(mbox_iter == NULL)
-	{
-		/* But still store the message in the msg buffer tree if some one want to pick up it later.
-		If still no one does, drop it when newer coming message with same receiver field */
-		TPT_TRACE(TRACE_ABN, "No active mailbox matched incoming message's receiver = 0x%08x", message->receiver);
-		MUTEX_UNLOCK(&posixmq_inst.m_active_mbox_tree_mtx);
-		return;
-	}
-
-	notify_receiver_about_msg_arrival(*mbox_iter);
-	MUTEX_UNLOCK(&posixmq_inst.m_active_mbox_tree_mtx);
+#endif
 }
 
 static void release_posixmq_contactlist()
@@ -11,9 +11,11 @@
 #include <signal.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <time.h>
 
-#include <semaphore.h>
+#include <linux/futex.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/prctl.h>
@@ -30,15 +32,21 @@
 *****                    INTERNAL TYPES IN POSIXSHM-ATOR                   *****
 *******************************************************************************/
 #define POSIXSHM_PAGE_SIZE		4096
-#define POSIXSHM_SLOT_HEADER_SIZE	32
-#define MAX_POSIXSHM_SLOTS		70
+#define POSIXSHM_SLOT_HEADER_SIZE	ITC_MSG_ALIGN_PAD // Slots are 64-byte aligned, so msgno of the message in it starts a cache line
+#define POSIXSHM_RING_SIZE		128 // Power of 2 above the number of slots of all pools, so a sender holding a slot always finds room in the ring
+#define POSIXSHM_SLOT_WAIT_MS		1000 // How long a sender waits for a slot of a full pool to be given back
+#define POSIXSHM_RING_WAIT_MS		1000 // How long a sender sleeps on its ring cell before it checks that the receiver is alive
+#define POSIXSHM_HELD_UP_MS		100 // How long the ring head may be taken but empty before the rx thread checks that its sender is alive
 #define POSIXSHM_STATIC_ALLOC_PAGES	25
 #define NUM_SLOTS_POOL_480		16
 #define NUM_SLOTS_POOL_992		8
 #define NUM_SLOTS_POOL_2016		8
 #define NUM_SLOTS_POOL_4064		4
 #define NUM_SLOTS_POOL_16352		3
-#define NUM_SLOTS_POOL_UNLIMIT		1
+#define NUM_SLOTS_POOL_UNLIMIT		4
+#define POSIXSHM_LARGE_TRIM_PAGES	256 // High-water mark, a region grown beyond it is dropped once it is mostly unused, see trim_large_posixshm()
+#define POSIXSHM_LARGE_MIN_PAGES	16 // First region of a large slot, doubled whenever a larger message comes
+#define POSIXSHM_LARGE_MAX_PAGES	65536 // Regions of large slots are this far apart in the file, 256MB per message at most
 
 enum posixshm_pool_type_e {
 	POOL_96 = 0, // 1 page (same page as metadata) - ((POSIXSHM_PAGE_SIZE - (sizeof(posixshm_metadata_t)/128 + 1)*128) / 128) slots (< 32 slots)
@@ -47,7 +55,7 @@ enum posixshm_pool_type_e {
 	POOL_2016, // 4 pages, 8 slots
 	POOL_4064, // 4 pages, 4 slots
 	POOL_16352, // 12 pages, 3 slots -> statically allocated pages in total = 25 pages ~ 100KB
-	POOL_UNLIMIT, // n pages (size > 16352 bytes), only 1 slot at a time -> dynamically allocated pages
+	POOL_UNLIMIT, // n pages (size > 16352 bytes) behind the static ones, 4 slots, each with its own region that grows and is kept -> dynamically allocated pages
 	NUM_POOLS
 };
 
@@ -57,29 +65,54 @@ struct posixshm_pool_slot {
 };
 
 struct posixshm_slot_info_t {
-	struct posixshm_pool_slot		next_slot;
 	unsigned char				pool_type;
-	bool					is_in_use;
+	pid_t					owner; // Process of the sender holding the slot, 0 while it is free
+};
+
+/* A large message goes into the region of its slot, at file offset POSIXSHM_LARGE_OFFSET(whichslot). The sender holding the
+slot doubles the region if the message does not fit, otherwise it is reused, so senders and receiver keep it mapped */
+struct posixshm_large_slot {
+	struct posixshm_slot_info_t		header;
+	uint32_t				used_pages; // by the message in the slot, set by its sender
+	uint32_t				num_pages; // of the region, 0 until the first large message
+};
+
+#define POSIXSHM_LARGE_OFFSET(whichslot)	(((off_t)POSIXSHM_STATIC_ALLOC_PAGES + (off_t)(whichslot) * POSIXSHM_LARGE_MAX_PAGES) * POSIXSHM_PAGE_SIZE)
+
+/* Bounded multi-producer ring (D. Vyukov), the rx thread is the only consumer. A cell is free for the sender that got
+ring position pos from ring_tail when seq == pos, and holds a message for the receiver when seq == pos + 1 */
+struct posixshm_ring_cell {
+	uint32_t				seq;
+	struct posixshm_pool_slot		slot;
+	pid_t					owner; // Process of the sender that got the cell, 0 until it has got it
 };
 
 struct posixshm_metadata_t {
 	uint16_t				num_pages;
-	uint16_t				num_unlimit_pages;
-	struct posixshm_pool_slot		head; // to let receiver dequeue messages
-	struct posixshm_pool_slot		tail; // to let sender enqueue messages
+	uint32_t				rx_sleeping; // Futex word, 1 while the rx thread waits for the ring to be filled
+	uint32_t				closed; // Set by the owner at exit, attached senders then reconnect to a new segment
+	pid_t					pid; // of the owner, checked by senders whose ring cell is not given back
+
+	uint64_t				free_slots[NUM_POOLS] __attribute__((aligned(ITC_CACHE_LINE))); // Bit n is set while slot n of the pool is free, so at most 64 slots per pool
+
+	uint32_t				slots_freed __attribute__((aligned(ITC_CACHE_LINE))); // Futex word, moved when a slot is given back while slot_waiters != 0
+	uint32_t				slot_waiters; // Senders sleeping on slots_freed for a full pool
+	uint32_t				ring_waiters; // Senders sleeping on the seq of a ring cell that the rx thread has not given back yet
+
+	uint32_t				ring_tail __attribute__((aligned(ITC_CACHE_LINE))); // to let senders enqueue messages
+	uint32_t				ring_head __attribute__((aligned(ITC_CACHE_LINE))); // to let receiver dequeue messages
+	struct posixshm_ring_cell		ring[POSIXSHM_RING_SIZE];
+
+	struct posixshm_large_slot		large_slots[NUM_SLOTS_POOL_UNLIMIT];
 };
 
 struct posixshm_contactlist {
 	itc_mbox_id_t				mbox_id_in_itccoord;
 	int					posixshm_id;
 	struct posixshm_metadata_t		*metadata;
-	// Binary semaphore indicating that only one process can access shared memory at a time
-	sem_t					*m_sem_mutex;
-	// Binary semaphore used by sender to trigger a notification towards receiver telling them that a new message has been enqueued
-	// So receiver will block on sem_wait(m_sem_notify) while sender will call sem_post(m_sem_notify)
-	sem_t					*m_sem_notify;
-	// Counting semaphore used by receiver to indicate that a message has been dequeued and queue buffer has new slot for another message
-	sem_t					*m_sem_slot;
+
+	uint32_t				large_num_pages[NUM_SLOTS_POOL_UNLIMIT]; // Regions of the large slots we have mapped
+	void					*large_shm_ptr[NUM_SLOTS_POOL_UNLIMIT];
 };
 
 struct posixshm_instance {
@@ -91,15 +124,18 @@ struct posixshm_instance {
 	char				my_posixshm_name[64];
 	struct posixshm_metadata_t	*my_shm_ptr;
 
-	sem_t				*my_sem_mutex;
-	char				my_sem_mutex_name[64];
-	sem_t				*my_sem_notify;
-	char				my_sem_notify_name[64];
-	sem_t				*my_sem_slot;
-	char				my_sem_slot_name[64];
+	uint32_t			my_large_num_pages[NUM_SLOTS_POOL_UNLIMIT];
+	void				*my_large_shm_ptr[NUM_SLOTS_POOL_UNLIMIT];
 
 	int				is_initialized;
 	int				is_terminated;
+	bool				prefault; // itc_init() with ITC_PREFAULT_SHM, see map_posixshm()
+	bool				mlock_failed;
+	pid_t				my_pid; // Written into the slots and ring cells we take, see skip_dead_posixshm_sender()
+
+	bool				is_held_up; // The ring head was taken by a sender but not filled when we last looked
+	uint32_t			held_up_pos;
+	struct timespec			held_up_since;
 
 	itc_mbox_id_t			my_mbox_id;
 	pthread_mutex_t			thread_mtx;
@@ -124,21 +160,35 @@ static struct posixshm_instance posixshm_inst; // One instance per a process, mu
 *****                   INTERNAL FUNCTIONS PROTOTYPES                      *****
 *******************************************************************************/
 static void init_posixshm(struct result_code* rc);
-static void init_posixshm_semaphores(struct result_code* rc);
 static void remove_posixshm();
-static void remove_posixshm_semaphores();
 static void init_posixshm_rx_thread(struct result_code* rc);
 static void init_posixshm_mempool(struct posixshm_metadata_t *shm_ptr);
+static struct posixshm_slot_info_t* get_posixshm_slot(struct posixshm_metadata_t *shm_ptr, int whichpool, int whichslot);
+static int take_posixshm_slot(struct posixshm_metadata_t *shm_ptr, int *whichpool);
+static void release_posixshm_slot(struct posixshm_metadata_t *shm_ptr, int whichpool, int whichslot);
+static bool enqueue_posixshm_ring(struct posixshm_metadata_t *shm_ptr, int whichpool, int whichslot);
+static void give_back_posixshm_cell(struct posixshm_metadata_t *shm_ptr, struct posixshm_ring_cell *cell, uint32_t pos);
+static bool dequeue_posixshm_ring(struct posixshm_metadata_t *shm_ptr, struct posixshm_pool_slot *pool_slot);
+static void wait_for_posixshm_ring(struct posixshm_metadata_t *shm_ptr);
+static bool skip_dead_posixshm_sender(struct posixshm_metadata_t *shm_ptr);
+static void reclaim_dead_posixshm_slots(struct posixshm_metadata_t *shm_ptr, pid_t owner);
+static bool is_dead(pid_t pid);
 static void release_posixshm_resources(struct result_code* rc);
 static struct posixshm_contactlist* get_posixshm_cl(struct result_code* rc, itc_mbox_id_t mbox_id);
 static struct posixshm_contactlist* find_cl(struct result_code* rc, itc_mbox_id_t mbox_id);
 static void add_posixshm_cl(struct result_code* rc, struct posixshm_contactlist* cl, itc_mbox_id_t mbox_id);
-// static void remove_posixshm_cl(struct result_code* rc, itc_mbox_id_t mbox_id);
+static void remove_posixshm_cl(struct result_code* rc, itc_mbox_id_t mbox_id);
 
-static void handle_received_message(struct posixshm_slot_info_t *slot);
+static void handle_received_message(struct itc_message *rxmsg, const struct posixshm_pool_slot *head);
+static void release_received_slot(const struct posixshm_pool_slot *head);
 static void rxthread_destructor(void* data);
 
+static void grow_large_posixshm(struct result_code* rc, int shmid, struct posixshm_large_slot *large_slot, int whichslot, uint32_t num_pages);
+static void *map_large_posixshm(int shmid, uint32_t *mapped_num_pages, void **mapped_ptr, struct posixshm_large_slot *large_slot, int whichslot);
+static void unmap_large_posixshm(uint32_t *mapped_num_pages, void **mapped_ptr);
+static void trim_large_posixshm(int whichslot);
 static void release_posixshm_contactlist();
+static void *map_posixshm(int shmid, size_t size, off_t offset);
 
 
 
@@ -163,6 +213,8 @@ struct itci_transport_apis posixshm_trans_apis = { NULL,
                                             	posixshm_send,
                                             	NULL,
                                             	NULL,
+                                            	NULL,
+                                            	NULL,
                                             	NULL };
 
 
@@ -206,6 +258,9 @@ void posixshm_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itccoord,
 		tmp_shift++; // Should be 20 for current design
 	}
 
+	posixshm_inst.prefault			= (flags & ITC_FLAGS_SHM_PREFAULT) != 0;
+	posixshm_inst.my_pid			= getpid();
+	posixshm_inst.is_held_up		= false;
 	posixshm_inst.itccoord_mask 		= itccoord_mask;
 	posixshm_inst.itccoord_shift		= tmp_shift;
 	posixshm_inst.my_mbox_id_in_itccoord 	= my_mbox_id_in_itccoord;
@@ -232,9 +287,7 @@ void posixshm_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itccoord,
 	posixshm_inst.pool_offset[POOL_2016]		= 5 * POSIXSHM_PAGE_SIZE;
 	posixshm_inst.pool_offset[POOL_4064]		= 9 * POSIXSHM_PAGE_SIZE;
 	posixshm_inst.pool_offset[POOL_16352]		= 13 * POSIXSHM_PAGE_SIZE;
-	posixshm_inst.pool_offset[POOL_UNLIMIT]		= 25 * POSIXSHM_PAGE_SIZE;
-
-	init_posixshm_semaphores(rc);
+	posixshm_inst.pool_offset[POOL_UNLIMIT]		= offsetof(struct posixshm_metadata_t, large_slots);
 
 	init_posixshm(rc);
 	
@@ -258,7 +311,6 @@ static void posixshm_exit(struct result_code* rc)
 static void posixshm_send(struct result_code* rc, struct itc_message *message, itc_mbox_id_t to)
 {
 	struct posixshm_contactlist* cl;
-	int res = -1;
 
 	if(!posixshm_inst.is_initialized)
 	{
@@ -268,12 +320,12 @@ static void posixshm_send(struct result_code* rc, struct itc_message *message, i
 	}
 
 	// Choose which POOL should be used
-	uint16_t num_unlimit_pages = 0;
-	int16_t whichpool = 0;
+	uint32_t num_unlimit_pages = 0;
+	int whichpool = 0;
 	for(; whichpool < NUM_POOLS; ++whichpool)
 	{
-		// 1 byte for ENDPOINT and 32 bytes for slot's header
-		if(posixshm_inst.slot_sizes[whichpool] > 0 && (message->size + ITC_HEADER_SIZE + 1 + 32) <= (uint32_t)posixshm_inst.slot_sizes[whichpool])
+		// 1 byte for ENDPOINT and POSIXSHM_SLOT_HEADER_SIZE bytes for slot's header
+		if(posixshm_inst.slot_sizes[whichpool] > 0 && (itc_msg_wire_size(message) + POSIXSHM_SLOT_HEADER_SIZE) <= (uint32_t)posixshm_inst.slot_sizes[whichpool])
 		{
 			break;
 		}
@@ -282,7 +334,13 @@ static void posixshm_send(struct result_code* rc, struct itc_message *message, i
 	if(whichpool == NUM_POOLS)
 	{
 		whichpool = POOL_UNLIMIT;
-		num_unlimit_pages = (message->size + ITC_HEADER_SIZE + 1 + 32) / POSIXSHM_PAGE_SIZE + 1;
+		num_unlimit_pages = (itc_msg_wire_size(message) + POSIXSHM_SLOT_HEADER_SIZE) / POSIXSHM_PAGE_SIZE + 1;
+		if(num_unlimit_pages > POSIXSHM_LARGE_MAX_PAGES)
+		{
+			TPT_TRACE(TRACE_ERROR, "Message too large for posixshm, %u pages, limit at %u pages!", num_unlimit_pages, POSIXSHM_LARGE_MAX_PAGES);
+			rc->flags |= ITC_OUT_OF_RANGE;
+			return;
+		}
 	}
 
 	cl = get_posixshm_cl(rc, to);
@@ -295,122 +353,69 @@ static void posixshm_send(struct result_code* rc, struct itc_message *message, i
 		return;
 	}
 
-	// Get into a line before allowed inserting an itc message into receiver shared memory's queue
-	// Have to wait if receiver queue has been fulled with MAX_POSIXSHM_SLOTS messages
-	if(sem_wait(cl->m_sem_slot) == -1)
+	if(__atomic_load_n(&cl->metadata->closed, __ATOMIC_ACQUIRE))
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_wait(cl->m_sem_slot), mbox_id_in_itccoord = 0x%08x, errno = %d!", cl->mbox_id_in_itccoord, errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		TPT_TRACE(TRACE_ERROR, "Receiver posixshm has been disconnected, reconnecting to them!");
+		remove_posixshm_cl(rc, to);
+		add_posixshm_cl(rc, cl, to);
+		if(cl->mbox_id_in_itccoord == 0)
+		{
+			TPT_TRACE(TRACE_ERROR, "Add contact list again failed, receiver process not online!");
+			rc->flags &= ~ITC_SYSCALL_ERROR;
+			rc->flags |= ITC_QUEUE_NULL; // Same as above, the receiver has no endpoint for us
+			return;
+		}
 	}
 
-	// Accquire mutex lock to access receiver's shared memory resources
-	if(sem_wait(cl->m_sem_mutex) == -1)
+	// No lock is taken, senders of all processes race for a slot with a CAS and then for a place in the ring
+	int new_slot_index = take_posixshm_slot(cl->metadata, &whichpool);
+	if(new_slot_index < 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_wait(cl->m_sem_mutex), mbox_id_in_itccoord = 0x%08x, errno = %d!", cl->mbox_id_in_itccoord, errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
+		TPT_TRACE(TRACE_ERROR, "No more slot available for pool = %d and larger ones!", whichpool);
+		rc->flags |= ITC_OUT_OF_RANGE;
 		return;
 	}
 
-	// Critical section
-	struct posixshm_slot_info_t *new_slot;
-	unsigned char new_slot_index = 0;
-	if(whichpool == POOL_UNLIMIT && num_unlimit_pages > (posixshm_inst.slot_sizes[POOL_16352] / POSIXSHM_PAGE_SIZE))
+	struct posixshm_slot_info_t *new_slot = get_posixshm_slot(cl->metadata, whichpool, new_slot_index);
+	if(whichpool == POOL_UNLIMIT)
 	{
-		if(munmap(cl->metadata, POSIXSHM_STATIC_ALLOC_PAGES * POSIXSHM_PAGE_SIZE) == -1)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to munmap(POSIXSHM_STATIC_ALLOC_PAGES), errno = %d!", errno);
-			return;
-		}
+		struct posixshm_large_slot *large_slot = &cl->metadata->large_slots[new_slot_index];
+		void *large_shm_ptr = NULL;
 
-		res = ftruncate(cl->posixshm_id, (POSIXSHM_STATIC_ALLOC_PAGES + num_unlimit_pages) * POSIXSHM_PAGE_SIZE); // Assume page size is 4KB
-		if(res < 0)
+		if(large_slot->num_pages < num_unlimit_pages)
 		{
-			TPT_TRACE(TRACE_ERROR, "Failed to ftruncate, res = %d, errno = %d!", res, errno);
-			rc->flags |= ITC_SYSCALL_ERROR;
-			return;
+			grow_large_posixshm(rc, cl->posixshm_id, large_slot, new_slot_index, num_unlimit_pages);
 		}
 
-		cl->metadata = (struct posixshm_metadata_t *)mmap(NULL, (POSIXSHM_STATIC_ALLOC_PAGES + num_unlimit_pages) * POSIXSHM_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, cl->posixshm_id, 0);
-		cl->metadata->num_unlimit_pages = num_unlimit_pages;
-		cl->metadata->num_pages = POSIXSHM_STATIC_ALLOC_PAGES + num_unlimit_pages;
-		new_slot = (struct posixshm_slot_info_t *)((unsigned long)cl->metadata + posixshm_inst.pool_offset[whichpool]);
-		new_slot->next_slot.whichpool = -1;
-		new_slot->next_slot.whichslot = -1;
-		new_slot->pool_type = POOL_UNLIMIT;
-	} else
-	{
-		// Shopping for a slot in whichpool
-		struct posixshm_slot_info_t *slot = (struct posixshm_slot_info_t *)((unsigned long)cl->metadata + posixshm_inst.pool_offset[whichpool]);
-		for(; new_slot_index < posixshm_inst.num_slots[whichpool]; ++new_slot_index)
+		if(rc->flags == ITC_OK)
 		{
-			if(slot->is_in_use == false && slot->next_slot.whichpool == -1 && slot->next_slot.whichslot == -1)
-			{
-				new_slot = slot;
-				break;
-			}
-
-			// Move to next slot in whichpool
-			slot = (struct posixshm_slot_info_t *)((unsigned long)slot + posixshm_inst.slot_sizes[whichpool]);
+			large_shm_ptr = map_large_posixshm(cl->posixshm_id, &cl->large_num_pages[new_slot_index], &cl->large_shm_ptr[new_slot_index],
+							   large_slot, new_slot_index);
 		}
 
-		if(new_slot_index == posixshm_inst.num_slots[whichpool])
+		if(large_shm_ptr == NULL)
 		{
-			TPT_TRACE(TRACE_ERROR, "No more slot available for this pool = %d, limit at %u slots!", whichpool, posixshm_inst.num_slots[whichpool]);
+			release_posixshm_slot(cl->metadata, whichpool, new_slot_index);
+			rc->flags |= ITC_SYSCALL_ERROR;
 			return;
 		}
-	}
 
-	if(cl->metadata->tail.whichpool == -1 && cl->metadata->tail.whichslot == -1)
-	{
-		// TPT_TRACE(TRACE_INFO, "POSIX shared memory queue is empty, add a new one!"); // TBD
-		cl->metadata->head.whichpool = whichpool;
-		cl->metadata->head.whichslot = new_slot_index;
-		cl->metadata->tail.whichpool = whichpool;
-		cl->metadata->tail.whichslot = new_slot_index;
+		// Same offset as in the static slots, so msgno still starts a cache line
+		(void)itc_msg_gather_shm(message, (void *)((unsigned long)large_shm_ptr + POSIXSHM_SLOT_HEADER_SIZE));
+		large_slot->used_pages = num_unlimit_pages;
 	} else
 	{
-		unsigned long pool_offset = posixshm_inst.pool_offset[cl->metadata->tail.whichpool];
-		unsigned long slot_offset = posixshm_inst.slot_sizes[cl->metadata->tail.whichpool]*cl->metadata->tail.whichslot;
-		struct posixshm_slot_info_t *tail_node = (struct posixshm_slot_info_t *)((unsigned long)cl->metadata + pool_offset + slot_offset);
-		tail_node->next_slot.whichpool = whichpool;
-		tail_node->next_slot.whichslot = new_slot_index;
-		cl->metadata->tail.whichpool = whichpool;
-		cl->metadata->tail.whichslot = new_slot_index;
-	}
-
-	new_slot->is_in_use = true;
-
-	memcpy((void *)((unsigned long)new_slot + POSIXSHM_SLOT_HEADER_SIZE), message, message->size + ITC_HEADER_SIZE + 1);
-
-	// Release mutex lock
-	if(sem_post(cl->m_sem_mutex) == -1)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_post(cl->m_sem_mutex), errno = %d!", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		(void)itc_msg_gather_shm(message, (void *)((unsigned long)new_slot + POSIXSHM_SLOT_HEADER_SIZE));
 	}
 
-	// Notify receiver about incoming message
-	if(sem_post(cl->m_sem_notify) == -1)
+	// Hand the slot over to the receiver, wakes it up only if it sleeps
+	if(!enqueue_posixshm_ring(cl->metadata, whichpool, new_slot_index))
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_post(my_sem_slot), errno = %d!", errno);
+		release_posixshm_slot(cl->metadata, whichpool, new_slot_index);
 		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
 
-	// Unmmap unlimited slot to save space for our sender's virtual address space
-	if(whichpool == POOL_UNLIMIT && num_unlimit_pages > (posixshm_inst.slot_sizes[POOL_16352] / POSIXSHM_PAGE_SIZE))
-	{
-		if(munmap(cl->metadata, (POSIXSHM_STATIC_ALLOC_PAGES + num_unlimit_pages) * POSIXSHM_PAGE_SIZE) == -1)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to munmap(POSIXSHM_STATIC_ALLOC_PAGES + num_unlimit_pages), errno = %d!", errno);
-			return;
-		}
-
-		cl->metadata = (struct posixshm_metadata_t *)mmap(NULL, POSIXSHM_STATIC_ALLOC_PAGES * POSIXSHM_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, cl->posixshm_id, 0);
-	}
-
 	union itc_msg* msg;
 #ifdef UNITTEST
 	free(message);
@@ -436,7 +441,7 @@ static void* posixshm_rx_thread(void *data)
 
 	sprintf(itc_mbox_name, "itc_rx_posixshm_0x%08x", posixshm_inst.my_mbox_id_in_itccoord);
 
-	posixshm_inst.my_mbox_id = itc_create_mailbox(itc_mbox_name, ITC_NO_NAMESPACE);
+	posixshm_inst.my_mbox_id = itc_create_mailbox(itc_mbox_name, ITC_NO_NAMESPACE | ITC_FLAGS_MBOX_FORWARDER);
 
 	TPT_TRACE(TRACE_INFO, "Starting posixshm_rx_thread %s...!", itc_mbox_name);
 	int ret = pthread_setspecific(posixshm_inst.destruct_key, (void*)(unsigned long)posixshm_inst.my_mbox_id);
@@ -450,110 +455,55 @@ static void* posixshm_rx_thread(void *data)
 	MUTEX_UNLOCK(&posixshm_inst.thread_mtx);
 	for(;;)
 	{
+		struct posixshm_pool_slot head;
+
 		if(posixshm_inst.is_terminated)
 		{
 			TPT_TRACE(TRACE_INFO, "Terminating posixshm rx thread!");
 			break;
 		}
 
-		if(sem_wait(posixshm_inst.my_sem_notify) == -1)
+		if(!dequeue_posixshm_ring(posixshm_inst.my_shm_ptr, &head))
 		{
-			TPT_TRACE(TRACE_ERROR, "Failed to sem_wait(my_sem_notify), errno = %d!", errno);
-			break;
+			if(!skip_dead_posixshm_sender(posixshm_inst.my_shm_ptr))
+			{
+				wait_for_posixshm_ring(posixshm_inst.my_shm_ptr);
+			}
+			continue;
 		}
 
-		// Some processes has notified us about a new message
-		// Accquire mutex lock to access the shared memory resources
-		if(sem_wait(posixshm_inst.my_sem_mutex) == -1)
+		if(head.whichpool < 0 || head.whichpool >= NUM_POOLS || head.whichslot < 0 || head.whichslot >= posixshm_inst.num_slots[head.whichpool])
 		{
-			TPT_TRACE(TRACE_ERROR, "Failed to sem_wait(my_sem_mutex), errno = %d!", errno);
-			break;
+			TPT_TRACE(TRACE_ERROR, "Invalid slot in ring, pool = %d, slot = %d!", head.whichpool, head.whichslot);
+			continue;
 		}
 
-		if(posixshm_inst.my_shm_ptr->head.whichpool != -1 && posixshm_inst.my_shm_ptr->head.whichslot != -1)
+		struct posixshm_slot_info_t *slot = get_posixshm_slot(posixshm_inst.my_shm_ptr, head.whichpool, head.whichslot);
+		if(__atomic_load_n(&posixshm_inst.my_shm_ptr->free_slots[head.whichpool], __ATOMIC_RELAXED) & (1ULL << head.whichslot))
 		{
-			struct posixshm_slot_info_t *slot;
-			uint16_t num_unlimit_pages = 0;
-			if(posixshm_inst.my_shm_ptr->head.whichpool == POOL_UNLIMIT && posixshm_inst.my_shm_ptr->num_unlimit_pages > 0)
-			{
-				num_unlimit_pages = posixshm_inst.my_shm_ptr->num_unlimit_pages;
-				if(munmap(posixshm_inst.my_shm_ptr, POSIXSHM_STATIC_ALLOC_PAGES * POSIXSHM_PAGE_SIZE) == -1)
-				{
-					TPT_TRACE(TRACE_ERROR, "Failed to munmap(POSIXSHM_STATIC_ALLOC_PAGES), errno = %d!", errno);
-					break;
-				}
-
-				posixshm_inst.my_shm_ptr = (struct posixshm_metadata_t *)mmap(NULL, (POSIXSHM_STATIC_ALLOC_PAGES + num_unlimit_pages)*POSIXSHM_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, posixshm_inst.my_shmid, 0);
-			}
-
-			unsigned long pool_offset = posixshm_inst.pool_offset[posixshm_inst.my_shm_ptr->head.whichpool];
-			unsigned long slot_offset = posixshm_inst.slot_sizes[posixshm_inst.my_shm_ptr->head.whichpool]*posixshm_inst.my_shm_ptr->head.whichslot;
-			slot = (struct posixshm_slot_info_t *)((unsigned long)posixshm_inst.my_shm_ptr + pool_offset + slot_offset);
-
-			handle_received_message(slot);
-
-			// Remove slot from queue
-			if(posixshm_inst.my_shm_ptr->head.whichpool == posixshm_inst.my_shm_ptr->tail.whichpool && \
-			posixshm_inst.my_shm_ptr->head.whichslot == posixshm_inst.my_shm_ptr->tail.whichslot)
-			{
-				// TPT_TRACE(TRACE_INFO, "POSIX shared memory queue has only one slot, dequeue it!"); // TBD
-				// Both head and tail should be moved to NULL
-				posixshm_inst.my_shm_ptr->head.whichpool = -1;
-				posixshm_inst.my_shm_ptr->head.whichslot = -1;
-				posixshm_inst.my_shm_ptr->tail.whichpool = -1;
-				posixshm_inst.my_shm_ptr->tail.whichslot = -1;
-			} else
-			{
-				// In case queue has more than one items, move head to the 2nd item and remove the 1st item via prev
-				// pointer of the 2nd.
-				posixshm_inst.my_shm_ptr->head.whichpool = slot->next_slot.whichpool;
-				posixshm_inst.my_shm_ptr->head.whichslot = slot->next_slot.whichslot;
-			}
-
-			// Clean up slot's header info
-			slot->is_in_use = false;
-			slot->next_slot.whichpool = -1;
-			slot->next_slot.whichslot = -1;
-
-			// Unmap unlimited slot for a large itc message to save memory
-			if(num_unlimit_pages > 0)
-			{
-				if(munmap(posixshm_inst.my_shm_ptr, (POSIXSHM_STATIC_ALLOC_PAGES + num_unlimit_pages)*POSIXSHM_PAGE_SIZE) == -1)
-				{
-					TPT_TRACE(TRACE_ERROR, "Failed to munmap(POSIXSHM_STATIC_ALLOC_PAGES + num_unlimit_pages), errno = %d!", errno);
-					break;
-				}
-
-				/* FIXME: Comment out this ftruncate will lower send-receive latency from 5.5ms to 3.2ms */
-				int res = ftruncate(posixshm_inst.my_shmid, POSIXSHM_STATIC_ALLOC_PAGES * POSIXSHM_PAGE_SIZE);
-				if(res < 0)
-				{
-					TPT_TRACE(TRACE_ERROR, "Failed to ftruncate, res = %d, errno = %d!", res, errno);
-					break;
-				}
-
-				posixshm_inst.my_shm_ptr = (struct posixshm_metadata_t *)mmap(NULL, POSIXSHM_STATIC_ALLOC_PAGES*POSIXSHM_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, posixshm_inst.my_shmid, 0);
-				posixshm_inst.my_shm_ptr->num_unlimit_pages = 0;
-				posixshm_inst.my_shm_ptr->num_pages = POSIXSHM_STATIC_ALLOC_PAGES;
-			}
-		} else
+			TPT_TRACE(TRACE_ERROR, "Slot is not in use, pool type = %u!", slot->pool_type);
+		} else if(slot->pool_type > POOL_UNLIMIT)
 		{
-			TPT_TRACE(TRACE_ERROR, "Some process has notified of new incoming message, but no message found in shared memory!");
-		}
-
-		// Release mutex lock
-		if(sem_post(posixshm_inst.my_sem_mutex) == -1)
+			TPT_TRACE(TRACE_ERROR, "Invalid pool type = %u!", slot->pool_type);
+		} else if(head.whichpool != POOL_UNLIMIT)
 		{
-			TPT_TRACE(TRACE_ERROR, "Failed to sem_post(my_sem_mutex), errno = %d!", errno);
-			break;
-		}
-
-		// Allow new process take a slot in queue
-		if(sem_post(posixshm_inst.my_sem_slot) == -1)
+			handle_received_message((struct itc_message *)((unsigned long)slot + POSIXSHM_SLOT_HEADER_SIZE), &head);
+			continue;
+		} else
 		{
-			TPT_TRACE(TRACE_ERROR, "Failed to sem_post(my_sem_slot), errno = %d!", errno);
-			break;
+			// Stays mapped for the next large message in this slot, unless a sender has grown it meanwhile
+			void *large_shm_ptr = map_large_posixshm(posixshm_inst.my_shmid, &posixshm_inst.my_large_num_pages[head.whichslot],
+								 &posixshm_inst.my_large_shm_ptr[head.whichslot],
+								 &posixshm_inst.my_shm_ptr->large_slots[head.whichslot], head.whichslot);
+			if(large_shm_ptr != NULL)
+			{
+				handle_received_message((struct itc_message *)((unsigned long)large_shm_ptr + POSIXSHM_SLOT_HEADER_SIZE), &head);
+				continue;
+			}
 		}
+
+		// Nothing could be taken out of it, just give the slot back to senders
+		release_received_slot(&head);
 	}
 	
 	return NULL;
@@ -569,7 +519,6 @@ static void init_posixshm(struct result_code* rc)
 	if ((posixshm_inst.my_shmid = shm_open(posixshm_inst.my_posixshm_name, O_RDWR | O_CREAT | O_EXCL, 0666)) == -1) {
 		TPT_TRACE(TRACE_ERROR, "Failed to mq_open, errno = %d!", errno);
 		rc->flags |= ITC_SYSCALL_ERROR;
-		remove_posixshm_semaphores();
 		return;
 	}
 
@@ -578,7 +527,6 @@ static void init_posixshm(struct result_code* rc)
 	{
 		TPT_TRACE(TRACE_ERROR, "Failed to fchmod, file = %s, res = %d, errno = %d!", posixshm_inst.my_posixshm_name, res, errno);
 		remove_posixshm();
-		remove_posixshm_semaphores();
 		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
@@ -588,220 +536,395 @@ static void init_posixshm(struct result_code* rc)
 	{
 		TPT_TRACE(TRACE_ERROR, "Failed to ftruncate, res = %d, errno = %d!", res, errno);
 		remove_posixshm();
-		remove_posixshm_semaphores();
 		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
 
-	posixshm_inst.my_shm_ptr = (struct posixshm_metadata_t *)mmap(NULL, POSIXSHM_STATIC_ALLOC_PAGES * POSIXSHM_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, posixshm_inst.my_shmid, 0);
-	init_posixshm_mempool(posixshm_inst.my_shm_ptr);
+	posixshm_inst.my_shm_ptr = map_posixshm(posixshm_inst.my_shmid, POSIXSHM_STATIC_ALLOC_PAGES * POSIXSHM_PAGE_SIZE, 0);
+	if(posixshm_inst.my_shm_ptr == MAP_FAILED)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to mmap, errno = %d!", errno);
+		remove_posixshm();
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return;
+	}
 
-	// Done initialization, allow other processes to access our shared memory now
-	sem_post(posixshm_inst.my_sem_mutex);
+	// No sender attaches before our mailboxes can be located, which is after itc_init() returned
+	init_posixshm_mempool(posixshm_inst.my_shm_ptr);
 }
 
-static void init_posixshm_semaphores(struct result_code* rc)
+static void remove_posixshm()
 {
-	sprintf(posixshm_inst.my_sem_mutex_name, "/itc_posixshm_sem_mutex_0x%08x", posixshm_inst.my_mbox_id_in_itccoord);
-	if ((posixshm_inst.my_sem_mutex = sem_open(posixshm_inst.my_sem_mutex_name, O_CREAT | O_EXCL, 0666, 0)) == SEM_FAILED) {
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_open, semaphore %s, errno = %d!", posixshm_inst.my_sem_mutex_name, errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+	// Senders still attached to the segment reconnect to our next one rather than filling this one for no one
+	if(posixshm_inst.my_shm_ptr != NULL && posixshm_inst.my_shm_ptr != MAP_FAILED)
+	{
+		__atomic_store_n(&posixshm_inst.my_shm_ptr->closed, 1, __ATOMIC_RELEASE);
 	}
 
-	char path[128];
-	sprintf(path, "/dev/shm/sem.%s", posixshm_inst.my_sem_mutex_name + 1);
-	int res = chmod(path, 0777);
-	if(res < 0)
+	for(int i = 0; i < NUM_SLOTS_POOL_UNLIMIT; ++i)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to chmod, file = %s, res = %d, errno = %d!", path, res, errno);
-		remove_posixshm_semaphores();
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		unmap_large_posixshm(&posixshm_inst.my_large_num_pages[i], &posixshm_inst.my_large_shm_ptr[i]);
 	}
-	
-	sprintf(posixshm_inst.my_sem_notify_name, "/itc_posixshm_sem_notify_0x%08x", posixshm_inst.my_mbox_id_in_itccoord);
-	if ((posixshm_inst.my_sem_notify = sem_open(posixshm_inst.my_sem_notify_name, O_CREAT | O_EXCL, 0666, 0)) == SEM_FAILED) {
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_open, semaphore %s, errno = %d!", posixshm_inst.my_sem_notify_name, errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		remove_posixshm_semaphores();
-		return;
+
+	if (close(posixshm_inst.my_shmid) == -1) {
+		TPT_TRACE(TRACE_ERROR, "Failed to close, my_shmid = %d, errno = %d!", posixshm_inst.my_shmid, errno);
 	}
 
-	sprintf(path, "/dev/shm/sem.%s", posixshm_inst.my_sem_notify_name + 1);
-	res = chmod(path, 0777);
-	if(res < 0)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to chmod, file = %s, res = %d, errno = %d!", path, res, errno);
-		remove_posixshm_semaphores();
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+	if (shm_unlink(posixshm_inst.my_posixshm_name) == -1) {
+		TPT_TRACE(TRACE_ERROR, "Failed to mq_unlink, my_posixshm_name = %s, errno = %d!", posixshm_inst.my_posixshm_name, errno);
 	}
+}
 
-	sprintf(posixshm_inst.my_sem_slot_name, "/itc_posixshm_sem_slot_0x%08x", posixshm_inst.my_mbox_id_in_itccoord);
-	if ((posixshm_inst.my_sem_slot = sem_open(posixshm_inst.my_sem_slot_name, O_CREAT | O_EXCL, 0666, MAX_POSIXSHM_SLOTS)) == SEM_FAILED) {
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_open, semaphore %s, errno = %d!", posixshm_inst.my_sem_slot_name, errno);
+static void init_posixshm_rx_thread(struct result_code* rc)
+{
+	int res = pthread_key_create(&posixshm_inst.destruct_key, rxthread_destructor);
+	if(res != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_key_create, error code = %d", res);
+		remove_posixshm();
 		rc->flags |= ITC_SYSCALL_ERROR;
-		remove_posixshm_semaphores();
 		return;
 	}
 
-	sprintf(path, "/dev/shm/sem.%s", posixshm_inst.my_sem_slot_name + 1);
-	res = chmod(path, 0777);
-	if(res < 0)
+	res = pthread_mutex_init(&posixshm_inst.thread_mtx, NULL);
+	if(res != 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to chmod, file = %s, res = %d, errno = %d!", path, res, errno);
-		remove_posixshm_semaphores();
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutex_init, error code = %d", res);
+		remove_posixshm();
 		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
+
+	add_itcthread(rc, posixshm_rx_thread, NULL, false, &posixshm_inst.thread_mtx);
 }
 
-static void remove_posixshm()
+static void init_posixshm_mempool(struct posixshm_metadata_t *shm_ptr)
 {
-	if (close(posixshm_inst.my_shmid) == -1) {
-		TPT_TRACE(TRACE_ERROR, "Failed to close, my_shmid = %d, errno = %d!", posixshm_inst.my_shmid, errno);
+	struct posixshm_metadata_t *metadata = shm_ptr;
+
+	metadata->num_pages = POSIXSHM_STATIC_ALLOC_PAGES;
+	metadata->rx_sleeping = 0;
+	metadata->closed = 0;
+	metadata->pid = posixshm_inst.my_pid;
+	metadata->ring_tail = 0;
+	metadata->ring_head = 0;
+	metadata->slots_freed = 0;
+	metadata->slot_waiters = 0;
+	metadata->ring_waiters = 0;
+	for(uint32_t i = 0; i < POSIXSHM_RING_SIZE; ++i)
+	{
+		metadata->ring[i].seq = i;
+		metadata->ring[i].slot.whichpool = -1;
+		metadata->ring[i].slot.whichslot = -1;
+		metadata->ring[i].owner = 0;
 	}
 
-	if (shm_unlink(posixshm_inst.my_posixshm_name) == -1) {
-		TPT_TRACE(TRACE_ERROR, "Failed to mq_unlink, my_posixshm_name = %s, errno = %d!", posixshm_inst.my_posixshm_name, errno);
+	for(int whichslot = 0; whichslot < NUM_SLOTS_POOL_UNLIMIT; ++whichslot)
+	{
+		metadata->large_slots[whichslot].used_pages = 0;
+		metadata->large_slots[whichslot].num_pages = 0;
 	}
-}
 
-static void remove_posixshm_semaphores()
-{
-	if(sem_close(posixshm_inst.my_sem_mutex) == -1)
+	for(int whichpool = POOL_96; whichpool < NUM_POOLS; ++whichpool)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_close, my_sem_mutex, errno = %d!", errno);
+		for(int whichslot = 0; whichslot < posixshm_inst.num_slots[whichpool]; ++whichslot)
+		{
+			struct posixshm_slot_info_t *slot_header = get_posixshm_slot(metadata, whichpool, whichslot);
+			slot_header->pool_type = whichpool;
+			slot_header->owner = 0;
+		}
+
+		metadata->free_slots[whichpool] = (1ULL << posixshm_inst.num_slots[whichpool]) - 1;
 	}
+}
+
+static struct posixshm_slot_info_t* get_posixshm_slot(struct posixshm_metadata_t *shm_ptr, int whichpool, int whichslot)
+{
+	unsigned long pool_offset = posixshm_inst.pool_offset[whichpool];
+	unsigned long slot_offset = (whichpool == POOL_UNLIMIT) ? sizeof(struct posixshm_large_slot) * whichslot :
+				    (unsigned long)posixshm_inst.slot_sizes[whichpool] * whichslot;
+
+	return (struct posixshm_slot_info_t *)((unsigned long)shm_ptr + pool_offset + slot_offset);
+}
+
+/* Take the lowest free slot of whichpool by clearing its bit in free_slots with a CAS. A pool that is used up spills over
+into the next larger one, but not into the unlimited pool, whose slots have a region of their own. If all of
+them are full, sleep until the receiver hands a slot back, for up to POSIXSHM_SLOT_WAIT_MS in total before giving up */
+static int take_posixshm_slot(struct posixshm_metadata_t *shm_ptr, int *whichpool)
+{
+	struct timespec t_start, t_now, tmo;
+	int lastpool = (*whichpool == POOL_UNLIMIT) ? POOL_UNLIMIT : POOL_16352;
+	bool is_waiting = false;
+	uint32_t slots_freed = 0;
+	long waited;
 
-	if(sem_unlink(posixshm_inst.my_sem_mutex_name) == -1)
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	for(;;)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_close, my_sem_mutex_name, errno = %d!", errno);
+		for(int pool = *whichpool; pool <= lastpool; ++pool)
+		{
+			uint64_t free_slots = __atomic_load_n(&shm_ptr->free_slots[pool], __ATOMIC_RELAXED);
+
+			// A failed CAS reloads free_slots, so only retry while the pool still has a free slot
+			while(free_slots != 0)
+			{
+				int whichslot = __builtin_ctzll(free_slots);
+
+				if(__atomic_compare_exchange_n(&shm_ptr->free_slots[pool], &free_slots, free_slots & ~(1ULL << whichslot), false,
+							       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				{
+					// Lets the receiver give the slot back if we die with it, see reclaim_dead_posixshm_slots()
+					__atomic_store_n(&get_posixshm_slot(shm_ptr, pool, whichslot)->owner, posixshm_inst.my_pid, __ATOMIC_RELAXED);
+					if(is_waiting)
+					{
+						__atomic_fetch_sub(&shm_ptr->slot_waiters, 1, __ATOMIC_SEQ_CST);
+					}
+					*whichpool = pool;
+					return whichslot;
+				}
+			}
+		}
+
+		if(is_waiting)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &t_now);
+			waited = (t_now.tv_sec - t_start.tv_sec) * 1000 + (t_now.tv_nsec - t_start.tv_nsec) / 1000000;
+			if(waited >= POSIXSHM_SLOT_WAIT_MS)
+			{
+				__atomic_fetch_sub(&shm_ptr->slot_waiters, 1, __ATOMIC_SEQ_CST);
+				return -1;
+			}
+
+			tmo.tv_sec = (POSIXSHM_SLOT_WAIT_MS - waited) / 1000;
+			tmo.tv_nsec = ((POSIXSHM_SLOT_WAIT_MS - waited) % 1000) * 1000000;
+			syscall(SYS_futex, &shm_ptr->slots_freed, FUTEX_WAIT, slots_freed, &tmo, NULL, 0);
+		} else
+		{
+			__atomic_fetch_add(&shm_ptr->slot_waiters, 1, __ATOMIC_SEQ_CST);
+			is_waiting = true;
+		}
+
+		// Read before the next look at free_slots, so a slot given back after it does not let us sleep
+		slots_freed = __atomic_load_n(&shm_ptr->slots_freed, __ATOMIC_SEQ_CST);
 	}
+}
+
+static void release_posixshm_slot(struct posixshm_metadata_t *shm_ptr, int whichpool, int whichslot)
+{
+	__atomic_store_n(&get_posixshm_slot(shm_ptr, whichpool, whichslot)->owner, 0, __ATOMIC_RELAXED);
+	__atomic_fetch_or(&shm_ptr->free_slots[whichpool], 1ULL << whichslot, __ATOMIC_SEQ_CST);
 
-	if(sem_close(posixshm_inst.my_sem_notify) == -1)
+	// No syscall as long as no sender waits for a slot, all are woken as they may wait for different pools
+	if(__atomic_load_n(&shm_ptr->slot_waiters, __ATOMIC_SEQ_CST) != 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_close, my_sem_notify, errno = %d!", errno);
+		__atomic_add_fetch(&shm_ptr->slots_freed, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &shm_ptr->slots_freed, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
 	}
+}
 
-	if(sem_unlink(posixshm_inst.my_sem_notify_name) == -1)
+/* Publish a filled slot to the rx thread. At most one ring position is taken per slot in use and the ring is larger than
+all pools together, so the cell of our position is free, unless the rx thread has not finished taking it the round before.
+Until then we sleep on its seq, and give up only once the receiver turns out to be dead */
+static bool enqueue_posixshm_ring(struct posixshm_metadata_t *shm_ptr, int whichpool, int whichslot)
+{
+	uint32_t pos = __atomic_fetch_add(&shm_ptr->ring_tail, 1, __ATOMIC_RELAXED);
+	struct posixshm_ring_cell *cell = &shm_ptr->ring[pos & (POSIXSHM_RING_SIZE - 1)];
+	struct timespec t_start, t_now, tmo;
+	uint32_t seq;
+	long waited;
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	while((seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE)) != pos)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_close, my_sem_notify_name, errno = %d!", errno);
+		clock_gettime(CLOCK_MONOTONIC, &t_now);
+		waited = (t_now.tv_sec - t_start.tv_sec) * 1000 + (t_now.tv_nsec - t_start.tv_nsec) / 1000000;
+		if(waited >= POSIXSHM_RING_WAIT_MS)
+		{
+			if(is_dead(shm_ptr->pid))
+			{
+				TPT_TRACE(TRACE_ERROR, "Receiver %d died before giving back ring position %u!", shm_ptr->pid, pos);
+				return false;
+			}
+
+			TPT_TRACE(TRACE_ABN, "Ring position %u held up for %d ms, receiver %d is still alive!", pos, POSIXSHM_RING_WAIT_MS, shm_ptr->pid);
+			t_start = t_now;
+			waited = 0;
+		}
+
+		// The rx thread only wakes us if it sees waiters after giving the cell back, and the futex does not sleep once it did
+		tmo.tv_sec = (POSIXSHM_RING_WAIT_MS - waited) / 1000;
+		tmo.tv_nsec = ((POSIXSHM_RING_WAIT_MS - waited) % 1000) * 1000000;
+		__atomic_fetch_add(&shm_ptr->ring_waiters, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &cell->seq, FUTEX_WAIT, seq, &tmo, NULL, 0);
+		__atomic_fetch_sub(&shm_ptr->ring_waiters, 1, __ATOMIC_SEQ_CST);
 	}
 
-	if(sem_close(posixshm_inst.my_sem_slot) == -1)
+	// Only written once the cell is ours, the rx thread clears it when it takes the cell
+	__atomic_store_n(&cell->owner, posixshm_inst.my_pid, __ATOMIC_RELAXED);
+	cell->slot.whichpool = whichpool;
+	cell->slot.whichslot = whichslot;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+	// No syscall as long as the rx thread is awake
+	if(__atomic_load_n(&shm_ptr->rx_sleeping, __ATOMIC_SEQ_CST) == 1 && __atomic_exchange_n(&shm_ptr->rx_sleeping, 0, __ATOMIC_SEQ_CST) == 1)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_close, my_sem_slot, errno = %d!", errno);
+		syscall(SYS_futex, &shm_ptr->rx_sleeping, FUTEX_WAKE, 1, NULL, NULL, 0);
 	}
 
-	if(sem_unlink(posixshm_inst.my_sem_slot_name) == -1)
+	return true;
+}
+
+static bool dequeue_posixshm_ring(struct posixshm_metadata_t *shm_ptr, struct posixshm_pool_slot *pool_slot)
+{
+	uint32_t pos = shm_ptr->ring_head;
+	struct posixshm_ring_cell *cell = &shm_ptr->ring[pos & (POSIXSHM_RING_SIZE - 1)];
+
+	if(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_close, my_sem_slot_name, errno = %d!", errno);
+		return false;
 	}
-	
+
+	*pool_slot = cell->slot;
+	give_back_posixshm_cell(shm_ptr, cell, pos);
+	return true;
 }
 
-static void init_posixshm_rx_thread(struct result_code* rc)
+/* Hands the cell of ring position pos over to the sender that gets pos + POSIXSHM_RING_SIZE */
+static void give_back_posixshm_cell(struct posixshm_metadata_t *shm_ptr, struct posixshm_ring_cell *cell, uint32_t pos)
 {
-	int res = pthread_key_create(&posixshm_inst.destruct_key, rxthread_destructor);
-	if(res != 0)
+	cell->owner = 0;
+	__atomic_store_n(&cell->seq, pos + POSIXSHM_RING_SIZE, __ATOMIC_SEQ_CST);
+	shm_ptr->ring_head = pos + 1;
+
+	if(__atomic_load_n(&shm_ptr->ring_waiters, __ATOMIC_SEQ_CST) != 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to pthread_key_create, error code = %d", res);
-		remove_posixshm();
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		syscall(SYS_futex, &cell->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
 	}
+}
 
-	res = pthread_mutex_init(&posixshm_inst.thread_mtx, NULL);
-	if(res != 0)
+/* rx_sleeping is raised before the ring is checked one last time and senders check it after publishing, so either we see
+their message here or they see us sleeping and wake us up. FUTEX_WAIT is no cancellation point, so the rx thread can only
+be cancelled asynchronously while it sleeps. While a sender has got the head position but not filled it, wake up now and
+then to look whether it is still alive, see skip_dead_posixshm_sender() */
+static void wait_for_posixshm_ring(struct posixshm_metadata_t *shm_ptr)
+{
+	uint32_t pos = shm_ptr->ring_head;
+	struct timespec tmo = { 0, POSIXSHM_HELD_UP_MS * 1000000 };
+	bool is_claimed = __atomic_load_n(&shm_ptr->ring_tail, __ATOMIC_RELAXED) != pos;
+	int oldtype;
+
+	__atomic_store_n(&shm_ptr->rx_sleeping, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&shm_ptr->ring[pos & (POSIXSHM_RING_SIZE - 1)].seq, __ATOMIC_SEQ_CST) != pos + 1)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutex_init, error code = %d", res);
-		remove_posixshm();
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, &oldtype);
+		if(syscall(SYS_futex, &shm_ptr->rx_sleeping, FUTEX_WAIT, 1, is_claimed ? &tmo : NULL, NULL, 0) == -1 &&
+		   errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to FUTEX_WAIT, errno = %d!", errno);
+		}
+		pthread_setcanceltype(oldtype, NULL);
 	}
 
-	add_itcthread(rc, posixshm_rx_thread, NULL, false, &posixshm_inst.thread_mtx);
+	__atomic_store_n(&shm_ptr->rx_sleeping, 0, __ATOMIC_RELAXED);
 }
 
-static void init_posixshm_mempool(struct posixshm_metadata_t *shm_ptr)
+/* A sender that got the head position but died before filling it would hold the ring up forever. Once the head has been
+taken but empty for POSIXSHM_HELD_UP_MS and its sender is dead, skip it and give back the slots the sender held. Returns
+whether the head has moved on or been filled meanwhile */
+static bool skip_dead_posixshm_sender(struct posixshm_metadata_t *shm_ptr)
 {
-	struct posixshm_metadata_t *metadata = shm_ptr;
+	uint32_t pos = shm_ptr->ring_head;
+	struct posixshm_ring_cell *cell = &shm_ptr->ring[pos & (POSIXSHM_RING_SIZE - 1)];
+	struct timespec t_now;
+	pid_t owner;
 
-	// At this moment owner don't need to lock my_sem_mutex since it's = 0 currently after initialization
-	metadata->head.whichpool = -1;
-	metadata->head.whichslot = -1;
-	metadata->tail.whichpool = -1;
-	metadata->tail.whichslot = -1;
-	metadata->num_pages = POSIXSHM_STATIC_ALLOC_PAGES;
-	metadata->num_unlimit_pages = 0;
-
-	struct posixshm_slot_info_t *slot_header = (struct posixshm_slot_info_t *)((unsigned long)metadata + posixshm_inst.pool_offset[POOL_96]);
-	for(unsigned char i = 0; i < posixshm_inst.num_slots[POOL_96]; ++i)
+	if(__atomic_load_n(&shm_ptr->ring_tail, __ATOMIC_RELAXED) == pos)
 	{
-		slot_header->pool_type = POOL_96;
-		slot_header->is_in_use = false;
-		slot_header->next_slot.whichpool = -1;
-		slot_header->next_slot.whichslot = -1;
-		slot_header = (struct posixshm_slot_info_t *)((unsigned long)slot_header + 128);
+		posixshm_inst.is_held_up = false;
+		return false;
 	}
 
-	slot_header = (struct posixshm_slot_info_t *)((unsigned long)metadata + posixshm_inst.pool_offset[POOL_480]);
-	for(unsigned char i = 0; i < posixshm_inst.num_slots[POOL_480]; ++i)
+	clock_gettime(CLOCK_MONOTONIC, &t_now);
+	if(!posixshm_inst.is_held_up || posixshm_inst.held_up_pos != pos)
 	{
-		slot_header->pool_type = POOL_480;
-		slot_header->is_in_use = false;
-		slot_header->next_slot.whichpool = -1;
-		slot_header->next_slot.whichslot = -1;
-		slot_header = (struct posixshm_slot_info_t *)((unsigned long)slot_header + 512);
+		posixshm_inst.is_held_up = true;
+		posixshm_inst.held_up_pos = pos;
+		posixshm_inst.held_up_since = t_now;
+		return false;
 	}
 
-	slot_header = (struct posixshm_slot_info_t *)((unsigned long)metadata + posixshm_inst.pool_offset[POOL_992]);
-	for(unsigned char i = 0; i < posixshm_inst.num_slots[POOL_992]; ++i)
+	if((t_now.tv_sec - posixshm_inst.held_up_since.tv_sec) * 1000 +
+	   (t_now.tv_nsec - posixshm_inst.held_up_since.tv_nsec) / 1000000 < POSIXSHM_HELD_UP_MS)
 	{
-		slot_header->pool_type = POOL_992;
-		slot_header->is_in_use = false;
-		slot_header->next_slot.whichpool = -1;
-		slot_header->next_slot.whichslot = -1;
-		slot_header = (struct posixshm_slot_info_t *)((unsigned long)slot_header + 1024);
+		return false;
 	}
 
-	slot_header = (struct posixshm_slot_info_t *)((unsigned long)metadata + posixshm_inst.pool_offset[POOL_2016]);
-	for(unsigned char i = 0; i < posixshm_inst.num_slots[POOL_2016]; ++i)
+	// A sender that died before it could write owner cannot be told from a slow one, keep waiting for it
+	posixshm_inst.held_up_since = t_now;
+	owner = __atomic_load_n(&cell->owner, __ATOMIC_RELAXED);
+	if(owner == 0 || !is_dead(owner))
 	{
-		slot_header->pool_type = POOL_2016;
-		slot_header->is_in_use = false;
-		slot_header->next_slot.whichpool = -1;
-		slot_header->next_slot.whichslot = -1;
-		slot_header = (struct posixshm_slot_info_t *)((unsigned long)slot_header + 2048);
+		return false;
 	}
 
-	slot_header = (struct posixshm_slot_info_t *)((unsigned long)metadata + posixshm_inst.pool_offset[POOL_4064]);
-	for(unsigned char i = 0; i < posixshm_inst.num_slots[POOL_4064]; ++i)
+	if(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) == pos + 1)
 	{
-		slot_header->pool_type = POOL_4064;
-		slot_header->is_in_use = false;
-		slot_header->next_slot.whichpool = -1;
-		slot_header->next_slot.whichslot = -1;
-		slot_header = (struct posixshm_slot_info_t *)((unsigned long)slot_header + 4096);
+		// Filled just before it died
+		return true;
 	}
 
-	slot_header = (struct posixshm_slot_info_t *)((unsigned long)metadata + posixshm_inst.pool_offset[POOL_16352]);
-	for(unsigned char i = 0; i < posixshm_inst.num_slots[POOL_16352]; ++i)
+	TPT_TRACE(TRACE_ERROR, "Sender %d died before filling ring position %u, skipping it!", owner, pos);
+	reclaim_dead_posixshm_slots(shm_ptr, owner);
+	give_back_posixshm_cell(shm_ptr, cell, pos);
+	posixshm_inst.is_held_up = false;
+	return true;
+}
+
+/* Slots still held by a dead sender, except the ones of messages it managed to put in the ring, which we still receive */
+static void reclaim_dead_posixshm_slots(struct posixshm_metadata_t *shm_ptr, pid_t owner)
+{
+	uint32_t tail = __atomic_load_n(&shm_ptr->ring_tail, __ATOMIC_ACQUIRE);
+
+	for(int whichpool = POOL_96; whichpool < NUM_POOLS; ++whichpool)
 	{
-		slot_header->pool_type = POOL_16352;
-		slot_header->is_in_use = false;
-		slot_header->next_slot.whichpool = -1;
-		slot_header->next_slot.whichslot = -1;
-		slot_header = (struct posixshm_slot_info_t *)((unsigned long)slot_header + 16384);
+		uint64_t free_slots = __atomic_load_n(&shm_ptr->free_slots[whichpool], __ATOMIC_ACQUIRE);
+
+		for(int whichslot = 0; whichslot < posixshm_inst.num_slots[whichpool]; ++whichslot)
+		{
+			bool is_queued = false;
+
+			if((free_slots & (1ULL << whichslot)) ||
+			   __atomic_load_n(&get_posixshm_slot(shm_ptr, whichpool, whichslot)->owner, __ATOMIC_RELAXED) != owner)
+			{
+				continue;
+			}
+
+			for(uint32_t pos = shm_ptr->ring_head + 1; pos != tail && !is_queued; ++pos)
+			{
+				struct posixshm_ring_cell *cell = &shm_ptr->ring[pos & (POSIXSHM_RING_SIZE - 1)];
+
+				is_queued = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) == pos + 1 &&
+					    cell->slot.whichpool == whichpool && cell->slot.whichslot == whichslot;
+			}
+
+			if(!is_queued)
+			{
+				TPT_TRACE(TRACE_INFO, "Giving back slot %d of pool %d held by dead sender %d", whichslot, whichpool, owner);
+				release_posixshm_slot(shm_ptr, whichpool, whichslot);
+			}
+		}
 	}
 }
 
+/* Alive but owned by another user still counts as alive */
+static bool is_dead(pid_t pid)
+{
+	return kill(pid, 0) == -1 && errno == ESRCH;
+}
+
 static void release_posixshm_resources(struct result_code* rc)
 {
 	remove_posixshm();
-	remove_posixshm_semaphores();
 	release_posixshm_contactlist();
 
 	int ret = pthread_key_delete(posixshm_inst.destruct_key);
@@ -865,9 +988,7 @@ static struct posixshm_contactlist* find_cl(struct result_code* rc, itc_mbox_id_
 static void add_posixshm_cl(struct result_code* rc, struct posixshm_contactlist* cl, itc_mbox_id_t mbox_id)
 {
 	int shmid;
-	sem_t *sem_mutex;
-	sem_t *sem_notify;
-	sem_t *sem_slot;
+	struct posixshm_metadata_t *shm_ptr;
 	char partner_name[64];
 
 	sprintf(partner_name, "/itc_posixshm_0x%08x", mbox_id & posixshm_inst.itccoord_mask);
@@ -878,73 +999,69 @@ static void add_posixshm_cl(struct result_code* rc, struct posixshm_contactlist*
 		return;
 	}
 
-	sprintf(partner_name, "/itc_posixshm_sem_mutex_0x%08x", mbox_id & posixshm_inst.itccoord_mask);
-	if ((sem_mutex = sem_open(partner_name, 0, 0, 0)) == SEM_FAILED) {
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_open, semaphore %s, errno = %d!", partner_name, errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
-
-	sprintf(partner_name, "/itc_posixshm_sem_notify_0x%08x", mbox_id & posixshm_inst.itccoord_mask);
-	if ((sem_notify = sem_open(partner_name, 0, 0, 0)) == SEM_FAILED) {
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_open, semaphore %s, errno = %d!", partner_name, errno);
-		sem_close(sem_mutex);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
-
-	sprintf(partner_name, "/itc_posixshm_sem_slot_0x%08x", mbox_id & posixshm_inst.itccoord_mask);
-	if ((sem_slot = sem_open(partner_name, 0, 0, 0)) == SEM_FAILED) {
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_open, semaphore %s, errno = %d!", partner_name, errno);
-		sem_close(sem_mutex);
-		sem_close(sem_notify);
+	shm_ptr = map_posixshm(shmid, POSIXSHM_STATIC_ALLOC_PAGES * POSIXSHM_PAGE_SIZE, 0);
+	if(shm_ptr == MAP_FAILED)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to mmap partner posix shm %s, errno = %d!", partner_name, errno);
+		close(shmid);
 		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
 
 	cl->mbox_id_in_itccoord = (mbox_id & posixshm_inst.itccoord_mask);
 	cl->posixshm_id = shmid;
-	cl->metadata = (struct posixshm_metadata_t *)mmap(NULL, POSIXSHM_STATIC_ALLOC_PAGES * POSIXSHM_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shmid, 0);
-	cl->m_sem_mutex = sem_mutex;
-	cl->m_sem_notify = sem_notify;
-	cl->m_sem_slot = sem_slot;
+	cl->metadata = shm_ptr;
 }
 
-// static void remove_posixshm_cl(struct result_code* rc, itc_mbox_id_t mbox_id)
-// {
-// 	(void)rc;
-// 	struct posixshm_contactlist* cl;
+static void remove_posixshm_cl(struct result_code* rc, itc_mbox_id_t mbox_id)
+{
+	(void)rc;
+	struct posixshm_contactlist* cl;
 
-// 	cl = find_cl(rc, mbox_id);
-// 	cl->mbox_id_in_itccoord = 0;
-// 	cl->posix_mqd = 0;
-// }
+	cl = find_cl(rc, mbox_id);
+	if(cl->metadata != NULL && munmap(cl->metadata, POSIXSHM_STATIC_ALLOC_PAGES * POSIXSHM_PAGE_SIZE) == -1)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to munmap(POSIXSHM_STATIC_ALLOC_PAGES), errno = %d!", errno);
+	}
+
+	for(int i = 0; i < NUM_SLOTS_POOL_UNLIMIT; ++i)
+	{
+		unmap_large_posixshm(&cl->large_num_pages[i], &cl->large_shm_ptr[i]);
+	}
+
+	if (close(cl->posixshm_id) == -1) {
+		TPT_TRACE(TRACE_ERROR, "Failed to close, posixshm_id = %d, errno = %d!", cl->posixshm_id, errno);
+	}
+
+	cl->mbox_id_in_itccoord = 0;
+	cl->posixshm_id = 0;
+	cl->metadata = NULL;
+}
 
-static void handle_received_message(struct posixshm_slot_info_t *slot)
+/* Gives the slot back to senders as soon as the message has been copied out of it, before the copy is forwarded.
+Otherwise the receiver may already answer and the sender take and fault in another slot for the next message */
+static void handle_received_message(struct itc_message *rxmsg, const struct posixshm_pool_slot *head)
 {
 	struct itc_message* message;
-	struct itc_message* rxmsg;
 	union itc_msg* msg;
 	uint16_t flags;
 
-	if(slot->is_in_use == false)
-	{
-		TPT_TRACE(TRACE_ERROR, "Slot is not in use, pool type = %u!", slot->pool_type);
-		return;
-	} else if(slot->pool_type > POOL_UNLIMIT)
+	char *endpoint = (char*)((unsigned long)(&rxmsg->msgno) + rxmsg->size);
+	if(*endpoint != ENDPOINT)
 	{
-		TPT_TRACE(TRACE_ERROR, "Invalid pool type = %u!", slot->pool_type);
+		TPT_TRACE(TRACE_ABN, "Received malform message from some mailbox, invalid ENDPOINT 0x%02x!", *endpoint & 0xFF);
+		release_received_slot(head);
 		return;
 	}
 
-	rxmsg = (struct itc_message *)((unsigned long)slot + POSIXSHM_SLOT_HEADER_SIZE);
-
-	char *endpoint = (char*)((unsigned long)(&rxmsg->msgno) + rxmsg->size);
-	if(*endpoint != ENDPOINT)
+#ifndef UNITTEST
+	/* Receiver is blocked in itc_receive_into(), copy straight from our rx buffer and skip itc_alloc() + itc_send() */
+	if(itc_deliver_into_waiting_mbox(rxmsg))
 	{
-		TPT_TRACE(TRACE_ABN, "Received malform message from some mailbox, invalid ENDPOINT 0x%02x!", *endpoint & 0xFF);
+		release_received_slot(head);
 		return;
 	}
+#endif
 
 #ifdef UNITTEST
 	struct itc_message* tmp_message;
@@ -958,8 +1075,9 @@ static void handle_received_message(struct posixshm_slot_info_t *slot)
 	message = CONVERT_TO_MESSAGE(msg);
 
 	flags = message->flags; // Saved flags
-	memcpy(message, rxmsg, (rxmsg->size + ITC_HEADER_SIZE + 1));
+	itc_copy(message, rxmsg, (rxmsg->size + ITC_HEADER_SIZE + 1));
 	message->flags = flags; // Retored flags
+	release_received_slot(head);
 
 #ifdef UNITTEST
 	// Simulate that everything is ok at this point. Do nothing in unit test.
@@ -968,16 +1086,120 @@ static void handle_received_message(struct posixshm_slot_info_t *slot)
 	free(tmp_message);
 #else
 
-	// TPT_TRACE(TRACE_INFO, "Forwarding a message to local mailbox from external mbox = 0x%08x", message->sender); // TBD
-	itc_send(&msg, message->receiver, ITC_MY_MBOX_ID, NULL);
+	/* Straight onto the FIFO rx queue of the receiver, like the other transports, which also counts it as delivered */
+	if(!itc_deliver_local(message))
+	{
+		itc_free(&msg);
+	}
 #endif
 }
 
+/* Gives a slot back to senders from the rx thread, the only place where the region of a large slot can be trimmed */
+static void release_received_slot(const struct posixshm_pool_slot *head)
+{
+	if(head->whichpool == POOL_UNLIMIT)
+	{
+		trim_large_posixshm(head->whichslot);
+	}
+
+	release_posixshm_slot(posixshm_inst.my_shm_ptr, head->whichpool, head->whichslot);
+}
+
 static void rxthread_destructor(void* data)
 {
 	(void)data;
 }
 
+/* Only called by the sender holding the slot, nobody else looks at the slot meanwhile. posix_fallocate() never shrinks the
+file, so growing one region does not cut off a larger one of another slot. */
+static void grow_large_posixshm(struct result_code* rc, int shmid, struct posixshm_large_slot *large_slot, int whichslot, uint32_t num_pages)
+{
+	uint32_t new_num_pages = (large_slot->num_pages > 0) ? large_slot->num_pages : POSIXSHM_LARGE_MIN_PAGES;
+
+	while(new_num_pages < num_pages)
+	{
+		new_num_pages *= 2;
+	}
+
+	if(new_num_pages > POSIXSHM_LARGE_MAX_PAGES)
+	{
+		new_num_pages = POSIXSHM_LARGE_MAX_PAGES;
+	}
+
+	int res = posix_fallocate(shmid, POSIXSHM_LARGE_OFFSET(whichslot), (off_t)new_num_pages * POSIXSHM_PAGE_SIZE);
+	if(res != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to posix_fallocate %u pages, res = %d!", new_num_pages, res);
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return;
+	}
+
+	large_slot->num_pages = new_num_pages;
+}
+
+/* Return our mapping of the region of a large slot, map it again first if the region has grown since we mapped it */
+static void *map_large_posixshm(int shmid, uint32_t *mapped_num_pages, void **mapped_ptr, struct posixshm_large_slot *large_slot, int whichslot)
+{
+	if(*mapped_ptr != NULL && *mapped_num_pages == large_slot->num_pages)
+	{
+		return *mapped_ptr;
+	}
+
+	unmap_large_posixshm(mapped_num_pages, mapped_ptr);
+	if(large_slot->num_pages == 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Large slot has no region!");
+		return NULL;
+	}
+
+	void *shm_ptr = map_posixshm(shmid, (size_t)large_slot->num_pages * POSIXSHM_PAGE_SIZE, POSIXSHM_LARGE_OFFSET(whichslot));
+	if(shm_ptr == MAP_FAILED)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to mmap %u pages of large slot %d, errno = %d!", large_slot->num_pages, whichslot, errno);
+		return NULL;
+	}
+
+	*mapped_num_pages = large_slot->num_pages;
+	*mapped_ptr = shm_ptr;
+
+	return shm_ptr;
+}
+
+static void unmap_large_posixshm(uint32_t *mapped_num_pages, void **mapped_ptr)
+{
+	if(*mapped_ptr != NULL && munmap(*mapped_ptr, (size_t)*mapped_num_pages * POSIXSHM_PAGE_SIZE) == -1)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to munmap(large slot), errno = %d!", errno);
+	}
+
+	*mapped_num_pages = 0;
+	*mapped_ptr = NULL;
+}
+
+/* Regions only grow while senders reuse them, so one grown beyond POSIXSHM_LARGE_TRIM_PAGES for a rare huge message is
+dropped once a message of a quarter of it or less has gone through. Punching the hole frees its pages also under the
+mappings of senders, the next sender sets up a region of the size it needs */
+static void trim_large_posixshm(int whichslot)
+{
+	struct posixshm_large_slot *large_slot = &posixshm_inst.my_shm_ptr->large_slots[whichslot];
+
+	if(large_slot->num_pages <= POSIXSHM_LARGE_TRIM_PAGES || large_slot->used_pages * 4 > large_slot->num_pages)
+	{
+		return;
+	}
+
+	TPT_TRACE(TRACE_INFO, "Trimming large slot %d of %u pages, %u used", whichslot, large_slot->num_pages, large_slot->used_pages);
+	unmap_large_posixshm(&posixshm_inst.my_large_num_pages[whichslot], &posixshm_inst.my_large_shm_ptr[whichslot]);
+	if(fallocate(posixshm_inst.my_shmid, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, POSIXSHM_LARGE_OFFSET(whichslot),
+		     (off_t)large_slot->num_pages * POSIXSHM_PAGE_SIZE) == -1)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to punch large slot %d, errno = %d!", whichslot, errno);
+	}
+
+	large_slot->num_pages = 0;
+	large_slot->used_pages = 0;
+}
+
 static void release_posixshm_contactlist()
 {
 	for(int i = 0; i < MAX_SUPPORTED_PROCESSES; ++i)
@@ -986,39 +1208,48 @@ static void release_posixshm_contactlist()
 		{
 			if(munmap(posixshm_inst.posixshm_cl[i].metadata, POSIXSHM_STATIC_ALLOC_PAGES * POSIXSHM_PAGE_SIZE) == -1)
 			{
-				TPT_TRACE(TRACE_ERROR, "Failed to munmap(POSIXSHM_STATIC_ALLOC_PAGES + num_unlimit_pages), errno = %d!", errno);
+				TPT_TRACE(TRACE_ERROR, "Failed to munmap(POSIXSHM_STATIC_ALLOC_PAGES), errno = %d!", errno);
 				return;
 			}
 
-			if (close(posixshm_inst.posixshm_cl[i].posixshm_id) == -1) {
-				TPT_TRACE(TRACE_ERROR, "Failed to close, my_shmid = %d, errno = %d!", posixshm_inst.my_shmid, errno);
-			}
-
-			if(sem_close(posixshm_inst.posixshm_cl[i].m_sem_mutex) == -1)
+			for(int j = 0; j < NUM_SLOTS_POOL_UNLIMIT; ++j)
 			{
-				TPT_TRACE(TRACE_ERROR, "Failed to sem_close, m_sem_mutex, errno = %d!", errno);
+				unmap_large_posixshm(&posixshm_inst.posixshm_cl[i].large_num_pages[j], &posixshm_inst.posixshm_cl[i].large_shm_ptr[j]);
 			}
 
-			if(sem_close(posixshm_inst.posixshm_cl[i].m_sem_notify) == -1)
-			{
-				TPT_TRACE(TRACE_ERROR, "Failed to sem_close, m_sem_notify, errno = %d!", errno);
-			}
-
-			if(sem_close(posixshm_inst.posixshm_cl[i].m_sem_slot) == -1)
-			{
-				TPT_TRACE(TRACE_ERROR, "Failed to sem_close, m_sem_slot, errno = %d!", errno);
+			if (close(posixshm_inst.posixshm_cl[i].posixshm_id) == -1) {
+				TPT_TRACE(TRACE_ERROR, "Failed to close, my_shmid = %d, errno = %d!", posixshm_inst.my_shmid, errno);
 			}
 
 			posixshm_inst.posixshm_cl[i].mbox_id_in_itccoord = 0;
 			posixshm_inst.posixshm_cl[i].posixshm_id = 0;
-			posixshm_inst.posixshm_cl[i].m_sem_mutex = 0;
-			posixshm_inst.posixshm_cl[i].m_sem_notify = 0;
-			posixshm_inst.posixshm_cl[i].m_sem_slot = 0;
 			posixshm_inst.posixshm_cl[i].metadata = NULL;
 		}
 	}
 }
 
+/* Every mapping of a segment goes through here. With ITC_PREFAULT_SHM pages are faulted in by MAP_POPULATE and locked,
+so copying a message into or out of the segment, including the regions of large slots, does not take
+page faults while the slot is held. Locking is best effort, munmap() unlocks. */
+static void *map_posixshm(int shmid, size_t size, off_t offset)
+{
+	void *shm_ptr;
+
+	if(!posixshm_inst.prefault)
+	{
+		return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shmid, offset);
+	}
+
+	shm_ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, shmid, offset);
+	if(shm_ptr != MAP_FAILED && mlock(shm_ptr, size) == -1 && !posixshm_inst.mlock_failed)
+	{
+		TPT_TRACE(TRACE_ABN, "Failed to mlock %zu bytes, errno = %d, only prefault shared memory from now on!", size, errno);
+		posixshm_inst.mlock_failed = true;
+	}
+
+	return shm_ptr;
+}
+
 
 
 
@@ -13,8 +13,11 @@
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
 #include <search.h>
 
 #include "itc.h"
@@ -31,10 +34,58 @@
 *******************************************************************************/
 #define ITC_SYSV_MSG_BASE	(ITC_MSG_BASE + 0x100)
 #define ITC_SYSV_MSQ_TX_MSG	(ITC_SYSV_MSG_BASE + 1)
+/* Received messages up to this wire size are copied out into a right-sized itc_msg, larger ones take over the rx buffer */
+#define SYSVMQ_RX_COPYBREAK	1024
+
+/* Messages to an ITC_DIRECT_IPC_RX mailbox carry an mtype of their own above ITC_SYSV_MSQ_TX_MSG, which the rx thread
+never asks msgrcv() for. Which mailboxes of a process want that is published in a bitmap file per message queue. */
+#define SYSVMQ_DIRECT_MTYPE(mbox_id)	(ITC_SYSV_MSQ_TX_MSG + 1 + (long)((mbox_id) & ~sysvmq_inst.itccoord_mask))
+#define SYSVMQ_DIRECT_MAP_SIZE		(((size_t)~sysvmq_inst.itccoord_mask + 1) / 8)
+/* Messages being reassembled at a time per receiver, beyond that a new one is rejected. One that has not seen a fragment for
+SYSVMQ_REASM_TMO ms, e.g. because its sender died or failed in the middle of it, is dropped as soon as another fragment comes in. */
+#define SYSVMQ_MAX_REASSEMBLIES		32
+#define SYSVMQ_REASM_TMO		1000
+/* A sender that saw the bit of a mailbox just before it was deleted may still put a message on its mtype. That long after
+the delete the own mtype is drained once more, unless the mailbox id is in use again by then. */
+#define SYSVMQ_LATE_DRAIN_MS		1000
 
 struct sysvmq_contactlist {
 	itc_mbox_id_t	mbox_id_in_itccoord;
 	int		sysvmq_id;
+	const uint8_t*	direct_map; // ITC_DIRECT_IPC_RX bitmap of the receiver process, NULL if not there
+};
+
+/* Messages above the kernel limit go as a train of fragments with the same mtype, so they stay in order. Each one carries
+a slice of the wire image of the message behind this header, the first slice holds the itc_message header. */
+struct sysvmq_frag_hdr {
+	uint32_t	flags; // ITC_FLAGS_MSG_FRAGMENT, where an itc_message has its flags
+	uint32_t	msg_id; // Per sending process
+	itc_mbox_id_t	src; // mbox_id_in_itccoord of the sending process
+	uint32_t	offset; // Of the slice in the wire image
+	uint32_t	total; // Wire size of the whole message
+	uint32_t	reserved; // Keep slices 8-byte aligned
+};
+
+/* A message whose fragments are still coming in, pre-sized to the whole message at the first one */
+struct sysvmq_reasm {
+	struct sysvmq_reasm*	next;
+	itc_mbox_id_t		src;
+	uint32_t		msg_id;
+	uint32_t		total;
+	uint32_t		received;
+	struct timespec		last; // CLOCK_MONOTONIC, when the latest fragment came in
+	struct itc_message*	message;
+};
+
+/* Per mailbox state of an ITC_DIRECT_IPC_RX mailbox, owned by its thread */
+struct sysvmq_direct_rx {
+	char*		rx_buffer; // Same as sysvmq_instance.rx_buffer
+	struct sysvmq_reasm*	reasm; // Same as sysvmq_instance.reasm
+	struct sysvmq_direct_rx*	next_armed; // In sysvmq_instance.armed while the owner waits with a timeout
+	struct timespec		deadline; // CLOCK_MONOTONIC, when the kicker gets the owner out of msgrcv()
+	itc_mbox_id_t		mbox_id;
+	bool			is_armed;
+	bool			is_retired; // Mailbox deleted, the kicker drains its mtype at deadline and frees us
 };
 
 struct sysvmq_instance {
@@ -52,7 +103,17 @@ struct sysvmq_instance {
 	int				is_initialized;
 	int				is_terminated;
 	long				max_msgsize;
-	char*				rx_buffer;
+	char*				rx_buffer; // mtype + itc_message, the itc_message is an itc_alloc()ed one of the largest size
+	uint8_t*			direct_map; // ITC_DIRECT_IPC_RX bitmap of our own mailboxes, shared with senders
+	struct sysvmq_reasm*		reasm; // Fragmented messages the rx thread is reassembling
+	uint32_t			next_frag_id;
+
+	pthread_mutex_t			kick_mtx; // Protects armed and the kicker, and the late drain against a new owner
+	pthread_cond_t			kick_cond;
+	pthread_t			kicker; // One thread kicks all ITC_DIRECT_IPC_RX owners whose itc_receive() times out
+	bool				has_kicker;
+	bool				stop_kicker;
+	struct sysvmq_direct_rx*	armed;
 
 	struct sysvmq_contactlist	sysvmq_cl[MAX_SUPPORTED_PROCESSES];
 };
@@ -78,6 +139,31 @@ static void add_sysvmq_cl(struct result_code* rc, struct sysvmq_contactlist* cl,
 static int get_sysvmq_id(struct result_code* rc, itc_mbox_id_t mbox_id);
 static void remove_sysvmq_cl(struct result_code* rc, itc_mbox_id_t mbox_id);
 static void forward_sysvmq_msg(struct result_code* rc, char* buffer, int length, int msqid);
+static long read_msgmax(struct result_code* rc);
+static void send_msq(struct result_code* rc, struct sysvmq_contactlist* cl, itc_mbox_id_t to, long* txmsg, int size);
+static void send_fragments(struct result_code* rc, struct sysvmq_contactlist* cl, itc_mbox_id_t to, long mtype, char* wire, size_t size);
+static struct itc_message* check_rx_msg(char* buffer, long length);
+static struct itc_message* take_rx_msg(char** buffer);
+static bool is_fragment(char* buffer, long length);
+static struct itc_message* reassemble(struct sysvmq_reasm** pending, char* buffer, long length);
+static void drop_reassemblies(struct sysvmq_reasm** pending, bool give_back);
+static void drop_stale_reassemblies(struct sysvmq_reasm** pending, const struct timespec *now);
+static struct itc_message* take_direct_rx_msg(struct itc_mailbox *mbox, long length);
+static void free_rx_msg(struct itc_message* message);
+static uint8_t* create_direct_map(int proj_id);
+static const uint8_t* map_direct_map(itc_mbox_id_t mbox_id);
+static void drain_direct_rx(itc_mbox_id_t mbox_id);
+static void kick_direct_rx(itc_mbox_id_t mbox_id);
+static bool arm_kick(struct sysvmq_direct_rx* direct_rx, const struct timespec *ts);
+static bool start_kicker(void);
+static void retire_direct_rx(struct sysvmq_direct_rx* direct_rx);
+static void cancel_late_drain(itc_mbox_id_t mbox_id);
+static void disarm_kick(struct sysvmq_direct_rx* direct_rx);
+static void unlink_armed(struct sysvmq_direct_rx* direct_rx);
+static void stop_kicker(void);
+static void* sysvmq_kicker(void *data);
+static char* alloc_rx_buffer(void);
+static void free_rx_buffer(char* buffer);
 static void rxthread_destructor(void* data);
 
 
@@ -92,21 +178,33 @@ static void sysvmq_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itcc
 static void sysvmq_exit(struct result_code* rc);
 
 
+static void sysvmq_create_mailbox(struct result_code* rc, struct itc_mailbox *mbox, uint32_t flags);
+
+static void sysvmq_delete_mailbox(struct result_code* rc, struct itc_mailbox *mbox);
+
 static void sysvmq_send(struct result_code* rc, struct itc_message *message, itc_mbox_id_t to);
 
+static struct itc_message *sysvmq_receive(struct result_code* rc, struct itc_mailbox *my_mbox);
+
 static long sysvmq_maxmsgsize(struct result_code* rc);
 
+static struct itc_message *sysvmq_wait(struct result_code* rc, struct itc_mailbox *my_mbox, const struct timespec *ts);
+
+static void sysvmq_wakeup(struct result_code* rc, struct itc_mailbox *mbox);
+
 static void* sysvmq_rx_thread(void *data);
 
 struct itci_transport_apis sysvmq_trans_apis = { NULL,
                                             	sysvmq_init,
                                             	sysvmq_exit,
-                                            	NULL,
-                                            	NULL,
+                                            	sysvmq_create_mailbox,
+                                            	sysvmq_delete_mailbox,
                                             	sysvmq_send,
+                                            	sysvmq_receive,
                                             	NULL,
-                                            	NULL,
-                                            	sysvmq_maxmsgsize };
+                                            	sysvmq_maxmsgsize,
+                                            	sysvmq_wait,
+                                            	sysvmq_wakeup };
 
 
 
@@ -130,7 +228,7 @@ void sysvmq_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itccoord, i
 				TPT_TRACE(TRACE_ERROR, "Failed to release_sysvmq_resources!");
 				return;
 			}
-			(void)sysvmq_maxmsgsize(rc);
+			(void)read_msgmax(rc);
 		} else
 		{
 			TPT_TRACE(TRACE_INFO, "Already initialized!");
@@ -179,6 +277,23 @@ void sysvmq_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itccoord, i
 		return;
 	}
 
+	/* Deadlines are CLOCK_MONOTONIC ones, as everywhere in itc_receive() */
+	pthread_condattr_t cond_attr;
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	ret = pthread_mutex_init(&sysvmq_inst.kick_mtx, NULL);
+	if(ret == 0)
+	{
+		ret = pthread_cond_init(&sysvmq_inst.kick_cond, &cond_attr);
+	}
+	pthread_condattr_destroy(&cond_attr);
+	if(ret != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to init kick_mtx or kick_cond, error code = %d", ret);
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return;
+	}
+
 	add_itcthread(rc, sysvmq_rx_thread, NULL, true, &sysvmq_inst.thread_mtx);
 }
 
@@ -191,6 +306,17 @@ static void sysvmq_exit(struct result_code* rc)
 		return;
 	}
 
+	stop_kicker();
+	while(sysvmq_inst.armed != NULL)
+	{
+		/* Only retired ones are left once all mailboxes are gone */
+		struct sysvmq_direct_rx* retired = sysvmq_inst.armed;
+		sysvmq_inst.armed = retired->next_armed;
+		free(retired);
+	}
+	pthread_cond_destroy(&sysvmq_inst.kick_cond);
+	pthread_mutex_destroy(&sysvmq_inst.kick_mtx);
+
 	int ret = pthread_mutex_destroy(&sysvmq_inst.thread_mtx);
 	if(ret != 0)
 	{
@@ -207,32 +333,82 @@ static void sysvmq_exit(struct result_code* rc)
 		return;
 	}
 
+	for(int i = 0; i < MAX_SUPPORTED_PROCESSES; i++)
+	{
+		if(sysvmq_inst.sysvmq_cl[i].direct_map != NULL)
+		{
+			munmap((void*)sysvmq_inst.sysvmq_cl[i].direct_map, SYSVMQ_DIRECT_MAP_SIZE);
+		}
+	}
+
 	memset(&sysvmq_inst, 0, sizeof(struct sysvmq_instance));
 }
 
+/* Larger messages are fragmented, so like the shared memory transports there is no limit of our own */
 static long sysvmq_maxmsgsize(struct result_code* rc)
 {
-	// struct msginfo from <bits/msg.h> included in <sys/msg.h>
-	struct msginfo info;
+	(void)read_msgmax(rc);
+	return 0;
+}
 
-	if(sysvmq_inst.max_msgsize > 0)
+static void sysvmq_create_mailbox(struct result_code* rc, struct itc_mailbox *mbox, uint32_t flags)
+{
+	(void)rc;
+	(void)flags;
+	struct sysvmq_direct_rx* direct_rx;
+
+	mbox->trans_rx = NULL;
+	if(!sysvmq_inst.is_initialized || sysvmq_inst.my_sysvmq_id == -1)
 	{
-		TPT_TRACE(TRACE_INFO, "Return already read max msg size, %u bytes!", sysvmq_inst.max_msgsize);
-		return sysvmq_inst.max_msgsize;
+		mbox->flags &= ~ITC_DIRECT_IPC_RX; // Rx thread is not up yet, nobody knows our message queue
+		return;
 	}
 
-	if(msgctl(0, IPC_INFO, (struct msqid_ds*)&info) == -1)
+	/* Whatever a previous owner of this mailbox id left behind is not for us */
+	cancel_late_drain(mbox->mbox_id);
+	drain_direct_rx(mbox->mbox_id);
+
+	if(!(mbox->flags & ITC_DIRECT_IPC_RX))
 	{
-		// ERROR tracing is needed only, no need to set result code
-		TPT_TRACE(TRACE_ABN, "Failed to msgctl()");
-		rc->flags |= ITC_SYSCALL_ERROR;
+		return;
 	}
 
-	int max_msgsize_tmp = MIN(info.msgmax, info.msgmnb);
-	sysvmq_inst.max_msgsize = (long)(max_msgsize_tmp < 0 ? 0 : max_msgsize_tmp);
+	direct_rx = (struct sysvmq_direct_rx*)calloc(1, sizeof(struct sysvmq_direct_rx));
+	if(sysvmq_inst.direct_map == NULL || direct_rx == NULL || (direct_rx->rx_buffer = alloc_rx_buffer()) == NULL)
+	{
+		TPT_TRACE(TRACE_ABN, "Failed to set up direct rx for mailbox 0x%08x, use sysvmq rx thread instead!", mbox->mbox_id);
+		free(direct_rx);
+		mbox->flags &= ~ITC_DIRECT_IPC_RX;
+		return;
+	}
 
-	TPT_TRACE(TRACE_INFO, "Retrieve max msg size successfully, %u bytes!", sysvmq_inst.max_msgsize);
-	return sysvmq_inst.max_msgsize;
+	direct_rx->mbox_id = mbox->mbox_id;
+	mbox->trans_rx = direct_rx;
+
+	itc_mbox_id_t index = mbox->mbox_id & ~sysvmq_inst.itccoord_mask;
+	__atomic_or_fetch(&sysvmq_inst.direct_map[index / 8], (uint8_t)(1 << (index % 8)), __ATOMIC_RELEASE);
+}
+
+static void sysvmq_delete_mailbox(struct result_code* rc, struct itc_mailbox *mbox)
+{
+	(void)rc;
+	struct sysvmq_direct_rx* direct_rx = (struct sysvmq_direct_rx*)mbox->trans_rx;
+
+	if(direct_rx == NULL)
+	{
+		return;
+	}
+
+	itc_mbox_id_t index = mbox->mbox_id & ~sysvmq_inst.itccoord_mask;
+	__atomic_and_fetch(&sysvmq_inst.direct_map[index / 8], (uint8_t)~(1 << (index % 8)), __ATOMIC_RELEASE);
+	drain_direct_rx(mbox->mbox_id);
+
+	disarm_kick(direct_rx);
+	drop_reassemblies(&direct_rx->reasm, true);
+	free_rx_buffer(direct_rx->rx_buffer);
+	direct_rx->rx_buffer = NULL;
+	retire_direct_rx(direct_rx);
+	mbox->trans_rx = NULL;
 }
 
 static void sysvmq_send(struct result_code* rc, struct itc_message *message, itc_mbox_id_t to)
@@ -241,6 +417,7 @@ static void sysvmq_send(struct result_code* rc, struct itc_message *message, itc
 	struct sysvmq_contactlist* cl;
 	int size;
 	long* txmsg;
+	long mtype;
 
 	if(!sysvmq_inst.is_initialized)
 	{
@@ -259,35 +436,55 @@ static void sysvmq_send(struct result_code* rc, struct itc_message *message, itc
 		return;
 	}
 
-	size = message->size + ITC_HEADER_SIZE + 1; // Will send ENDPOINT as well for sanity check on receiver side
-	txmsg = (long*)malloc(sizeof(long) + size);
-	*txmsg = ITC_SYSV_MSQ_TX_MSG;
-	memcpy((void*)(txmsg + 1), message, size);
-
-	while(msgsnd(cl->sysvmq_id, (void*)txmsg, size, MSG_NOERROR) == -1)
+	/* The mtype goes into the allocator headroom right in front of the message, so it is sent as it is. Only scatter-gather
+	messages, and any message if the build has no headroom for the mtype, are gathered into a temporary buffer. Fragments
+	are sent in place as well, see send_fragments(). */
+	size = itc_msg_wire_size(message); // Will send ENDPOINT as well for sanity check on receiver side
+	if((message->flags & ITC_FLAGS_MSG_SG) || ITC_MSG_HEADROOM < sizeof(long))
 	{
-		if(errno == EINTR)
-		{
-			continue;
-		} else if(errno == EINVAL || errno == EIDRM)
+		txmsg = (long*)malloc(sizeof(long) + size);
+		if(txmsg == NULL)
 		{
-			TPT_TRACE(TRACE_ABN, "MSG queue of receiver has corrupted and just re-created, add contact list and resend msg again!");
-			remove_sysvmq_cl(rc, to);
-			add_sysvmq_cl(rc, cl, to);
-			if(cl->mbox_id_in_itccoord == 0)
-			{
-				TPT_TRACE(TRACE_ERROR, "Add contact list again failed due to msq_key = -1!");
-				break;
-			}
-		} else
+			TPT_TRACE(TRACE_ERROR, "Failed to malloc tx buffer!");
+			rc->flags |= ITC_SYSCALL_ERROR;
+			return;
+		}
+		(void)itc_msg_gather(message, (void*)(txmsg + 1));
+	} else
+	{
+		txmsg = (long*)message - 1;
+	}
+
+	mtype = ITC_SYSV_MSQ_TX_MSG;
+	if(cl->direct_map != NULL)
+	{
+		itc_mbox_id_t index = to & ~sysvmq_inst.itccoord_mask;
+		if(__atomic_load_n(&cl->direct_map[index / 8], __ATOMIC_ACQUIRE) & (1 << (index % 8)))
 		{
-			// ERROR trace is needed here
-			TPT_TRACE(TRACE_ERROR, "Failed to msgsnd()");
-			rc->flags |= ITC_SYSCALL_ERROR; // Will not return here
+			mtype = SYSVMQ_DIRECT_MTYPE(to);
 		}
 	}
 
-	free(txmsg);
+	if(size > sysvmq_inst.max_msgsize - (long)sizeof(long))
+	{
+		send_fragments(rc, cl, to, mtype, (char*)(txmsg + 1), size);
+	} else
+	{
+		*txmsg = mtype;
+		send_msq(rc, cl, to, txmsg, size);
+	}
+
+	if(txmsg != (long*)message - 1)
+	{
+		free(txmsg);
+	}
+
+	if(rc->flags & ITC_SYSCALL_ERROR)
+	{
+		/* Like on ITC_QUEUE_NULL the message is left to the caller, who gives back its credit. A receiver that got some of
+		its fragments drops them without handing back a credit, see drop_stale_reassemblies(). */
+		return;
+	}
 
 #ifdef UNITTEST
 	free(message);
@@ -298,6 +495,105 @@ static void sysvmq_send(struct result_code* rc, struct itc_message *message, itc
 #endif
 }
 
+/* Called with rxq_mtx held, picks up what arrived for our own mtype. itc_receive() accounts it as queued. */
+static struct itc_message *sysvmq_receive(struct result_code* rc, struct itc_mailbox *my_mbox)
+{
+	(void)rc;
+	struct sysvmq_direct_rx* direct_rx = (struct sysvmq_direct_rx*)my_mbox->trans_rx;
+	struct itc_message* message;
+	ssize_t rx_len;
+
+	if(direct_rx == NULL)
+	{
+		return NULL;
+	}
+
+	for(;;)
+	{
+		rx_len = msgrcv(sysvmq_inst.my_sysvmq_id, direct_rx->rx_buffer, sysvmq_inst.max_msgsize - sizeof(long),
+				SYSVMQ_DIRECT_MTYPE(my_mbox->mbox_id), IPC_NOWAIT);
+		if(rx_len < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return NULL; // ENOMSG mostly
+		}
+
+		message = take_direct_rx_msg(my_mbox, rx_len + sizeof(long));
+		if(message == NULL)
+		{
+			continue; // Kicks of sysvmq_wakeup() and incomplete fragmented messages included
+		} else if(message->call_id & ITC_CALL_ID_REPLY)
+		{
+			/* Replies only count while itc_call() waits in sysvmq_wait(), this one is stale */
+			TPT_TRACE(TRACE_ABN, "Drop stale reply 0x%08x from 0x%08x to mailbox 0x%08x!", message->msgno, message->sender, my_mbox->mbox_id);
+			free_rx_msg(message);
+			continue;
+		}
+
+		my_mbox->p_rxq_info->rxq_len++;
+		return message;
+	}
+}
+
+/* Blocks in msgrcv() on our own mtype with rxq_mtx released. Returns NULL without setting rc when kicked, either by
+sysvmq_wakeup() or by the kicker thread once ts passes. */
+static struct itc_message *sysvmq_wait(struct result_code* rc, struct itc_mailbox *my_mbox, const struct timespec *ts)
+{
+	struct sysvmq_direct_rx* direct_rx = (struct sysvmq_direct_rx*)my_mbox->trans_rx;
+	struct itc_message* message = NULL;
+	ssize_t rx_len;
+
+	if(ts != NULL && !arm_kick(direct_rx, ts))
+	{
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return NULL;
+	}
+
+	for(;;)
+	{
+		rx_len = msgrcv(sysvmq_inst.my_sysvmq_id, direct_rx->rx_buffer, sysvmq_inst.max_msgsize - sizeof(long),
+				SYSVMQ_DIRECT_MTYPE(my_mbox->mbox_id), 0);
+		if(rx_len < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			TPT_TRACE(TRACE_ERROR, "Failed to msgrcv() for mailbox 0x%08x!", my_mbox->mbox_id);
+			rc->flags |= ITC_SYSCALL_ERROR;
+			break;
+		} else if(rx_len == 0)
+		{
+			break; // Kicked
+		}
+
+		message = take_direct_rx_msg(my_mbox, rx_len + sizeof(long));
+		if(message != NULL)
+		{
+			break;
+		}
+	}
+
+	if(ts != NULL)
+	{
+		disarm_kick(direct_rx);
+	}
+
+	return message;
+}
+
+/* Called with rxq_mtx of mbox held, a kick that arrives after the owner woke up for something else is skipped later on */
+static void sysvmq_wakeup(struct result_code* rc, struct itc_mailbox *mbox)
+{
+	(void)rc;
+
+	kick_direct_rx(mbox->mbox_id);
+}
+
 static void* sysvmq_rx_thread(void *data)
 {
 	(void)data;
@@ -326,7 +622,7 @@ static void* sysvmq_rx_thread(void *data)
 	// API itc_create_mailbox is an external interface, so do not care about it if everything we pass into it is all correct.
 	sysvmq_inst.my_mbox_id = 1;
 #else
-	sysvmq_inst.my_mbox_id = itc_create_mailbox(itc_mbox_name, ITC_NO_NAMESPACE);
+	sysvmq_inst.my_mbox_id = itc_create_mailbox(itc_mbox_name, ITC_NO_NAMESPACE | ITC_FLAGS_MBOX_FORWARDER);
 #endif
 
 	TPT_TRACE(TRACE_INFO, "Starting sysvmq_rx_thread %s...!", itc_mbox_name);
@@ -347,6 +643,9 @@ static void* sysvmq_rx_thread(void *data)
 		TPT_TRACE(TRACE_ERROR, "Failed to ftok");
 	}
 
+	/* Must be in place before senders can find our message queue, ITC_DIRECT_IPC_RX is just not available without it */
+	sysvmq_inst.direct_map = create_direct_map(proj_id);
+
 	sysvmq_inst.my_sysvmq_id = msgget(key, IPC_CREAT | 0666);
 	if(sysvmq_inst.my_sysvmq_id == -1)
 	{
@@ -382,8 +681,8 @@ static void* sysvmq_rx_thread(void *data)
 	}
 
 	rc_tmp = (struct result_code*)malloc(sizeof(struct result_code));
-	(void)sysvmq_maxmsgsize(rc_tmp);
-	sysvmq_inst.rx_buffer = malloc(sysvmq_inst.max_msgsize);
+	(void)read_msgmax(rc_tmp);
+	sysvmq_inst.rx_buffer = alloc_rx_buffer();
 	if(sysvmq_inst.rx_buffer == NULL)
 	{
 		// ERROR trace is needed here
@@ -391,7 +690,6 @@ static void* sysvmq_rx_thread(void *data)
 		free(rc_tmp);
 		return NULL;
 	}
-	memset(sysvmq_inst.rx_buffer, 0, sysvmq_inst.max_msgsize);
 
 	MUTEX_UNLOCK(&sysvmq_inst.thread_mtx);
 	free(rc_tmp);
@@ -404,7 +702,8 @@ static void* sysvmq_rx_thread(void *data)
 			break;
 		}
 
-		rx_len = msgrcv(sysvmq_inst.my_sysvmq_id, sysvmq_inst.rx_buffer, sysvmq_inst.max_msgsize - sizeof(long), 0, 0);
+		/* Everything above ITC_SYSV_MSQ_TX_MSG is left to the owners of ITC_DIRECT_IPC_RX mailboxes */
+		rx_len = msgrcv(sysvmq_inst.my_sysvmq_id, sysvmq_inst.rx_buffer, sysvmq_inst.max_msgsize - sizeof(long), -(long)ITC_SYSV_MSQ_TX_MSG, 0);
 		if(rx_len < 0)
 		{
 			if((errno == EIDRM || errno == EINVAL) && !repeat)
@@ -423,12 +722,6 @@ static void* sysvmq_rx_thread(void *data)
 			TPT_TRACE(TRACE_ERROR, "Negative rx message length, rx_len = %ld!", rx_len);
 		}
 
-		if(rx_len <= (long)(sizeof(long) + ITC_HEADER_SIZE))
-		{
-			TPT_TRACE(TRACE_ABN, "Received malform message from some mailbox, msg size too small (%ld)!", rx_len);
-			continue;
-		}
-
 		forward_sysvmq_msg(&rc_tmp_stack, sysvmq_inst.rx_buffer, rx_len + sizeof(long), sysvmq_inst.my_sysvmq_id);
 		repeat = 0;
 	}
@@ -567,6 +860,7 @@ static void add_sysvmq_cl(struct result_code* rc, struct sysvmq_contactlist* cl,
 	{
 		cl->mbox_id_in_itccoord = (mbox_id & sysvmq_inst.itccoord_mask);
 		cl->sysvmq_id = sysv_msqid;
+		cl->direct_map = map_direct_map(mbox_id);
 	} else
 	{
 		TPT_TRACE(TRACE_ERROR, "sysv_msqid = -1!");
@@ -614,72 +908,892 @@ static void remove_sysvmq_cl(struct result_code* rc, itc_mbox_id_t mbox_id)
 	struct sysvmq_contactlist* cl;
 
 	cl = find_cl(rc, mbox_id);
+	if(cl->direct_map != NULL)
+	{
+		munmap((void*)cl->direct_map, SYSVMQ_DIRECT_MAP_SIZE);
+		cl->direct_map = NULL;
+	}
 	cl->mbox_id_in_itccoord = 0;
 	cl->sysvmq_id = 0;
 }
 
 static void forward_sysvmq_msg(struct result_code* rc, char* buffer, int length, int msqid)
 {
-	(void)length;
 	(void)msqid;
 	(void)rc;
 
 	struct itc_message* message;
 	struct itc_message* rxmsg;
-	union itc_msg* msg;
-	uint16_t flags;
 
-	rxmsg = (struct itc_message*)(buffer + 8);
-
-	char *endpoint = (char*)((unsigned long)(&rxmsg->msgno) + rxmsg->size);
-	if(*endpoint != ENDPOINT)
+	if(is_fragment(buffer, length))
 	{
-		TPT_TRACE(TRACE_ABN, "Received malform message from some mailbox, invalid ENDPOINT 0x%02x!", *endpoint & 0xFF);
-		return;
-	}
+		message = reassemble(&sysvmq_inst.reasm, buffer, length);
+		if(message == NULL)
+		{
+			return; // More to come
+		}
+	} else
+	{
+		rxmsg = check_rx_msg(buffer, length);
+		if(rxmsg == NULL)
+		{
+			return;
+		}
 
-#ifdef UNITTEST
-	struct itc_message* tmp_message;
-	tmp_message = (struct itc_message *)malloc(rxmsg->size + ITC_HEADER_SIZE + 1);
-	tmp_message->flags = 0;
-	msg = CONVERT_TO_MSG(tmp_message);
-#else
-	msg = itc_alloc(rxmsg->size, 0);
+#ifndef UNITTEST
+		/* Receiver is blocked in itc_receive_into(), copy straight from our rx buffer and skip itc_alloc() + itc_send() */
+		if(itc_deliver_into_waiting_mbox(rxmsg))
+		{
+			return;
+		}
 #endif
 
-	message = CONVERT_TO_MESSAGE(msg);
-
-	flags = message->flags; // Saved flags
-	memcpy(message, rxmsg, (rxmsg->size + ITC_HEADER_SIZE + 1));
-	message->flags = flags; // Retored flags
+		message = take_rx_msg(&sysvmq_inst.rx_buffer);
+		if(message == NULL)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to allocate message, drop it, sender = 0x%08x!", rxmsg->sender);
+#ifndef UNITTEST
+			itc_credit_return(rxmsg);
+#endif
+			return;
+		}
+	}
 
 #ifdef UNITTEST
 	// Simulate that everything is ok at this point. Do nothing in unit test.
 	// API itc_send is an external interface, so do not care about it if everything we pass into it is all correct.
 	TPT_TRACE(TRACE_DEBUG, "ENTER UNITTEST!");
-	free(tmp_message);
+	free(message);
 #else
 
 	// TPT_TRACE(TRACE_INFO, "Forwarding a message to local mailbox from external mbox = 0x%08x", message->sender); // TBD
-	itc_send(&msg, message->receiver, ITC_MY_MBOX_ID, NULL);
+	if(!itc_deliver_local(message))
+	{
+		free_rx_msg(message);
+	}
 #endif
 }
 
-static void rxthread_destructor(void* data)
+/* Largest message, mtype included, that one msgsnd() takes */
+static long read_msgmax(struct result_code* rc)
 {
-	(void)data;
+	// struct msginfo from <bits/msg.h> included in <sys/msg.h>
+	struct msginfo info;
 
-	if(sysvmq_inst.my_sysvmq_id != -1)
+	if(sysvmq_inst.max_msgsize > 0)
 	{
-		sysvmq_inst.is_terminated = 1;
-		if(msgctl(sysvmq_inst.my_sysvmq_id, IPC_RMID, NULL) == -1)
+		TPT_TRACE(TRACE_INFO, "Return already read max msg size, %u bytes!", sysvmq_inst.max_msgsize);
+		return sysvmq_inst.max_msgsize;
+	}
+
+	if(msgctl(0, IPC_INFO, (struct msqid_ds*)&info) == -1)
+	{
+		// ERROR tracing is needed only, no need to set result code
+		TPT_TRACE(TRACE_ABN, "Failed to msgctl()");
+		rc->flags |= ITC_SYSCALL_ERROR;
+	}
+
+	int max_msgsize_tmp = MIN(info.msgmax, info.msgmnb);
+	sysvmq_inst.max_msgsize = (long)(max_msgsize_tmp < 0 ? 0 : max_msgsize_tmp);
+
+	TPT_TRACE(TRACE_INFO, "Retrieve max msg size successfully, %u bytes!", sysvmq_inst.max_msgsize);
+	return sysvmq_inst.max_msgsize;
+}
+
+static void send_msq(struct result_code* rc, struct sysvmq_contactlist* cl, itc_mbox_id_t to, long* txmsg, int size)
+{
+	while(msgsnd(cl->sysvmq_id, (void*)txmsg, size, MSG_NOERROR) == -1)
+	{
+		if(errno == EINTR)
+		{
+			continue;
+		} else if(errno == EINVAL || errno == EIDRM)
+		{
+			TPT_TRACE(TRACE_ABN, "MSG queue of receiver has corrupted and just re-created, add contact list and resend msg again!");
+			remove_sysvmq_cl(rc, to);
+			add_sysvmq_cl(rc, cl, to);
+			if(cl->mbox_id_in_itccoord == 0)
+			{
+				TPT_TRACE(TRACE_ERROR, "Add contact list again failed due to msq_key = -1!");
+				break;
+			}
+		} else
 		{
 			// ERROR trace is needed here
-			TPT_TRACE(TRACE_ERROR, "Failed to msgctl");
+			TPT_TRACE(TRACE_ERROR, "Failed to msgsnd(), errno = %d!", errno);
+			rc->flags |= ITC_SYSCALL_ERROR;
+			break;
 		}
-		sysvmq_inst.my_sysvmq_id = -1;
 	}
+}
+
+/* Sends the wire image of size bytes as fragments of the largest size msgsnd() takes, each one as soon as the one before
+is in the queue, so the receiver copies one out while the next is copied in. The first fragment is built in a buffer of
+its own. Every later one is sent in place, its mtype and header borrow the tail of the slice before, which is sent
+already, and put it back afterwards. Returns whether the first fragment went out. */
+static void send_fragments(struct result_code* rc, struct sysvmq_contactlist* cl, itc_mbox_id_t to, long mtype, char* wire, size_t size)
+{
+	char saved[sizeof(long) + sizeof(struct sysvmq_frag_hdr)];
+	struct sysvmq_frag_hdr hdr;
+	size_t slice, len;
+	char* first;
+	char* frag;
+
+	slice = (sysvmq_inst.max_msgsize - sizeof(long) - sizeof(struct sysvmq_frag_hdr)) & ~7UL;
+	first = (char*)malloc(sizeof(long) + sizeof(struct sysvmq_frag_hdr) + slice);
+	if(first == NULL)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to malloc first fragment!");
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return;
+	}
+
+	hdr.flags = ITC_FLAGS_MSG_FRAGMENT;
+	hdr.msg_id = __atomic_add_fetch(&sysvmq_inst.next_frag_id, 1, __ATOMIC_RELAXED);
+	hdr.src = sysvmq_inst.my_mbox_id_in_itccoord;
+	hdr.total = (uint32_t)size;
+	hdr.reserved = 0;
 
-	free(sysvmq_inst.rx_buffer);
+	for(size_t offset = 0; offset < size; offset += len)
+	{
+		len = MIN(slice, size - offset);
+		if(offset == 0)
+		{
+			frag = first;
+			memcpy(frag + sizeof(long) + sizeof(struct sysvmq_frag_hdr), wire, len);
+		} else
+		{
+			frag = wire + offset - sizeof(saved);
+			memcpy(saved, frag, sizeof(saved));
+		}
+
+		hdr.offset = (uint32_t)offset;
+		memcpy(frag, &mtype, sizeof(long));
+		memcpy(frag + sizeof(long), &hdr, sizeof(struct sysvmq_frag_hdr));
+
+		send_msq(rc, cl, to, (long*)frag, (int)(sizeof(struct sysvmq_frag_hdr) + len));
+		if(frag != first)
+		{
+			memcpy(frag, saved, sizeof(saved));
+		}
+		if(rc->flags & ITC_SYSCALL_ERROR)
+		{
+			break;
+		}
+	}
+
+	free(first);
+}
+
+/* Returns the itc_message in a received buffer of length bytes, mtype included, or NULL if it is malformed. Zero-length
+kicks of sysvmq_wakeup() are not traced. */
+static struct itc_message* check_rx_msg(char* buffer, long length)
+{
+	struct itc_message* rxmsg;
+
+	if(length <= (long)(sizeof(long) + ITC_HEADER_SIZE))
+	{
+		if(length != (long)sizeof(long))
+		{
+			TPT_TRACE(TRACE_ABN, "Received malform message from some mailbox, msg size too small (%ld)!", length - (long)sizeof(long));
+		}
+		return NULL;
+	}
+
+	rxmsg = (struct itc_message*)(buffer + sizeof(long));
+	if((long)rxmsg->size + ITC_HEADER_SIZE + 1 > length - (long)sizeof(long))
+	{
+		TPT_TRACE(TRACE_ABN, "Received malform message from some mailbox, size %u exceeds received length %ld!", rxmsg->size, length);
+		return NULL;
+	}
+
+	char *endpoint = (char*)((unsigned long)(&rxmsg->msgno) + rxmsg->size);
+	if(*endpoint != ENDPOINT)
+	{
+		TPT_TRACE(TRACE_ABN, "Received malform message from some mailbox, invalid ENDPOINT 0x%02x!", *endpoint & 0xFF);
+		return NULL;
+	}
+
+	return rxmsg;
+}
+
+/* Turns the checked message in *buffer into one the caller owns. Small ones are copied out, a large one stays where
+msgrcv() put it and *buffer is replaced by a fresh rx buffer. */
+static struct itc_message* take_rx_msg(char** buffer)
+{
+	struct itc_message* rxmsg = (struct itc_message*)(*buffer + sizeof(long));
+	struct itc_message* message;
+	union itc_msg* msg;
+	uint16_t flags;
+
+#ifdef UNITTEST
+	message = (struct itc_message *)malloc(rxmsg->size + ITC_HEADER_SIZE + 1);
+	if(message == NULL)
+	{
+		return NULL;
+	}
+	message->flags = 0;
+	(void)msg;
+#else
+	char* new_buffer = (rxmsg->size + ITC_HEADER_SIZE + 1 > SYSVMQ_RX_COPYBREAK) ? alloc_rx_buffer() : NULL;
+	if(new_buffer != NULL)
+	{
+		*buffer = new_buffer;
+		rxmsg->flags = 0; // As itc_alloc() left them, the flags of the sender side mean nothing here
+		return rxmsg;
+	}
+
+	msg = itc_alloc(rxmsg->size, 0);
+	if(msg == NULL)
+	{
+		return NULL;
+	}
+	message = CONVERT_TO_MESSAGE(msg);
+#endif
+
+	flags = message->flags; // Saved flags
+	memcpy(message, rxmsg, (rxmsg->size + ITC_HEADER_SIZE + 1));
+	message->flags = flags; // Retored flags
+
+	return message;
+}
+
+static bool is_fragment(char* buffer, long length)
+{
+	return length >= (long)(sizeof(long) + sizeof(struct sysvmq_frag_hdr)) &&
+	       (((struct sysvmq_frag_hdr*)(buffer + sizeof(long)))->flags & ITC_FLAGS_MSG_FRAGMENT);
+}
+
+/* Copies a received fragment into its message and returns the message once the last fragment is in, NULL before that or
+if the fragment is dropped. Fragments of one message arrive in order, those of different messages interleave. */
+static struct itc_message* reassemble(struct sysvmq_reasm** pending, char* buffer, long length)
+{
+	struct sysvmq_frag_hdr* hdr = (struct sysvmq_frag_hdr*)(buffer + sizeof(long));
+	char* data = (char*)(hdr + 1);
+	size_t len = length - sizeof(long) - sizeof(struct sysvmq_frag_hdr);
+	struct sysvmq_reasm** iter = pending;
+	struct sysvmq_reasm* reasm = NULL;
+	struct itc_message* message;
+	uint32_t nr_pending = 0;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for(struct sysvmq_reasm** it = pending; *it != NULL; it = &(*it)->next)
+	{
+		if((*it)->src == hdr->src && (*it)->msg_id == hdr->msg_id)
+		{
+			/* Not stale, this is what it waited for */
+			(*it)->last = now;
+			reasm = *it;
+		}
+	}
+	drop_stale_reassemblies(pending, &now);
+
+	for(; *iter != NULL; iter = &(*iter)->next)
+	{
+		if(*iter == reasm)
+		{
+			break;
+		}
+		nr_pending++;
+	}
+
+	if(reasm == NULL)
+	{
+		struct itc_message* head = (struct itc_message*)data;
+
+		if(hdr->offset != 0 || len < ITC_HEADER_SIZE || hdr->total > ITC_MAX_MSGSIZE + ITC_HEADER_SIZE + 1 ||
+		   (uint64_t)head->size + ITC_HEADER_SIZE + 1 != hdr->total || len > hdr->total)
+		{
+			TPT_TRACE(TRACE_ABN, "Drop fragment of message %u from process 0x%08x, offset %u of %u!", hdr->msg_id, hdr->src, hdr->offset, hdr->total);
+			return NULL;
+		}
+
+		if(nr_pending >= SYSVMQ_MAX_REASSEMBLIES)
+		{
+			/* The rest of its fragments are dropped as they come, there is no way back to the sender */
+			TPT_TRACE(TRACE_ERROR, "Too many messages being reassembled, reject message %u from process 0x%08x!", hdr->msg_id, hdr->src);
+#ifndef UNITTEST
+			itc_credit_return(head);
+#endif
+			return NULL;
+		}
+
+		reasm = (struct sysvmq_reasm*)malloc(sizeof(struct sysvmq_reasm));
+#ifdef UNITTEST
+		message = (struct itc_message*)malloc(hdr->total);
+		if(message != NULL)
+		{
+			message->flags = 0;
+		}
+#else
+		union itc_msg* msg = itc_alloc(head->size, 0);
+		message = (msg != NULL) ? CONVERT_TO_MESSAGE(msg) : NULL;
+#endif
+		if(reasm == NULL || message == NULL)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to allocate %u bytes for fragmented message, drop it!", hdr->total);
+#ifndef UNITTEST
+			itc_credit_return(head);
+#endif
+			free(reasm);
+			free_rx_msg(message);
+			return NULL;
+		}
+
+		reasm->src = hdr->src;
+		reasm->msg_id = hdr->msg_id;
+		reasm->total = hdr->total;
+		reasm->received = 0;
+		reasm->message = message;
+		reasm->next = *pending;
+		*pending = reasm;
+		iter = pending;
+	}
+
+	if(hdr->offset != reasm->received || hdr->total != reasm->total || len > reasm->total - reasm->received)
+	{
+		TPT_TRACE(TRACE_ABN, "Fragment of message %u from process 0x%08x out of order, drop the message!", hdr->msg_id, hdr->src);
+		*iter = reasm->next;
+		reasm->next = NULL;
+		drop_reassemblies(&reasm, false);
+		return NULL;
+	}
+
+	message = reasm->message;
+	if(hdr->offset == 0)
+	{
+		uint32_t flags = message->flags; // Saved flags
+		memcpy(message, data, len);
+		message->flags = flags; // Restored flags
+	} else
+	{
+		memcpy((char*)message + hdr->offset, data, len);
+	}
+
+	reasm->received += len;
+	reasm->last = now;
+	if(reasm->received < reasm->total)
+	{
+		return NULL;
+	}
+
+	*iter = reasm->next;
+	free(reasm);
+
+	/* The whole message holds one credit, handed back once it is delivered or dropped, see drop_reassemblies() */
+	if(*((char*)&message->msgno + message->size) != ENDPOINT)
+	{
+		TPT_TRACE(TRACE_ABN, "Reassembled message from 0x%08x has an invalid ENDPOINT, drop it!", message->sender);
+#ifndef UNITTEST
+		itc_credit_return(message);
+#endif
+		free_rx_msg(message);
+		return NULL;
+	}
+
+	return message;
+}
+
+/* With give_back the sender took its message as sent and the credit is handed back, its header is in. Otherwise the
+sender is gone or its send failed, and it gave back the credit itself. */
+static void drop_reassemblies(struct sysvmq_reasm** pending, bool give_back)
+{
+	while(*pending != NULL)
+	{
+		struct sysvmq_reasm* reasm = *pending;
+
+		*pending = reasm->next;
+#ifndef UNITTEST
+		if(give_back && reasm->received != 0)
+		{
+			itc_credit_return(reasm->message);
+		}
+#else
+		(void)give_back;
+#endif
+		/* Whatever is still missing includes the ENDPOINT, which itc_free() wants to see */
+		*((char*)&reasm->message->msgno + reasm->message->size) = ENDPOINT;
+		free_rx_msg(reasm->message);
+		free(reasm);
+	}
+}
+
+static void drop_stale_reassemblies(struct sysvmq_reasm** pending, const struct timespec *now)
+{
+	struct sysvmq_reasm** iter = pending;
+
+	while(*iter != NULL)
+	{
+		struct sysvmq_reasm* stale = *iter;
+
+		if(calc_time_diff(stale->last, *now) < SYSVMQ_REASM_TMO * 1000000UL)
+		{
+			iter = &stale->next;
+			continue;
+		}
+
+		TPT_TRACE(TRACE_ABN, "No fragment of message %u from process 0x%08x for %d ms, drop it!", stale->msg_id, stale->src, SYSVMQ_REASM_TMO);
+		*iter = stale->next;
+		stale->next = NULL;
+		drop_reassemblies(&stale, false);
+	}
+}
+
+/* Takes over what an ITC_DIRECT_IPC_RX mailbox received into its rx buffer, NULL if it is nothing (yet) */
+static struct itc_message* take_direct_rx_msg(struct itc_mailbox *mbox, long length)
+{
+	struct sysvmq_direct_rx* direct_rx = (struct sysvmq_direct_rx*)mbox->trans_rx;
+	struct itc_message* message;
+
+	if(is_fragment(direct_rx->rx_buffer, length))
+	{
+		message = reassemble(&direct_rx->reasm, direct_rx->rx_buffer, length);
+#ifndef UNITTEST
+		if(message != NULL)
+		{
+			itc_credit_return(message);
+		}
+#endif
+		if(message != NULL && message->receiver != mbox->mbox_id)
+		{
+			TPT_TRACE(TRACE_ABN, "Drop message 0x%08x from 0x%08x, not for mailbox 0x%08x!", message->msgno, message->sender, mbox->mbox_id);
+			free_rx_msg(message);
+			return NULL;
+		}
+		return message;
+	}
+
+	message = check_rx_msg(direct_rx->rx_buffer, length);
+	if(message == NULL)
+	{
+		return NULL;
+	}
+
+#ifndef UNITTEST
+	itc_credit_return(message);
+#endif
+	if(message->receiver != mbox->mbox_id)
+	{
+		TPT_TRACE(TRACE_ABN, "Drop message 0x%08x from 0x%08x, not for mailbox 0x%08x!", message->msgno, message->sender, mbox->mbox_id);
+		return NULL;
+	}
+
+	return take_rx_msg(&direct_rx->rx_buffer);
+}
+
+static void free_rx_msg(struct itc_message* message)
+{
+	if(message == NULL)
+	{
+		return;
+	}
+
+#ifdef UNITTEST
+	free(message);
+#else
+	union itc_msg* msg = CONVERT_TO_MSG(message);
+	itc_free(&msg);
+#endif
+}
+
+/* Returns where msgrcv() puts the mtype, the itc_message behind it is a valid itc_alloc()ed one that can be handed over */
+static char* alloc_rx_buffer(void)
+{
+#ifdef UNITTEST
+	char* buffer = (char*)malloc(sysvmq_inst.max_msgsize);
+	return buffer;
+#else
+	union itc_msg* msg = itc_alloc(sysvmq_inst.max_msgsize - sizeof(long) - ITC_HEADER_SIZE - 1, 0);
+	if(msg == NULL)
+	{
+		return NULL;
+	}
+
+	/* The mtype lands in the allocator headroom in front of the itc_message */
+	return (char*)CONVERT_TO_MESSAGE(msg) - sizeof(long);
+#endif
+}
+
+static void free_rx_buffer(char* buffer)
+{
+#ifdef UNITTEST
+	free(buffer);
+#else
+	struct itc_message* message = (struct itc_message*)(buffer + sizeof(long));
+	union itc_msg* msg = CONVERT_TO_MSG(message);
+
+	/* Whatever was received last is overwritten by what itc_alloc() set up, so that itc_free() accepts it */
+	message->flags = 0;
+	message->size = sysvmq_inst.max_msgsize - sizeof(long) - ITC_HEADER_SIZE - 1;
+	*((char*)&message->msgno + message->size) = ENDPOINT;
+	itc_free(&msg);
+#endif
+}
+
+/* The bitmap file of a message queue outlives it, so a process that gets the same project id later on takes over the
+mapping other processes may still have of it. It is cleared instead of truncated, which would SIGBUS them. */
+static uint8_t* create_direct_map(int proj_id)
+{
+	char path[64];
+	void* map;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s%d", ITC_SYSVMSQ_DIRECT_FILENAME, proj_id);
+	fd = open(path, O_CREAT | O_RDWR, 0666);
+	if(fd == -1)
+	{
+		TPT_TRACE(TRACE_ABN, "Failed to open %s, ITC_DIRECT_IPC_RX is not available!", path);
+		return NULL;
+	}
+
+	(void)fchmod(fd, 0666);
+	if(ftruncate(fd, SYSVMQ_DIRECT_MAP_SIZE) == -1)
+	{
+		TPT_TRACE(TRACE_ABN, "Failed to ftruncate %s, ITC_DIRECT_IPC_RX is not available!", path);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, SYSVMQ_DIRECT_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		TPT_TRACE(TRACE_ABN, "Failed to mmap %s, ITC_DIRECT_IPC_RX is not available!", path);
+		return NULL;
+	}
+
+	memset(map, 0, SYSVMQ_DIRECT_MAP_SIZE);
+	return (uint8_t*)map;
+}
+
+/* Senders of a process that has no bitmap file, or a smaller one, always go through its rx thread */
+static const uint8_t* map_direct_map(itc_mbox_id_t mbox_id)
+{
+	char path[64];
+	struct stat st;
+	void* map;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s%u", ITC_SYSVMSQ_DIRECT_FILENAME, (mbox_id & sysvmq_inst.itccoord_mask) >> sysvmq_inst.itccoord_shift);
+	fd = open(path, O_RDONLY);
+	if(fd == -1)
+	{
+		return NULL;
+	}
+
+	if(fstat(fd, &st) == -1 || (size_t)st.st_size < SYSVMQ_DIRECT_MAP_SIZE)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, SYSVMQ_DIRECT_MAP_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	return (map == MAP_FAILED) ? NULL : (const uint8_t*)map;
+}
+
+/* Throws away everything queued for the own mtype of a mailbox. Whatever a sender left there after the mailbox was
+deleted would otherwise sit in msgmnb, and hold a credit of its sender, until the mailbox id is reused. */
+static void drain_direct_rx(itc_mbox_id_t mbox_id)
+{
+	char* buffer = NULL;
+	ssize_t rx_len;
+	long kick;
+
+	for(;;)
+	{
+		/* Kicks fit into the mtype alone, a buffer is only needed once there is a real message */
+		if(buffer == NULL)
+		{
+			rx_len = msgrcv(sysvmq_inst.my_sysvmq_id, &kick, 0, SYSVMQ_DIRECT_MTYPE(mbox_id), IPC_NOWAIT);
+		} else
+		{
+			rx_len = msgrcv(sysvmq_inst.my_sysvmq_id, buffer, sysvmq_inst.max_msgsize - sizeof(long),
+					SYSVMQ_DIRECT_MTYPE(mbox_id), IPC_NOWAIT);
+		}
+
+		if(rx_len < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			} else if(errno != E2BIG || buffer != NULL)
+			{
+				break; // ENOMSG mostly
+			}
+
+			buffer = (char*)malloc(sysvmq_inst.max_msgsize);
+			if(buffer == NULL)
+			{
+				TPT_TRACE(TRACE_ERROR, "Failed to malloc drain buffer, leave stale messages of mailbox 0x%08x!", mbox_id);
+				break;
+			}
+			continue;
+		} else if(rx_len == 0)
+		{
+			continue;
+		}
+
+		TPT_TRACE(TRACE_DEBUG, "Drained a stale message of mailbox 0x%08x!", mbox_id);
+#ifndef UNITTEST
+		struct itc_message* stale = NULL;
+		if(is_fragment(buffer, rx_len + sizeof(long)))
+		{
+			/* The first fragment carries the header and with it the credit of the whole message */
+			struct sysvmq_frag_hdr* hdr = (struct sysvmq_frag_hdr*)(buffer + sizeof(long));
+			if(hdr->offset == 0 && rx_len >= (ssize_t)(sizeof(struct sysvmq_frag_hdr) + ITC_HEADER_SIZE))
+			{
+				stale = (struct itc_message*)(hdr + 1);
+			}
+		} else
+		{
+			stale = check_rx_msg(buffer, rx_len + sizeof(long));
+		}
+
+		if(stale != NULL)
+		{
+			itc_credit_return(stale);
+		}
+#endif
+	}
+
+	free(buffer);
+}
+
+/* A zero-length message on the own mtype of a mailbox gets its owner out of msgrcv() in sysvmq_wait() */
+static void kick_direct_rx(itc_mbox_id_t mbox_id)
+{
+	long kick = SYSVMQ_DIRECT_MTYPE(mbox_id);
+
+	while(msgsnd(sysvmq_inst.my_sysvmq_id, &kick, 0, 0) == -1)
+	{
+		if(errno != EINTR)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to kick mailbox 0x%08x!", mbox_id);
+			break;
+		}
+	}
+}
+
+/* Hands the deadline of a timed sysvmq_wait() to the kicker, which is started at the first one */
+static bool arm_kick(struct sysvmq_direct_rx* direct_rx, const struct timespec *ts)
+{
+	MUTEX_LOCK(&sysvmq_inst.kick_mtx);
+	if(!start_kicker())
+	{
+		MUTEX_UNLOCK(&sysvmq_inst.kick_mtx);
+		return false;
+	}
+
+	direct_rx->deadline = *ts;
+	if(!direct_rx->is_armed)
+	{
+		direct_rx->next_armed = sysvmq_inst.armed;
+		sysvmq_inst.armed = direct_rx;
+		direct_rx->is_armed = true;
+	}
+	pthread_cond_signal(&sysvmq_inst.kick_cond);
+	MUTEX_UNLOCK(&sysvmq_inst.kick_mtx);
+
+	return true;
+}
+
+/* Called with kick_mtx held */
+static bool start_kicker(void)
+{
+	if(!sysvmq_inst.has_kicker)
+	{
+		int ret = pthread_create(&sysvmq_inst.kicker, NULL, sysvmq_kicker, NULL);
+		if(ret != 0)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to pthread_create() kicker, error code = %d", ret);
+			return false;
+		}
+		sysvmq_inst.has_kicker = true;
+	}
+
+	return true;
+}
+
+/* Leaves the direct rx of a deleted mailbox to the kicker, for the late drain after SYSVMQ_LATE_DRAIN_MS */
+static void retire_direct_rx(struct sysvmq_direct_rx* direct_rx)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += SYSVMQ_LATE_DRAIN_MS / 1000;
+	ts.tv_nsec += (SYSVMQ_LATE_DRAIN_MS % 1000) * 1000000L;
+	if(ts.tv_nsec >= 1000000000L)
+	{
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	MUTEX_LOCK(&sysvmq_inst.kick_mtx);
+	if(!start_kicker())
+	{
+		/* Then late messages wait for the next owner of the mailbox id, who drains them */
+		MUTEX_UNLOCK(&sysvmq_inst.kick_mtx);
+		free(direct_rx);
+		return;
+	}
+
+	direct_rx->is_retired = true;
+	direct_rx->deadline = ts;
+	direct_rx->next_armed = sysvmq_inst.armed;
+	sysvmq_inst.armed = direct_rx;
+	direct_rx->is_armed = true;
+	pthread_cond_signal(&sysvmq_inst.kick_cond);
+	MUTEX_UNLOCK(&sysvmq_inst.kick_mtx);
+}
+
+/* The mailbox id is taken again, whatever comes on its mtype from now on belongs to the new owner */
+static void cancel_late_drain(itc_mbox_id_t mbox_id)
+{
+	struct sysvmq_direct_rx* iter;
+
+	MUTEX_LOCK(&sysvmq_inst.kick_mtx);
+	for(iter = sysvmq_inst.armed; iter != NULL; iter = iter->next_armed)
+	{
+		if(iter->is_retired && iter->mbox_id == mbox_id)
+		{
+			unlink_armed(iter);
+			free(iter);
+			break;
+		}
+	}
+	MUTEX_UNLOCK(&sysvmq_inst.kick_mtx);
+}
+
+/* Once this returns the kicker no longer looks at direct_rx, a kick it already sent is skipped as a spurious wakeup */
+static void disarm_kick(struct sysvmq_direct_rx* direct_rx)
+{
+	MUTEX_LOCK(&sysvmq_inst.kick_mtx);
+	if(direct_rx->is_armed)
+	{
+		unlink_armed(direct_rx);
+	}
+	MUTEX_UNLOCK(&sysvmq_inst.kick_mtx);
+}
+
+/* Called with kick_mtx held */
+static void unlink_armed(struct sysvmq_direct_rx* direct_rx)
+{
+	struct sysvmq_direct_rx** iter = &sysvmq_inst.armed;
+
+	while(*iter != direct_rx)
+	{
+		iter = &(*iter)->next_armed;
+	}
+	*iter = direct_rx->next_armed;
+	direct_rx->is_armed = false;
+}
+
+static void stop_kicker(void)
+{
+	/* The kicker is not there in a forked child */
+	if(!sysvmq_inst.has_kicker || sysvmq_inst.pid != getpid())
+	{
+		return;
+	}
+
+	MUTEX_LOCK(&sysvmq_inst.kick_mtx);
+	sysvmq_inst.stop_kicker = true;
+	pthread_cond_signal(&sysvmq_inst.kick_cond);
+	MUTEX_UNLOCK(&sysvmq_inst.kick_mtx);
+
+	pthread_join(sysvmq_inst.kicker, NULL);
+	sysvmq_inst.has_kicker = false;
+	sysvmq_inst.stop_kicker = false;
+}
+
+/* Sleeps until the earliest deadline of all armed mailboxes, then kicks every owner whose deadline has passed, or drains
+the mtype of a deleted one */
+static void* sysvmq_kicker(void *data)
+{
+	struct sysvmq_direct_rx *iter, *earliest;
+	struct timespec now;
+
+	(void)data;
+	if(prctl(PR_SET_NAME, "itc_kick_sysvmq", 0, 0, 0) == -1)
+	{
+		TPT_TRACE(TRACE_ABN, "Failed to prctl()!");
+	}
+
+	MUTEX_LOCK(&sysvmq_inst.kick_mtx);
+	while(!sysvmq_inst.stop_kicker)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		earliest = NULL;
+		for(iter = sysvmq_inst.armed; iter != NULL; iter = iter->next_armed)
+		{
+			if(iter->deadline.tv_sec < now.tv_sec || (iter->deadline.tv_sec == now.tv_sec && iter->deadline.tv_nsec <= now.tv_nsec))
+			{
+				break;
+			} else if(earliest == NULL || iter->deadline.tv_sec < earliest->deadline.tv_sec ||
+				  (iter->deadline.tv_sec == earliest->deadline.tv_sec && iter->deadline.tv_nsec < earliest->deadline.tv_nsec))
+			{
+				earliest = iter;
+			}
+		}
+
+		if(iter != NULL && iter->is_retired)
+		{
+			/* Under kick_mtx, so a new owner of the mailbox id cannot show up meanwhile. Drains without blocking */
+			unlink_armed(iter);
+			drain_direct_rx(iter->mbox_id);
+			free(iter);
+		} else if(iter != NULL)
+		{
+			/* Disarmed before the kick, msgsnd() may block and the owner may delete its mailbox meanwhile */
+			itc_mbox_id_t mbox_id = iter->mbox_id;
+
+			unlink_armed(iter);
+			MUTEX_UNLOCK(&sysvmq_inst.kick_mtx);
+			kick_direct_rx(mbox_id);
+			MUTEX_LOCK(&sysvmq_inst.kick_mtx);
+		} else if(earliest == NULL)
+		{
+			pthread_cond_wait(&sysvmq_inst.kick_cond, &sysvmq_inst.kick_mtx);
+		} else
+		{
+			pthread_cond_timedwait(&sysvmq_inst.kick_cond, &sysvmq_inst.kick_mtx, &earliest->deadline);
+		}
+	}
+	MUTEX_UNLOCK(&sysvmq_inst.kick_mtx);
+
+	return NULL;
+}
+
+static void rxthread_destructor(void* data)
+{
+	(void)data;
+
+	if(sysvmq_inst.my_sysvmq_id != -1)
+	{
+		sysvmq_inst.is_terminated = 1;
+		if(msgctl(sysvmq_inst.my_sysvmq_id, IPC_RMID, NULL) == -1)
+		{
+			// ERROR trace is needed here
+			TPT_TRACE(TRACE_ERROR, "Failed to msgctl");
+		}
+		sysvmq_inst.my_sysvmq_id = -1;
+	}
+
+	if(sysvmq_inst.rx_buffer != NULL)
+	{
+		free_rx_buffer(sysvmq_inst.rx_buffer);
+		sysvmq_inst.rx_buffer = NULL;
+	}
+
+	drop_reassemblies(&sysvmq_inst.reasm, false);
+
+	if(sysvmq_inst.direct_map != NULL)
+	{
+		munmap(sysvmq_inst.direct_map, SYSVMQ_DIRECT_MAP_SIZE);
+		sysvmq_inst.direct_map = NULL;
+	}
 }
 
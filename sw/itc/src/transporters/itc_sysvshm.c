@@ -11,13 +11,16 @@
 #include <signal.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <time.h>
 
+#include <linux/futex.h>
 #include <sys/ipc.h>
 #include <sys/shm.h> 
-#include <sys/sem.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/prctl.h>
+#include <sys/mman.h>
 
 #include "itc.h"
 #include "itc_impl.h"
@@ -31,15 +34,20 @@
 *****                    INTERNAL TYPES IN SYSVSHM-ATOR                   *****
 *******************************************************************************/
 #define SYSVSHM_PAGE_SIZE		4096
-#define SYSVSHM_SLOT_HEADER_SIZE	32
-#define MAX_SYSVSHM_SLOTS		70
+#define SYSVSHM_SLOT_HEADER_SIZE	ITC_MSG_ALIGN_PAD // Slots are 64-byte aligned, so msgno of the message in it starts a cache line
+#define SYSVSHM_RING_SIZE		128 // Power of 2 above the number of slots of all pools, so a sender holding a slot always finds room in the ring
+#define SYSVSHM_SLOT_WAIT_MS		1000 // How long a sender waits for a slot of a full pool to be given back
+#define SYSVSHM_RING_WAIT_MS		1000 // How long a sender sleeps on its ring cell before it checks that the receiver is alive
+#define SYSVSHM_HELD_UP_MS		100 // How long the ring head may be taken but empty before the rx thread checks that its sender is alive
 #define SYSVSHM_STATIC_ALLOC_PAGES	25
 #define NUM_SLOTS_POOL_480		16
 #define NUM_SLOTS_POOL_992		8
 #define NUM_SLOTS_POOL_2016		8
 #define NUM_SLOTS_POOL_4064		4
 #define NUM_SLOTS_POOL_16352		3
-#define NUM_SLOTS_POOL_UNLIMIT		1
+#define NUM_SLOTS_POOL_UNLIMIT		ITC_SYSVSHM_LARGE_SLOTS
+#define SYSVSHM_LARGE_TRIM_PAGES	256 // High-water mark, a region grown beyond it is dropped once it is mostly unused, see trim_large_sysvshm()
+#define SYSVSHM_LARGE_MIN_PAGES		16 // First region of a large slot, doubled whenever a larger message comes
 
 enum sysvshm_pool_type_e {
 	POOL_96 = 0, // 1 page (same page as metadata) - ((SYSVSHM_PAGE_SIZE - (sizeof(sysvshm_metadata_t)/128 + 1)*128) / 128) slots (< 32 slots)
@@ -48,50 +56,66 @@ enum sysvshm_pool_type_e {
 	POOL_2016, // 4 pages, 8 slots
 	POOL_4064, // 4 pages, 4 slots
 	POOL_16352, // 12 pages, 3 slots -> statically allocated pages in total = 25 pages ~ 100KB
-	POOL_UNLIMIT, // n pages (size > 16352 bytes), only 1 slot at a time -> dynamically allocated pages
+	POOL_UNLIMIT, // n pages (size > 16352 bytes), 4 slots, each with its own segment that grows and is kept -> dynamically allocated pages
 	NUM_POOLS
 };
 
-union semattr_un {
-	int val;
-	struct semid_ds *buf;
-	unsigned short array [1];
-};
-
 struct sysvshm_pool_slot {
 	int					whichpool;
 	int					whichslot;
 };
 
 struct sysvshm_slot_info_t {
-	struct sysvshm_pool_slot		next_slot;
 	unsigned char				pool_type;
-	bool					is_in_use;
+	pid_t					owner; // Process of the sender holding the slot, 0 while it is free
+};
+
+/* A large message goes into the segment of its slot. The sender holding the slot replaces the segment by a twice as
+large one if the message does not fit, otherwise it is reused, so senders and receiver keep it attached. A segment is
+only freed once the last of them has detached, so they all detach as soon as generation moves. */
+struct sysvshm_large_slot {
+	struct sysvshm_slot_info_t		header;
+	uint32_t				used_pages; // by the message in the slot, set by its sender
+	uint32_t				num_pages; // of the segment, 0 until the first large message
+	int					shmid;
+	key_t					key; // of the segment, set by the receiver, see init_large_sysvshm_keys()
+	uint32_t				generation; // Moved whenever the segment is removed
+};
+
+/* Bounded multi-producer ring (D. Vyukov), the rx thread is the only consumer. A cell is free for the sender that got
+ring position pos from ring_tail when seq == pos, and holds a message for the receiver when seq == pos + 1 */
+struct sysvshm_ring_cell {
+	uint32_t				seq;
+	struct sysvshm_pool_slot		slot;
+	pid_t					owner; // Process of the sender that got the cell, 0 until it has got it
 };
 
 struct sysvshm_metadata_t {
 	uint16_t				num_pages;
-	uint16_t				num_unlimit_pages;
-	struct sysvshm_pool_slot		head; // to let receiver dequeue messages
-	struct sysvshm_pool_slot		tail; // to let sender enqueue messages
+	uint32_t				rx_sleeping; // Futex word, 1 while the rx thread waits for the ring to be filled
+	uint32_t				closed; // Set by the owner at exit, attached senders then reconnect to a new segment
+	pid_t					pid; // of the owner, checked by senders whose ring cell is not given back
+
+	uint64_t				free_slots[NUM_POOLS] __attribute__((aligned(ITC_CACHE_LINE))); // Bit n is set while slot n of the pool is free, so at most 64 slots per pool
+
+	uint32_t				slots_freed __attribute__((aligned(ITC_CACHE_LINE))); // Futex word, moved when a slot is given back while slot_waiters != 0
+	uint32_t				slot_waiters; // Senders sleeping on slots_freed for a full pool
+	uint32_t				ring_waiters; // Senders sleeping on the seq of a ring cell that the rx thread has not given back yet
 
-	struct sysvshm_slot_info_t		slot_unlimit;
+	uint32_t				ring_tail __attribute__((aligned(ITC_CACHE_LINE))); // to let senders enqueue messages
+	uint32_t				ring_head __attribute__((aligned(ITC_CACHE_LINE))); // to let receiver dequeue messages
+	struct sysvshm_ring_cell		ring[SYSVSHM_RING_SIZE];
+
+	struct sysvshm_large_slot		large_slots[NUM_SLOTS_POOL_UNLIMIT];
 };
 
 struct sysvshm_contactlist {
 	itc_mbox_id_t				mbox_id_in_itccoord;
 	int					sysvshm_id;
 	struct sysvshm_metadata_t		*metadata;
-	// Binary semaphore indicating that only one process can access shared memory at a time
-	int					m_sem_mutex;
-	// Binary semaphore used by sender to trigger a notification towards receiver telling them that a new message has been enqueued
-	// So receiver will block on sem_wait(m_sem_notify) while sender will call sem_post(m_sem_notify)
-	int					m_sem_notify;
-	// Counting semaphore used by receiver to indicate that a message has been dequeued and queue buffer has new slot for another message
-	int					m_sem_slot;
-
-	int					unlimit_sysvshm_id;
-	void					*unlimit_shm_ptr;
+
+	uint32_t				large_gen[NUM_SLOTS_POOL_UNLIMIT]; // Generations of the large slots we are attached to
+	void					*large_shm_ptr[NUM_SLOTS_POOL_UNLIMIT];
 };
 
 struct sysvshm_instance {
@@ -102,16 +126,19 @@ struct sysvshm_instance {
 	int				my_shmid;
 	struct sysvshm_metadata_t	*my_shm_ptr;
 
-	int				my_unlimit_shmid;
-	void				*my_unlimit_shm_ptr;
-
-	int				my_sem_mutex;
-	int				my_sem_notify;
-	int				my_sem_slot;
-	union semattr_un		sem_attr;
+	uint32_t			my_large_gen[NUM_SLOTS_POOL_UNLIMIT];
+	void				*my_large_shm_ptr[NUM_SLOTS_POOL_UNLIMIT];
+	pthread_mutex_t			large_mtx; // Over the large slot attachments in all contact lists, see detach_stale_large_sysvshm()
 
 	int				is_initialized;
 	int				is_terminated;
+	bool				prefault; // itc_init() with ITC_PREFAULT_SHM, see prefault_sysvshm()
+	bool				mlock_failed;
+	pid_t				my_pid; // Written into the slots and ring cells we take, see skip_dead_sysvshm_sender()
+
+	bool				is_held_up; // The ring head was taken by a sender but not filled when we last looked
+	uint32_t			held_up_pos;
+	struct timespec			held_up_since;
 
 	itc_mbox_id_t			my_mbox_id;
 	pthread_mutex_t			thread_mtx;
@@ -136,11 +163,19 @@ static struct sysvshm_instance sysvshm_inst; // One instance per a process, mult
 *****                   INTERNAL FUNCTIONS PROTOTYPES                      *****
 *******************************************************************************/
 static void init_sysvshm(struct result_code* rc);
-static void init_sysvshm_semaphores(struct result_code* rc);
 static void remove_sysvshm();
-static void remove_sysvshm_semaphores();
 static void init_sysvshm_rx_thread(struct result_code* rc);
 static void init_sysvshm_mempool(struct sysvshm_metadata_t *shm_ptr);
+static struct sysvshm_slot_info_t* get_sysvshm_slot(struct sysvshm_metadata_t *shm_ptr, int whichpool, int whichslot);
+static int take_sysvshm_slot(struct sysvshm_metadata_t *shm_ptr, int *whichpool);
+static void release_sysvshm_slot(struct sysvshm_metadata_t *shm_ptr, int whichpool, int whichslot);
+static bool enqueue_sysvshm_ring(struct sysvshm_metadata_t *shm_ptr, int whichpool, int whichslot);
+static void give_back_sysvshm_cell(struct sysvshm_metadata_t *shm_ptr, struct sysvshm_ring_cell *cell, uint32_t pos);
+static bool dequeue_sysvshm_ring(struct sysvshm_metadata_t *shm_ptr, struct sysvshm_pool_slot *pool_slot);
+static void wait_for_sysvshm_ring(struct sysvshm_metadata_t *shm_ptr);
+static bool skip_dead_sysvshm_sender(struct sysvshm_metadata_t *shm_ptr);
+static void reclaim_dead_sysvshm_slots(struct sysvshm_metadata_t *shm_ptr, pid_t owner);
+static bool is_dead(pid_t pid);
 static void release_sysvshm_resources(struct result_code* rc);
 static void generate_msqfile(struct result_code* rc);
 
@@ -149,12 +184,19 @@ static struct sysvshm_contactlist* find_cl(struct result_code* rc, itc_mbox_id_t
 static void add_sysvshm_cl(struct result_code* rc, struct sysvshm_contactlist* cl, itc_mbox_id_t mbox_id);
 static void remove_sysvshm_cl(struct result_code* rc, itc_mbox_id_t mbox_id);
 
-static void handle_received_message(struct itc_message *p_message);
+static void handle_received_message(struct itc_message *p_message, const struct sysvshm_pool_slot *head);
+static void release_received_slot(const struct sysvshm_pool_slot *head);
 static void rxthread_destructor(void* data);
 
-static void init_unilimit_sysvshm(struct result_code* rc, uint16_t num_unlimit_pages, struct sysvshm_contactlist* cl);
-static void get_my_unlimit_shm(uint16_t num_unlimit_pages);
+static void init_large_sysvshm_keys(key_t *keys, int proj_id);
+static void remove_large_sysvshm_key(key_t key);
+static void grow_large_sysvshm(struct result_code* rc, struct sysvshm_large_slot *large_slot, uint32_t num_pages);
+static void *attach_large_sysvshm(uint32_t *attached_gen, void **attached_ptr, struct sysvshm_large_slot *large_slot);
+static void detach_large_sysvshm(uint32_t *attached_gen, void **attached_ptr);
+static void detach_stale_large_sysvshm(struct sysvshm_contactlist* cl);
+static void trim_large_sysvshm(int whichslot);
 static void release_sysvshm_contactlist();
+static void prefault_sysvshm(void *shm_ptr, size_t size);
 
 
 
@@ -178,6 +220,8 @@ struct itci_transport_apis sysvshm_trans_apis = { NULL,
                                             	sysvshm_send,
                                             	NULL,
                                             	NULL,
+                                            	NULL,
+                                            	NULL,
                                             	NULL };
 
 
@@ -229,6 +273,9 @@ void sysvshm_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itccoord,
 	}
 
 	sysvshm_inst.my_shmid			= -1;
+	sysvshm_inst.prefault			= (flags & ITC_FLAGS_SHM_PREFAULT) != 0;
+	sysvshm_inst.my_pid			= getpid();
+	sysvshm_inst.is_held_up			= false;
 	sysvshm_inst.itccoord_mask 		= itccoord_mask;
 	sysvshm_inst.itccoord_shift		= tmp_shift;
 	sysvshm_inst.my_mbox_id_in_itccoord 	= my_mbox_id_in_itccoord;
@@ -255,9 +302,7 @@ void sysvshm_init(struct result_code* rc, itc_mbox_id_t my_mbox_id_in_itccoord,
 	sysvshm_inst.pool_offset[POOL_2016]		= 5 * SYSVSHM_PAGE_SIZE;
 	sysvshm_inst.pool_offset[POOL_4064]		= 9 * SYSVSHM_PAGE_SIZE;
 	sysvshm_inst.pool_offset[POOL_16352]		= 13 * SYSVSHM_PAGE_SIZE;
-	sysvshm_inst.pool_offset[POOL_UNLIMIT]		= offsetof(struct sysvshm_metadata_t, slot_unlimit);
-
-	init_sysvshm_semaphores(rc);
+	sysvshm_inst.pool_offset[POOL_UNLIMIT]		= offsetof(struct sysvshm_metadata_t, large_slots);
 
 	init_sysvshm(rc);
 	
@@ -290,12 +335,12 @@ static void sysvshm_send(struct result_code* rc, struct itc_message *message, it
 	}
 
 	// Choose which POOL should be used
-	uint16_t num_unlimit_pages = 0;
-	int16_t whichpool = 0;
+	uint32_t num_unlimit_pages = 0;
+	int whichpool = 0;
 	for(; whichpool < NUM_POOLS; ++whichpool)
 	{
-		// 1 byte for ENDPOINT and 32 bytes for slot's header
-		if(sysvshm_inst.slot_sizes[whichpool] > 0 && (message->size + ITC_HEADER_SIZE + 1 + 32) <= (uint32_t)sysvshm_inst.slot_sizes[whichpool])
+		// 1 byte for ENDPOINT and SYSVSHM_SLOT_HEADER_SIZE bytes for slot's header
+		if(sysvshm_inst.slot_sizes[whichpool] > 0 && (itc_msg_wire_size(message) + SYSVSHM_SLOT_HEADER_SIZE) <= (uint32_t)sysvshm_inst.slot_sizes[whichpool])
 		{
 			break;
 		}
@@ -304,7 +349,7 @@ static void sysvshm_send(struct result_code* rc, struct itc_message *message, it
 	if(whichpool == NUM_POOLS)
 	{
 		whichpool = POOL_UNLIMIT;
-		num_unlimit_pages = ((message->size + ITC_HEADER_SIZE + 1) / SYSVSHM_PAGE_SIZE) + 1;
+		num_unlimit_pages = (itc_msg_wire_size(message) + SYSVSHM_SLOT_HEADER_SIZE) / SYSVSHM_PAGE_SIZE + 1;
 	}
 
 	cl = get_sysvshm_cl(rc, to);
@@ -317,140 +362,68 @@ static void sysvshm_send(struct result_code* rc, struct itc_message *message, it
 		return;
 	}
 
-	struct sembuf asem[1];
-	asem[0].sem_num = 0;
-	asem[0].sem_flg = 0;
-
-	// Get into a line before allowed inserting an itc message into receiver shared memory's queue
-	// Have to wait if receiver queue has been fulled with MAX_SYSVSHM_SLOTS messages
-	asem[0].sem_op = -1;
-	if(semop(cl->m_sem_slot, asem, 1) == -1)
+	if(__atomic_load_n(&cl->metadata->closed, __ATOMIC_ACQUIRE))
 	{
-		if(errno != EIDRM)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to sem_wait(cl->m_sem_slot), mbox_id_in_itccoord = 0x%08x, errno = %d!", cl->mbox_id_in_itccoord, errno);
-			rc->flags |= ITC_SYSCALL_ERROR;
-			return;
-		}
-
 		TPT_TRACE(TRACE_ERROR, "Receiver sysvshm has been disconnected, reconnecting to them!");
 		remove_sysvshm_cl(rc, to);
 		add_sysvshm_cl(rc, cl, to);
 		if(cl->mbox_id_in_itccoord == 0)
 		{
 			TPT_TRACE(TRACE_ERROR, "Add contact list again failed, receiver process not online!");
+			rc->flags &= ~ITC_SYSCALL_ERROR;
+			rc->flags |= ITC_QUEUE_NULL; // Same as above, the receiver has no endpoint for us
 			return;
 		}
 	}
 
-	// Accquire mutex lock to access receiver's shared memory resources
-	asem[0].sem_op = -1;
-	if(semop(cl->m_sem_mutex, asem, 1) == -1)
-	{
-		if(errno != EIDRM)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to sem_wait(cl->m_sem_mutex), mbox_id_in_itccoord = 0x%08x, errno = %d!", cl->mbox_id_in_itccoord, errno);
-			rc->flags |= ITC_SYSCALL_ERROR;
-			return;
-		}
+	detach_stale_large_sysvshm(cl);
 
-		TPT_TRACE(TRACE_ERROR, "Receiver sysvshm has been disconnected, reconnecting to them!");
-		remove_sysvshm_cl(rc, to);
-		add_sysvshm_cl(rc, cl, to);
-		if(cl->mbox_id_in_itccoord == 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Add contact list again failed, receiver process not online!");
-			return;
-		}
+	// No lock is taken, senders of all processes race for a slot with a CAS and then for a place in the ring
+	int new_slot_index = take_sysvshm_slot(cl->metadata, &whichpool);
+	if(new_slot_index < 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "No more slot available for pool = %d and larger ones!", whichpool);
+		rc->flags |= ITC_OUT_OF_RANGE;
+		return;
 	}
 
-	// Critical section
-	struct sysvshm_slot_info_t *new_slot;
-	unsigned char new_slot_index = 0;
-	if(whichpool == POOL_UNLIMIT && num_unlimit_pages > (sysvshm_inst.slot_sizes[POOL_16352] / SYSVSHM_PAGE_SIZE))
+	struct sysvshm_slot_info_t *new_slot = get_sysvshm_slot(cl->metadata, whichpool, new_slot_index);
+	if(whichpool == POOL_UNLIMIT)
 	{
-		init_unilimit_sysvshm(rc, num_unlimit_pages, cl);
-
-		cl->metadata->num_unlimit_pages = num_unlimit_pages;
-		cl->metadata->num_pages = SYSVSHM_STATIC_ALLOC_PAGES + num_unlimit_pages;
+		struct sysvshm_large_slot *large_slot = &cl->metadata->large_slots[new_slot_index];
+		void *large_shm_ptr = NULL;
 
-		new_slot = (struct sysvshm_slot_info_t *)((unsigned long)cl->metadata + sysvshm_inst.pool_offset[whichpool]);
-		new_slot->next_slot.whichpool = -1;
-		new_slot->next_slot.whichslot = -1;
-		new_slot->pool_type = POOL_UNLIMIT;
-	} else
-	{
-		// Shopping for a slot in whichpool
-		struct sysvshm_slot_info_t *slot = (struct sysvshm_slot_info_t *)((unsigned long)cl->metadata + sysvshm_inst.pool_offset[whichpool]);
-		for(; new_slot_index < sysvshm_inst.num_slots[whichpool]; ++new_slot_index)
+		if(large_slot->num_pages < num_unlimit_pages)
 		{
-			if(slot->is_in_use == false && slot->next_slot.whichpool == -1 && slot->next_slot.whichslot == -1)
-			{
-				new_slot = slot;
-				break;
-			}
-
-			// Move to next slot in whichpool
-			slot = (struct sysvshm_slot_info_t *)((unsigned long)slot + sysvshm_inst.slot_sizes[whichpool]);
+			grow_large_sysvshm(rc, large_slot, num_unlimit_pages);
 		}
 
-		if(new_slot_index == sysvshm_inst.num_slots[whichpool])
+		if(rc->flags == ITC_OK)
 		{
-			TPT_TRACE(TRACE_ERROR, "No more slot available for this pool = %d, limit at %u slots!", whichpool, sysvshm_inst.num_slots[whichpool]);
-			return;
+			MUTEX_LOCK(&sysvshm_inst.large_mtx);
+			large_shm_ptr = attach_large_sysvshm(&cl->large_gen[new_slot_index], &cl->large_shm_ptr[new_slot_index], large_slot);
+			MUTEX_UNLOCK(&sysvshm_inst.large_mtx);
 		}
-	}
 
-	if(cl->metadata->tail.whichpool == -1 && cl->metadata->tail.whichslot == -1)
-	{
-		// TPT_TRACE(TRACE_INFO, "SYSV shared memory queue is empty, add a new one!"); // TBD
-		cl->metadata->head.whichpool = whichpool;
-		cl->metadata->head.whichslot = new_slot_index;
-		cl->metadata->tail.whichpool = whichpool;
-		cl->metadata->tail.whichslot = new_slot_index;
-	} else
-	{
-		unsigned long pool_offset = sysvshm_inst.pool_offset[cl->metadata->tail.whichpool];
-		unsigned long slot_offset = sysvshm_inst.slot_sizes[cl->metadata->tail.whichpool]*cl->metadata->tail.whichslot;
-		struct sysvshm_slot_info_t *tail_node = (struct sysvshm_slot_info_t *)((unsigned long)cl->metadata + pool_offset + slot_offset);
-		tail_node->next_slot.whichpool = whichpool;
-		tail_node->next_slot.whichslot = new_slot_index;
-		cl->metadata->tail.whichpool = whichpool;
-		cl->metadata->tail.whichslot = new_slot_index;
-	}
-
-	new_slot->is_in_use = true;
-
-	if(whichpool == POOL_UNLIMIT && num_unlimit_pages > (sysvshm_inst.slot_sizes[POOL_16352] / SYSVSHM_PAGE_SIZE))
-	{
-		memcpy((void *)((unsigned long)cl->unlimit_shm_ptr), message, message->size + ITC_HEADER_SIZE + 1);
-
-		// Unmmap unlimited slot to save space for our sender's virtual address space
-		if (shmdt((void *)cl->unlimit_shm_ptr) == -1) {
-			TPT_TRACE(TRACE_ERROR, "Failed to shmdt, errno = %d!", errno);
+		if(large_shm_ptr == NULL)
+		{
+			release_sysvshm_slot(cl->metadata, whichpool, new_slot_index);
+			rc->flags |= ITC_SYSCALL_ERROR;
+			return;
 		}
 
-		cl->unlimit_sysvshm_id = 0;
-		cl->unlimit_shm_ptr = NULL;
+		// Same offset as in the static slots, so msgno still starts a cache line
+		(void)itc_msg_gather_shm(message, (void *)((unsigned long)large_shm_ptr + SYSVSHM_SLOT_HEADER_SIZE));
+		large_slot->used_pages = num_unlimit_pages;
 	} else
 	{
-		memcpy((void *)((unsigned long)new_slot + SYSVSHM_SLOT_HEADER_SIZE), message, message->size + ITC_HEADER_SIZE + 1);
+		(void)itc_msg_gather_shm(message, (void *)((unsigned long)new_slot + SYSVSHM_SLOT_HEADER_SIZE));
 	}
 
-	// Release mutex lock
-	asem[0].sem_op = 1;
-	if(semop(cl->m_sem_mutex, asem, 1) == -1)
+	// Hand the slot over to the receiver, wakes it up only if it sleeps
+	if(!enqueue_sysvshm_ring(cl->metadata, whichpool, new_slot_index))
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_post(cl->m_sem_mutex), errno = %d!", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
-
-	// Notify receiver about incoming message
-	asem[0].sem_op = 1;
-	if(semop(cl->m_sem_notify, asem, 1) == -1)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to sem_post(my_sem_slot), errno = %d!", errno);
+		release_sysvshm_slot(cl->metadata, whichpool, new_slot_index);
 		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
@@ -480,7 +453,7 @@ static void* sysvshm_rx_thread(void *data)
 
 	sprintf(itc_mbox_name, "itc_rx_sysvshm_0x%08x", sysvshm_inst.my_mbox_id_in_itccoord);
 
-	sysvshm_inst.my_mbox_id = itc_create_mailbox(itc_mbox_name, ITC_NO_NAMESPACE);
+	sysvshm_inst.my_mbox_id = itc_create_mailbox(itc_mbox_name, ITC_NO_NAMESPACE | ITC_FLAGS_MBOX_FORWARDER);
 
 	TPT_TRACE(TRACE_INFO, "Starting sysvshm_rx_thread %s...!", itc_mbox_name);
 	int ret = pthread_setspecific(sysvshm_inst.destruct_key, (void*)(unsigned long)sysvshm_inst.my_mbox_id);
@@ -494,130 +467,58 @@ static void* sysvshm_rx_thread(void *data)
 	// Make this rx_sysvshm_thread cancellable without any cancellation point
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
-	struct sembuf asem[1];
-	asem[0].sem_num = 0;
-	asem[0].sem_flg = 0;
-
 	MUTEX_UNLOCK(&sysvshm_inst.thread_mtx);
 	for(;;)
 	{
+		struct sysvshm_pool_slot head;
+
 		if(sysvshm_inst.is_terminated)
 		{
 			TPT_TRACE(TRACE_INFO, "Terminating sysvshm rx thread!");
 			break;
 		}
 
-		asem[0].sem_op = -1;
-		if(semop(sysvshm_inst.my_sem_notify, asem, 1) == -1)
+		if(!dequeue_sysvshm_ring(sysvshm_inst.my_shm_ptr, &head))
 		{
-			TPT_TRACE(TRACE_ERROR, "Failed to sem_wait(my_sem_notify), errno = %d!", errno);
-			break;
+			if(!skip_dead_sysvshm_sender(sysvshm_inst.my_shm_ptr))
+			{
+				wait_for_sysvshm_ring(sysvshm_inst.my_shm_ptr);
+			}
+			continue;
 		}
 
-		// Some processes has notified us about a new message
-		// Accquire mutex lock to access the shared memory resources
-		asem[0].sem_op = -1;
-		if(semop(sysvshm_inst.my_sem_mutex, asem, 1) == -1)
+		if(head.whichpool < 0 || head.whichpool >= NUM_POOLS || head.whichslot < 0 || head.whichslot >= sysvshm_inst.num_slots[head.whichpool])
 		{
-			TPT_TRACE(TRACE_ERROR, "Failed to sem_wait(my_sem_mutex), errno = %d!", errno);
-			break;
+			TPT_TRACE(TRACE_ERROR, "Invalid slot in ring, pool = %d, slot = %d!", head.whichpool, head.whichslot);
+			continue;
 		}
 
-		if(sysvshm_inst.my_shm_ptr->head.whichpool != -1 && sysvshm_inst.my_shm_ptr->head.whichslot != -1)
+		struct sysvshm_slot_info_t *slot = get_sysvshm_slot(sysvshm_inst.my_shm_ptr, head.whichpool, head.whichslot);
+		if(__atomic_load_n(&sysvshm_inst.my_shm_ptr->free_slots[head.whichpool], __ATOMIC_RELAXED) & (1ULL << head.whichslot))
 		{
-			struct sysvshm_slot_info_t *slot;
-			uint16_t num_unlimit_pages = 0;
-			if(sysvshm_inst.my_shm_ptr->head.whichpool == POOL_UNLIMIT && sysvshm_inst.my_shm_ptr->num_unlimit_pages > 0)
-			{
-				num_unlimit_pages = sysvshm_inst.my_shm_ptr->num_unlimit_pages;
-				if(sysvshm_inst.my_unlimit_shmid == 0 && sysvshm_inst.my_unlimit_shm_ptr == NULL)
-				{
-					get_my_unlimit_shm(num_unlimit_pages);
-				}
-			}
-
-			unsigned long pool_offset = sysvshm_inst.pool_offset[sysvshm_inst.my_shm_ptr->head.whichpool];
-			unsigned long slot_offset = sysvshm_inst.slot_sizes[sysvshm_inst.my_shm_ptr->head.whichpool]*sysvshm_inst.my_shm_ptr->head.whichslot;
-			slot = (struct sysvshm_slot_info_t *)((unsigned long)sysvshm_inst.my_shm_ptr + pool_offset + slot_offset);
-
-			if(slot->is_in_use == false)
-			{
-				TPT_TRACE(TRACE_ERROR, "Slot is not in use, pool type = %u!", slot->pool_type);
-			} else if(slot->pool_type > POOL_UNLIMIT)
-			{
-				TPT_TRACE(TRACE_ERROR, "Invalid pool type = %u!", slot->pool_type);
-			} else
-			{
-				if(sysvshm_inst.my_shm_ptr->head.whichpool == POOL_UNLIMIT && sysvshm_inst.my_shm_ptr->num_unlimit_pages > 0)
-				{
-					handle_received_message((struct itc_message *)sysvshm_inst.my_unlimit_shm_ptr);
-				} else
-				{
-					handle_received_message((struct itc_message *)((unsigned long)slot + SYSVSHM_SLOT_HEADER_SIZE));
-				}
-			}
-
-			// Remove slot from queue
-			if(sysvshm_inst.my_shm_ptr->head.whichpool == sysvshm_inst.my_shm_ptr->tail.whichpool && \
-			sysvshm_inst.my_shm_ptr->head.whichslot == sysvshm_inst.my_shm_ptr->tail.whichslot)
-			{
-				// TPT_TRACE(TRACE_INFO, "SYSV shared memory queue has only one slot, dequeue it!"); // TBD
-				// Both head and tail should be moved to NULL
-				sysvshm_inst.my_shm_ptr->head.whichpool = -1;
-				sysvshm_inst.my_shm_ptr->head.whichslot = -1;
-				sysvshm_inst.my_shm_ptr->tail.whichpool = -1;
-				sysvshm_inst.my_shm_ptr->tail.whichslot = -1;
-			} else
-			{
-				// In case queue has more than one items, move head to the 2nd item and remove the 1st item via prev
-				// pointer of the 2nd.
-				sysvshm_inst.my_shm_ptr->head.whichpool = slot->next_slot.whichpool;
-				sysvshm_inst.my_shm_ptr->head.whichslot = slot->next_slot.whichslot;
-			}
-
-			// Clean up slot's header info
-			slot->is_in_use = false;
-			slot->next_slot.whichpool = -1;
-			slot->next_slot.whichslot = -1;
-
-			/* FIXME: Comment out this if-block will lower send-receive latency from 7.5ms to 3.5ms */
-			// Unmap unlimited slot for a large itc message to save memory
-			if(num_unlimit_pages > 0)
-			{
-				if (shmdt(sysvshm_inst.my_unlimit_shm_ptr) == -1) {
-					TPT_TRACE(TRACE_ERROR, "Failed to shmdt, errno = %d!", errno);
-				}
-
-				if (shmctl(sysvshm_inst.my_unlimit_shmid, IPC_RMID, NULL) == -1)
-				{
-					TPT_TRACE(TRACE_ERROR, "Failed to IPC_RMID shmctl(my_unlimit_shmid), errno = %d", errno);
-				}
-
-				sysvshm_inst.my_unlimit_shmid = 0;
-				sysvshm_inst.my_unlimit_shm_ptr = NULL;
-				sysvshm_inst.my_shm_ptr->num_unlimit_pages = 0;
-				sysvshm_inst.my_shm_ptr->num_pages = SYSVSHM_STATIC_ALLOC_PAGES;
-			}
-		} else
+			TPT_TRACE(TRACE_ERROR, "Slot is not in use, pool type = %u!", slot->pool_type);
+		} else if(slot->pool_type > POOL_UNLIMIT)
 		{
-			TPT_TRACE(TRACE_ERROR, "Some process has notified of new incoming message, but no message found in shared memory!");
-		}
-
-		// Release mutex lock
-		asem[0].sem_op = 1;
-		if(semop(sysvshm_inst.my_sem_mutex, asem, 1) == -1)
+			TPT_TRACE(TRACE_ERROR, "Invalid pool type = %u!", slot->pool_type);
+		} else if(head.whichpool != POOL_UNLIMIT)
 		{
-			TPT_TRACE(TRACE_ERROR, "Failed to sem_post(my_sem_mutex), errno = %d!", errno);
-			break;
-		}
-
-		// Allow new process take a slot in queue
-		asem[0].sem_op = 1;
-		if(semop(sysvshm_inst.my_sem_slot, asem, 1) == -1)
+			handle_received_message((struct itc_message *)((unsigned long)slot + SYSVSHM_SLOT_HEADER_SIZE), &head);
+			continue;
+		} else
 		{
-			TPT_TRACE(TRACE_ERROR, "Failed to sem_post(my_sem_slot), errno = %d!", errno);
-			break;
+			// Stays attached for the next large message in this slot, unless a sender has grown it meanwhile
+			void *large_shm_ptr = attach_large_sysvshm(&sysvshm_inst.my_large_gen[head.whichslot],
+								   &sysvshm_inst.my_large_shm_ptr[head.whichslot],
+								   &sysvshm_inst.my_shm_ptr->large_slots[head.whichslot]);
+			if(large_shm_ptr != NULL)
+			{
+				handle_received_message((struct itc_message *)((unsigned long)large_shm_ptr + SYSVSHM_SLOT_HEADER_SIZE), &head);
+				continue;
+			}
 		}
+
+		// Nothing could be taken out of it, just give the slot back to senders
+		release_received_slot(&head);
 	}
 
 	return NULL;
@@ -629,6 +530,7 @@ static void* sysvshm_rx_thread(void *data)
 *******************************************************************************/
 static void init_sysvshm(struct result_code* rc)
 {
+	key_t large_keys[NUM_SLOTS_POOL_UNLIMIT];
 	int proj_id;
 	key_t shm_key;
 
@@ -657,235 +559,404 @@ static void init_sysvshm(struct result_code* rc)
 		return;
 	}
 
-	// Locked, till we finish initialization
-	sysvshm_inst.sem_attr.val = 0;
-	if (semctl(sysvshm_inst.my_sem_mutex, 0, SETVAL, sysvshm_inst.sem_attr) == -1)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to SETVAL semctl(my_sem_mutex), errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
+	prefault_sysvshm(sysvshm_inst.my_shm_ptr, SYSVSHM_STATIC_ALLOC_PAGES * SYSVSHM_PAGE_SIZE);
 
+	// No sender attaches before our mailboxes can be located, which is after itc_init() returned
+	init_large_sysvshm_keys(large_keys, proj_id);
 	init_sysvshm_mempool(sysvshm_inst.my_shm_ptr);
-
-	// Done initialization, allow other processes to access our shared memory now
-	sysvshm_inst.sem_attr.val = 1;
-	if (semctl(sysvshm_inst.my_sem_mutex, 0, SETVAL, sysvshm_inst.sem_attr) == -1)
+	for(int i = 0; i < NUM_SLOTS_POOL_UNLIMIT; ++i)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to SETVAL semctl(my_sem_mutex), errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		sysvshm_inst.my_shm_ptr->large_slots[i].key = large_keys[i];
 	}
 }
 
-static void init_sysvshm_semaphores(struct result_code* rc)
+static void remove_sysvshm()
 {
-	int proj_id;
-	key_t sem_key;
+	// Senders still attached to the segment reconnect to our next one rather than filling this one for no one
+	if(sysvshm_inst.my_shm_ptr != NULL && sysvshm_inst.my_shm_ptr != (struct sysvshm_metadata_t *)-1)
+	{
+		__atomic_store_n(&sysvshm_inst.my_shm_ptr->closed, 1, __ATOMIC_RELEASE);
 
-	proj_id = (sysvshm_inst.my_mbox_id_in_itccoord >> sysvshm_inst.itccoord_shift);
+		// Segments of our large slots are created by senders, but only we know when they are no longer needed
+		for(int i = 0; i < NUM_SLOTS_POOL_UNLIMIT; ++i)
+		{
+			detach_large_sysvshm(&sysvshm_inst.my_large_gen[i], &sysvshm_inst.my_large_shm_ptr[i]);
+			if(sysvshm_inst.my_shm_ptr->large_slots[i].num_pages > 0 &&
+			   shmctl(sysvshm_inst.my_shm_ptr->large_slots[i].shmid, IPC_RMID, NULL) == -1)
+			{
+				TPT_TRACE(TRACE_ERROR, "Failed to IPC_RMID shmctl(large slot %d), errno = %d", i, errno);
+			}
+		}
+	}
 
-	// ITC_SYSVSHM_SEM_MUTEX
-	sem_key = ftok(ITC_SYSVSHM_SEM_MUTEX, proj_id);
-	if(sem_key == -1)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to ftok, errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+	if (shmdt((void *)sysvshm_inst.my_shm_ptr) == -1) {
+		TPT_TRACE(TRACE_ERROR, "Failed to shmdt, errno = %d!", errno);
 	}
 
-	sysvshm_inst.my_sem_mutex = semget(sem_key, 1, 0666 | IPC_CREAT | IPC_EXCL);
-	if(sysvshm_inst.my_sem_mutex == -1)
+	if (sysvshm_inst.my_shmid != -1 && shmctl(sysvshm_inst.my_shmid, IPC_RMID, NULL) == -1)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to semget, errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		TPT_TRACE(TRACE_ERROR, "Failed to IPC_RMID shmctl(my_shmid), my_shmid = %d, errno = %d", sysvshm_inst.my_shmid, errno);
 	}
+}
 
-	// ITC_SYSVSHM_SEM_NOTIFY
-	sem_key = ftok(ITC_SYSVSHM_SEM_NOTIFY, proj_id);
-	if(sem_key == -1)
+static void init_sysvshm_rx_thread(struct result_code* rc)
+{
+	int res = pthread_key_create(&sysvshm_inst.destruct_key, rxthread_destructor);
+	if(res != 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to ftok, errno = %d", errno);
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_key_create, error code = %d", res);
+		remove_sysvshm();
 		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
 
-	sysvshm_inst.my_sem_notify = semget(sem_key, 1, 0666 | IPC_CREAT | IPC_EXCL);
-	if(sysvshm_inst.my_sem_notify == -1)
+	res = pthread_mutex_init(&sysvshm_inst.thread_mtx, NULL);
+	if(res != 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to semget, errno = %d", errno);
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutex_init, error code = %d", res);
+		remove_sysvshm();
 		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
 
-	sysvshm_inst.sem_attr.val = 0;
-	if (semctl(sysvshm_inst.my_sem_notify, 0, SETVAL, sysvshm_inst.sem_attr) == -1)
+	res = pthread_mutex_init(&sysvshm_inst.large_mtx, NULL);
+	if(res != 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to SETVAL semctl(my_sem_notify), errno = %d", errno);
+		TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutex_init, error code = %d", res);
+		remove_sysvshm();
 		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
 
-	// ITC_SYSVSHM_SEM_SLOT
-	sem_key = ftok(ITC_SYSVSHM_SEM_SLOT, proj_id);
-	if(sem_key == -1)
+	add_itcthread(rc, sysvshm_rx_thread, NULL, false, &sysvshm_inst.thread_mtx);
+}
+
+static void init_sysvshm_mempool(struct sysvshm_metadata_t *shm_ptr)
+{
+	struct sysvshm_metadata_t *metadata = shm_ptr;
+
+	metadata->num_pages = SYSVSHM_STATIC_ALLOC_PAGES;
+	metadata->rx_sleeping = 0;
+	metadata->closed = 0;
+	metadata->pid = sysvshm_inst.my_pid;
+	metadata->ring_tail = 0;
+	metadata->ring_head = 0;
+	metadata->slots_freed = 0;
+	metadata->slot_waiters = 0;
+	metadata->ring_waiters = 0;
+	for(uint32_t i = 0; i < SYSVSHM_RING_SIZE; ++i)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to ftok, errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		metadata->ring[i].seq = i;
+		metadata->ring[i].slot.whichpool = -1;
+		metadata->ring[i].slot.whichslot = -1;
+		metadata->ring[i].owner = 0;
 	}
 
-	sysvshm_inst.my_sem_slot = semget(sem_key, 1, 0666 | IPC_CREAT | IPC_EXCL);
-	if(sysvshm_inst.my_sem_slot == -1)
+	for(int whichslot = 0; whichslot < NUM_SLOTS_POOL_UNLIMIT; ++whichslot)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to semget, errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		metadata->large_slots[whichslot].used_pages = 0;
+		metadata->large_slots[whichslot].num_pages = 0;
+		metadata->large_slots[whichslot].shmid = -1;
+		metadata->large_slots[whichslot].key = IPC_PRIVATE;
+		metadata->large_slots[whichslot].generation = 0;
 	}
 
-	sysvshm_inst.sem_attr.val = MAX_SYSVSHM_SLOTS;
-	if (semctl(sysvshm_inst.my_sem_slot, 0, SETVAL, sysvshm_inst.sem_attr) == -1)
+	for(int whichpool = POOL_96; whichpool < NUM_POOLS; ++whichpool)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to SETVAL semctl(my_sem_slot), errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		for(int whichslot = 0; whichslot < sysvshm_inst.num_slots[whichpool]; ++whichslot)
+		{
+			struct sysvshm_slot_info_t *slot_header = get_sysvshm_slot(metadata, whichpool, whichslot);
+			slot_header->pool_type = whichpool;
+			slot_header->owner = 0;
+		}
+
+		metadata->free_slots[whichpool] = (1ULL << sysvshm_inst.num_slots[whichpool]) - 1;
 	}
 }
 
-static void remove_sysvshm()
+static struct sysvshm_slot_info_t* get_sysvshm_slot(struct sysvshm_metadata_t *shm_ptr, int whichpool, int whichslot)
 {
-	if (shmdt((void *)sysvshm_inst.my_shm_ptr) == -1) {
-		TPT_TRACE(TRACE_ERROR, "Failed to shmdt, errno = %d!", errno);
-	}
+	unsigned long pool_offset = sysvshm_inst.pool_offset[whichpool];
+	unsigned long slot_offset = (whichpool == POOL_UNLIMIT) ? sizeof(struct sysvshm_large_slot) * whichslot :
+				    (unsigned long)sysvshm_inst.slot_sizes[whichpool] * whichslot;
 
-	if (sysvshm_inst.my_shmid != -1 && shmctl(sysvshm_inst.my_shmid, IPC_RMID, NULL) == -1)
+	return (struct sysvshm_slot_info_t *)((unsigned long)shm_ptr + pool_offset + slot_offset);
+}
+
+/* Take the lowest free slot of whichpool by clearing its bit in free_slots with a CAS. A pool that is used up spills over
+into the next larger one, but not into the unlimited pool, whose slots have a segment of their own. If all of
+them are full, sleep until the receiver hands a slot back, for up to SYSVSHM_SLOT_WAIT_MS in total before giving up */
+static int take_sysvshm_slot(struct sysvshm_metadata_t *shm_ptr, int *whichpool)
+{
+	struct timespec t_start, t_now, tmo;
+	int lastpool = (*whichpool == POOL_UNLIMIT) ? POOL_UNLIMIT : POOL_16352;
+	bool is_waiting = false;
+	uint32_t slots_freed = 0;
+	long waited;
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	for(;;)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to IPC_RMID shmctl(my_shmid), my_shmid = %d, errno = %d", sysvshm_inst.my_shmid, errno);
+		for(int pool = *whichpool; pool <= lastpool; ++pool)
+		{
+			uint64_t free_slots = __atomic_load_n(&shm_ptr->free_slots[pool], __ATOMIC_RELAXED);
+
+			// A failed CAS reloads free_slots, so only retry while the pool still has a free slot
+			while(free_slots != 0)
+			{
+				int whichslot = __builtin_ctzll(free_slots);
+
+				if(__atomic_compare_exchange_n(&shm_ptr->free_slots[pool], &free_slots, free_slots & ~(1ULL << whichslot), false,
+							       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				{
+					// Lets the receiver give the slot back if we die with it, see reclaim_dead_sysvshm_slots()
+					__atomic_store_n(&get_sysvshm_slot(shm_ptr, pool, whichslot)->owner, sysvshm_inst.my_pid, __ATOMIC_RELAXED);
+					if(is_waiting)
+					{
+						__atomic_fetch_sub(&shm_ptr->slot_waiters, 1, __ATOMIC_SEQ_CST);
+					}
+					*whichpool = pool;
+					return whichslot;
+				}
+			}
+		}
+
+		if(is_waiting)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &t_now);
+			waited = (t_now.tv_sec - t_start.tv_sec) * 1000 + (t_now.tv_nsec - t_start.tv_nsec) / 1000000;
+			if(waited >= SYSVSHM_SLOT_WAIT_MS)
+			{
+				__atomic_fetch_sub(&shm_ptr->slot_waiters, 1, __ATOMIC_SEQ_CST);
+				return -1;
+			}
+
+			tmo.tv_sec = (SYSVSHM_SLOT_WAIT_MS - waited) / 1000;
+			tmo.tv_nsec = ((SYSVSHM_SLOT_WAIT_MS - waited) % 1000) * 1000000;
+			syscall(SYS_futex, &shm_ptr->slots_freed, FUTEX_WAIT, slots_freed, &tmo, NULL, 0);
+		} else
+		{
+			__atomic_fetch_add(&shm_ptr->slot_waiters, 1, __ATOMIC_SEQ_CST);
+			is_waiting = true;
+		}
+
+		// Read before the next look at free_slots, so a slot given back after it does not let us sleep
+		slots_freed = __atomic_load_n(&shm_ptr->slots_freed, __ATOMIC_SEQ_CST);
 	}
 }
 
-static void remove_sysvshm_semaphores()
+static void release_sysvshm_slot(struct sysvshm_metadata_t *shm_ptr, int whichpool, int whichslot)
 {
-	if (semctl(sysvshm_inst.my_sem_mutex, 0, IPC_RMID, 0) == -1)
+	__atomic_store_n(&get_sysvshm_slot(shm_ptr, whichpool, whichslot)->owner, 0, __ATOMIC_RELAXED);
+	__atomic_fetch_or(&shm_ptr->free_slots[whichpool], 1ULL << whichslot, __ATOMIC_SEQ_CST);
+
+	// No syscall as long as no sender waits for a slot, all are woken as they may wait for different pools
+	if(__atomic_load_n(&shm_ptr->slot_waiters, __ATOMIC_SEQ_CST) != 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to IPC_RMID semctl(my_sem_mutex), errno = %d", errno);
-		return;
+		__atomic_add_fetch(&shm_ptr->slots_freed, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &shm_ptr->slots_freed, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+/* Publish a filled slot to the rx thread. At most one ring position is taken per slot in use and the ring is larger than
+all pools together, so the cell of our position is free, unless the rx thread has not finished taking it the round before.
+Until then we sleep on its seq, and give up only once the receiver turns out to be dead */
+static bool enqueue_sysvshm_ring(struct sysvshm_metadata_t *shm_ptr, int whichpool, int whichslot)
+{
+	uint32_t pos = __atomic_fetch_add(&shm_ptr->ring_tail, 1, __ATOMIC_RELAXED);
+	struct sysvshm_ring_cell *cell = &shm_ptr->ring[pos & (SYSVSHM_RING_SIZE - 1)];
+	struct timespec t_start, t_now, tmo;
+	uint32_t seq;
+	long waited;
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	while((seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE)) != pos)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &t_now);
+		waited = (t_now.tv_sec - t_start.tv_sec) * 1000 + (t_now.tv_nsec - t_start.tv_nsec) / 1000000;
+		if(waited >= SYSVSHM_RING_WAIT_MS)
+		{
+			if(is_dead(shm_ptr->pid))
+			{
+				TPT_TRACE(TRACE_ERROR, "Receiver %d died before giving back ring position %u!", shm_ptr->pid, pos);
+				return false;
+			}
+
+			TPT_TRACE(TRACE_ABN, "Ring position %u held up for %d ms, receiver %d is still alive!", pos, SYSVSHM_RING_WAIT_MS, shm_ptr->pid);
+			t_start = t_now;
+			waited = 0;
+		}
+
+		// The rx thread only wakes us if it sees waiters after giving the cell back, and the futex does not sleep once it did
+		tmo.tv_sec = (SYSVSHM_RING_WAIT_MS - waited) / 1000;
+		tmo.tv_nsec = ((SYSVSHM_RING_WAIT_MS - waited) % 1000) * 1000000;
+		__atomic_fetch_add(&shm_ptr->ring_waiters, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &cell->seq, FUTEX_WAIT, seq, &tmo, NULL, 0);
+		__atomic_fetch_sub(&shm_ptr->ring_waiters, 1, __ATOMIC_SEQ_CST);
 	}
 
-	if (semctl(sysvshm_inst.my_sem_notify, 0, IPC_RMID, 0) == -1)
+	// Only written once the cell is ours, the rx thread clears it when it takes the cell
+	__atomic_store_n(&cell->owner, sysvshm_inst.my_pid, __ATOMIC_RELAXED);
+	cell->slot.whichpool = whichpool;
+	cell->slot.whichslot = whichslot;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+	// No syscall as long as the rx thread is awake
+	if(__atomic_load_n(&shm_ptr->rx_sleeping, __ATOMIC_SEQ_CST) == 1 && __atomic_exchange_n(&shm_ptr->rx_sleeping, 0, __ATOMIC_SEQ_CST) == 1)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to IPC_RMID semctl(my_sem_notify), errno = %d", errno);
-		return;
+		syscall(SYS_futex, &shm_ptr->rx_sleeping, FUTEX_WAKE, 1, NULL, NULL, 0);
 	}
 
-	if (semctl(sysvshm_inst.my_sem_slot, 0, IPC_RMID, 0) == -1)
+	return true;
+}
+
+static bool dequeue_sysvshm_ring(struct sysvshm_metadata_t *shm_ptr, struct sysvshm_pool_slot *pool_slot)
+{
+	uint32_t pos = shm_ptr->ring_head;
+	struct sysvshm_ring_cell *cell = &shm_ptr->ring[pos & (SYSVSHM_RING_SIZE - 1)];
+
+	if(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to IPC_RMID semctl(my_sem_slot), errno = %d", errno);
-		return;
+		return false;
 	}
+
+	*pool_slot = cell->slot;
+	give_back_sysvshm_cell(shm_ptr, cell, pos);
+	return true;
 }
 
-static void init_sysvshm_rx_thread(struct result_code* rc)
+/* Hands the cell of ring position pos over to the sender that gets pos + SYSVSHM_RING_SIZE */
+static void give_back_sysvshm_cell(struct sysvshm_metadata_t *shm_ptr, struct sysvshm_ring_cell *cell, uint32_t pos)
 {
-	int res = pthread_key_create(&sysvshm_inst.destruct_key, rxthread_destructor);
-	if(res != 0)
+	cell->owner = 0;
+	__atomic_store_n(&cell->seq, pos + SYSVSHM_RING_SIZE, __ATOMIC_SEQ_CST);
+	shm_ptr->ring_head = pos + 1;
+
+	if(__atomic_load_n(&shm_ptr->ring_waiters, __ATOMIC_SEQ_CST) != 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to pthread_key_create, error code = %d", res);
-		remove_sysvshm();
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		syscall(SYS_futex, &cell->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
 	}
+}
 
-	res = pthread_mutex_init(&sysvshm_inst.thread_mtx, NULL);
-	if(res != 0)
+/* rx_sleeping is raised before the ring is checked one last time and senders check it after publishing, so either we see
+their message here or they see us sleeping and wake us up. While a sender has got the head position but not filled it,
+wake up now and then to look whether it is still alive, see skip_dead_sysvshm_sender() */
+static void wait_for_sysvshm_ring(struct sysvshm_metadata_t *shm_ptr)
+{
+	uint32_t pos = shm_ptr->ring_head;
+	struct timespec tmo = { 0, SYSVSHM_HELD_UP_MS * 1000000 };
+	bool is_claimed = __atomic_load_n(&shm_ptr->ring_tail, __ATOMIC_RELAXED) != pos;
+
+	__atomic_store_n(&shm_ptr->rx_sleeping, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&shm_ptr->ring[pos & (SYSVSHM_RING_SIZE - 1)].seq, __ATOMIC_SEQ_CST) != pos + 1)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutex_init, error code = %d", res);
-		remove_sysvshm();
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		if(syscall(SYS_futex, &shm_ptr->rx_sleeping, FUTEX_WAIT, 1, is_claimed ? &tmo : NULL, NULL, 0) == -1 &&
+		   errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to FUTEX_WAIT, errno = %d!", errno);
+		}
 	}
 
-	add_itcthread(rc, sysvshm_rx_thread, NULL, false, &sysvshm_inst.thread_mtx);
+	__atomic_store_n(&shm_ptr->rx_sleeping, 0, __ATOMIC_RELAXED);
 }
 
-static void init_sysvshm_mempool(struct sysvshm_metadata_t *shm_ptr)
+/* A sender that got the head position but died before filling it would hold the ring up forever. Once the head has been
+taken but empty for SYSVSHM_HELD_UP_MS and its sender is dead, skip it and give back the slots the sender held. Returns
+whether the head has moved on or been filled meanwhile */
+static bool skip_dead_sysvshm_sender(struct sysvshm_metadata_t *shm_ptr)
 {
-	struct sysvshm_metadata_t *metadata = shm_ptr;
+	uint32_t pos = shm_ptr->ring_head;
+	struct sysvshm_ring_cell *cell = &shm_ptr->ring[pos & (SYSVSHM_RING_SIZE - 1)];
+	struct timespec t_now;
+	pid_t owner;
 
-	// At this moment owner don't need to lock my_sem_mutex since it's = 0 currently after initialization
-	metadata->head.whichpool = -1;
-	metadata->head.whichslot = -1;
-	metadata->tail.whichpool = -1;
-	metadata->tail.whichslot = -1;
-	metadata->num_pages = SYSVSHM_STATIC_ALLOC_PAGES;
-	metadata->num_unlimit_pages = 0;
-
-	struct sysvshm_slot_info_t *slot_header = (struct sysvshm_slot_info_t *)((unsigned long)metadata + sysvshm_inst.pool_offset[POOL_96]);
-	for(unsigned char i = 0; i < sysvshm_inst.num_slots[POOL_96]; ++i)
+	if(__atomic_load_n(&shm_ptr->ring_tail, __ATOMIC_RELAXED) == pos)
 	{
-		slot_header->pool_type = POOL_96;
-		slot_header->is_in_use = false;
-		slot_header->next_slot.whichpool = -1;
-		slot_header->next_slot.whichslot = -1;
-		slot_header = (struct sysvshm_slot_info_t *)((unsigned long)slot_header + 128);
+		sysvshm_inst.is_held_up = false;
+		return false;
 	}
 
-	slot_header = (struct sysvshm_slot_info_t *)((unsigned long)metadata + sysvshm_inst.pool_offset[POOL_480]);
-	for(unsigned char i = 0; i < sysvshm_inst.num_slots[POOL_480]; ++i)
+	clock_gettime(CLOCK_MONOTONIC, &t_now);
+	if(!sysvshm_inst.is_held_up || sysvshm_inst.held_up_pos != pos)
 	{
-		slot_header->pool_type = POOL_480;
-		slot_header->is_in_use = false;
-		slot_header->next_slot.whichpool = -1;
-		slot_header->next_slot.whichslot = -1;
-		slot_header = (struct sysvshm_slot_info_t *)((unsigned long)slot_header + 512);
+		sysvshm_inst.is_held_up = true;
+		sysvshm_inst.held_up_pos = pos;
+		sysvshm_inst.held_up_since = t_now;
+		return false;
 	}
 
-	slot_header = (struct sysvshm_slot_info_t *)((unsigned long)metadata + sysvshm_inst.pool_offset[POOL_992]);
-	for(unsigned char i = 0; i < sysvshm_inst.num_slots[POOL_992]; ++i)
+	if((t_now.tv_sec - sysvshm_inst.held_up_since.tv_sec) * 1000 +
+	   (t_now.tv_nsec - sysvshm_inst.held_up_since.tv_nsec) / 1000000 < SYSVSHM_HELD_UP_MS)
 	{
-		slot_header->pool_type = POOL_992;
-		slot_header->is_in_use = false;
-		slot_header->next_slot.whichpool = -1;
-		slot_header->next_slot.whichslot = -1;
-		slot_header = (struct sysvshm_slot_info_t *)((unsigned long)slot_header + 1024);
+		return false;
 	}
 
-	slot_header = (struct sysvshm_slot_info_t *)((unsigned long)metadata + sysvshm_inst.pool_offset[POOL_2016]);
-	for(unsigned char i = 0; i < sysvshm_inst.num_slots[POOL_2016]; ++i)
+	// A sender that died before it could write owner cannot be told from a slow one, keep waiting for it
+	sysvshm_inst.held_up_since = t_now;
+	owner = __atomic_load_n(&cell->owner, __ATOMIC_RELAXED);
+	if(owner == 0 || !is_dead(owner))
 	{
-		slot_header->pool_type = POOL_2016;
-		slot_header->is_in_use = false;
-		slot_header->next_slot.whichpool = -1;
-		slot_header->next_slot.whichslot = -1;
-		slot_header = (struct sysvshm_slot_info_t *)((unsigned long)slot_header + 2048);
+		return false;
 	}
 
-	slot_header = (struct sysvshm_slot_info_t *)((unsigned long)metadata + sysvshm_inst.pool_offset[POOL_4064]);
-	for(unsigned char i = 0; i < sysvshm_inst.num_slots[POOL_4064]; ++i)
+	if(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) == pos + 1)
 	{
-		slot_header->pool_type = POOL_4064;
-		slot_header->is_in_use = false;
-		slot_header->next_slot.whichpool = -1;
-		slot_header->next_slot.whichslot = -1;
-		slot_header = (struct sysvshm_slot_info_t *)((unsigned long)slot_header + 4096);
+		// Filled just before it died
+		return true;
 	}
 
-	slot_header = (struct sysvshm_slot_info_t *)((unsigned long)metadata + sysvshm_inst.pool_offset[POOL_16352]);
-	for(unsigned char i = 0; i < sysvshm_inst.num_slots[POOL_16352]; ++i)
+	TPT_TRACE(TRACE_ERROR, "Sender %d died before filling ring position %u, skipping it!", owner, pos);
+	reclaim_dead_sysvshm_slots(shm_ptr, owner);
+	give_back_sysvshm_cell(shm_ptr, cell, pos);
+	sysvshm_inst.is_held_up = false;
+	return true;
+}
+
+/* Slots still held by a dead sender, except the ones of messages it managed to put in the ring, which we still receive */
+static void reclaim_dead_sysvshm_slots(struct sysvshm_metadata_t *shm_ptr, pid_t owner)
+{
+	uint32_t tail = __atomic_load_n(&shm_ptr->ring_tail, __ATOMIC_ACQUIRE);
+
+	for(int whichpool = POOL_96; whichpool < NUM_POOLS; ++whichpool)
 	{
-		slot_header->pool_type = POOL_16352;
-		slot_header->is_in_use = false;
-		slot_header->next_slot.whichpool = -1;
-		slot_header->next_slot.whichslot = -1;
-		slot_header = (struct sysvshm_slot_info_t *)((unsigned long)slot_header + 16384);
+		uint64_t free_slots = __atomic_load_n(&shm_ptr->free_slots[whichpool], __ATOMIC_ACQUIRE);
+
+		for(int whichslot = 0; whichslot < sysvshm_inst.num_slots[whichpool]; ++whichslot)
+		{
+			bool is_queued = false;
+
+			if((free_slots & (1ULL << whichslot)) ||
+			   __atomic_load_n(&get_sysvshm_slot(shm_ptr, whichpool, whichslot)->owner, __ATOMIC_RELAXED) != owner)
+			{
+				continue;
+			}
+
+			for(uint32_t pos = shm_ptr->ring_head + 1; pos != tail && !is_queued; ++pos)
+			{
+				struct sysvshm_ring_cell *cell = &shm_ptr->ring[pos & (SYSVSHM_RING_SIZE - 1)];
+
+				is_queued = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) == pos + 1 &&
+					    cell->slot.whichpool == whichpool && cell->slot.whichslot == whichslot;
+			}
+
+			if(!is_queued)
+			{
+				TPT_TRACE(TRACE_INFO, "Giving back slot %d of pool %d held by dead sender %d", whichslot, whichpool, owner);
+				release_sysvshm_slot(shm_ptr, whichpool, whichslot);
+			}
+		}
 	}
 }
 
+/* Alive but owned by another user still counts as alive */
+static bool is_dead(pid_t pid)
+{
+	return kill(pid, 0) == -1 && errno == ESRCH;
+}
+
 static void release_sysvshm_resources(struct result_code* rc)
 {
 	remove_sysvshm();
-	remove_sysvshm_semaphores();
 	release_sysvshm_contactlist();
 
 	int ret = pthread_key_delete(sysvshm_inst.destruct_key);
@@ -904,70 +975,192 @@ static void release_sysvshm_resources(struct result_code* rc)
 		return;
 	}
 
+	ret = pthread_mutex_destroy(&sysvshm_inst.large_mtx);
+	if(ret != 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "pthread_mutex_destroy error code = %d", ret);
+		rc->flags |= ITC_SYSCALL_ERROR;
+		return;
+	}
+
 	sysvshm_inst.is_terminated = 1;
 	sysvshm_inst.is_initialized = -1;
 	memset(&sysvshm_inst, 0, sizeof(struct sysvshm_instance));
 }
 
-static void init_unilimit_sysvshm(struct result_code* rc, uint16_t num_unlimit_pages, struct sysvshm_contactlist* cl)
+/* Segments of large slots are created by senders under keys of the receiver, one file per process index, so that the
+next process with our index finds and removes whatever a previous one left behind */
+static void init_large_sysvshm_keys(key_t *keys, int proj_id)
 {
-	int proj_id;
-	key_t shm_key;
+	char path[64];
+	int fd;
 
-	proj_id = ((cl->mbox_id_in_itccoord & sysvshm_inst.itccoord_mask) >> sysvshm_inst.itccoord_shift);
+	snprintf(path, sizeof(path), "%s%d", ITC_SYSVSHM_LARGE_FILENAME, proj_id);
+	fd = open(path, O_CREAT | O_RDONLY, 0644);
+	if(fd == -1)
+	{
+		TPT_TRACE(TRACE_ABN, "Failed to open %s, errno = %d, large segments are not cleaned up after a crash!", path, errno);
+	} else
+	{
+		close(fd);
+	}
 
-	shm_key = ftok(ITC_SYSVSHM_UNLIMIT_FILENAME, proj_id);
-	if(shm_key == -1)
+	for(int whichslot = 0; whichslot < NUM_SLOTS_POOL_UNLIMIT; ++whichslot)
+	{
+		keys[whichslot] = (fd == -1) ? IPC_PRIVATE : ftok(path, whichslot + 1);
+		if(keys[whichslot] == -1)
+		{
+			TPT_TRACE(TRACE_ABN, "Failed to ftok %s, errno = %d!", path, errno);
+			keys[whichslot] = IPC_PRIVATE;
+		}
+
+		if(keys[whichslot] != IPC_PRIVATE)
+		{
+			remove_large_sysvshm_key(keys[whichslot]);
+		}
+	}
+}
+
+static void remove_large_sysvshm_key(key_t key)
+{
+	int shmid = shmget(key, 0, 0);
+
+	if(shmid == -1)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to ftok, errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
 
-	cl->unlimit_sysvshm_id = shmget(shm_key, (SYSVSHM_STATIC_ALLOC_PAGES + num_unlimit_pages) * SYSVSHM_PAGE_SIZE, 0666 | IPC_CREAT);
-	if(cl->unlimit_sysvshm_id == -1)
+	TPT_TRACE(TRACE_INFO, "Removing leftover large segment, key = 0x%08x", key);
+	if(shmctl(shmid, IPC_RMID, NULL) == -1)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to shmget, errno = %d", errno);
+		TPT_TRACE(TRACE_ERROR, "Failed to IPC_RMID shmctl(leftover large segment), errno = %d", errno);
+	}
+}
+
+/* Only called by the sender holding the slot, nobody else looks at the slot meanwhile. The old segment is removed first,
+which frees its key, whoever is still attached to it keeps it until they see generation move and detach. */
+static void grow_large_sysvshm(struct result_code* rc, struct sysvshm_large_slot *large_slot, uint32_t num_pages)
+{
+	uint32_t new_num_pages = (large_slot->num_pages > 0) ? large_slot->num_pages : SYSVSHM_LARGE_MIN_PAGES;
+	int shmid;
+
+	while(new_num_pages < num_pages)
+	{
+		new_num_pages *= 2;
+	}
+
+	if(large_slot->num_pages > 0)
+	{
+		if(shmctl(large_slot->shmid, IPC_RMID, NULL) == -1)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to IPC_RMID shmctl(old large segment), errno = %d", errno);
+		}
+
+		large_slot->shmid = -1;
+		large_slot->num_pages = 0;
+		__atomic_add_fetch(&large_slot->generation, 1, __ATOMIC_RELEASE);
+	}
+
+	// Only the receiver and senders of its user may attach
+	shmid = shmget(large_slot->key, (size_t)new_num_pages * SYSVSHM_PAGE_SIZE, 0600 | IPC_CREAT | IPC_EXCL);
+	if(shmid == -1)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to shmget %u pages, errno = %d", new_num_pages, errno);
 		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
 
-	cl->unlimit_shm_ptr = shmat(cl->unlimit_sysvshm_id, NULL, 0);
-	if(cl->unlimit_shm_ptr == (struct sysvshm_metadata_t *)-1)
+	large_slot->shmid = shmid;
+	large_slot->num_pages = new_num_pages;
+}
+
+/* Return our attachment of the segment of a large slot, attach it first if it is not the one we are attached to */
+static void *attach_large_sysvshm(uint32_t *attached_gen, void **attached_ptr, struct sysvshm_large_slot *large_slot)
+{
+	uint32_t generation = __atomic_load_n(&large_slot->generation, __ATOMIC_ACQUIRE);
+
+	if(*attached_ptr != NULL && *attached_gen == generation)
+	{
+		return *attached_ptr;
+	}
+
+	detach_large_sysvshm(attached_gen, attached_ptr);
+	if(large_slot->num_pages == 0)
+	{
+		TPT_TRACE(TRACE_ERROR, "Large slot has no segment!");
+		return NULL;
+	}
+
+	void *shm_ptr = shmat(large_slot->shmid, NULL, 0);
+	if(shm_ptr == (void *)-1)
 	{
 		TPT_TRACE(TRACE_ERROR, "Failed to shmat, errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
+		return NULL;
 	}
+
+	prefault_sysvshm(shm_ptr, (size_t)large_slot->num_pages * SYSVSHM_PAGE_SIZE);
+	*attached_gen = generation;
+	*attached_ptr = shm_ptr;
+
+	return shm_ptr;
 }
 
-static void get_my_unlimit_shm(uint16_t num_unlimit_pages)
+static void detach_large_sysvshm(uint32_t *attached_gen, void **attached_ptr)
 {
-	int proj_id;
-	key_t shm_key;
+	if(*attached_ptr != NULL && shmdt(*attached_ptr) == -1)
+	{
+		TPT_TRACE(TRACE_ERROR, "Failed to shmdt, errno = %d!", errno);
+	}
 
-	proj_id = ((sysvshm_inst.my_mbox_id_in_itccoord & sysvshm_inst.itccoord_mask) >> sysvshm_inst.itccoord_shift);
+	*attached_gen = 0;
+	*attached_ptr = NULL;
+}
 
-	shm_key = ftok(ITC_SYSVSHM_UNLIMIT_FILENAME, proj_id);
-	if(shm_key == -1)
+/* Lets go of segments of the receiver that were replaced or trimmed since we attached, rather than waiting for our next
+large message in their slot. The generation of a slot does not move while one of our threads holds it, so whatever that
+thread is attached to stays. */
+static void detach_stale_large_sysvshm(struct sysvshm_contactlist* cl)
+{
+	for(int i = 0; i < NUM_SLOTS_POOL_UNLIMIT; ++i)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to ftok, errno = %d", errno);
-		return;
+		if(__atomic_load_n(&cl->large_shm_ptr[i], __ATOMIC_RELAXED) == NULL ||
+		   __atomic_load_n(&cl->metadata->large_slots[i].generation, __ATOMIC_ACQUIRE) == cl->large_gen[i])
+		{
+			continue;
+		}
+
+		MUTEX_LOCK(&sysvshm_inst.large_mtx);
+		if(cl->large_shm_ptr[i] != NULL && __atomic_load_n(&cl->metadata->large_slots[i].generation, __ATOMIC_ACQUIRE) != cl->large_gen[i])
+		{
+			detach_large_sysvshm(&cl->large_gen[i], &cl->large_shm_ptr[i]);
+		}
+		MUTEX_UNLOCK(&sysvshm_inst.large_mtx);
 	}
+}
+
+/* Regions only grow while senders reuse them, so one grown beyond SYSVSHM_LARGE_TRIM_PAGES for a rare huge message is
+dropped once a message of a quarter of it or less has gone through. The next sender sets up a region of the size it
+needs, senders still attached let go of the old one with their next message to us, see detach_stale_large_sysvshm() */
+static void trim_large_sysvshm(int whichslot)
+{
+	struct sysvshm_large_slot *large_slot = &sysvshm_inst.my_shm_ptr->large_slots[whichslot];
 
-	sysvshm_inst.my_unlimit_shmid = shmget(shm_key, (SYSVSHM_STATIC_ALLOC_PAGES + num_unlimit_pages) * SYSVSHM_PAGE_SIZE, 0);
-	if(sysvshm_inst.my_unlimit_shmid == -1)
+	if(large_slot->num_pages <= SYSVSHM_LARGE_TRIM_PAGES || large_slot->used_pages * 4 > large_slot->num_pages)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to shmget, errno = %d", errno);
 		return;
 	}
 
-	sysvshm_inst.my_unlimit_shm_ptr = shmat(sysvshm_inst.my_unlimit_shmid, NULL, 0);
-	if(sysvshm_inst.my_unlimit_shm_ptr == (struct sysvshm_metadata_t *)-1)
+	TPT_TRACE(TRACE_INFO, "Trimming large slot %d of %u pages, %u used", whichslot, large_slot->num_pages, large_slot->used_pages);
+	detach_large_sysvshm(&sysvshm_inst.my_large_gen[whichslot], &sysvshm_inst.my_large_shm_ptr[whichslot]);
+	if(shmctl(large_slot->shmid, IPC_RMID, NULL) == -1)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to shmat, errno = %d", errno);
-		return;
+		TPT_TRACE(TRACE_ERROR, "Failed to IPC_RMID shmctl(large slot %d), errno = %d", whichslot, errno);
 	}
+
+	large_slot->shmid = -1;
+	large_slot->num_pages = 0;
+	large_slot->used_pages = 0;
+	__atomic_add_fetch(&large_slot->generation, 1, __ATOMIC_RELEASE);
 }
 
 static struct sysvshm_contactlist* get_sysvshm_cl(struct result_code* rc, itc_mbox_id_t mbox_id)
@@ -1009,9 +1202,6 @@ static void add_sysvshm_cl(struct result_code* rc, struct sysvshm_contactlist* c
 {
 	int shmid;
 	struct sysvshm_metadata_t *shm_ptr;
-	int sem_mutex;
-	int sem_notify;
-	int sem_slot;
 	int proj_id;
 	key_t key;
 	itc_mbox_id_t new_mbx_id;
@@ -1045,65 +1235,11 @@ static void add_sysvshm_cl(struct result_code* rc, struct sysvshm_contactlist* c
 		return;
 	}
 
-	// ITC_SYSVSHM_SEM_MUTEX
-	key = ftok(ITC_SYSVSHM_SEM_MUTEX, proj_id);
-	if(key == -1)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to ftok, errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
-
-	sem_mutex = semget(key, 1, 0);
-	if(sem_mutex == -1)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to semget, errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
-
-	// ITC_SYSVSHM_SEM_NOTIFY
-	key = ftok(ITC_SYSVSHM_SEM_NOTIFY, proj_id);
-	if(key == -1)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to ftok, errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
-
-	sem_notify = semget(key, 1, 0);
-	if(sem_notify == -1)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to semget, errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
-
-	// ITC_SYSVSHM_SEM_SLOT
-	key = ftok(ITC_SYSVSHM_SEM_SLOT, proj_id);
-	if(key == -1)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to ftok, errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
-
-	sem_slot = semget(key, 1, 0);
-	if(sem_slot == -1)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to semget, errno = %d", errno);
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
+	prefault_sysvshm(shm_ptr, SYSVSHM_STATIC_ALLOC_PAGES * SYSVSHM_PAGE_SIZE);
 
 	cl->mbox_id_in_itccoord = (mbox_id & sysvshm_inst.itccoord_mask);
 	cl->sysvshm_id = shmid;
 	cl->metadata = shm_ptr;
-	cl->m_sem_mutex = sem_mutex;
-	cl->m_sem_notify = sem_notify;
-	cl->m_sem_slot = sem_slot;
-	cl->unlimit_sysvshm_id = -1;
-	cl->unlimit_shm_ptr = NULL;
 }
 
 static void remove_sysvshm_cl(struct result_code* rc, itc_mbox_id_t mbox_id)
@@ -1112,17 +1248,25 @@ static void remove_sysvshm_cl(struct result_code* rc, itc_mbox_id_t mbox_id)
 	struct sysvshm_contactlist* cl;
 
 	cl = find_cl(rc, mbox_id);
+	if (cl->metadata != NULL && shmdt((void *)cl->metadata) == -1) {
+		TPT_TRACE(TRACE_ERROR, "Failed to shmdt, errno = %d!", errno);
+	}
+
+	MUTEX_LOCK(&sysvshm_inst.large_mtx);
+	for(int i = 0; i < NUM_SLOTS_POOL_UNLIMIT; ++i)
+	{
+		detach_large_sysvshm(&cl->large_gen[i], &cl->large_shm_ptr[i]);
+	}
+	MUTEX_UNLOCK(&sysvshm_inst.large_mtx);
+
 	cl->mbox_id_in_itccoord = 0;
 	cl->sysvshm_id = 0;
 	cl->metadata = NULL;
-	cl->m_sem_mutex = 0;
-	cl->m_sem_notify = 0;
-	cl->m_sem_slot = 0;
-	cl->unlimit_sysvshm_id = 0;
-	cl->unlimit_shm_ptr = NULL;
 }
 
-static void handle_received_message(struct itc_message *p_message)
+/* Gives the slot back to senders as soon as the message has been copied out of it, before the copy is forwarded.
+Otherwise the receiver may already answer and the sender take and fault in another slot for the next message */
+static void handle_received_message(struct itc_message *p_message, const struct sysvshm_pool_slot *head)
 {
 	struct itc_message* message;
 	union itc_msg* msg;
@@ -1132,8 +1276,18 @@ static void handle_received_message(struct itc_message *p_message)
 	if(*endpoint != ENDPOINT)
 	{
 		TPT_TRACE(TRACE_ABN, "Received malform message from some mailbox, invalid ENDPOINT 0x%02x!", *endpoint & 0xFF);
+		release_received_slot(head);
+		return;
+	}
+
+#ifndef UNITTEST
+	/* Receiver is blocked in itc_receive_into(), copy straight from our rx buffer and skip itc_alloc() + itc_send() */
+	if(itc_deliver_into_waiting_mbox(p_message))
+	{
+		release_received_slot(head);
 		return;
 	}
+#endif
 
 #ifdef UNITTEST
 	struct itc_message* tmp_message;
@@ -1147,8 +1301,9 @@ static void handle_received_message(struct itc_message *p_message)
 	message = CONVERT_TO_MESSAGE(msg);
 
 	flags = message->flags; // Saved flags
-	memcpy(message, p_message, (p_message->size + ITC_HEADER_SIZE + 1));
+	itc_copy(message, p_message, (p_message->size + ITC_HEADER_SIZE + 1));
 	message->flags = flags; // Retored flags
+	release_received_slot(head);
 
 #ifdef UNITTEST
 	// Simulate that everything is ok at this point. Do nothing in unit test.
@@ -1157,11 +1312,25 @@ static void handle_received_message(struct itc_message *p_message)
 	free(tmp_message);
 #else
 
-	// TPT_TRACE(TRACE_INFO, "Forwarding a message to local mailbox from external mbox = 0x%08x", message->sender); // TBD
-	itc_send(&msg, message->receiver, ITC_MY_MBOX_ID, NULL);
+	/* Straight onto the FIFO rx queue of the receiver, like the other transports, which also counts it as delivered */
+	if(!itc_deliver_local(message))
+	{
+		itc_free(&msg);
+	}
 #endif
 }
 
+/* Gives a slot back to senders from the rx thread, the only place where the region of a large slot can be trimmed */
+static void release_received_slot(const struct sysvshm_pool_slot *head)
+{
+	if(head->whichpool == POOL_UNLIMIT)
+	{
+		trim_large_sysvshm(head->whichslot);
+	}
+
+	release_sysvshm_slot(sysvshm_inst.my_shm_ptr, head->whichpool, head->whichslot);
+}
+
 static void rxthread_destructor(void* data)
 {
 	(void)data;
@@ -1169,6 +1338,7 @@ static void rxthread_destructor(void* data)
 	if(sysvshm_inst.my_shmid != -1)
 	{
 		sysvshm_inst.is_terminated = 1;
+		__atomic_store_n(&sysvshm_inst.my_shm_ptr->closed, 1, __ATOMIC_RELEASE);
 		if(shmctl(sysvshm_inst.my_shmid, IPC_RMID, NULL) == -1)
 		{
 			// ERROR trace is needed here
@@ -1235,131 +1405,62 @@ static void generate_msqfile(struct result_code* rc)
 		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
+}
 
-	fd = fopen(ITC_SYSVSHM_UNLIMIT_FILENAME, "w");
-	if(fd == NULL)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to fopen");
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
-
-	res = chmod(ITC_SYSVSHM_UNLIMIT_FILENAME, 0777);
-	if(res < 0)
+static void release_sysvshm_contactlist()
+{
+	for(int i = 0; i < MAX_SUPPORTED_PROCESSES; ++i)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to chmod");
-		// Will not "return" over here, just ignore it because maybe other users created this file earlier
-		// rc->flags |= ITC_SYSCALL_ERROR;
-		// return;
-	}
-
-	TPT_TRACE(TRACE_INFO, "Open file %s successfully!", ITC_SYSVSHM_UNLIMIT_FILENAME);
+		if(sysvshm_inst.sysvshm_cl[i].mbox_id_in_itccoord != 0)
+		{
+			if (shmdt((void *)sysvshm_inst.sysvshm_cl[i].metadata) == -1) {
+				TPT_TRACE(TRACE_ERROR, "Failed to shmdt, errno = %d!", errno);
+			}
 
-	if(fclose(fd) != 0)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to fclose");
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
-	
-	fd = fopen(ITC_SYSVSHM_SEM_MUTEX, "w");
-	if(fd == NULL)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to fopen");
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
+			for(int j = 0; j < NUM_SLOTS_POOL_UNLIMIT; ++j)
+			{
+				detach_large_sysvshm(&sysvshm_inst.sysvshm_cl[i].large_gen[j], &sysvshm_inst.sysvshm_cl[i].large_shm_ptr[j]);
+			}
 
-	res = chmod(ITC_SYSVSHM_SEM_MUTEX, 0777);
-	if(res < 0)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to chmod");
-		// Will not "return" over here, just ignore it because maybe other users created this file earlier
-		// rc->flags |= ITC_SYSCALL_ERROR;
-		// return;
+			sysvshm_inst.sysvshm_cl[i].mbox_id_in_itccoord = 0;
+			sysvshm_inst.sysvshm_cl[i].sysvshm_id = 0;
+			sysvshm_inst.sysvshm_cl[i].metadata = NULL;
+		}
 	}
+}
 
-	TPT_TRACE(TRACE_INFO, "Open file %s successfully!", ITC_SYSVSHM_SEM_MUTEX);
-
-	if(fclose(fd) != 0)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to fclose");
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
-	
-	fd = fopen(ITC_SYSVSHM_SEM_NOTIFY, "w");
-	if(fd == NULL)
+/* Fault in and lock every page of a segment as soon as it is attached, so that copying a message into or out of it later
+does not take page faults while the slot is held. mlock() both populates and pins the pages, if RLIMIT_MEMLOCK does
+not allow it the pages are only populated. Detaching a segment unlocks it. */
+static void prefault_sysvshm(void *shm_ptr, size_t size)
+{
+	if(!sysvshm_inst.prefault)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to fopen");
-		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
 
-	res = chmod(ITC_SYSVSHM_SEM_NOTIFY, 0777);
-	if(res < 0)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to chmod");
-		// Will not "return" over here, just ignore it because maybe other users created this file earlier
-		// rc->flags |= ITC_SYSCALL_ERROR;
-		// return;
-	}
-
-	TPT_TRACE(TRACE_INFO, "Open file %s successfully!", ITC_SYSVSHM_SEM_NOTIFY);
-
-	if(fclose(fd) != 0)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to fclose");
-		rc->flags |= ITC_SYSCALL_ERROR;
-		return;
-	}
-	
-	fd = fopen(ITC_SYSVSHM_SEM_SLOT, "w");
-	if(fd == NULL)
+	if(mlock(shm_ptr, size) == 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to fopen");
-		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
 
-	res = chmod(ITC_SYSVSHM_SEM_SLOT, 0777);
-	if(res < 0)
+	if(!sysvshm_inst.mlock_failed)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to chmod");
-		// Will not "return" over here, just ignore it because maybe other users created this file earlier
-		// rc->flags |= ITC_SYSCALL_ERROR;
-		// return;
+		TPT_TRACE(TRACE_ABN, "Failed to mlock %zu bytes, errno = %d, only prefault shared memory from now on!", size, errno);
+		sysvshm_inst.mlock_failed = true;
 	}
 
-	TPT_TRACE(TRACE_INFO, "Open file %s successfully!", ITC_SYSVSHM_SEM_SLOT);
-
-	if(fclose(fd) != 0)
+#ifdef MADV_POPULATE_WRITE
+	if(madvise(shm_ptr, size, MADV_POPULATE_WRITE) == 0)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to fclose");
-		rc->flags |= ITC_SYSCALL_ERROR;
 		return;
 	}
-}
+#endif
 
-static void release_sysvshm_contactlist()
-{
-	for(int i = 0; i < MAX_SUPPORTED_PROCESSES; ++i)
+	// Older kernels, reading a byte of each page maps it as well
+	for(size_t offset = 0; offset < size; offset += SYSVSHM_PAGE_SIZE)
 	{
-		if(sysvshm_inst.sysvshm_cl[i].mbox_id_in_itccoord != 0)
-		{
-			if (shmdt((void *)sysvshm_inst.sysvshm_cl[i].metadata) == -1) {
-				TPT_TRACE(TRACE_ERROR, "Failed to shmdt, errno = %d!", errno);
-			}
-
-			sysvshm_inst.sysvshm_cl[i].mbox_id_in_itccoord = 0;
-			sysvshm_inst.sysvshm_cl[i].sysvshm_id = 0;
-			sysvshm_inst.sysvshm_cl[i].metadata = NULL;
-			sysvshm_inst.sysvshm_cl[i].m_sem_mutex = 0;
-			sysvshm_inst.sysvshm_cl[i].m_sem_notify = 0;
-			sysvshm_inst.sysvshm_cl[i].m_sem_slot = 0;
-			sysvshm_inst.sysvshm_cl[i].unlimit_shm_ptr = NULL;
-			sysvshm_inst.sysvshm_cl[i].unlimit_sysvshm_id = 0;
-		}
+		(void)*(volatile char *)((unsigned long)shm_ptr + offset);
 	}
 }
 
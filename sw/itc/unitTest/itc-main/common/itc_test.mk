@@ -0,0 +1,84 @@
+# Included by the Makefiles of tests that fork ITC processes with itc_test_proc.c. They set TARGET, which is also the name
+# of their source file, and may set TRANSPORTS, the transporters linked in besides local and lsocket, and RUN_ARGS.
+BIN = ./bin
+# itc.c is built without -DMOCK_..._UNITTEST here, the test needs a real itccoord to attach to
+CFLAGS = -g -O2 -Wall -Wextra -lpthread -lrt
+CC = gcc
+TRANSPORTS ?= itc_sysvmq itc_sysvshm itc_posixshm
+
+SDK_SYSROOT_DIR		:= $(SDKSYSROOT)
+SDK_USR_DIR		:= $(SDK_SYSROOT_DIR)/usr
+SDK_LIB_DIR		:= $(SDK_USR_DIR)/lib
+SDK_INC_DIR		:= $(SDK_USR_DIR)/include
+
+INCLUDE_DIR =
+INCLUDE_DIR += -I ../../../if
+INCLUDE_DIR += -I ../../../inc
+INCLUDE_DIR += -I ../common
+INCLUDE_DIR += -I $(SDK_INC_DIR)
+
+SRC_DIR =
+SRC_DIR += -I ../../../src
+SRC_DIR += -I ../../../src/allocators
+SRC_DIR += -I ../../../src/helpers
+SRC_DIR += -I ../../../src/transporters
+SRC_DIR += -I ../common
+SRC_DIR += -I ./
+
+vpath %.h 	$(INCLUDE_DIR)
+vpath %.c 	$(SRC_DIR)
+
+OBJS = $(TARGET) itc_test_proc itc itc_copy itc_threadmanager itc_queue itc_nametable itc_malloc itc_local itc_lsocket $(TRANSPORTS)
+
+.PHONY: all run clean
+
+all: create_bin $(TARGET)
+
+create_bin:
+	@mkdir -p $(BIN)
+
+
+$(TARGET): $(addprefix $(BIN)/, $(addsuffix .o, $(OBJS)))
+	$(CC) $^ $(CFLAGS) -L$(SDK_LIB_DIR) -ltraceifa -o $(BIN)/$(TARGET)
+
+
+$(BIN)/$(TARGET).o: $(TARGET).c itc.h itc_test_proc.h
+	$(CC) -c $(CFLAGS) -o $@ $(INCLUDE_DIR) $(SRC_DIR) $<
+
+$(BIN)/itc_test_proc.o: itc_test_proc.c itc_test_proc.h itc.h
+	$(CC) -c $(CFLAGS) -o $@ $(INCLUDE_DIR) $(SRC_DIR) $<
+
+$(BIN)/itc.o: itc.c itc_impl.h itc.h itci_alloc.h itci_trans.h itc_threadmanager.h itc_proto.h itc_queue.h itc_nametable.h
+	$(CC) -c $(CFLAGS) -o $@ $(INCLUDE_DIR) $(SRC_DIR) $<
+
+$(BIN)/itc_copy.o: itc_copy.c itc_impl.h
+	$(CC) -c $(CFLAGS) -o $@ $(INCLUDE_DIR) $(SRC_DIR) $<
+
+$(BIN)/itc_threadmanager.o: itc_threadmanager.c itc_impl.h
+	$(CC) -c $(CFLAGS) -o $@ $(INCLUDE_DIR) $(SRC_DIR) $<
+
+$(BIN)/itc_queue.o: itc_queue.c itc_impl.h itc_queue.h
+	$(CC) -c $(CFLAGS) -o $@ $(INCLUDE_DIR) $(SRC_DIR) $<
+
+$(BIN)/itc_nametable.o: itc_nametable.c itc_impl.h itc_nametable.h
+	$(CC) -c $(CFLAGS) -o $@ $(INCLUDE_DIR) $(SRC_DIR) $<
+
+$(BIN)/itc_malloc.o: itc_malloc.c itc_impl.h itci_alloc.h itc.h
+	$(CC) -c $(CFLAGS) -o $@ $(INCLUDE_DIR) $(SRC_DIR) $<
+
+$(BIN)/itc_local.o: itc_local.c itc_impl.h itci_trans.h itc.h
+	$(CC) -c $(CFLAGS) -o $@ $(INCLUDE_DIR) $(SRC_DIR) $<
+
+$(BIN)/itc_lsocket.o: itc_lsocket.c itc_impl.h itci_trans.h itc.h itc_proto.h
+	$(CC) -c $(CFLAGS) -o $@ $(INCLUDE_DIR) $(SRC_DIR) $<
+
+# The IPC transporters
+$(BIN)/itc_%.o: itc_%.c itc_impl.h itci_trans.h itc.h itc_threadmanager.h
+	$(CC) -c $(CFLAGS) -o $@ $(INCLUDE_DIR) $(SRC_DIR) $<
+
+# Needs itccoord to be running, e.g. ../../../../bin/exec/itccoord_so &
+run:
+	$(BIN)/$(TARGET) $(RUN_ARGS)
+
+clean:
+	rm -rf $(BIN)
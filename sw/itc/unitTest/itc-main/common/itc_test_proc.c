@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "itc_test_proc.h"
+
+uint64_t itc_test_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+itc_mbox_id_t itc_test_locate(const char *name)
+{
+	itc_mbox_id_t mbox_id = ITC_NO_MBOX_ID;
+
+	for(int i = 0; i < ITC_TEST_LOCATE_RETRIES && mbox_id == ITC_NO_MBOX_ID; i++)
+	{
+		mbox_id = itc_locate_sync(3000, name, true, NULL, NULL);
+		if(mbox_id == ITC_NO_MBOX_ID)
+		{
+			usleep(10000);
+		}
+	}
+
+	return mbox_id;
+}
+
+bool itc_test_write(int fd, const void *buf, size_t size)
+{
+	return write(fd, buf, size) == (ssize_t)size;
+}
+
+bool itc_test_start(struct itc_test_proc *proc)
+{
+	int result_pipe[2];
+
+	proc->pid = -1;
+	proc->fd = -1;
+	if(proc->result != NULL)
+	{
+		memset(proc->result, 0, proc->result_size);
+	}
+
+	if(pipe(result_pipe) < 0)
+	{
+		return false;
+	}
+
+	proc->pid = fork();
+	if(proc->pid < 0)
+	{
+		close(result_pipe[0]);
+		close(result_pipe[1]);
+		return false;
+	} else if(proc->pid == 0)
+	{
+		close(result_pipe[0]);
+		_exit(proc->main(proc->arg, result_pipe[1]) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	close(result_pipe[1]);
+	proc->fd = result_pipe[0];
+	return true;
+}
+
+bool itc_test_finish(struct itc_test_proc *proc)
+{
+	size_t nr_read = 0;
+	ssize_t n = 1;
+	int status;
+
+	if(proc->pid < 0)
+	{
+		return false;
+	}
+
+	while(proc->result != NULL && nr_read < proc->result_size && n > 0)
+	{
+		n = read(proc->fd, (char *)proc->result + nr_read, proc->result_size - nr_read);
+		nr_read += (n > 0) ? (size_t)n : 0;
+	}
+	close(proc->fd);
+
+	waitpid(proc->pid, &status, 0);
+	proc->pid = -1;
+
+	return (proc->result == NULL || nr_read == proc->result_size) && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+bool itc_test_run(struct itc_test_proc *procs, uint32_t nr_procs)
+{
+	bool ok = true;
+
+	for(uint32_t i = 0; i < nr_procs; i++)
+	{
+		ok = itc_test_start(&procs[i]) && ok;
+	}
+
+	for(uint32_t i = 0; i < nr_procs; i++)
+	{
+		ok = itc_test_finish(&procs[i]) && ok;
+	}
+
+	return ok;
+}
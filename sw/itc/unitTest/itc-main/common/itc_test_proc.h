@@ -0,0 +1,63 @@
+#ifndef __ITC_TEST_PROC_H__
+#define __ITC_TEST_PROC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "itc.h"
+
+#define PRINT_DASH_START					\
+	do							\
+	{							\
+		printf("\n-------------------------------------------------------------------------------------------------------------------\n");	\
+	} while(0)
+
+#define PRINT_DASH_END						\
+	do							\
+	{							\
+		printf("-------------------------------------------------------------------------------------------------------------------\n\n");	\
+	} while(0)
+
+#define ITC_TEST_LOCATE_RETRIES		300	// 10 ms apart
+
+/* Runs in a freshly forked child, as ITC is meant to be initialized once per process. What it writes to fd is read back
+** into result of its itc_test_proc, and the child exits with EXIT_SUCCESS if it returns true. */
+typedef bool (*itc_test_main)(void *arg, int fd);
+
+struct itc_test_proc {
+	itc_test_main		main;
+	void			*arg;
+	void			*result;	// Cleared by itc_test_start(), may be NULL if the child writes nothing
+	size_t			result_size;
+
+	pid_t			pid;		// Set by itc_test_start()
+	int			fd;		// Read end of the pipe the child writes its result to
+};
+
+extern uint64_t itc_test_now_ns(void);
+
+/* The peer is forked at the same time as us and itccoord does not wait for a mailbox that is not there yet, so retry */
+extern itc_mbox_id_t itc_test_locate(const char *name);
+
+/* Whether all size bytes went out, the result of a child is one write() */
+extern bool itc_test_write(int fd, const void *buf, size_t size);
+
+extern bool itc_test_start(struct itc_test_proc *proc);
+
+/* Reads the result and reaps the child, returns whether both went fine */
+extern bool itc_test_finish(struct itc_test_proc *proc);
+
+/* Starts all of them in the given order, e.g. the receiver first, and finishes them in the same order */
+extern bool itc_test_run(struct itc_test_proc *procs, uint32_t nr_procs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ITC_TEST_PROC_H__
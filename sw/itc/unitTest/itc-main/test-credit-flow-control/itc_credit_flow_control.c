@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define NR_SLOW_MSGS		2000
+#define SLOW_EVERY		8	// The slow receiver sleeps 1 ms every SLOW_EVERY messages
+#define GONE_AFTER_MS		300	// The receiver that goes away exits this long after creating its mailbox
+#define CREDIT_FILENAME		"/tmp/itc/credits_%u"	// Of a process index, as in itc_impl.h
+#define RECEIVER_MBOX_NAME	"credit_receiver"
+#define SENDER_MBOX_NAME	"credit_sender"
+#define CREDIT_DATA_MSG		0x1
+
+enum receiver_mode {
+	HOLDS_BACK,	// Receives nothing until the sender ran out of credits
+	SLOW,		// Receives everything, slowly
+	GOES_AWAY	// Dies while the sender waits for credits, and a successor replaces its credit file
+};
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	seq;
+	} credit_data;
+};
+
+struct sender_result {
+	uint32_t		nr_sent;
+	uint32_t		fail_ms;	// How long the send that failed took
+	uint32_t		nr_stats;
+	struct itc_credit_stats	stats;
+};
+
+struct receiver_result {
+	uint32_t		nr_received;
+	uint32_t		nr_out_of_order;
+};
+
+struct round_result {
+	struct sender_result	sender;
+	struct receiver_result	receiver;
+};
+
+struct round_args {
+	enum receiver_mode	mode;
+	int			go_pipe[2];	// The sender tells a receiver that holds back when to start
+};
+
+static bool run_round(const char *tmo, enum receiver_mode mode, struct round_result *result);
+static bool run_receiver(void *arg, int fd);
+static bool run_sender(void *arg, int fd);
+
+/* Expect main call:    ./itc_credit_flow_control
+** A sender process sends over sysvmq to an ITC_FLOW_CONTROL receiver process, whose ITC_DIRECT_IPC_RX mailbox only takes
+** messages off the message queue when its owner receives them. While the receiver holds back, exactly ITC_CREDIT_WINDOW
+** sends must succeed and the next one must fail, right away with ITC_CREDIT_TMO=0 and after 100 ms with ITC_CREDIT_TMO=100.
+** Then the receiver is slow instead, and the sender must stall on credits but get all NR_SLOW_MSGS messages through in
+** order. Last the receiver dies while the sender waits with ITC_CREDIT_TMO=5000, and its credit file is replaced as a
+** successor at its process index would do. The sender must stop waiting for credits that never come within about
+** 100 ms, without counting it as a failure. Prints the credit stall counters of the sender. itccoord
+** must be running. */
+int main(void)
+{
+	struct round_result fast_fail, tmo_fail, slow, gone;
+	bool passed;
+
+	if(!run_round("0", HOLDS_BACK, &fast_fail) || !run_round("100", HOLDS_BACK, &tmo_fail) || !run_round(NULL, SLOW, &slow) ||
+	   !run_round("5000", GOES_AWAY, &gone))
+	{
+		printf("\tFailed to run test, is itccoord running?\n");
+		return EXIT_FAILURE;
+	}
+
+	passed = fast_fail.sender.nr_sent == ITC_CREDIT_WINDOW && fast_fail.sender.fail_ms < 10 &&
+		 fast_fail.receiver.nr_received == ITC_CREDIT_WINDOW && fast_fail.sender.stats.nr_failed == 1;
+	passed = passed && tmo_fail.sender.nr_sent == ITC_CREDIT_WINDOW && tmo_fail.sender.fail_ms >= 100 &&
+		 tmo_fail.sender.fail_ms < 150 && tmo_fail.receiver.nr_received == ITC_CREDIT_WINDOW && tmo_fail.sender.stats.nr_failed == 1;
+	passed = passed && slow.sender.nr_sent == NR_SLOW_MSGS && slow.receiver.nr_received == NR_SLOW_MSGS &&
+		 slow.receiver.nr_out_of_order == 0 && slow.sender.nr_stats == 1 && slow.sender.stats.nr_stalls > 0 && slow.sender.stats.nr_failed == 0;
+	passed = passed && gone.sender.nr_sent >= ITC_CREDIT_WINDOW && gone.sender.stats.nr_stalls > 0 &&
+		 gone.sender.stats.max_stall_ns < (GONE_AFTER_MS + 500) * 1000000ULL && gone.sender.stats.nr_failed == 0;
+
+	PRINT_DASH_START;
+	printf("\tsysvmq towards an ITC_FLOW_CONTROL process, window of %d messages:\n", ITC_CREDIT_WINDOW);
+	printf("\t%22s %10s %12s %10s %14s %14s %8s\n", "receiver", "sent", "failed after", "stalls", "stalled", "max stall", "failed");
+	printf("\t%22s %10u %9u ms %10lu %11.2f ms %11.2f ms %8lu\n", "holds back, tmo 0", fast_fail.sender.nr_sent,
+		fast_fail.sender.fail_ms, fast_fail.sender.stats.nr_stalls, fast_fail.sender.stats.stall_ns / 1000000.0,
+		fast_fail.sender.stats.max_stall_ns / 1000000.0, fast_fail.sender.stats.nr_failed);
+	printf("\t%22s %10u %9u ms %10lu %11.2f ms %11.2f ms %8lu\n", "holds back, tmo 100", tmo_fail.sender.nr_sent,
+		tmo_fail.sender.fail_ms, tmo_fail.sender.stats.nr_stalls, tmo_fail.sender.stats.stall_ns / 1000000.0,
+		tmo_fail.sender.stats.max_stall_ns / 1000000.0, tmo_fail.sender.stats.nr_failed);
+	printf("\t%22s %10u %12s %10lu %11.2f ms %11.2f ms %8lu\n", "slow", slow.sender.nr_sent, "-",
+		slow.sender.stats.nr_stalls, slow.sender.stats.stall_ns / 1000000.0, slow.sender.stats.max_stall_ns / 1000000.0,
+		slow.sender.stats.nr_failed);
+	printf("\t%22s %10u %9u ms %10lu %11.2f ms %11.2f ms %8lu\n", "goes away, tmo 5000", gone.sender.nr_sent,
+		gone.sender.fail_ms, gone.sender.stats.nr_stalls, gone.sender.stats.stall_ns / 1000000.0,
+		gone.sender.stats.max_stall_ns / 1000000.0, gone.sender.stats.nr_failed);
+	printf("\tSlow receiver got %u of %d messages, %u out of order\n", slow.receiver.nr_received, NR_SLOW_MSGS,
+		slow.receiver.nr_out_of_order);
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* tmo goes to ITC_CREDIT_TMO of the sender, NULL for the default */
+static bool run_round(const char *tmo, enum receiver_mode mode, struct round_result *result)
+{
+	struct round_args args = { .mode = mode };
+	struct itc_test_proc procs[] = {
+		{ .main = run_receiver, .arg = &args, .result = &result->receiver, .result_size = sizeof(result->receiver) },
+		{ .main = run_sender, .arg = &args, .result = &result->sender, .result_size = sizeof(result->sender) }
+	};
+	bool ok;
+
+	if(pipe(args.go_pipe) < 0)
+	{
+		return false;
+	}
+
+	setenv("ITC_TRANSPORTS", "sysvmq", 1);
+	if(tmo != NULL)
+	{
+		setenv("ITC_CREDIT_TMO", tmo, 1);
+	} else
+	{
+		unsetenv("ITC_CREDIT_TMO");
+	}
+
+	ok = itc_test_start(&procs[0]);
+	ok = itc_test_start(&procs[1]) && ok;
+	close(args.go_pipe[0]);
+	close(args.go_pipe[1]);
+	ok = itc_test_finish(&procs[1]) && ok;
+
+	return itc_test_finish(&procs[0]) && ok;
+}
+
+/* Holding back, nothing is received until the sender tells over the go pipe how many messages it got out */
+static bool run_receiver(void *arg, int fd)
+{
+	struct round_args *args = (struct round_args *)arg;
+	enum receiver_mode mode = args->mode;
+	struct receiver_result result;
+	itc_mbox_id_t my_mbox_id;
+	uint32_t nr_expected = NR_SLOW_MSGS;
+	union itc_msg *msg;
+
+	close(args->go_pipe[1]);
+	memset(&result, 0, sizeof(result));
+	if(!itc_init(4, ITC_MALLOC, ITC_FLOW_CONTROL))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(RECEIVER_MBOX_NAME, ITC_DIRECT_IPC_RX);
+	if(mode == GOES_AWAY)
+	{
+		char path[64];
+
+		/* Nothing is cleaned up, so no credits come back, only the credit file is gone as if replaced */
+		usleep(GONE_AFTER_MS * 1000);
+		snprintf(path, sizeof(path), CREDIT_FILENAME, my_mbox_id >> 20);
+		unlink(path);
+		return itc_test_write(fd, &result, sizeof(result));
+	} else if(mode == HOLDS_BACK && read(args->go_pipe[0], &nr_expected, sizeof(nr_expected)) != sizeof(nr_expected))
+	{
+		return false;
+	}
+
+	for(uint32_t i = 0; i < nr_expected; i++)
+	{
+		msg = itc_receive(3000);
+		if(msg == NULL)
+		{
+			break;
+		}
+
+		result.nr_received++;
+		result.nr_out_of_order += (msg->credit_data.seq != i);
+		itc_free(&msg);
+
+		if(mode == SLOW && (i % SLOW_EVERY) == SLOW_EVERY - 1)
+		{
+			usleep(1000);
+		}
+	}
+
+	if(!itc_test_write(fd, &result, sizeof(result)))
+	{
+		return false;
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return true;
+}
+
+/* Unless slow, sends until a send fails, and tells a receiver that holds back over the go pipe how many went out */
+static bool run_sender(void *arg, int fd)
+{
+	struct round_args *args = (struct round_args *)arg;
+	enum receiver_mode mode = args->mode;
+	struct sender_result result;
+	itc_mbox_id_t my_mbox_id, receiver_mbox_id;
+	union itc_msg *msg;
+
+	close(args->go_pipe[0]);
+	memset(&result, 0, sizeof(result));
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(SENDER_MBOX_NAME, 0);
+	receiver_mbox_id = itc_test_locate(RECEIVER_MBOX_NAME);
+	if(receiver_mbox_id == ITC_NO_MBOX_ID)
+	{
+		return false;
+	}
+
+	for(uint32_t seq = 0; seq < (mode == SLOW ? NR_SLOW_MSGS : 2 * ITC_CREDIT_WINDOW); seq++)
+	{
+		uint64_t t_start = itc_test_now_ns();
+
+		msg = itc_alloc(sizeof(msg->credit_data), CREDIT_DATA_MSG);
+		msg->credit_data.seq = seq;
+		if(!itc_send(&msg, receiver_mbox_id, ITC_MY_MBOX_ID, NULL))
+		{
+			result.fail_ms = (uint32_t)((itc_test_now_ns() - t_start) / 1000000);
+			itc_free(&msg);
+			break;
+		}
+		result.nr_sent++;
+	}
+
+	if(mode == HOLDS_BACK && !itc_test_write(args->go_pipe[1], &result.nr_sent, sizeof(result.nr_sent)))
+	{
+		return false;
+	}
+
+	result.nr_stats = itc_get_credit_stats(&result.stats, 1);
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+
+	return itc_test_write(fd, &result, sizeof(result));
+}
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define NR_ROUND_TRIPS		20000
+#define NR_CALLS		1000
+#define RECEIVE_TMO		100	// ms
+#define SERVER_MBOX_NAME	"direct_rx_server"
+#define CLIENT_MBOX_NAME	"direct_rx_client"
+#define PING_MSG		0x1
+#define PONG_MSG		0x2
+#define CALL_MSG		0x3
+#define TMO_CHECK_MSG		0x4
+#define TMO_RESULT_MSG		0x5
+#define DONE_MSG		0x6
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	seq;
+	} ping;
+	struct {
+		uint32_t	msgno;
+		uint32_t	timed_out;	// itc_receive() returned NULL
+		uint32_t	elapsed_ms;
+	} tmo_result;
+};
+
+struct round_result {
+	double			rtt_us;		// Average send/receive round trip
+	double			call_us;	// Average itc_call()
+	uint32_t		tmo_ms;		// How long a RECEIVE_TMO itc_receive() took with nothing to receive
+	bool			fd_rejected;	// itc_get_fd() failed on the client mailbox
+};
+
+static bool run_round(uint32_t mbox_flags, struct round_result *result);
+static bool run_server(void *arg, int fd);
+static bool run_client(void *arg, int fd);
+
+/* Expect main call:    ./itc_direct_ipc_rx
+** Two processes talk over sysvmq, first with plain mailboxes, then with ITC_DIRECT_IPC_RX ones on both sides. Prints the
+** average round trip of NR_ROUND_TRIPS send/receive pairs and of NR_CALLS itc_call()s, and checks that an itc_receive()
+** with a RECEIVE_TMO ms timeout still times out while its owner waits in sysvmq, and that itc_get_fd() is refused.
+** itccoord must be running. */
+int main(void)
+{
+	struct round_result results[2];
+	bool passed;
+
+	setenv("ITC_TRANSPORTS", "sysvmq", 1);
+
+	if(!run_round(0, &results[0]) || !run_round(ITC_DIRECT_IPC_RX, &results[1]))
+	{
+		printf("\tFailed to run test, is itccoord running?\n");
+		return EXIT_FAILURE;
+	}
+
+	passed = !results[0].fd_rejected && results[1].fd_rejected;
+	for(int i = 0; i < 2; i++)
+	{
+		passed = passed && results[i].tmo_ms >= RECEIVE_TMO && results[i].tmo_ms < RECEIVE_TMO + 50;
+	}
+
+	PRINT_DASH_START;
+	printf("\tsysvmq between two processes, %d round trips and %d itc_call()s:\n", NR_ROUND_TRIPS, NR_CALLS);
+	printf("\t%22s %14s %14s %22s\n", "mailbox flags", "round trip", "itc_call()", "itc_receive(100) took");
+	printf("\t%22s %11.2f us %11.2f us %19u ms\n", "0", results[0].rtt_us, results[0].call_us, results[0].tmo_ms);
+	printf("\t%22s %11.2f us %11.2f us %19u ms\n", "ITC_DIRECT_IPC_RX", results[1].rtt_us, results[1].call_us, results[1].tmo_ms);
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool run_round(uint32_t mbox_flags, struct round_result *result)
+{
+	struct itc_test_proc procs[] = {
+		{ .main = run_server, .arg = &mbox_flags },
+		{ .main = run_client, .arg = &mbox_flags, .result = result, .result_size = sizeof(*result) }
+	};
+
+	return itc_test_run(procs, 2);
+}
+
+static bool run_server(void *arg, int fd)
+{
+	uint32_t mbox_flags = *(uint32_t *)arg;
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *msg, *rsp;
+	uint64_t t_start;
+
+	(void)fd;
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(SERVER_MBOX_NAME, mbox_flags);
+	for(;;)
+	{
+		msg = itc_receive(ITC_WAIT_FOREVER);
+		if(msg == NULL)
+		{
+			return false;
+		}
+
+		switch(msg->msgno)
+		{
+		case PING_MSG:
+			itc_reply_reuse(&msg, PONG_MSG, sizeof(msg->ping));
+			continue;
+
+		case CALL_MSG:
+			rsp = itc_alloc(sizeof(msg->ping), PONG_MSG);
+			rsp->ping.seq = msg->ping.seq;
+			itc_reply(msg, &rsp);
+			break;
+
+		case TMO_CHECK_MSG:
+			rsp = itc_alloc(sizeof(rsp->tmo_result), TMO_RESULT_MSG);
+			t_start = itc_test_now_ns();
+			union itc_msg *nothing = itc_receive(RECEIVE_TMO);
+			rsp->tmo_result.elapsed_ms = (uint32_t)((itc_test_now_ns() - t_start) / 1000000);
+			rsp->tmo_result.timed_out = (nothing == NULL);
+			if(nothing != NULL)
+			{
+				itc_free(&nothing);
+			}
+			itc_send(&rsp, itc_sender(msg), ITC_MY_MBOX_ID, NULL);
+			break;
+
+		case DONE_MSG:
+			itc_free(&msg);
+			sleep(1); // Let the client pick up what is still on its way
+			itc_delete_mailbox(my_mbox_id);
+			itc_exit();
+			return true;
+
+		default:
+			break;
+		}
+
+		itc_free(&msg);
+	}
+}
+
+static bool run_client(void *arg, int fd)
+{
+	uint32_t mbox_flags = *(uint32_t *)arg;
+	struct round_result result = { 0 };
+	itc_mbox_id_t my_mbox_id, server_mbox_id;
+	union itc_msg *msg;
+	uint64_t t_start;
+
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(CLIENT_MBOX_NAME, mbox_flags);
+	server_mbox_id = itc_test_locate(SERVER_MBOX_NAME);
+	if(server_mbox_id == ITC_NO_MBOX_ID)
+	{
+		return false;
+	}
+
+	result.fd_rejected = (itc_get_fd() == -1);
+
+	t_start = itc_test_now_ns();
+	for(uint32_t i = 0; i < NR_ROUND_TRIPS; i++)
+	{
+		msg = itc_alloc(sizeof(msg->ping), PING_MSG);
+		msg->ping.seq = i;
+		itc_send(&msg, server_mbox_id, ITC_MY_MBOX_ID, NULL);
+
+		msg = itc_receive(3000);
+		if(msg == NULL || msg->msgno != PONG_MSG || msg->ping.seq != i)
+		{
+			return false;
+		}
+		itc_free(&msg);
+	}
+	result.rtt_us = (double)(itc_test_now_ns() - t_start) / NR_ROUND_TRIPS / 1000;
+
+	t_start = itc_test_now_ns();
+	for(uint32_t i = 0; i < NR_CALLS; i++)
+	{
+		msg = itc_alloc(sizeof(msg->ping), CALL_MSG);
+		msg->ping.seq = i;
+		msg = itc_call(&msg, server_mbox_id, 3000);
+		if(msg == NULL || msg->ping.seq != i)
+		{
+			return false;
+		}
+		itc_free(&msg);
+	}
+	result.call_us = (double)(itc_test_now_ns() - t_start) / NR_CALLS / 1000;
+
+	msg = itc_alloc(sizeof(uint32_t), TMO_CHECK_MSG);
+	itc_send(&msg, server_mbox_id, ITC_MY_MBOX_ID, NULL);
+	msg = itc_receive(3000);
+	if(msg == NULL || msg->msgno != TMO_RESULT_MSG || !msg->tmo_result.timed_out)
+	{
+		return false;
+	}
+	result.tmo_ms = msg->tmo_result.elapsed_ms;
+	itc_free(&msg);
+
+	msg = itc_alloc(sizeof(uint32_t), DONE_MSG);
+	itc_send(&msg, server_mbox_id, ITC_MY_MBOX_ID, NULL);
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+
+	return itc_test_write(fd, &result, sizeof(result));
+}
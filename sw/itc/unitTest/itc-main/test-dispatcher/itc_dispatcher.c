@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "itc.h"
+
+#define PRINT_DASH_START					\
+	do							\
+	{							\
+		printf("\n-------------------------------------------------------------------------------------------------------------------\n");	\
+	} while(0)
+
+#define PRINT_DASH_END						\
+	do							\
+	{							\
+		printf("-------------------------------------------------------------------------------------------------------------------\n\n");	\
+	} while(0)
+
+#define FOO_MSG_BASE		0x100
+#define FOO_REQ			(FOO_MSG_BASE + 0x0)
+#define FOO_IND			(FOO_MSG_BASE + 0x5)
+#define FOO_SLOW_IND		(FOO_MSG_BASE + 0xFF)	// Handler sleeps SLOW_HANDLER_US
+#define FOO_UNHANDLED		(FOO_MSG_BASE + 0x1)	// Inside the FOO table, but nobody registered it
+#define BAR_MSG_BASE		0x5000
+#define BAR_REQ			(BAR_MSG_BASE + 0x0)
+#define BAR_TAKE_IND		(BAR_MSG_BASE + 0x1)	// Handler takes the message over and frees it itself
+#define UNKNOWN_MSG		0x3000			// Outside every table
+
+#define NR_MSGS			1000
+#define SLOW_HANDLER_US		2000
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	seq;
+	} seq_msg;
+};
+
+struct dispatch_ctx {
+	uint32_t		next_seq;	// Messages must be handled in the order they were sent
+	uint32_t		nr_out_of_order;
+	uint32_t		nr_fallback;
+};
+
+static const uint32_t sent_msgnos[] = { FOO_REQ, FOO_IND, BAR_REQ, FOO_IND, BAR_TAKE_IND, FOO_UNHANDLED, UNKNOWN_MSG, FOO_REQ };
+#define NR_SENT_MSGNOS		(sizeof(sent_msgnos) / sizeof(sent_msgnos[0]))
+
+static itc_mbox_id_t main_mbox_id;
+static pthread_barrier_t all_sent;
+
+static void check_order(union itc_msg **msg, void *ctx);
+static void handle_plain(union itc_msg **msg, void *ctx);
+static void handle_slow(union itc_msg **msg, void *ctx);
+static void handle_take(union itc_msg **msg, void *ctx);
+static void handle_fallback(union itc_msg **msg, void *ctx);
+static void *sender_thread(void *data);
+static uint32_t msgno_of(uint32_t seq);
+static uint64_t expected_count(uint32_t msgno);
+
+static const struct itc_handler foo_handlers[] = {
+	ITC_HANDLER(FOO_REQ, handle_plain),
+	ITC_HANDLER(FOO_IND, handle_plain),
+	ITC_HANDLER(FOO_SLOW_IND, handle_slow),
+};
+
+static const struct itc_handler bar_handlers[] = {
+	ITC_HANDLER(BAR_REQ, handle_plain),
+	ITC_HANDLER(BAR_TAKE_IND, handle_take),
+};
+
+static const struct itc_handler too_wide_handlers[] = {
+	ITC_HANDLER(0x10000, handle_plain),
+	ITC_HANDLER(0x10000 + ITC_DISPATCH_MAX_SPAN, handle_plain),
+};
+
+static const struct itc_handler overlapping_handlers[] = {
+	ITC_HANDLER(BAR_REQ - 1, handle_plain),
+	ITC_HANDLER(BAR_REQ, handle_plain),
+};
+
+/* Expect main call:    ./itc_dispatcher
+** Another thread sends NR_MSGS messages over two registered handler tables, msgnos without a handler inside and outside
+** the tables, and a few messages to a handler that sleeps, all before the first itc_dispatch(). Every message must reach
+** its handler or the fallback in the order it was sent, batches must be capped at ITC_DISPATCH_BATCH, and the handler
+** statistics must add up. Tables that are too wide or overlap must be refused. itccoord must be running. */
+int main(void)
+{
+	struct dispatch_ctx ctx;
+	struct itc_dispatcher *dispatcher;
+	struct itc_handler_stats stats[8];
+	pthread_t sender;
+	uint32_t nr_stats, nr_dispatched = 0, nr_batches = 0;
+	bool refused, batches_ok = true, stats_ok = true;
+	int n;
+
+	PRINT_DASH_START;
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		printf("\tFailed to itc_init()!\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	main_mbox_id = itc_create_mailbox("dispatcher_main", 0);
+	dispatcher = itc_dispatcher_create(&ctx, handle_fallback);
+
+	refused = itc_dispatcher_register(dispatcher, foo_handlers, sizeof(foo_handlers) / sizeof(foo_handlers[0])) &&
+		  itc_dispatcher_register(dispatcher, bar_handlers, sizeof(bar_handlers) / sizeof(bar_handlers[0])) &&
+		  !itc_dispatcher_register(dispatcher, too_wide_handlers, 2) &&
+		  !itc_dispatcher_register(dispatcher, overlapping_handlers, 2);
+
+	/* Nothing queued yet */
+	batches_ok = itc_dispatch(dispatcher, 10) == 0;
+
+	pthread_barrier_init(&all_sent, NULL, 2);
+	pthread_create(&sender, NULL, sender_thread, NULL);
+	pthread_barrier_wait(&all_sent);
+
+	while(nr_dispatched < NR_MSGS && (n = itc_dispatch(dispatcher, 1000)) > 0)
+	{
+		/* Everything is queued already, so every batch but the last one must be full */
+		batches_ok = batches_ok && (n == ITC_DISPATCH_BATCH || nr_dispatched + n == NR_MSGS);
+		nr_dispatched += n;
+		nr_batches++;
+	}
+	pthread_join(sender, NULL);
+
+	nr_stats = itc_dispatcher_get_stats(dispatcher, stats, 8);
+	stats_ok = nr_stats == 5 && itc_dispatcher_get_stats(dispatcher, NULL, 0) == 5;
+	for(uint32_t i = 0; i < nr_stats; i++)
+	{
+		stats_ok = stats_ok && stats[i].count == expected_count(stats[i].msgno) && stats[i].max_ns <= stats[i].total_ns;
+		if(stats[i].msgno == FOO_SLOW_IND)
+		{
+			stats_ok = stats_ok && strcmp(stats[i].name, "handle_slow") == 0 &&
+				   stats[i].max_ns >= SLOW_HANDLER_US * 1000ULL &&
+				   stats[i].total_ns >= stats[i].count * SLOW_HANDLER_US * 1000ULL;
+		}
+	}
+
+	itc_dispatcher_delete(&dispatcher);
+
+	bool passed = refused && batches_ok && stats_ok && dispatcher == NULL && nr_dispatched == NR_MSGS &&
+		      ctx.nr_out_of_order == 0 && ctx.nr_fallback == expected_count(FOO_UNHANDLED) + expected_count(UNKNOWN_MSG);
+
+	printf("\t%u messages in %u batches, %u out of order, %u to the fallback\n", nr_dispatched, nr_batches,
+		ctx.nr_out_of_order, ctx.nr_fallback);
+	printf("\tbad tables refused: %s, batches: %s, statistics: %s\n", refused ? "ok" : "NOT ok", batches_ok ? "ok" : "NOT ok",
+		stats_ok ? "ok" : "NOT ok");
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	itc_delete_mailbox(main_mbox_id);
+	itc_exit();
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void check_order(union itc_msg **msg, void *ctx)
+{
+	struct dispatch_ctx *dctx = (struct dispatch_ctx *)ctx;
+
+	dctx->nr_out_of_order += (*msg)->seq_msg.seq != dctx->next_seq;
+	dctx->next_seq = (*msg)->seq_msg.seq + 1;
+}
+
+static void handle_plain(union itc_msg **msg, void *ctx)
+{
+	check_order(msg, ctx);
+}
+
+static void handle_slow(union itc_msg **msg, void *ctx)
+{
+	check_order(msg, ctx);
+	usleep(SLOW_HANDLER_US);
+}
+
+static void handle_take(union itc_msg **msg, void *ctx)
+{
+	check_order(msg, ctx);
+	itc_free(msg);
+}
+
+static void handle_fallback(union itc_msg **msg, void *ctx)
+{
+	check_order(msg, ctx);
+	((struct dispatch_ctx *)ctx)->nr_fallback++;
+}
+
+/* Every 100th message goes to the slow handler, the rest cycle through sent_msgnos */
+static uint32_t msgno_of(uint32_t seq)
+{
+	return (seq % 100) == 99 ? FOO_SLOW_IND : sent_msgnos[seq % NR_SENT_MSGNOS];
+}
+
+static uint64_t expected_count(uint32_t msgno)
+{
+	uint64_t count = 0;
+
+	for(uint32_t seq = 0; seq < NR_MSGS; seq++)
+	{
+		count += msgno_of(seq) == msgno;
+	}
+
+	return count;
+}
+
+static void *sender_thread(void *data)
+{
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *msg;
+
+	(void)data;
+	my_mbox_id = itc_create_mailbox("dispatcher_sender", 0);
+	for(uint32_t seq = 0; seq < NR_MSGS; seq++)
+	{
+		msg = itc_alloc(sizeof(msg->seq_msg), msgno_of(seq));
+		msg->seq_msg.seq = seq;
+		if(!itc_send(&msg, main_mbox_id, ITC_MY_MBOX_ID, NULL))
+		{
+			itc_free(&msg);
+		}
+	}
+
+	pthread_barrier_wait(&all_sent);
+	itc_delete_mailbox(my_mbox_id);
+	return NULL;
+}
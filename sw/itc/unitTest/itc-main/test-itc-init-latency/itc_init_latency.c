@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "itc.h"
+
+#define PRINT_DASH_START					\
+	do							\
+	{							\
+		printf("\n-------------------------------------------------------------------------------------------------------------------\n");	\
+	} while(0)
+
+#define PRINT_DASH_END						\
+	do							\
+	{							\
+		printf("-------------------------------------------------------------------------------------------------------------------\n\n");	\
+	} while(0)
+
+#define NR_WARMUP_ROUNDS	10
+#define NR_DEFAULT_ROUNDS	1000
+
+static uint64_t now_ns(void);
+static bool run_one_round(uint32_t init_flags, uint64_t *init_ns, uint64_t *exit_ns);
+static int compare_u64(const void *a, const void *b);
+static void print_latency(const char *what, uint64_t *samples, int nr_samples);
+
+/* Expect main call:    ./itc_init_latency [nr_rounds] [lazy]
+** Measures how long itc_init() (attach to itccoord + transports init) and itc_exit() take, itccoord must be running.
+** With "lazy", itc_init() gets ITC_LAZY_TRANSPORTS and IPC transports are never started since nothing is sent.
+** ITC is meant to be initialized once per process, so every round is a freshly forked child doing one itc_init() + itc_exit(). */
+int main(int argc, char* argv[])
+{
+	int nr_rounds = (argc > 1) ? atoi(argv[1]) : NR_DEFAULT_ROUNDS;
+	uint32_t init_flags = (argc > 2 && strcmp(argv[2], "lazy") == 0) ? ITC_LAZY_TRANSPORTS : 0;
+	uint64_t *init_ns, *exit_ns, dummy_init, dummy_exit;
+
+	if(nr_rounds <= 0)
+	{
+		printf("\tInvalid number of rounds %s!\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	init_ns = (uint64_t *)malloc(nr_rounds * sizeof(uint64_t));
+	exit_ns = (uint64_t *)malloc(nr_rounds * sizeof(uint64_t));
+	if(init_ns == NULL || exit_ns == NULL)
+	{
+		printf("\tFailed to malloc samples!\n");
+		return EXIT_FAILURE;
+	}
+
+	for(int i = 0; i < NR_WARMUP_ROUNDS; i++)
+	{
+		if(run_one_round(init_flags, &dummy_init, &dummy_exit) == false)
+		{
+			printf("\tFailed in warm-up round %d, is itccoord running?\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for(int i = 0; i < nr_rounds; i++)
+	{
+		if(run_one_round(init_flags, &init_ns[i], &exit_ns[i]) == false)
+		{
+			printf("\tFailed in round %d!\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	PRINT_DASH_START;
+	printf("\t%d rounds of itc_init(10, ITC_MALLOC, %s) + itc_exit(), latency in microseconds:\n", nr_rounds,
+		init_flags ? "ITC_LAZY_TRANSPORTS" : "0");
+	print_latency("itc_init", init_ns, nr_rounds);
+	print_latency("itc_exit", exit_ns, nr_rounds);
+	PRINT_DASH_END;
+
+	free(init_ns);
+	free(exit_ns);
+	return EXIT_SUCCESS;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool run_one_round(uint32_t init_flags, uint64_t *init_ns, uint64_t *exit_ns)
+{
+	uint64_t samples[2], t_start;
+	int pipefd[2], status;
+	pid_t pid;
+
+	if(pipe(pipefd) < 0)
+	{
+		return false;
+	}
+
+	pid = fork();
+	if(pid < 0)
+	{
+		return false;
+	} else if(pid == 0)
+	{
+		close(pipefd[0]);
+
+		t_start = now_ns();
+		if(itc_init(10, ITC_MALLOC, init_flags) == false)
+		{
+			_exit(EXIT_FAILURE);
+		}
+		samples[0] = now_ns() - t_start;
+
+		t_start = now_ns();
+		if(itc_exit() == false)
+		{
+			_exit(EXIT_FAILURE);
+		}
+		samples[1] = now_ns() - t_start;
+
+		if(write(pipefd[1], samples, sizeof(samples)) != sizeof(samples))
+		{
+			_exit(EXIT_FAILURE);
+		}
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(pipefd[1]);
+	if(read(pipefd[0], samples, sizeof(samples)) != sizeof(samples))
+	{
+		close(pipefd[0]);
+		waitpid(pid, &status, 0);
+		return false;
+	}
+	close(pipefd[0]);
+
+	if(waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+	{
+		return false;
+	}
+
+	*init_ns = samples[0];
+	*exit_ns = samples[1];
+	return true;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void print_latency(const char *what, uint64_t *samples, int nr_samples)
+{
+	uint64_t total = 0;
+
+	qsort(samples, nr_samples, sizeof(uint64_t), compare_u64);
+	for(int i = 0; i < nr_samples; i++)
+	{
+		total += samples[i];
+	}
+
+	printf("\t%-10s min = %8.1f, avg = %8.1f, p50 = %8.1f, p99 = %8.1f, max = %8.1f\n", what,
+		samples[0] / 1000.0, (double)total / nr_samples / 1000.0, samples[nr_samples / 2] / 1000.0,
+		samples[(nr_samples * 99) / 100] / 1000.0, samples[nr_samples - 1] / 1000.0);
+}
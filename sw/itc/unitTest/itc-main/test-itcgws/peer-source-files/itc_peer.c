@@ -271,13 +271,14 @@ bool itc_init_zz(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme, uint32_t init
 	itc_inst.nr_mboxes = nr_mboxes;
 
 	struct itc_mailbox* mbox_iter;
+	pthread_mutexattr_t mtxattr;
 	pthread_condattr_t condattr;
 	for(uint32_t i=0; i < itc_inst.nr_mboxes; i++)
 	{
 		mbox_iter = &itc_inst.mboxes[i];
 		mbox_iter->mbox_id = itc_inst.my_mbox_id_in_itccoord | i;
 
-		ret = pthread_mutexattr_init(&(mbox_iter->rxq_info.rxq_attr));
+		ret = pthread_mutexattr_init(&mtxattr);
 		if(ret != 0)
 		{
 			TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutexattr_init, error code = %d", ret);
@@ -286,7 +287,7 @@ bool itc_init_zz(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme, uint32_t init
 		}
 
 		/* Use this type of mutex is safetest, check man7 page for details */
-		ret = pthread_mutexattr_settype(&(mbox_iter->rxq_info.rxq_attr), PTHREAD_MUTEX_ERRORCHECK);
+		ret = pthread_mutexattr_settype(&mtxattr, PTHREAD_MUTEX_ERRORCHECK);
 		if(ret != 0)
 		{
 			TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutexattr_settype, error code = %d", ret);
@@ -294,7 +295,7 @@ bool itc_init_zz(int32_t nr_mboxes, itc_alloc_scheme alloc_scheme, uint32_t init
 			return false;
 		}
 		
-		ret = pthread_mutex_init(&(mbox_iter->rxq_info.rxq_mtx), &(mbox_iter->rxq_info.rxq_attr));
+		ret = pthread_mutex_init(&(mbox_iter->rxq_info.rxq_mtx), &mtxattr);
 		if(ret != 0)
 		{
 			TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutex_init, error code = %d", ret);
@@ -461,13 +462,8 @@ bool itc_exit_zz()
 			return false;
 		}
 
-		ret = pthread_mutexattr_destroy(&(mbox->rxq_info.rxq_attr));
-		if(ret != 0)
-		{
-			// ERROR trace is needed here
-			TPT_TRACE(TRACE_ERROR, "Failed to pthread_mutexattr_destroy, error code = %d", ret);
-			return false;
-		}
+		free(mbox->name);
+		mbox->name = NULL;
 	}
 
 	for(uint32_t i = 0; i < ITC_NUM_TRANS; i++)
@@ -687,7 +683,7 @@ itc_mbox_id_t itc_create_mailbox_zz(const char *name, uint32_t flags)
 		TPT_TRACE(TRACE_ABN, "Requested mailbox name too long!");
 		return ITC_NO_MBOX_ID;
 	}
-	strcpy(new_mbox->name, name);
+	new_mbox->name = strdup(name);
 
 	new_mbox->flags			= flags;
 	new_mbox->p_rxq_info		= &new_mbox->rxq_info;
@@ -886,7 +882,8 @@ bool itc_delete_mailbox_zz(itc_mbox_id_t mbox_id)
 	}
 
 	mbox->p_rxq_info = NULL;
-	strcpy(mbox->name, "");
+	free(mbox->name);
+	mbox->name = NULL;
 	mbox->tid = 0;
 
 	rc->flags = ITC_OK;
@@ -1519,6 +1516,33 @@ unsigned long int calc_time_diff(struct timespec t_start, struct timespec t_end)
 	return diff; 
 }
 
+bool itc_deliver_into_waiting_mbox(struct itc_message *rxmsg)
+{
+	/* Peer host does not support itc_receive_into(), always go through the rx queue */
+	(void)rxmsg;
+	return false;
+}
+
+bool itc_start_ipc_transports(void)
+{
+	/* Peer host always starts its transports in itc_init() */
+	return true;
+}
+
+void itc_credit_return(const struct itc_message *message)
+{
+	/* Peer host has no flow control, nobody waits for credits of ours */
+	(void)message;
+}
+
+bool itc_deliver_local(struct itc_message *message)
+{
+	/* Peer host has no shortcut into its rx queues, go through itc_send() as the sysvmq rx thread used to */
+	union itc_msg *msg = CONVERT_TO_MSG(message);
+
+	return itc_send(&msg, message->receiver, message->sender, NULL);
+}
+
 static struct itc_mailbox *locate_local_mbox(const char *name)
 {
 	struct itc_mailbox **iter, *mbox;
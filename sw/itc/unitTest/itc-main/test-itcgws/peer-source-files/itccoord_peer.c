@@ -10,6 +10,7 @@
 #include <pthread.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <poll.h>
 
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -35,12 +36,13 @@
 ** 1. To be simple, itccoord in first version only manages free_list and used_list of processes that are running with ITC system.
 ** 2. At ITC initialization of each process, they must locate itccoord firstly.
 ** 3. Itccoord will run a while true loop in order to:
-** 	+ After seeing something is coming to itccoord by select(), itcoord will call handle_locate_coord_request() to dequeue a process from free_list, add to used_list and open a socket connection ready for connect() from lsock_init.
-** 	+ Next, it will check all processes in used_list to if any process want to release or any new process which has just been found by select().
-**	+ If process state is LISTENING -> it's been locating itccoord -> connect to it.
-**	+ If process state is CONNECTED -> it want to release (process is gonna be killed) -> disconnect from it.
-**	+ There are some cases where a process in used_list (added after locating but killed during lsock_init) -> cause it's to be zombie (still in used_list but not exist anymore and will never talk/connect to itccoord to change its state to CONNECTED).
-**	+ So, in that case, if after 10 while loop or free_list_count <= a threshold, we still see the process state stays at LISTENING, we need to validate the process aliveness */
+** 	+ After seeing something is coming to itccoord by select(), itcoord will call handle_locate_coord_request() to dequeue a process from free_list, add to used_list and reply with mailbox mask and itccoord mailbox id.
+**	+ The accepted connection is not closed after the reply, it is kept as the keep-alive channel of the process (state CONNECTED) so attaching costs only one connect/send/recv.
+** 	+ Next, it will check all processes in used_list to see if any of their keep-alive channels becomes readable, which means the process has exited or been killed -> disconnect from it.
+**	+ Since the kernel closes the channel for us whenever a process dies, no zombie process can be left behind in used_list.
+** 4. A process started with ITC_LAZY_TRANSPORTS sends ITC_LAZY_TRANSPORTS_NOTIFY on its keep-alive channel. Before another process is
+**	told where one of its mailboxes is, itccoord sends it ITC_START_TRANSPORTS_REQUEST and waits a bit for the reply, so the
+**	locating process can send to it right away. */
 
 /* Sequence:
 itccoord	:	itccoord_inst.sockfd = socket(AF_LOCAL, SOCK_STREAM,, 0)
@@ -49,34 +51,25 @@ itccoord	:	listen(itccoord_inst.sockfd, 10)
 
 process (lsock)	: 	sd = socket(AF_LOCAL, SOCK_STREAM, 0)
 process (lsock)	:	res = connect(sd, (struct sockaddr*)&coord_addr, sizeof(coord_addr)) ---> /tmp/itc/itccoord/itc_coordinator
-process (lsock)	:	res = send(sd, lrequest, sizeof(struct itc_locate_coord_request), 0)
+process (lsock)	:	res = send(sd, &lrequest, sizeof(struct itc_locate_coord_request), 0)
 
 itccoord	:	handle_locate_coord_request()
 itccoord	:	tmp_sd = accept(sd, (struct sockaddr *)&addr, &addr_len)
-itccoord	:	len = recv(tmp_sd, lrequest, RXLEN, 0)
-itccoord	:	tmp->sockfd = socket(AF_LOCAL, SOCK_STREAM, 0) 
-itccoord	:	res = bind(tmp->sockfd, (struct sockaddr*)&tmp->sockaddr, sizeof(tmp->sockaddr)) ---> /tmp/itc/socket/lsocket_0x...
-itccoord	:	res = listen(tmp->sockfd, 1)
+itccoord	:	len = recv(tmp_sd, &lrequest, sizeof(struct itc_locate_coord_request), MSG_WAITALL)
+itccoord	:	tmp->sockfd = tmp_sd, tmp->state = PROC_CONNECTED
+itccoord	:	res = send(tmp_sd, &lreply, sizeof(struct itc_locate_coord_reply), 0)
 
-process (lsock)	:	rx_len = recv(sd, lreply, RXBUF_LEN, 0) ---> itc_locate_coord_reply
-process (lsock)	:	close(sd) ---> LOCATING ITCCOORD DONE!
+process (lsock)	:	rx_len = recv(sd, &lreply, sizeof(struct itc_locate_coord_reply), MSG_WAITALL) ---> itc_locate_coord_reply
+process (lsock)	:	lsock_inst.sd = sd ---> LOCATING ITCCOORD AND CONNECTING KEEP-ALIVE CHANNEL DONE!
 
-process (lsock)	:	sd = socket(AF_LOCAL, SOCK_STREAM, 0) ---> lsock_init()
-process (lsock)	:	res = connect(sd, (struct sockaddr*)&coord_addr, sizeof(struct sockaddr)) ---> /tmp/itc/socket/lsocket_0x...
-
-itccoord	:	connect_to_process()
-itccoord	:	tmp_sd = accept(proc->sockfd, (struct sockaddr *)addr, &addr_len)
-itccoord	:	res = send(tmp_sd, "ack", 4, 0) ---> /tmp/itc/socket/lsocket_0x...
-
-process (lsock)	:	rx_len = recv(sd, str_ack, 4, 0) ---> CONNECTING TO A PROCESS DONE FROM ITCCOORD SIDE!
+process (lsock)	:	close(lsock_inst.sd) ---> lsock_exit()
+itccoord	:	select() sees tmp_sd readable ---> disconnect_from_process()
 */
 
 /*****************************************************************************\/
 *****                      INTERNAL TYPES IN ITC.C                         *****
 *******************************************************************************/
-#define NR_PROC_ALIVENESS_CHECK_RETRIES	10 // After 10 while true loop of itccoord main function, check zombie processes.
-#define FREELIST_LOW_THRESHOLD		10 // When number of processes remaining in free_list decreases down to 10 -> used_list count should be 255 - 10 = 245, check zombie processes.
-
+#define START_TRANSPORTS_TMO	1000 // ms a lazy process gets to start its IPC transports before a locate is answered anyway
 #define ITC_GATEWAY_MBOX_TCP_CLI_NAME2	"itcgw_tcpclient_mailbox2" // TEST ONLY
 #define ITC_ITCCOORD_LOGFILE2 		"itccoord.log" // TEST ONLY
 
@@ -94,8 +87,7 @@ union itc_msg {
 
 typedef enum {
 	PROC_UNUSED = 0,
-	PROC_LISTENING, // After a process called lsock_locate_coord, state is changed to LISTENING so that waiting for connect from the process by lsock_init
-	PROC_CONNECTED, // After a process called lsock_init
+	PROC_CONNECTED, // After a process called lsock_locate_coord, its locate connection is kept as keep-alive channel
 	PROC_INVALID
 } process_state_e;
 
@@ -107,9 +99,9 @@ struct itc_mbox_info {
 struct itc_process {
 	itc_mbox_id_t		mbox_id_in_itccoord; // Mailbox id of the process in itccoord, should be only masked with 3 left-most hexes 0xFFF00000
 	pid_t			pid; // PID of the process
-	int			sockfd; // socket fd of the process
-	struct sockaddr_un	sockaddr;
+	int			sockfd; // keep-alive socket fd of the process, the connection accepted in handle_locate_coord_request
 	process_state_e		state;
+	bool			lazy; // Its IPC transports are not running yet, see ITC_LAZY_TRANSPORTS
 	void			*list_mboxes_tree;
 };
 
@@ -153,7 +145,8 @@ static bool handle_locate_coord_request(int sd); // Handle itc_locate_coord_requ
 static bool disconnect_from_process(struct itc_process *proc); // Disconnect from a process that has called lsock_exit or by any reason its socket is closed
 static bool close_socket_connection(struct itc_process *proc);
 static struct itc_process *find_process(itc_mbox_id_t mbox_id);
-static bool connect_to_process(struct itc_process *proc);
+static bool read_keepalive_channel(struct itc_process *proc); // Handle what a process has sent on its keep-alive channel, false if closed
+static void start_lazy_process(struct itc_process *proc); // Ask a lazy process to start its IPC transports and wait for it
 static void handle_incoming_request(void);
 static void handle_add_mbox(itc_mbox_id_t mbox_id, char *mbox_name);
 static void handle_remove_mbox(itc_mbox_id_t mbox_id, char *mbox_name);
@@ -329,10 +322,9 @@ int main(int argc, char* argv[])
 	int max_fd;
 	struct itcq_node *iter;
 	struct itc_process *proc;
-	int zc_counter = 0; // Zombie process check
 	while(true)
 	{
-		/* We use FD_... macros to manage a set of file desciptors that are actually sock fd created by lsock_init function */
+		/* We use FD_... macros to manage a set of file desciptors that are actually keep-alive sock fd accepted by handle_locate_coord_request() */
 		FD_ZERO(&proc_fd_list); // Clear all fd in the set
 		FD_SET(itccoord_inst.sockfd, &proc_fd_list); // Add itccoord socket fd
 		max_fd = itccoord_inst.sockfd + 1;
@@ -342,7 +334,7 @@ int main(int argc, char* argv[])
 			max_fd = itccoord_inst.mbox_fd + 1;
 		}
 
-		/* Iterating through the used queue and add sockfd created by processes that have just called lsock_init to the fd set */
+		/* Iterating through the used queue and add keep-alive sockfd of all attached processes to the fd set */
 		for(iter = itccoord_inst.used_list->head; iter != NULL; iter = iter->next)
 		{
 			proc = (struct itc_process *)iter->p_data;
@@ -376,39 +368,14 @@ int main(int argc, char* argv[])
 			for(iter = itccoord_inst.used_list->head; iter != NULL; iter = iter->next)
 			{
 				proc = (struct itc_process *)iter->p_data;
-				if(proc->sockfd != -1 && FD_ISSET(proc->sockfd, &proc_fd_list))
+				if(proc->sockfd != -1 && FD_ISSET(proc->sockfd, &proc_fd_list) && !read_keepalive_channel(proc))
 				{
-					if(proc->state == PROC_LISTENING)
-					{
-						TPT_TRACE(TRACE_INFO, "Process with fd %d is in state PROC_LISTENING!", proc->sockfd);
-						if(connect_to_process(proc) == false)
-						{
-							exit(EXIT_FAILURE);
-						}
-					} else if(proc->state == PROC_CONNECTED)
+					TPT_TRACE(TRACE_INFO, "Process with fd %d, pid = %d closed its keep-alive channel!", proc->sockfd, proc->pid);
+					if(disconnect_from_process(proc) == false)
 					{
-						TPT_TRACE(TRACE_INFO, "Process with fd %d is in state PROC_CONNECTED!", proc->sockfd);
-						if(disconnect_from_process(proc) == false)
-						{
-							exit(EXIT_FAILURE);
-						}
-						break;
-					} else
-					{
-						TPT_TRACE(TRACE_ERROR, "Wrong process state = %d, pid = %d!", proc->state, proc->pid);
 						exit(EXIT_FAILURE);
 					}
-				} else if((zc_counter == (NR_PROC_ALIVENESS_CHECK_RETRIES - 1) || itccoord_inst.freelist_count < FREELIST_LOW_THRESHOLD) && \
-					proc->state == PROC_LISTENING && proc->pid > 0)
-				{
-					/* Try killing the process but received errno no such process */
-					if(kill(proc->pid, 0) == -1 && errno == ESRCH)
-					{
-						TPT_TRACE(TRACE_ABN, "Zomebie process detected, pid = %d!", proc->pid);
-						disconnect_from_process(proc);
-						zc_counter--;
-						break;
-					}
+					break;
 				}
 			}
 
@@ -417,9 +384,6 @@ int main(int argc, char* argv[])
 				TPT_TRACE(TRACE_INFO, "Calling handle_incoming_request()!");
 				handle_incoming_request(); // Such as ADD, RMV mailboxes,...
 			}
-
-			zc_counter++;
-			zc_counter %= NR_PROC_ALIVENESS_CHECK_RETRIES; // Keep it in range of 0-9
 		}
 	}
 
@@ -608,13 +572,13 @@ static bool create_itccoord_dir(void)
 
 static bool handle_locate_coord_request(int sd)
 {
-	struct itc_locate_coord_reply *lreply;
-	struct itc_locate_coord_request *lrequest;
+	struct itc_locate_coord_reply lreply;
+	struct itc_locate_coord_request lrequest;
 	struct itc_process *tmp;
 	struct sockaddr_un addr;
 	socklen_t addr_len = sizeof(struct sockaddr_un);
 	int tmp_sd, res;
-	long unsigned int len;
+	ssize_t len;
 
 	tmp_sd = accept(sd, (struct sockaddr *)&addr, &addr_len); // Create a socket connection on the file descriptor of itccoord to communicate with the process
 	if(tmp_sd < 0)
@@ -631,32 +595,22 @@ static bool handle_locate_coord_request(int sd)
 		return false;
 	}
 
-	size_t RXLEN = 1024;
-	lrequest = (struct itc_locate_coord_request*)malloc(RXLEN); // Allocate a rx buffer to receive the request from the process
-	if(lrequest == NULL)
+	do
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to malloc itc_locate_coord_request due to out of memory!");
-		return false;
-	}
+		len = recv(tmp_sd, &lrequest, sizeof(struct itc_locate_coord_request), MSG_WAITALL);
+	} while(len < 0 && errno == EINTR);
 
-	len = recv(tmp_sd, lrequest, RXLEN, 0);
-	if(len < (size_t)sizeof(struct itc_locate_coord_request))
+	if(len < (ssize_t)sizeof(struct itc_locate_coord_request))
 	{
-		if(errno == EIDRM || errno == ENOENT || errno == EINVAL)
-		{
-			/* The reason could be that the socket connection of the process was just closed 
-			** So ignore the request */
-			TPT_TRACE(TRACE_ABN, "The process's socket has just closed, OK!");
-			free(lrequest);
-			return true;
-		}
-
-		/* Not a big problem here so not return */
-		lrequest->my_pid = -1;
-	} else if(lrequest->msgno != ITC_LOCATE_COORD_REQUEST)
+		/* The process has closed its socket before its request could be read, just ignore the request */
+		TPT_TRACE(TRACE_ABN, "The process's socket has just closed, len = %zd, errno = %d, OK!", len, errno);
+		close(tmp_sd);
+		return true;
+	} else if(lrequest.msgno != ITC_LOCATE_COORD_REQUEST)
 	{
 		/* Received unknown request from the process */
 		TPT_TRACE(TRACE_ERROR, "Unknown message received, expected ITC_LOCATE_COORD_REQUEST!");
+		close(tmp_sd);
 		return false;
 	}
 
@@ -665,6 +619,7 @@ static bool handle_locate_coord_request(int sd)
 	if(rc->flags != ITC_OK)
 	{
 		TPT_TRACE(TRACE_ERROR, "Failed to dequeue a process from free_list, rc = %u!", rc->flags);
+		close(tmp_sd);
 		return false;
 	}
 
@@ -676,99 +631,72 @@ static bool handle_locate_coord_request(int sd)
 		if(rc->flags != ITC_OK)
 		{
 			TPT_TRACE(TRACE_ERROR, "Failed to enqueue a process to used_list, rc = %u!", rc->flags);
+			close(tmp_sd);
 			return false;
 		}
 
-
-		tmp->pid = lrequest->my_pid;
-
-		/* Create a new socket to keep communication with the process later on */
-		tmp->sockfd = socket(AF_LOCAL, SOCK_STREAM, 0);
-		if(tmp->sockfd < 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to create socket, errno = %d!", errno);
-			return false;
-		}
-		memset(&tmp->sockaddr, 0, sizeof(struct sockaddr_un));
-		tmp->sockaddr.sun_family = AF_LOCAL;
-		sprintf(tmp->sockaddr.sun_path, "%s_0x%08x", ITC_LSOCKET_FILENAME, tmp->mbox_id_in_itccoord);
-
-		res = bind(tmp->sockfd, (struct sockaddr*)&tmp->sockaddr, sizeof(tmp->sockaddr));
-		if(res < 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to bind socket, errno = %d!", errno);
-			return false;
-		}
-
-		res = chmod(tmp->sockaddr.sun_path, 0777);
-		if(res < 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to chmod %s, errno = %d!", tmp->sockaddr.sun_path, errno);
-			return false;
-		}
-
-		res = listen(tmp->sockfd, 1);
-		if(res < 0)
-		{
-			TPT_TRACE(TRACE_ERROR, "Failed to listen, errno = %d!", errno);
-			return false;
-		}
-
-		tmp->state = PROC_LISTENING;
+		/* The accepted connection itself is the keep-alive channel with the process from now on,
+		** when it is closed (process exited or crashed) select() wakes us up to disconnect_from_process() */
+		tmp->pid	= lrequest.my_pid;
+		tmp->sockfd	= tmp_sd;
+		tmp->state	= PROC_CONNECTED;
+		tmp->lazy	= false;
 	}
 
 	/* Send back response to the process */
-	lreply = (struct itc_locate_coord_reply*)malloc(sizeof(struct itc_locate_coord_reply));
-	if(lreply == NULL)
-	{
-		TPT_TRACE(TRACE_ERROR, "Failed to malloc lreply due to out of memory!");
-		return false;
-	}
-
-	lreply->msgno = ITC_LOCATE_COORD_REPLY;
+	lreply.msgno = ITC_LOCATE_COORD_REPLY;
 	if(tmp == NULL)
 	{
 		TPT_TRACE(TRACE_ABN, "No more process to allocate for this ITC_LOCATE_COORD_REQUEST!");
-		lreply->my_mbox_id_in_itccoord = ITC_NO_MBOX_ID;
+		lreply.my_mbox_id_in_itccoord = ITC_NO_MBOX_ID;
 	} else
 	{
-		lreply->my_mbox_id_in_itccoord = tmp->mbox_id_in_itccoord;
+		lreply.my_mbox_id_in_itccoord = tmp->mbox_id_in_itccoord;
 	}
 
-	lreply->itccoord_mask = ITC_COORD_MASK;
-	lreply->itccoord_mbox_id = itccoord_inst.mbox_id;
+	lreply.itccoord_mask = ITC_COORD_MASK;
+	lreply.itccoord_mbox_id = itccoord_inst.mbox_id;
+
+	do
+	{
+		res = send(tmp_sd, &lreply, sizeof(struct itc_locate_coord_reply), 0);
+	} while(res < 0 && errno == EINTR);
 
-	res = send(tmp_sd, lreply, sizeof(struct itc_locate_coord_reply), 0);
 	if(res < 0)
 	{
 		if(errno == EPIPE)
 		{
-			TPT_TRACE(TRACE_ERROR, "Failed to send itc_locate_coord_reply to process pid = %d due to EPIPE!", tmp->pid);
-			free(lreply);
-			free(lrequest);
+			/* The process socket has just closed, discard its locate request */
+			TPT_TRACE(TRACE_ABN, "Failed to send itc_locate_coord_reply to process pid = %d due to EPIPE!", lrequest.my_pid);
 			if(tmp != NULL)
 			{
-				disconnect_from_process(tmp);
+				return disconnect_from_process(tmp);
 			}
 
-			TPT_TRACE(TRACE_ERROR, "Failed to send itc_locate_coord_reply, EPIPE!");
-			return false;
+			close(tmp_sd);
+			return true;
 		}
 
-		TPT_TRACE(TRACE_ERROR, "Failed to send itc_locate_coord_reply, res < 0!");
+		TPT_TRACE(TRACE_ERROR, "Failed to send itc_locate_coord_reply, errno = %d!", errno);
+		if(tmp == NULL)
+		{
+			/* Not owned by any process slot, nobody else will ever close it */
+			close(tmp_sd);
+		}
 		return false;
 	}
 
 	TPT_TRACE(TRACE_INFO, "Sent itc_locate_coord_reply successfully!");
 
-	free(lreply);
-	free(lrequest);
-
-	res = close(tmp_sd);
-	if(res < 0)
+	if(tmp == NULL)
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to close, res = %d, errno = %d!", res, errno);
-		return false;
+		/* Nothing to keep alive, the process will give up on ITC_NO_MBOX_ID */
+		res = close(tmp_sd);
+		if(res < 0)
+		{
+			TPT_TRACE(TRACE_ERROR, "Failed to close, res = %d, errno = %d!", res, errno);
+			return false;
+		}
 	}
 
 	return true;
@@ -792,8 +720,8 @@ static bool disconnect_from_process(struct itc_process *proc)
 
 	twalk(proc->list_mboxes_tree, delete_counterpart_mailboxes_in_mailboxtree);
 	tdestroy(proc->list_mboxes_tree, free);
+	proc->list_mboxes_tree = NULL; // The slot will be handed out to another process later on
 
-	memset(&proc->sockaddr, 0, sizeof(struct sockaddr_un));
 	TPT_TRACE(TRACE_INFO, "Enqueue process mbox_id = 0x%08x to free_list!", proc->mbox_id_in_itccoord);
 	q_enqueue(rc, itccoord_inst.free_list, proc);
 	itccoord_inst.freelist_count++;
@@ -803,7 +731,6 @@ static bool disconnect_from_process(struct itc_process *proc)
 static bool close_socket_connection(struct itc_process *proc)
 {
 	int res, tmp_sd;
-	char socket_name[256];
 
 	if(proc->sockfd != -1)
 	{
@@ -835,22 +762,6 @@ static bool close_socket_connection(struct itc_process *proc)
 				break;
 			}
 		}
-
-		sprintf(socket_name, "%s_0x%08x", ITC_LSOCKET_FILENAME, proc->mbox_id_in_itccoord);
-		if(unlink(socket_name) == -1)
-		{
-			if(errno != ENOENT)
-			{
-				TPT_TRACE(TRACE_ERROR, "Failed to unlink socket address, errno = %d!", errno);
-				return false;
-			} else
-			{
-				TPT_TRACE(TRACE_ABN, "No such file or directory, not unlink socket address %s!", ITC_LSOCKET_FILENAME);
-			}
-		} else
-		{
-			TPT_TRACE(TRACE_INFO, "Unlink %s successfully!", ITC_LSOCKET_FILENAME);
-		}
 	}
 
 	return true;
@@ -871,64 +782,93 @@ static struct itc_process *find_process(itc_mbox_id_t mbox_id)
 	return &itccoord_inst.processes[index];
 }
 
-static bool connect_to_process(struct itc_process *proc)
+static bool read_keepalive_channel(struct itc_process *proc)
 {
-	struct sockaddr_un addr;
-	socklen_t addr_len = sizeof(struct sockaddr_un);
-	int tmp_sd, res;
+	struct itc_keepalive_msg msg;
+	int rx_len;
 
-	TPT_TRACE(TRACE_INFO, "Connecting to the process with pid = %d", proc->pid);
+	if(proc->sockfd == -1)
+	{
+		return false;
+	}
 
-	tmp_sd = accept(proc->sockfd, (struct sockaddr *)&addr, &addr_len);
-	if(tmp_sd < 0)
+	do
 	{
-		if(errno == ECONNABORTED)
-		{
-			/* The process socket has just closed, discard its connect request */
-			TPT_TRACE(TRACE_ABN, "The process's socket has just closed, discard its connect request!");
-			if(proc != NULL)
-			{
-				disconnect_from_process(proc);
-			}
-			return true;
-		}
+		rx_len = recv(proc->sockfd, &msg, sizeof(struct itc_keepalive_msg), MSG_DONTWAIT);
+	} while(rx_len < 0 && errno == EINTR);
 
-		TPT_TRACE(TRACE_ERROR, "Failed to accept socket connection on address %s!", proc->sockaddr.sun_path);
+	if(rx_len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+		return true;
+	} else if(rx_len != (int)sizeof(struct itc_keepalive_msg))
+	{
+		/* Closed, or something we do not understand, either way we are done with this process */
 		return false;
 	}
 
-	res = close(proc->sockfd);
-	if(res < 0)
+	if(msg.msgno == ITC_LAZY_TRANSPORTS_NOTIFY)
+	{
+		TPT_TRACE(TRACE_INFO, "Process pid = %d starts its IPC transports lazily!", proc->pid);
+		proc->lazy = true;
+	} else if(msg.msgno == ITC_START_TRANSPORTS_REPLY)
+	{
+		/* Came in after start_lazy_process() gave up waiting for it */
+		TPT_TRACE(TRACE_ABN, "Late ITC_START_TRANSPORTS_REPLY from process pid = %d!", proc->pid);
+	} else
 	{
-		TPT_TRACE(TRACE_ERROR, "Failed to close socket connection on address %s!", proc->sockaddr.sun_path);
+		TPT_TRACE(TRACE_ABN, "Unknown message 0x%08x on keep-alive channel of process pid = %d!", msg.msgno, proc->pid);
+		return false;
 	}
-	proc->sockfd = tmp_sd;
 
-	res = send(tmp_sd, "ack", 4, 0);
-	while(res < 0 && errno == EINTR)
+	return true;
+}
+
+static void start_lazy_process(struct itc_process *proc)
+{
+	struct itc_keepalive_msg msg;
+	struct pollfd pfd;
+	int res;
+
+	/* Whatever happens we only ask once, the process only listens for one request */
+	proc->lazy = false;
+
+	msg.msgno = ITC_START_TRANSPORTS_REQUEST;
+	do
 	{
-		res = send(tmp_sd, "ack", 4, 0);
-	}
+		res = send(proc->sockfd, &msg, sizeof(struct itc_keepalive_msg), MSG_NOSIGNAL);
+	} while(res < 0 && errno == EINTR);
+
 	if(res < 0)
 	{
-		if(errno == EPIPE)
-		{
-			/* The process socket has just closed, discard its connect request */
-			TPT_TRACE(TRACE_ABN, "The process's socket has just closed, will not send ACK!");
-			if(proc != NULL)
-			{
-				disconnect_from_process(proc);
-			}
-			return true;
-		}
+		/* Closed, select() will see it and disconnect_from_process() */
+		TPT_TRACE(TRACE_ABN, "Failed to send ITC_START_TRANSPORTS_REQUEST to process pid = %d, errno = %d!", proc->pid, errno);
+		return;
+	}
 
-		TPT_TRACE(TRACE_ERROR, "Failed to send ACK to the process, pid = %d", proc->pid);
-		return false;
+	pfd.fd		= proc->sockfd;
+	pfd.events	= POLLIN;
+	do
+	{
+		res = poll(&pfd, 1, START_TRANSPORTS_TMO);
+	} while(res < 0 && errno == EINTR);
+
+	if(res <= 0)
+	{
+		TPT_TRACE(TRACE_ABN, "Process pid = %d did not start its IPC transports within %d ms!", proc->pid, START_TRANSPORTS_TMO);
+		return;
 	}
 
-	TPT_TRACE(TRACE_INFO, "Sending ACK signature to the process successfully, pid = %d", proc->pid);
-	proc->state = PROC_CONNECTED;
-	return true;
+	do
+	{
+		res = recv(proc->sockfd, &msg, sizeof(struct itc_keepalive_msg), MSG_DONTWAIT | MSG_PEEK);
+	} while(res < 0 && errno == EINTR);
+
+	/* Leave anything else, including end of file, for the select() loop */
+	if(res == (int)sizeof(struct itc_keepalive_msg) && msg.msgno == ITC_START_TRANSPORTS_REPLY)
+	{
+		recv(proc->sockfd, &msg, sizeof(struct itc_keepalive_msg), MSG_DONTWAIT);
+		TPT_TRACE(TRACE_INFO, "Process pid = %d started its IPC transports!", proc->pid);
+	}
 }
 
 static void handle_incoming_request(void)
@@ -1118,6 +1058,14 @@ static void handle_locate_mbox(itc_mbox_id_t from_mbox, int32_t timeout, bool fi
 		}
 
 		pid = proc->pid;
+
+		/* The locating process is going to send to this mailbox, so its owner must be reachable by then. Its notify may
+		** still be unread on the keep-alive channel if it created the mailbox right after itc_init() */
+		read_keepalive_channel(proc);
+		if(proc->lazy && find_process(from_mbox) != proc)
+		{
+			start_lazy_process(proc);
+		}
 	}
 
 	union itc_msg *msg;
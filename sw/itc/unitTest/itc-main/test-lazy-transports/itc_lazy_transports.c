@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define SERVER_MBOX_NAME	"lazy_server"
+#define PING_MSG		0x1
+#define PONG_MSG		0x2
+#define DONE_MSG		0x3
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	cookie;
+	} ping_pong;
+};
+
+struct lazy_round {
+	const char		*transport;
+	bool			client_lazy;
+};
+
+static const struct lazy_round rounds[] = {
+	{ "sysvmq",	false },
+	{ "sysvmq",	true },
+	{ "sysvshm",	false },
+	{ "sysvshm",	true },
+	{ "posixshm",	false },
+	{ "posixshm",	true }
+};
+#define NR_ROUNDS		(sizeof(rounds) / sizeof(rounds[0]))
+
+static bool run_round(const struct lazy_round *round);
+static bool run_server(void *arg, int fd);
+static bool run_client(void *arg, int fd);
+
+/* Expect main call:    ./itc_lazy_transports
+** A server process started with ITC_LAZY_TRANSPORTS never sends anything before it is contacted, it only waits for a ping.
+** A client process locates the server's mailbox and sends the ping right away, the server must get it and answer with a
+** pong. Runs over sysvmq, sysvshm and posixshm, with an eager and a lazy client. itccoord must be running. */
+int main(void)
+{
+	bool results[NR_ROUNDS];
+	bool passed = true;
+
+	for(uint32_t r = 0; r < NR_ROUNDS; r++)
+	{
+		results[r] = run_round(&rounds[r]);
+		passed = passed && results[r];
+	}
+
+	PRINT_DASH_START;
+	printf("\tPing from a client to a server that started its transports lazily:\n");
+	printf("\t%12s %12s %12s\n", "transport", "client", "pong");
+	for(uint32_t r = 0; r < NR_ROUNDS; r++)
+	{
+		printf("\t%12s %12s %12s\n", rounds[r].transport, rounds[r].client_lazy ? "lazy" : "eager",
+			results[r] ? "received" : "missing");
+	}
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool run_round(const struct lazy_round *round)
+{
+	struct itc_test_proc procs[] = {
+		{ .main = run_server },
+		{ .main = run_client, .arg = (void *)&round->client_lazy }
+	};
+
+	setenv("ITC_TRANSPORTS", round->transport, 1);
+
+	return itc_test_run(procs, 2);
+}
+
+/* A server whose client never shows up gives up after 5 s */
+static bool run_server(void *arg, int fd)
+{
+	itc_mbox_id_t my_mbox_id, client_mbox_id;
+	union itc_msg *msg;
+	bool ok;
+
+	(void)arg;
+	(void)fd;
+	if(!itc_init(4, ITC_MALLOC, ITC_LAZY_TRANSPORTS))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(SERVER_MBOX_NAME, 0);
+	msg = itc_receive(5000);
+	if(msg == NULL || msg->msgno != PING_MSG)
+	{
+		printf("\tServer got no ping!\n");
+		if(msg != NULL)
+		{
+			itc_free(&msg);
+		}
+		itc_delete_mailbox(my_mbox_id);
+		itc_exit();
+		return false;
+	}
+
+	client_mbox_id = itc_sender(msg);
+	msg->msgno = PONG_MSG;
+	ok = itc_send(&msg, client_mbox_id, ITC_MY_MBOX_ID, NULL);
+	if(!ok)
+	{
+		itc_free(&msg);
+	}
+
+	/* Stay around until the client has its pong */
+	msg = itc_receive(5000);
+	ok = ok && msg != NULL && msg->msgno == DONE_MSG;
+	if(msg != NULL)
+	{
+		itc_free(&msg);
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return ok;
+}
+
+static bool run_client(void *arg, int fd)
+{
+	bool lazy = *(const bool *)arg;
+	uint32_t cookie = (uint32_t)getpid();
+	itc_mbox_id_t my_mbox_id, server_mbox_id;
+	union itc_msg *msg;
+	bool ok;
+
+	(void)fd;
+	if(!itc_init(4, ITC_MALLOC, lazy ? ITC_LAZY_TRANSPORTS : 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox("lazy_client", 0);
+	server_mbox_id = itc_test_locate(SERVER_MBOX_NAME);
+	if(server_mbox_id == ITC_NO_MBOX_ID)
+	{
+		printf("\tClient could not locate \"%s\"!\n", SERVER_MBOX_NAME);
+		return false;
+	}
+
+	msg = itc_alloc(sizeof(msg->ping_pong), PING_MSG);
+	msg->ping_pong.cookie = cookie;
+	if(!itc_send(&msg, server_mbox_id, ITC_MY_MBOX_ID, NULL))
+	{
+		printf("\tClient failed to send the ping!\n");
+		itc_free(&msg);
+		return false;
+	}
+
+	msg = itc_receive(3000);
+	ok = msg != NULL && msg->msgno == PONG_MSG && msg->ping_pong.cookie == cookie;
+	if(msg != NULL)
+	{
+		itc_free(&msg);
+	}
+
+	msg = itc_alloc(sizeof(msg->ping_pong), DONE_MSG);
+	if(!itc_send(&msg, server_mbox_id, ITC_MY_MBOX_ID, NULL))
+	{
+		itc_free(&msg);
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return ok;
+}
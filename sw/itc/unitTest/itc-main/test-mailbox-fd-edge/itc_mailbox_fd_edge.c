@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include "itc.h"
+
+#define PRINT_DASH_START					\
+	do							\
+	{							\
+		printf("\n-------------------------------------------------------------------------------------------------------------------\n");	\
+	} while(0)
+
+#define PRINT_DASH_END						\
+	do							\
+	{							\
+		printf("-------------------------------------------------------------------------------------------------------------------\n\n");	\
+	} while(0)
+
+#define NR_BURSTS		1000
+#define BURST_SIZE		16
+#define NR_STREAMED		200000
+#define DATA_MSG		0x1
+#define BATCH_END_MSG		0x2
+#define BATCH_ACK_MSG		0x3
+#define DONE_MSG		0x4
+
+union itc_msg {
+	uint32_t	msgno;
+};
+
+struct consumer_stats {
+	uint64_t	nr_data;
+	uint64_t	nr_wakeups;
+	uint64_t	nr_writes;	// eventfd counter at the end, ITC never reads it in this mode
+	bool		timed_out;
+};
+
+static itc_mbox_id_t main_mbox_id;
+static itc_mbox_id_t consumer_mbox_id;
+static pthread_barrier_t consumer_ready;
+static struct consumer_stats stats;
+
+static void *consumer_thread(void *data);
+static bool send_batch(uint32_t nr_msgs);
+
+/* Expect main call:    ./itc_mailbox_fd_edge
+** A consumer thread waits on its ITC_EDGE_TRIGGERED_FD mailbox fd with EPOLLET and drains it with
+** itc_receive(ITC_NO_WAIT) after every wakeup. Main first sends bursts of BURST_SIZE messages and waits for each
+** burst to be consumed, then streams NR_STREAMED messages without waiting. Every message must arrive without a missed
+** wakeup, and the number of eventfd write() calls ITC made per message is printed. itccoord must be running. */
+int main(void)
+{
+	pthread_t consumer;
+	uint64_t burst_data, burst_wakeups, burst_writes;
+	union itc_msg *msg;
+	bool result = true;
+
+	PRINT_DASH_START;
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		printf("\tFailed to itc_init()!\n");
+		return 1;
+	}
+
+	main_mbox_id = itc_create_mailbox("main_mailbox", 0);
+	pthread_barrier_init(&consumer_ready, NULL, 2);
+	pthread_create(&consumer, NULL, consumer_thread, NULL);
+	pthread_barrier_wait(&consumer_ready);
+
+	for(int b = 0; b < NR_BURSTS && result; b++)
+	{
+		result = send_batch(BURST_SIZE);
+	}
+	burst_data	= __atomic_load_n(&stats.nr_data, __ATOMIC_RELAXED);
+	burst_wakeups	= __atomic_load_n(&stats.nr_wakeups, __ATOMIC_RELAXED);
+	burst_writes	= __atomic_load_n(&stats.nr_writes, __ATOMIC_RELAXED);
+
+	result = result && send_batch(NR_STREAMED);
+
+	msg = itc_alloc(sizeof(union itc_msg), DONE_MSG);
+	itc_send(&msg, consumer_mbox_id, ITC_MY_MBOX_ID, NULL);
+	pthread_join(consumer, NULL);
+
+	itc_delete_mailbox(main_mbox_id);
+	result = itc_exit() && result && !stats.timed_out && stats.nr_data == (uint64_t)NR_BURSTS * BURST_SIZE + NR_STREAMED;
+
+	printf("\tBursts:   %lu messages, %lu wakeups, %lu eventfd writes, %.3f writes/message\n", burst_data,
+		burst_wakeups, burst_writes, (double)burst_writes / (double)(burst_data ? burst_data : 1));
+	printf("\tStreamed: %lu messages, %lu wakeups, %lu eventfd writes, %.3f writes/message\n", stats.nr_data - burst_data,
+		stats.nr_wakeups - burst_wakeups, stats.nr_writes - burst_writes,
+		(double)(stats.nr_writes - burst_writes) / (double)NR_STREAMED);
+	printf("\t%s\n", result ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return 0;
+}
+
+/* Sends nr_msgs data messages and a BATCH_END_MSG, then waits until the consumer has seen all of them */
+static bool send_batch(uint32_t nr_msgs)
+{
+	union itc_msg *msg;
+
+	for(uint32_t i = 0; i < nr_msgs; i++)
+	{
+		msg = itc_alloc(sizeof(union itc_msg), DATA_MSG);
+		itc_send(&msg, consumer_mbox_id, ITC_MY_MBOX_ID, NULL);
+	}
+
+	msg = itc_alloc(sizeof(union itc_msg), BATCH_END_MSG);
+	itc_send(&msg, consumer_mbox_id, ITC_MY_MBOX_ID, NULL);
+
+	msg = itc_receive(5000);
+	if(msg == NULL)
+	{
+		printf("\tConsumer did not ack a batch of %u messages!\n", nr_msgs);
+		return false;
+	}
+
+	itc_free(&msg);
+	return true;
+}
+
+static void *consumer_thread(void *data)
+{
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLET };
+	bool done = false;
+	int epfd, fd;
+
+	(void)data;
+	consumer_mbox_id = itc_create_mailbox("edge_consumer", ITC_EDGE_TRIGGERED_FD);
+	fd = itc_get_fd();
+	epfd = epoll_create1(0);
+	ev.data.fd = fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	pthread_barrier_wait(&consumer_ready);
+
+	while(!done)
+	{
+		union itc_msg *msg;
+		uint64_t counter;
+
+		if(epoll_wait(epfd, &ev, 1, 5000) <= 0)
+		{
+			stats.timed_out = true;
+			break;
+		}
+		__atomic_add_fetch(&stats.nr_wakeups, 1, __ATOMIC_RELAXED);
+
+		while((msg = itc_receive(ITC_NO_WAIT)) != NULL)
+		{
+			if(msg->msgno == DATA_MSG)
+			{
+				__atomic_add_fetch(&stats.nr_data, 1, __ATOMIC_RELAXED);
+			} else if(msg->msgno == BATCH_END_MSG)
+			{
+				/* Count writes before the ack, so main sees the figures of the finished batch */
+				if(read(fd, &counter, sizeof(counter)) == sizeof(counter))
+				{
+					__atomic_add_fetch(&stats.nr_writes, counter, __ATOMIC_RELAXED);
+				}
+
+				union itc_msg *ack = itc_alloc(sizeof(union itc_msg), BATCH_ACK_MSG);
+				itc_send(&ack, main_mbox_id, ITC_MY_MBOX_ID, NULL);
+			} else if(msg->msgno == DONE_MSG)
+			{
+				done = true;
+			}
+			itc_free(&msg);
+		}
+	}
+
+	close(epfd);
+	itc_delete_mailbox(consumer_mbox_id);
+
+	return NULL;
+}
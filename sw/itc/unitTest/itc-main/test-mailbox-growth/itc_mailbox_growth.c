@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "itc.h"
+
+#define PRINT_DASH_START					\
+	do							\
+	{							\
+		printf("\n-------------------------------------------------------------------------------------------------------------------\n");	\
+	} while(0)
+
+#define PRINT_DASH_END						\
+	do							\
+	{							\
+		printf("-------------------------------------------------------------------------------------------------------------------\n\n");	\
+	} while(0)
+
+#define NR_INIT_MAILBOXES	4
+#define NR_WORKERS		300
+#define WORKER_MSGNO_BASE	0x100
+
+union itc_msg {
+	uint32_t	msgno;
+};
+
+static itc_mbox_id_t main_mbox_id;
+static pthread_barrier_t workers_done;
+
+static void *worker_thread(void *data);
+
+/* Expect main call:    ./itc_mailbox_growth
+** itc_init() only reserves a few mailboxes, then many more threads than that create one each, which makes the
+** mailbox table and the local name table grow while other threads keep sending and locating. itccoord must be running. */
+int main(void)
+{
+	pthread_t workers[NR_WORKERS];
+	int nr_received = 0, nr_located = 0;
+	bool result;
+
+	PRINT_DASH_START;
+	if(!itc_init(NR_INIT_MAILBOXES, ITC_MALLOC, 0))
+	{
+		printf("\tFailed to itc_init()!\n");
+		return 1;
+	}
+
+	main_mbox_id = itc_create_mailbox("main_mailbox", 0);
+	pthread_barrier_init(&workers_done, NULL, NR_WORKERS + 1);
+
+	for(long i = 0; i < NR_WORKERS; i++)
+	{
+		pthread_create(&workers[i], NULL, worker_thread, (void *)i);
+	}
+
+	for(int i = 0; i < NR_WORKERS; i++)
+	{
+		union itc_msg *msg = itc_receive(2000);
+		if(msg != NULL)
+		{
+			nr_received++;
+			itc_free(&msg);
+		}
+	}
+
+	/* Workers keep their mailboxes until the barrier, so all of them must be found by name */
+	for(int i = 0; i < NR_WORKERS; i++)
+	{
+		char name[32];
+
+		sprintf(name, "worker_%d", i);
+		if(itc_locate_sync(100, name, true, NULL, NULL) != ITC_NO_MBOX_ID)
+		{
+			nr_located++;
+		}
+	}
+
+	pthread_barrier_wait(&workers_done);
+	for(int i = 0; i < NR_WORKERS; i++)
+	{
+		pthread_join(workers[i], NULL);
+	}
+
+	itc_delete_mailbox(main_mbox_id);
+	result = itc_exit();
+
+	printf("\tReceived %d/%d, located %d/%d, itc_exit() = %d\n", nr_received, NR_WORKERS, nr_located, NR_WORKERS, result);
+	printf("\t%s\n", (nr_received == NR_WORKERS && nr_located == NR_WORKERS && result) ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return 0;
+}
+
+static void *worker_thread(void *data)
+{
+	long idx = (long)data;
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *msg;
+	char name[32];
+
+	sprintf(name, "worker_%ld", idx);
+	my_mbox_id = itc_create_mailbox(name, 0);
+	if(my_mbox_id == ITC_NO_MBOX_ID)
+	{
+		printf("\tFailed to create mailbox %s!\n", name);
+		pthread_barrier_wait(&workers_done);
+		return NULL;
+	}
+
+	msg = itc_alloc(sizeof(union itc_msg), WORKER_MSGNO_BASE + idx);
+	itc_send(&msg, main_mbox_id, ITC_MY_MBOX_ID, NULL);
+
+	pthread_barrier_wait(&workers_done);
+	itc_delete_mailbox(my_mbox_id);
+
+	return NULL;
+}
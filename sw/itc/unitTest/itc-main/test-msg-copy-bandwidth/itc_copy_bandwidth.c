@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "itc.h"
+#include "itc_impl.h"
+
+#define PRINT_DASH_START					\
+	do							\
+	{							\
+		printf("\n-------------------------------------------------------------------------------------------------------------------\n");	\
+	} while(0)
+
+#define PRINT_DASH_END						\
+	do							\
+	{							\
+		printf("-------------------------------------------------------------------------------------------------------------------\n\n");	\
+	} while(0)
+
+#define NR_REPEATS		5
+#define BYTES_PER_REPEAT	(512UL * 1024 * 1024)
+
+union itc_msg {
+	uint32_t		msgno;
+};
+
+static const size_t payload_sizes[] = { 4096, 16384, 65536, 262144, 1048576, 4194304, 10 * 1024 * 1024 - 64 }; // Largest is kept below ITC_MAX_MSGSIZE with header and ENDPOINT
+#define NR_PAYLOAD_SIZES	(sizeof(payload_sizes) / sizeof(payload_sizes[0]))
+#define NR_RUNS			3
+
+typedef void *(*copy_fn_t)(void *dst, const void *src, size_t len);
+
+static uint64_t now_ns(void);
+static bool run_scheme(itc_alloc_scheme scheme, copy_fn_t copy, double *gbps, unsigned int *offsets);
+static bool measure_copies(copy_fn_t copy, double *gbps, unsigned int *offsets);
+
+/* Expect main call:    ./itc_copy_bandwidth
+** Copies 4KB - 10MB itc_msgs, msgno and user data, into another one as transports do, with ITC_MALLOC and with
+** ITC_MALLOC_ALIGNED, and prints the best bandwidth out of NR_REPEATS runs. The last run copies aligned itc_msgs with
+** itc_copy() as shared memory transports do, which streams from ITC_NT_COPY_THRESHOLD on, and checks every copy is
+** intact. itccoord must be running.
+** ITC is meant to be initialized once per process, so every scheme runs in a freshly forked child. */
+int main(void)
+{
+	double gbps[NR_RUNS][NR_PAYLOAD_SIZES];
+	unsigned int offsets[NR_RUNS][NR_PAYLOAD_SIZES];
+
+	if(!run_scheme(ITC_MALLOC, memcpy, gbps[0], offsets[0]) || !run_scheme(ITC_MALLOC_ALIGNED, memcpy, gbps[1], offsets[1]) ||
+	   !run_scheme(ITC_MALLOC_ALIGNED, itc_copy, gbps[2], offsets[2]))
+	{
+		printf("\tFailed to run benchmark, is itccoord running?\n");
+		return EXIT_FAILURE;
+	}
+
+	PRINT_DASH_START;
+	printf("\tCopies of whole itc_msgs, itc_msg address %% 64 in brackets, best of %d runs, itc_copy() kernel is %s:\n",
+		NR_REPEATS, itc_copy_kernel_name());
+	printf("\t%12s %22s %22s %22s\n", "payload", "ITC_MALLOC", "ITC_MALLOC_ALIGNED", "ALIGNED + itc_copy");
+	for(uint32_t i = 0; i < NR_PAYLOAD_SIZES; i++)
+	{
+		printf("\t%10zuKB %13.2f GB/s [%2u] %13.2f GB/s [%2u] %13.2f GB/s [%2u]\n", payload_sizes[i] / 1024,
+			gbps[0][i], offsets[0][i], gbps[1][i], offsets[1][i], gbps[2][i], offsets[2][i]);
+	}
+	PRINT_DASH_END;
+
+	return EXIT_SUCCESS;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool run_scheme(itc_alloc_scheme scheme, copy_fn_t copy, double *gbps, unsigned int *offsets)
+{
+	int pipefd[2], status;
+	pid_t pid;
+	bool result;
+
+	if(pipe(pipefd) < 0)
+	{
+		return false;
+	}
+
+	pid = fork();
+	if(pid < 0)
+	{
+		return false;
+	} else if(pid == 0)
+	{
+		close(pipefd[0]);
+
+		if(itc_init(4, scheme, 0) == false)
+		{
+			_exit(EXIT_FAILURE);
+		}
+
+		if(!measure_copies(copy, gbps, offsets))
+		{
+			_exit(EXIT_FAILURE);
+		}
+		itc_exit();
+
+		if(write(pipefd[1], gbps, NR_PAYLOAD_SIZES * sizeof(double)) != NR_PAYLOAD_SIZES * sizeof(double) ||
+		   write(pipefd[1], offsets, NR_PAYLOAD_SIZES * sizeof(unsigned int)) != NR_PAYLOAD_SIZES * sizeof(unsigned int))
+		{
+			_exit(EXIT_FAILURE);
+		}
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(pipefd[1]);
+	result = read(pipefd[0], gbps, NR_PAYLOAD_SIZES * sizeof(double)) == NR_PAYLOAD_SIZES * sizeof(double) &&
+		 read(pipefd[0], offsets, NR_PAYLOAD_SIZES * sizeof(unsigned int)) == NR_PAYLOAD_SIZES * sizeof(unsigned int);
+	close(pipefd[0]);
+	waitpid(pid, &status, 0);
+
+	return result && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+static bool measure_copies(copy_fn_t copy, double *gbps, unsigned int *offsets)
+{
+	bool intact = true;
+
+	for(uint32_t i = 0; i < NR_PAYLOAD_SIZES; i++)
+	{
+		size_t size = payload_sizes[i];
+		uint64_t nr_copies = BYTES_PER_REPEAT / size + 1;
+		union itc_msg *src, *dst;
+
+		gbps[i] = 0;
+		offsets[i] = 0;
+
+		src = itc_alloc(size, 0x1);
+		dst = itc_alloc(size, 0x1);
+		if(src == NULL || dst == NULL)
+		{
+			continue;
+		}
+
+		for(size_t n = 0; n < size; n++)
+		{
+			((unsigned char *)src)[n] = (unsigned char)(n * 31 + 7); // Not uniform, so a misplaced chunk shows up
+		}
+		memset(dst, 0, size); // Fault pages in before timing
+		offsets[i] = (unsigned int)((unsigned long)dst % 64);
+
+		for(int r = 0; r < NR_REPEATS; r++)
+		{
+			uint64_t t_start = now_ns();
+
+			for(uint64_t n = 0; n < nr_copies; n++)
+			{
+				copy(dst, src, size);
+				__asm__ __volatile__("" : : "r"(dst) : "memory"); // Keep every copy
+			}
+
+			double rate = (double)(nr_copies * size) / (double)(now_ns() - t_start);
+			gbps[i] = (rate > gbps[i]) ? rate : gbps[i];
+		}
+
+		if(memcmp(dst, src, size) != 0)
+		{
+			printf("\tCopy of %zu bytes is corrupted!\n", size);
+			intact = false;
+		}
+
+		itc_free(&src);
+		itc_free(&dst);
+	}
+
+	return intact;
+}
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "itc.h"
+#include "itc_impl.h"
+#include "itc_nametable.h"
+
+#define PRINT_DASH_START					\
+	do							\
+	{							\
+		printf("\n-------------------------------------------------------------------------------------------------------------------\n");	\
+	} while(0)
+
+#define PRINT_DASH_END						\
+	do							\
+	{							\
+		printf("-------------------------------------------------------------------------------------------------------------------\n\n");	\
+	} while(0)
+
+#define NR_READERS		4
+#define NR_CHURN_NAMES		20000
+#define NR_CHURN_LIVE		1000	// The writer removes each name again this many inserts later
+#define NR_CHURN_ROUNDS		5
+#define NR_STABLE_NAMES		256	// Never removed, so they must be found every single time
+#define STABLE_ID_BASE		0x100000
+#define NR_TIMED_LOOKUPS	1000000
+
+struct reader_result {
+	uint64_t		nr_lookups;
+	uint64_t		nr_wrong;
+};
+
+static struct itc_nametable *nt;
+static volatile bool writer_done;
+
+static uint64_t now_ns(void);
+static void *reader_thread(void *data);
+static void *writer_thread(void *data);
+static double time_lookups(uint32_t nr_entries);
+
+/* Expect main call:    ./itc_nametable_stress
+** NR_READERS threads look names up in the lock-free name table while one writer keeps inserting and removing
+** NR_CHURN_NAMES names, which makes the table grow and purge its tombstones under the readers. A lookup may miss a churned
+** name, but it must never return another name's id, and it must always find the names that are never removed.
+** Then the cost of a lookup, including sprintf() of the key, is measured for tables of 16 up to 4096 entries. */
+int main(void)
+{
+	struct reader_result results[NR_READERS];
+	pthread_t readers[NR_READERS], writer;
+	struct result_code rc = { .flags = ITC_OK };
+	uint64_t nr_lookups = 0, nr_wrong = 0;
+	char name[32];
+
+	PRINT_DASH_START;
+	nt = nt_init(&rc, 16);
+	if(nt == NULL)
+	{
+		printf("\tFailed to nt_init()!\n");
+		return EXIT_FAILURE;
+	}
+
+	for(uint32_t i = 0; i < NR_STABLE_NAMES; i++)
+	{
+		sprintf(name, "stable_%u", i);
+		nt_insert(&rc, nt, name, STABLE_ID_BASE + i);
+	}
+
+	writer_done = false;
+	for(uint32_t r = 0; r < NR_READERS; r++)
+	{
+		memset(&results[r], 0, sizeof(struct reader_result));
+		pthread_create(&readers[r], NULL, reader_thread, &results[r]);
+	}
+	pthread_create(&writer, NULL, writer_thread, NULL);
+
+	pthread_join(writer, NULL);
+	for(uint32_t r = 0; r < NR_READERS; r++)
+	{
+		pthread_join(readers[r], NULL);
+		nr_lookups += results[r].nr_lookups;
+		nr_wrong += results[r].nr_wrong;
+	}
+	nt_exit(&rc, nt);
+
+	printf("\t%d readers, 1 writer churning %d names %d times: %lu lookups, %lu wrong\n", NR_READERS, NR_CHURN_NAMES,
+		NR_CHURN_ROUNDS, nr_lookups, nr_wrong);
+
+	printf("\n\t%12s %12s\n", "entries", "ns/lookup");
+	for(uint32_t nr_entries = 16; nr_entries <= 4096; nr_entries <<= 2)
+	{
+		printf("\t%12u %12.1f\n", nr_entries, time_lookups(nr_entries));
+	}
+
+	bool passed = rc.flags == ITC_OK && nr_wrong == 0;
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void *reader_thread(void *data)
+{
+	struct reader_result *result = (struct reader_result *)data;
+	unsigned int seed = (unsigned int)(uintptr_t)data;
+	itc_mbox_id_t mbox_id;
+	char name[32];
+
+	while(!writer_done)
+	{
+		uint32_t i = (uint32_t)rand_r(&seed);
+
+		if(i & 1)
+		{
+			i = (i >> 1) % NR_STABLE_NAMES;
+			sprintf(name, "stable_%u", i);
+			mbox_id = nt_lookup(nt, name);
+			result->nr_wrong += mbox_id != STABLE_ID_BASE + i;
+		} else
+		{
+			i = (i >> 1) % NR_CHURN_NAMES;
+			sprintf(name, "churn_%u", i);
+			mbox_id = nt_lookup(nt, name);
+			result->nr_wrong += mbox_id != ITC_NO_MBOX_ID && mbox_id != i + 1;
+		}
+		result->nr_lookups++;
+	}
+
+	return NULL;
+}
+
+static void *writer_thread(void *data)
+{
+	struct result_code rc = { .flags = ITC_OK };
+	char name[32];
+
+	(void)data;
+	for(uint32_t round = 0; round < NR_CHURN_ROUNDS; round++)
+	{
+		for(uint32_t i = 0; i < NR_CHURN_NAMES + NR_CHURN_LIVE; i++)
+		{
+			if(i < NR_CHURN_NAMES)
+			{
+				sprintf(name, "churn_%u", i);
+				nt_insert(&rc, nt, name, i + 1);
+			}
+
+			if(i >= NR_CHURN_LIVE)
+			{
+				sprintf(name, "churn_%u", i - NR_CHURN_LIVE);
+				nt_remove(&rc, nt, name);
+			}
+		}
+	}
+
+	if(rc.flags != ITC_OK)
+	{
+		printf("\tWriter got rc 0x%x!\n", rc.flags);
+	}
+
+	writer_done = true;
+	return NULL;
+}
+
+static double time_lookups(uint32_t nr_entries)
+{
+	struct result_code rc = { .flags = ITC_OK };
+	struct itc_nametable *table;
+	uint64_t t_start, nr_found = 0;
+	char name[32];
+
+	table = nt_init(&rc, nr_entries);
+	for(uint32_t i = 0; i < nr_entries; i++)
+	{
+		sprintf(name, "mailbox_%u", i);
+		nt_insert(&rc, table, name, i + 1);
+	}
+
+	t_start = now_ns();
+	for(uint32_t n = 0; n < NR_TIMED_LOOKUPS; n++)
+	{
+		sprintf(name, "mailbox_%u", (n * 2654435761u) % nr_entries);
+		nr_found += nt_lookup(table, name) != ITC_NO_MBOX_ID;
+	}
+	double ns = (double)(now_ns() - t_start) / NR_TIMED_LOOKUPS;
+
+	nt_exit(&rc, table);
+	return nr_found == NR_TIMED_LOOKUPS ? ns : -1.0;
+}
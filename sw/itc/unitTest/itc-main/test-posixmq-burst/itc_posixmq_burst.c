@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define NR_BURSTS		200
+#define BURST_SIZE		64
+#define RECEIVER_MBOX_NAME	"burst_receiver"
+#define SENDER_MBOX_NAME	"burst_sender"
+#define BURST_DATA_MSG		0x1
+#define BURST_ACK_MSG		0x2
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	seq;
+	} burst_data;
+};
+
+struct burst_result {
+	double			msgs_per_sec;	// From the first message received to the last one
+	uint32_t		nr_out_of_order;
+	int			threads_before;	// Of the receiver, right after itc_init()
+	int			threads_max;	// Of the receiver, sampled after every burst
+	bool			posixmq_rx;	// The receiver runs an itc_rx_posixmq thread
+};
+
+static int nr_threads(void);
+static bool has_thread(const char *name);
+static bool run_receiver(void *arg, int fd);
+static bool run_sender(void *arg, int fd);
+
+/* Expect main call:    ./itc_posixmq_burst
+** A sender process sends NR_BURSTS bursts of BURST_SIZE messages over posixmq to a receiver process, which acks every
+** burst. Prints the message rate and the number of threads of the receiver, which has to stay flat under load as
+** messages are drained by one rx thread instead of a new mq_notify() thread per notification. Messages must also arrive
+** in the order they were sent. Both processes put posixmq in ITC_TRANSPORTS, ahead of sysvmq, so they pin it towards
+** each other, while sysvmq is linked in to reach a default itccoord. The receiver must have its posixmq rx thread
+** running, so the test fails if /dev/mqueue is not usable instead of passing over sysvmq. itccoord must be running. */
+int main(void)
+{
+	struct burst_result result;
+	struct itc_test_proc procs[] = {
+		{ .main = run_receiver, .result = &result, .result_size = sizeof(result) },
+		{ .main = run_sender }
+	};
+	bool ok;
+
+	setenv("ITC_TRANSPORTS", "posixmq", 1);
+	ok = itc_test_run(procs, 2);
+
+	PRINT_DASH_START;
+	if(!ok)
+	{
+		printf("\tFailed to run test, is itccoord running?\n");
+	} else if(!result.posixmq_rx)
+	{
+		printf("\tposixmq did not start in the receiver, is /dev/mqueue mounted?\n");
+		ok = false;
+	} else
+	{
+		printf("\t%d bursts of %d messages over posixmq: %.0f msgs/s, %u out of order\n", NR_BURSTS, BURST_SIZE,
+			result.msgs_per_sec, result.nr_out_of_order);
+		printf("\tThreads of the receiver: %d after itc_init(), at most %d under load\n", result.threads_before,
+			result.threads_max);
+		ok = result.threads_max <= result.threads_before && result.nr_out_of_order == 0;
+	}
+	printf("\n\tTest %s\n", ok ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int nr_threads(void)
+{
+	char line[128];
+	int threads = -1;
+	FILE *fp;
+
+	fp = fopen("/proc/self/status", "r");
+	if(fp == NULL)
+	{
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		if(sscanf(line, "Threads: %d", &threads) == 1)
+		{
+			break;
+		}
+	}
+
+	fclose(fp);
+	return threads;
+}
+
+static bool has_thread(const char *name)
+{
+	char path[300], comm[32];
+	struct dirent *entry;
+	bool found = false;
+	FILE *fp;
+	DIR *dir;
+
+	dir = opendir("/proc/self/task");
+	if(dir == NULL)
+	{
+		return false;
+	}
+
+	while(!found && (entry = readdir(dir)) != NULL)
+	{
+		snprintf(path, sizeof(path), "/proc/self/task/%s/comm", entry->d_name);
+		fp = fopen(path, "r");
+		if(fp == NULL)
+		{
+			continue;
+		}
+
+		found = fgets(comm, sizeof(comm), fp) != NULL && strncmp(comm, name, strlen(name)) == 0;
+		fclose(fp);
+	}
+
+	closedir(dir);
+	return found;
+}
+
+static bool run_receiver(void *arg, int fd)
+{
+	struct burst_result result;
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *msg;
+	uint64_t t_start = 0;
+	uint32_t seq = 0;
+
+	(void)arg;
+	memset(&result, 0, sizeof(result));
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(RECEIVER_MBOX_NAME, 0);
+	result.threads_before = nr_threads();
+	result.posixmq_rx = has_thread("itc_rx_posixmq");
+	result.threads_max = result.threads_before;
+
+	for(uint32_t b = 0; b < NR_BURSTS; b++)
+	{
+		itc_mbox_id_t sender = ITC_NO_MBOX_ID;
+
+		for(uint32_t i = 0; i < BURST_SIZE; i++)
+		{
+			msg = itc_receive(5000);
+			if(msg == NULL)
+			{
+				return false;
+			}
+
+			t_start = (t_start == 0) ? itc_test_now_ns() : t_start;
+			result.nr_out_of_order += (msg->burst_data.seq != seq++);
+			sender = itc_sender(msg);
+			itc_free(&msg);
+		}
+
+		int threads = nr_threads();
+		result.threads_max = (threads > result.threads_max) ? threads : result.threads_max;
+
+		msg = itc_alloc(sizeof(uint32_t), BURST_ACK_MSG);
+		itc_send(&msg, sender, ITC_MY_MBOX_ID, NULL);
+	}
+	result.msgs_per_sec = (double)(NR_BURSTS * BURST_SIZE) / ((double)(itc_test_now_ns() - t_start) / 1000000000.0);
+
+	if(!itc_test_write(fd, &result, sizeof(result)))
+	{
+		return false;
+	}
+
+	sleep(1); // Let the last ack be picked up before our message queue goes away
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return true;
+}
+
+static bool run_sender(void *arg, int fd)
+{
+	itc_mbox_id_t my_mbox_id, receiver_mbox_id;
+	union itc_msg *msg;
+	uint32_t seq = 0;
+
+	(void)arg;
+	(void)fd;
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(SENDER_MBOX_NAME, 0);
+	receiver_mbox_id = itc_test_locate(RECEIVER_MBOX_NAME);
+	if(receiver_mbox_id == ITC_NO_MBOX_ID)
+	{
+		return false;
+	}
+
+	for(uint32_t b = 0; b < NR_BURSTS; b++)
+	{
+		for(uint32_t i = 0; i < BURST_SIZE; i++, seq++)
+		{
+			msg = itc_alloc(sizeof(msg->burst_data), BURST_DATA_MSG);
+			msg->burst_data.seq = seq;
+			if(!itc_send(&msg, receiver_mbox_id, ITC_MY_MBOX_ID, NULL))
+			{
+				itc_free(&msg);
+				return false;
+			}
+		}
+
+		msg = itc_receive(5000);
+		if(msg == NULL)
+		{
+			return false;
+		}
+		itc_free(&msg);
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+
+	return true;
+}
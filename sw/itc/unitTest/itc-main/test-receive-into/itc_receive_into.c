@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define NR_MSGS			400	// Half of them while the receiver waits, half already queued
+#define RECEIVER_MBOX_NAME	"into_receiver"
+#define INTO_DATA_MSG		0x1
+#define MAX_MSG_SIZE		2048
+#define SMALL_CAP		32	// Every TRUNCATE_EVERY-th message is received into a buffer this small
+#define TRUNCATE_EVERY		10
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	seq;
+		uint8_t		data[1];
+	} into_data;
+};
+
+static itc_mbox_id_t local_sender_mbox_id;
+
+static const char *transports[] = { "sysvmq", "sysvshm", "posixshm" };
+#define NR_TRANSPORTS		(sizeof(transports) / sizeof(transports[0]))
+
+struct round_result {
+	bool			local_ok;	// Local sends, truncation and timeouts within the receiver process
+	uint32_t		nr_received;
+	uint32_t		nr_wrong;	// Wrong content, order, info or truncation
+};
+
+static uint8_t pattern(uint32_t seq, size_t i);
+static size_t msg_size(uint32_t seq);
+static bool check_into(const union itc_msg *buf, size_t cap, const struct itc_msg_info *info, uint32_t seq, itc_mbox_id_t from);
+static union itc_msg *make_msg(uint32_t seq);
+static bool run_round(const char *transport, struct round_result *result);
+static void *local_sender(void *data);
+static bool run_local(itc_mbox_id_t my_mbox_id);
+static bool run_receiver(void *arg, int fd);
+static bool run_sender(void *arg, int fd);
+
+/* Expect main call:    ./itc_receive_into
+** Within one process, a thread sends to a mailbox that takes messages out with itc_receive_into(), with and without
+** truncation, and with nothing to receive before the timeout. Then another process sends NR_MSGS messages of varying sizes
+** over each IPC transport, the first half while the receiver is blocked in itc_receive_into() so the rx thread copies them
+** straight into its buffer, the second half while it is busy so they are queued first. Every message must arrive in order
+** with the right content and itc_msg_info. itccoord must be running. */
+int main(void)
+{
+	struct round_result results[NR_TRANSPORTS];
+	bool passed = true;
+
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		if(!run_round(transports[t], &results[t]))
+		{
+			printf("\tFailed to run test over %s, is itccoord running?\n", transports[t]);
+			return EXIT_FAILURE;
+		}
+
+		passed = passed && results[t].local_ok && results[t].nr_received == NR_MSGS && results[t].nr_wrong == 0;
+	}
+
+	PRINT_DASH_START;
+	printf("\t%d messages of %d - %d bytes per transport:\n", NR_MSGS, (int)msg_size(0), MAX_MSG_SIZE);
+	printf("\t%12s %8s %12s %10s\n", "transport", "local", "received", "wrong");
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		printf("\t%12s %8s %12u %10u\n", transports[t], results[t].local_ok ? "ok" : "NOT ok", results[t].nr_received,
+			results[t].nr_wrong);
+	}
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static uint8_t pattern(uint32_t seq, size_t i)
+{
+	return (uint8_t)(i * 29 + seq * 3 + 1);
+}
+
+static size_t msg_size(uint32_t seq)
+{
+	return offsetof(union itc_msg, into_data.data) + 1 + (seq * 97) % (MAX_MSG_SIZE - offsetof(union itc_msg, into_data.data));
+}
+
+static bool check_into(const union itc_msg *buf, size_t cap, const struct itc_msg_info *info, uint32_t seq, itc_mbox_id_t from)
+{
+	size_t size = msg_size(seq);
+	size_t copied = size < cap ? size : cap;
+
+	if(info->msgno != INTO_DATA_MSG || info->size != size || info->truncated != (size > cap) || info->sender != from ||
+	   buf->msgno != INTO_DATA_MSG || buf->into_data.seq != seq)
+	{
+		return false;
+	}
+
+	for(size_t i = 0; i < copied - offsetof(union itc_msg, into_data.data); i++)
+	{
+		if(buf->into_data.data[i] != pattern(seq, i))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static union itc_msg *make_msg(uint32_t seq)
+{
+	size_t size = msg_size(seq);
+	union itc_msg *msg = itc_alloc(size, INTO_DATA_MSG);
+
+	msg->into_data.seq = seq;
+	for(size_t i = 0; i < size - offsetof(union itc_msg, into_data.data); i++)
+	{
+		msg->into_data.data[i] = pattern(seq, i);
+	}
+
+	return msg;
+}
+
+static bool run_round(const char *transport, struct round_result *result)
+{
+	struct itc_test_proc procs[] = {
+		{ .main = run_receiver, .result = result, .result_size = sizeof(*result) },
+		{ .main = run_sender }
+	};
+
+	setenv("ITC_TRANSPORTS", transport, 1);
+
+	return itc_test_run(procs, 2);
+}
+
+static void *local_sender(void *data)
+{
+	itc_mbox_id_t to = *(itc_mbox_id_t *)data;
+	union itc_msg *msg;
+
+	local_sender_mbox_id = itc_create_mailbox("into_local_sender", 0);
+
+	/* The first one is sent while the receiver already waits, the rest queue up behind it */
+	usleep(50000);
+	for(uint32_t seq = 0; seq < TRUNCATE_EVERY; seq++)
+	{
+		msg = make_msg(seq);
+		if(!itc_send(&msg, to, ITC_MY_MBOX_ID, NULL))
+		{
+			itc_free(&msg);
+		}
+	}
+
+	itc_delete_mailbox(local_sender_mbox_id);
+	return NULL;
+}
+
+static bool run_local(itc_mbox_id_t my_mbox_id)
+{
+	union itc_msg *buf = malloc(MAX_MSG_SIZE);
+	struct itc_msg_info info;
+	pthread_t sender;
+	bool ok;
+
+	/* Nothing to receive */
+	ok = !itc_receive_into(buf, MAX_MSG_SIZE, ITC_NO_WAIT, &info) && !itc_receive_into(buf, MAX_MSG_SIZE, 20, &info);
+
+	pthread_create(&sender, NULL, local_sender, &my_mbox_id);
+	for(uint32_t seq = 0; seq < TRUNCATE_EVERY; seq++)
+	{
+		size_t cap = (seq % 2) ? SMALL_CAP : MAX_MSG_SIZE;
+
+		ok = ok && itc_receive_into(buf, cap, 1000, &info);
+		ok = ok && check_into(buf, cap, &info, seq, local_sender_mbox_id) && info.receiver == my_mbox_id;
+	}
+	pthread_join(sender, NULL);
+
+	free(buf);
+	return ok;
+}
+
+static bool run_receiver(void *arg, int fd)
+{
+	struct round_result result;
+	struct itc_msg_info info;
+	itc_mbox_id_t my_mbox_id, sender_mbox_id = ITC_NO_MBOX_ID;
+	union itc_msg *buf = malloc(MAX_MSG_SIZE);
+
+	(void)arg;
+	memset(&result, 0, sizeof(result));
+	if(buf == NULL || !itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(RECEIVER_MBOX_NAME, 0);
+	result.local_ok = run_local(my_mbox_id);
+
+	for(uint32_t seq = 0; seq < NR_MSGS; seq++)
+	{
+		size_t cap = (seq % TRUNCATE_EVERY) == TRUNCATE_EVERY - 1 ? SMALL_CAP : MAX_MSG_SIZE;
+
+		/* Stay away for a while, so that the second half is queued before we get to it */
+		if(seq == NR_MSGS / 2)
+		{
+			usleep(200000);
+		}
+
+		if(!itc_receive_into(buf, cap, 5000, &info))
+		{
+			break;
+		}
+
+		if(sender_mbox_id == ITC_NO_MBOX_ID)
+		{
+			sender_mbox_id = info.sender;
+		}
+
+		result.nr_received++;
+		result.nr_wrong += check_into(buf, cap, &info, seq, sender_mbox_id) && info.receiver == my_mbox_id ? 0 : 1;
+	}
+
+	if(!itc_test_write(fd, &result, sizeof(result)))
+	{
+		return false;
+	}
+
+	free(buf);
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return true;
+}
+
+static bool run_sender(void *arg, int fd)
+{
+	itc_mbox_id_t my_mbox_id, receiver_mbox_id;
+	union itc_msg *msg;
+
+	(void)arg;
+	(void)fd;
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox("into_sender", 0);
+	receiver_mbox_id = itc_test_locate(RECEIVER_MBOX_NAME);
+	if(receiver_mbox_id == ITC_NO_MBOX_ID)
+	{
+		return false;
+	}
+
+	/* Let the receiver finish the local part and block in itc_receive_into() */
+	usleep(300000);
+	for(uint32_t seq = 0; seq < NR_MSGS; seq++)
+	{
+		msg = make_msg(seq);
+		if(!itc_send(&msg, receiver_mbox_id, ITC_MY_MBOX_ID, NULL))
+		{
+			itc_free(&msg);
+			return false;
+		}
+
+		/* First half one by one, so each of them finds the receiver waiting */
+		if(seq < NR_MSGS / 2)
+		{
+			usleep(1000);
+		}
+	}
+
+	/* Our messages are copied out by the receiver side, nothing to wait for */
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+
+	return true;
+}
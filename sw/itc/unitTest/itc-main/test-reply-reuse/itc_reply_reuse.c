@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "itc.h"
+
+#define PRINT_DASH_START					\
+	do							\
+	{							\
+		printf("\n-------------------------------------------------------------------------------------------------------------------\n");	\
+	} while(0)
+
+#define PRINT_DASH_END						\
+	do							\
+	{							\
+		printf("-------------------------------------------------------------------------------------------------------------------\n\n");	\
+	} while(0)
+
+#define SERVER_MBOX_NAME	"reuse_server"
+#define REUSE_REQUEST_MSG	0x1
+#define REUSE_REPLY_MSG		0x2
+
+#define REQUEST_SIZE		256
+#define SG_HEAD_SIZE		64
+#define SHRUNK_SIZE		16
+#define GROWN_SIZE		1024
+
+enum reuse_case {
+	CASE_SHRINK,		// Reply smaller than the request, sent back in place
+	CASE_SG_SHRINK,		// Scatter-gather request whose head alone is larger than the reply
+	CASE_GROW,		// Reply larger than the request, reallocated
+	CASE_FAIL,		// Requester is gone, the request must come back untouched
+	NR_CASES
+};
+
+static const char *case_names[NR_CASES] = { "shrink in place", "shrink scatter-gather", "grow", "failed send" };
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	reuse_case;
+		uint8_t		data[1];
+	} reuse;
+};
+
+static itc_mbox_id_t server_mbox_id;
+static uint8_t sg_segment[512];
+static bool results[NR_CASES];
+static pthread_barrier_t server_ready;
+static pthread_barrier_t requester_gone;
+
+static uint8_t pattern(uint32_t reuse_case, size_t i);
+static bool data_intact(union itc_msg *msg, size_t len);
+static void *server_thread(void *data);
+static void *vanishing_requester(void *data);
+static void serve(union itc_msg *req);
+static bool request_reply(enum reuse_case reuse_case);
+
+/* Expect main call:    ./itc_reply_reuse
+** A server thread answers requests with itc_reply_reuse(): shrinking a plain request in place, shrinking a
+** scatter-gather request, growing a request, and replying to a requester whose mailbox is already deleted. Replies must
+** carry the payload written into the request and free cleanly, and the failed reply must leave the request as it was.
+** itccoord must be running. */
+int main(void)
+{
+	pthread_t server, requester;
+	bool passed = true;
+
+	PRINT_DASH_START;
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		printf("\tFailed to itc_init()!\n");
+		return EXIT_FAILURE;
+	}
+
+	for(size_t i = 0; i < sizeof(sg_segment); i++)
+	{
+		sg_segment[i] = (uint8_t)(i * 5 + 1);
+	}
+
+	pthread_barrier_init(&server_ready, NULL, 2);
+	pthread_barrier_init(&requester_gone, NULL, 2);
+	pthread_create(&server, NULL, server_thread, NULL);
+	pthread_barrier_wait(&server_ready);
+
+	(void)itc_create_mailbox("reuse_client", 0);
+	results[CASE_SHRINK] = request_reply(CASE_SHRINK);
+	results[CASE_SG_SHRINK] = request_reply(CASE_SG_SHRINK);
+	results[CASE_GROW] = request_reply(CASE_GROW);
+
+	pthread_create(&requester, NULL, vanishing_requester, NULL);
+	pthread_join(requester, NULL);
+	pthread_join(server, NULL);
+
+	for(uint32_t c = 0; c < NR_CASES; c++)
+	{
+		printf("\t%-24s %s\n", case_names[c], results[c] ? "ok" : "NOT ok");
+		passed = passed && results[c];
+	}
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	itc_delete_mailbox(itc_current_mbox());
+	itc_exit();
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static uint8_t pattern(uint32_t reuse_case, size_t i)
+{
+	return (uint8_t)(i * 13 + reuse_case * 7 + 3);
+}
+
+/* First len bytes of the payload behind reuse_case */
+static bool data_intact(union itc_msg *msg, size_t len)
+{
+	for(size_t i = 0; i < len; i++)
+	{
+		if(msg->reuse.data[i] != pattern(msg->reuse.reuse_case, i))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void *server_thread(void *data)
+{
+	union itc_msg *req;
+
+	(void)data;
+	server_mbox_id = itc_create_mailbox(SERVER_MBOX_NAME, 0);
+	pthread_barrier_wait(&server_ready);
+
+	for(uint32_t n = 0; n < NR_CASES; n++)
+	{
+		req = itc_receive(ITC_WAIT_FOREVER);
+		serve(req);
+	}
+
+	itc_delete_mailbox(server_mbox_id);
+	return NULL;
+}
+
+/* Sends the last request and deletes its mailbox before the server gets to answer it */
+static void *vanishing_requester(void *data)
+{
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *req;
+
+	(void)data;
+	my_mbox_id = itc_create_mailbox("reuse_vanishing", 0);
+	req = itc_alloc(REQUEST_SIZE, REUSE_REQUEST_MSG);
+	req->reuse.reuse_case = CASE_FAIL;
+	for(size_t i = 0; i < REQUEST_SIZE - offsetof(union itc_msg, reuse.data); i++)
+	{
+		req->reuse.data[i] = pattern(CASE_FAIL, i);
+	}
+
+	if(!itc_send(&req, server_mbox_id, ITC_MY_MBOX_ID, NULL))
+	{
+		itc_free(&req);
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	pthread_barrier_wait(&requester_gone);
+	return NULL;
+}
+
+static void serve(union itc_msg *req)
+{
+	size_t req_data_len = itc_size(req) - offsetof(union itc_msg, reuse.data);
+	itc_mbox_id_t requester = itc_sender(req);
+
+	switch(req->reuse.reuse_case)
+	{
+	case CASE_SHRINK:
+	case CASE_SG_SHRINK:
+		(void)itc_reply_reuse(&req, REUSE_REPLY_MSG, SHRUNK_SIZE);
+		break;
+
+	case CASE_GROW:
+		(void)itc_reply_reuse(&req, REUSE_REPLY_MSG, GROWN_SIZE);
+		break;
+
+	case CASE_FAIL:
+		pthread_barrier_wait(&requester_gone);
+		if(itc_reply_reuse(&req, REUSE_REPLY_MSG, SHRUNK_SIZE))
+		{
+			break;
+		}
+
+		/* Everything must be as it was received, ENDPOINT and the byte the reply's ENDPOINT went to included */
+		results[CASE_FAIL] = req != NULL && req->msgno == REUSE_REQUEST_MSG && itc_size(req) == REQUEST_SIZE &&
+				     itc_sender(req) == requester && itc_receiver(req) == server_mbox_id &&
+				     data_intact(req, req_data_len) && itc_free(&req);
+		break;
+
+	default:
+		break;
+	}
+
+	if(req != NULL)
+	{
+		itc_free(&req);
+	}
+}
+
+static bool request_reply(enum reuse_case reuse_case)
+{
+	union itc_msg *req, *rsp;
+	size_t head_size = reuse_case == CASE_SG_SHRINK ? SG_HEAD_SIZE : REQUEST_SIZE;
+	size_t expected_size = reuse_case == CASE_GROW ? GROWN_SIZE : SHRUNK_SIZE;
+	size_t kept;
+
+	if(reuse_case == CASE_SG_SHRINK)
+	{
+		req = itc_alloc_sg(head_size, REUSE_REQUEST_MSG);
+		(void)itc_append_segment(req, sg_segment, sizeof(sg_segment), NULL);
+	} else
+	{
+		req = itc_alloc(head_size, REUSE_REQUEST_MSG);
+	}
+
+	/* The server replies with what it finds in the request, so the reply payload is written in here already */
+	req->reuse.reuse_case = reuse_case;
+	for(size_t i = 0; i < head_size - offsetof(union itc_msg, reuse.data); i++)
+	{
+		req->reuse.data[i] = pattern(reuse_case, i);
+	}
+
+	if(!itc_send(&req, server_mbox_id, ITC_MY_MBOX_ID, NULL))
+	{
+		itc_free(&req);
+		return false;
+	}
+
+	rsp = itc_receive(1000);
+	if(rsp == NULL)
+	{
+		return false;
+	}
+
+	kept = (expected_size < head_size ? expected_size : head_size) - offsetof(union itc_msg, reuse.data);
+	return rsp->msgno == REUSE_REPLY_MSG && itc_size(rsp) == expected_size && itc_sender(rsp) == server_mbox_id &&
+	       rsp->reuse.reuse_case == reuse_case && data_intact(rsp, kept) && itc_free(&rsp);
+}
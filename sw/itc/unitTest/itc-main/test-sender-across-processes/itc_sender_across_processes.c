@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define NR_MSGS			100
+#define SERVER_MBOX_NAME	"sender_server"
+#define CLIENT_MBOX_NAME	"sender_client"
+#define PING_MSG		0x1
+#define PONG_MSG		0x2
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		itc_mbox_id_t	from;	// Filled in by whoever sends it, to compare with itc_sender()
+		uint32_t	seq;
+	} ping;
+};
+
+static const char *transports[] = { "sysvmq", "sysvshm", "posixshm" };
+#define NR_TRANSPORTS		(sizeof(transports) / sizeof(transports[0]))
+
+static bool run_server(void *arg, int fd);
+static int run_client(void);
+
+/* Expect main call:    ./itc_sender_across_processes
+** A client process pings a server process NR_MSGS times over each IPC transport. Both sides check that itc_sender() of
+** what they receive is the mailbox that sent it in the other process, not the rx thread of the transport, and the server
+** answers every ping with itc_send() to itc_sender() of it. itccoord must be running. */
+int main(void)
+{
+	int nr_wrong[NR_TRANSPORTS];
+	bool passed = true;
+
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		struct itc_test_proc server = { .main = run_server };
+
+		setenv("ITC_TRANSPORTS", transports[t], 1);
+		if(!itc_test_start(&server))
+		{
+			return EXIT_FAILURE;
+		}
+
+		nr_wrong[t] = run_client();
+		if(!itc_test_finish(&server))
+		{
+			nr_wrong[t] = nr_wrong[t] < 0 ? nr_wrong[t] : nr_wrong[t] + 1;
+		}
+
+		passed = passed && nr_wrong[t] == 0;
+	}
+
+	PRINT_DASH_START;
+	printf("\t%d pings per transport:\n", NR_MSGS);
+	printf("\t%12s %14s\n", "transport", "wrong sender");
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		if(nr_wrong[t] < 0)
+		{
+			printf("\t%12s %14s\n", transports[t], "no server");
+		} else
+		{
+			printf("\t%12s %14d\n", transports[t], nr_wrong[t]);
+		}
+	}
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool run_server(void *arg, int fd)
+{
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *msg;
+	int nr_wrong = 0;
+
+	(void)arg;
+	(void)fd;
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(SERVER_MBOX_NAME, 0);
+	for(int n = 0; n < NR_MSGS; n++)
+	{
+		msg = itc_receive(5000);
+		if(msg == NULL)
+		{
+			nr_wrong++;
+			break;
+		}
+
+		nr_wrong += itc_sender(msg) != msg->ping.from;
+		msg->msgno = PONG_MSG;
+		msg->ping.from = my_mbox_id;
+		if(!itc_send(&msg, itc_sender(msg), ITC_MY_MBOX_ID, NULL))
+		{
+			itc_free(&msg);
+			nr_wrong++;
+		}
+	}
+
+	/* Let the last pong get out before the rx thread goes away */
+	usleep(100000);
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return nr_wrong == 0;
+}
+
+/* Returns how many pongs came back from somebody else than the server, or -1 if there was no server to ping */
+static int run_client(void)
+{
+	itc_mbox_id_t my_mbox_id, server_mbox_id;
+	union itc_msg *msg;
+	int nr_wrong = 0;
+
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return -1;
+	}
+
+	my_mbox_id = itc_create_mailbox(CLIENT_MBOX_NAME, 0);
+	server_mbox_id = itc_test_locate(SERVER_MBOX_NAME);
+	if(server_mbox_id == ITC_NO_MBOX_ID)
+	{
+		itc_delete_mailbox(my_mbox_id);
+		itc_exit();
+		return -1;
+	}
+
+	for(uint32_t seq = 0; seq < NR_MSGS; seq++)
+	{
+		msg = itc_alloc(sizeof(msg->ping), PING_MSG);
+		msg->ping.from = my_mbox_id;
+		msg->ping.seq = seq;
+		if(!itc_send(&msg, server_mbox_id, ITC_MY_MBOX_ID, NULL))
+		{
+			itc_free(&msg);
+			nr_wrong++;
+			continue;
+		}
+
+		msg = itc_receive(5000);
+		if(msg == NULL)
+		{
+			nr_wrong++;
+			continue;
+		}
+
+		nr_wrong += msg->msgno != PONG_MSG || msg->ping.seq != seq || itc_sender(msg) != server_mbox_id ||
+			    msg->ping.from != server_mbox_id;
+		itc_free(&msg);
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+
+	return nr_wrong;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "itc.h"
+
+#define PRINT_DASH_START					\
+	do							\
+	{							\
+		printf("\n-------------------------------------------------------------------------------------------------------------------\n");	\
+	} while(0)
+
+#define PRINT_DASH_END						\
+	do							\
+	{							\
+		printf("-------------------------------------------------------------------------------------------------------------------\n\n");	\
+	} while(0)
+
+#define SG_TEST_MSG		0x1
+#define MAX_SEG_LEN		4096
+#define NR_ROUNDS		200
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	round;
+		uint32_t	nr_segs;
+	} sg_test;
+};
+
+static uint8_t segments[ITC_MAX_SG_SEGMENTS][MAX_SEG_LEN];
+static uint8_t rxbuf[ITC_MAX_SG_SEGMENTS * MAX_SEG_LEN + sizeof(union itc_msg)];
+
+static itc_mbox_id_t main_mbox_id;
+
+static void *sender_thread(void *data);
+static bool check_round(int sd[2], uint32_t round);
+
+/* Expect main call:    ./itc_sg_sendmsg
+** Scatter-gather messages with 0 to ITC_MAX_SG_SEGMENTS segments of varying lengths are sent by another thread, then
+** written to a socket by a single sendmsg() over the iovec from itc_get_segments(), without flattening them first. What
+** comes out of the other end must be byte for byte what itc_flatten() makes of the same message. itccoord must be running. */
+int main(void)
+{
+	int sd[2];
+	uint32_t nr_passed = 0;
+	pthread_t sender;
+
+	PRINT_DASH_START;
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		printf("\tFailed to itc_init()!\n");
+		return EXIT_FAILURE;
+	}
+
+	if(socketpair(AF_LOCAL, SOCK_STREAM, 0, sd) < 0)
+	{
+		printf("\tFailed to socketpair()!\n");
+		return EXIT_FAILURE;
+	}
+
+	for(uint32_t s = 0; s < ITC_MAX_SG_SEGMENTS; s++)
+	{
+		for(uint32_t i = 0; i < MAX_SEG_LEN; i++)
+		{
+			segments[s][i] = (uint8_t)(s * 31 + i * 7);
+		}
+	}
+
+	main_mbox_id = itc_create_mailbox("sg_sendmsg", 0);
+	pthread_create(&sender, NULL, sender_thread, NULL);
+	for(uint32_t round = 0; round < NR_ROUNDS; round++)
+	{
+		nr_passed += check_round(sd, round) ? 1 : 0;
+	}
+	pthread_join(sender, NULL);
+
+	printf("\t%u out of %u scatter-gather messages went through sendmsg() intact\n", nr_passed, NR_ROUNDS);
+	printf("\n\tTest %s\n", nr_passed == NR_ROUNDS ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	close(sd[0]);
+	close(sd[1]);
+	itc_delete_mailbox(main_mbox_id);
+	itc_exit();
+
+	return nr_passed == NR_ROUNDS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void *sender_thread(void *data)
+{
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *msg;
+
+	(void)data;
+	my_mbox_id = itc_create_mailbox("sg_sendmsg_sender", 0);
+	for(uint32_t round = 0; round < NR_ROUNDS; round++)
+	{
+		uint32_t nr_segs = round % (ITC_MAX_SG_SEGMENTS + 1);
+
+		msg = itc_alloc_sg(sizeof(msg->sg_test), SG_TEST_MSG);
+		msg->sg_test.round = round;
+		msg->sg_test.nr_segs = nr_segs;
+		for(uint32_t s = 0; s < nr_segs; s++)
+		{
+			/* Odd lengths and offsets, so segment borders never line up with anything */
+			size_t offset = (round + s) % 61;
+			size_t len = 1 + ((round * 131 + s * 977) % (MAX_SEG_LEN - offset - 1));
+
+			if(!itc_append_segment(msg, &segments[s][offset], len, NULL))
+			{
+				printf("\tFailed to append segment %u in round %u!\n", s, round);
+				break;
+			}
+		}
+
+		/* Local delivery hands over the very same scatter-gather message */
+		if(!itc_send(&msg, main_mbox_id, ITC_MY_MBOX_ID, NULL))
+		{
+			printf("\tFailed to send round %u!\n", round);
+			itc_free(&msg);
+		}
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	return NULL;
+}
+
+static bool check_round(int sd[2], uint32_t round)
+{
+	struct iovec iov[ITC_MAX_SG_SEGMENTS + 1];
+	struct msghdr mhdr;
+	union itc_msg *msg;
+	size_t total = 0;
+	uint32_t nr_segs;
+	ssize_t res;
+	int iovcnt;
+	bool ok;
+
+	msg = itc_receive(1000);
+	if(msg == NULL)
+	{
+		printf("\tRound %u never came!\n", round);
+		return false;
+	}
+
+	nr_segs = msg->sg_test.nr_segs;
+	iovcnt = itc_get_segments(msg, iov, ITC_MAX_SG_SEGMENTS + 1);
+	ok = msg->sg_test.round == round && iovcnt == (int)nr_segs + 1 &&
+	     (nr_segs == 0 || itc_get_segments(msg, iov, nr_segs) == -1);
+
+	/* The short call above has written over the first entries again */
+	iovcnt = itc_get_segments(msg, iov, ITC_MAX_SG_SEGMENTS + 1);
+	for(int i = 0; i < iovcnt; i++)
+	{
+		total += iov[i].iov_len;
+	}
+
+	memset(&mhdr, 0, sizeof(struct msghdr));
+	mhdr.msg_iov = iov;
+	mhdr.msg_iovlen = iovcnt;
+	res = sendmsg(sd[0], &mhdr, 0);
+	ok = ok && res == (ssize_t)total;
+
+	res = recv(sd[1], rxbuf, total, MSG_WAITALL);
+	ok = ok && res == (ssize_t)total;
+
+	/* What the peer got must be exactly the contiguous form of the message */
+	ok = ok && itc_flatten(&msg) && itc_size(msg) == total && memcmp(rxbuf, msg, total) == 0;
+	if(!ok)
+	{
+		printf("\tRound %u with %u segments, %zu bytes, differs!\n", round, nr_segs, total);
+	}
+
+	itc_free(&msg);
+	return ok;
+}
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define RECEIVER_MBOX_NAME	"regions_receiver"
+#define SENDER_MBOX_NAME	"regions_sender"
+#define NR_REPEATS		5	// Messages of each step
+#define POSIXSHM_FILENAME	"/dev/shm/itc_posixshm_0x%08x"	// Of the process of a mailbox, as in itc_posixshm.c
+#define REGIONS_DATA_MSG	0x1
+#define REGIONS_SYNC_MSG	0x2
+#define REGIONS_SYNC_REPLY	0x3
+#define REGIONS_DONE_MSG	0x4
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	seq;
+		uint32_t	nr_words;
+		uint32_t	pad;
+		uint64_t	words[1];
+	} regions_data;
+};
+
+static const char *transports[] = { "sysvshm", "posixshm" };
+#define NR_TRANSPORTS		(sizeof(transports) / sizeof(transports[0]))
+
+/* Each step sends NR_REPEATS messages of one size, one at a time, so they all go through the same large slot */
+enum step { FIRST, GROWN, SMALL_AFTER_GROWN, HUGE, HUGE_AGAIN, SMALL_AFTER_HUGE, NR_STEPS };
+static const size_t step_sizes[NR_STEPS] = { 40000, 200000, 40000, 3000000, 3000000, 40000 };
+static const char *step_names[NR_STEPS] = { "40KB", "200KB", "40KB", "3MB", "3MB again", "40KB" };
+
+struct sender_result {
+	uint64_t		region_bytes[NR_STEPS];	// Of all large slots after each step
+};
+
+struct receiver_result {
+	uint32_t		nr_received;
+	uint32_t		nr_out_of_order;
+	uint32_t		nr_corrupted;
+};
+
+struct round_result {
+	struct sender_result	sender;
+	struct receiver_result	receiver;
+};
+
+static uint64_t pattern(uint32_t seq, uint32_t i);
+static bool run_round(const char *transport, struct round_result *result);
+static bool run_receiver(void *arg, int fd);
+static bool run_sender(void *arg, int fd);
+static bool sync_with(itc_mbox_id_t receiver_mbox_id);
+static uint64_t region_bytes(const char *transport, itc_mbox_id_t receiver_mbox_id, uint64_t static_bytes);
+
+/* Expect main call:    ./itc_shm_large_regions
+** Messages above the largest static pool go into the region of a large slot, which the sender grows when a message does
+** not fit and which is otherwise reused. A sender sends steps of NR_REPEATS equally large messages, one at a time, and
+** looks at how much memory the regions hold after each step: segments it created for sysvshm, allocated pages of the
+** receiver's file beyond the static pools for posixshm. Regions must be set up by the first step, grow for larger
+** messages, stay as they are while the messages fit, and one grown beyond its high-water mark for huge messages must be
+** trimmed back once small messages follow. All messages must arrive intact and in order. Done once over sysvshm and once
+** over posixshm. itccoord must be running. */
+int main(void)
+{
+	struct round_result results[NR_TRANSPORTS];
+	bool passed = true;
+
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		if(!run_round(transports[t], &results[t]))
+		{
+			printf("\tFailed to run test over %s, is itccoord running?\n", transports[t]);
+			return EXIT_FAILURE;
+		}
+
+		uint64_t *bytes = results[t].sender.region_bytes;
+		passed = passed && bytes[FIRST] > 0 && bytes[GROWN] > bytes[FIRST] && bytes[SMALL_AFTER_GROWN] == bytes[GROWN] &&
+			 bytes[HUGE] > bytes[GROWN] && bytes[HUGE_AGAIN] == bytes[HUGE] && bytes[SMALL_AFTER_HUGE] == bytes[FIRST] &&
+			 results[t].receiver.nr_received == NR_STEPS * NR_REPEATS && results[t].receiver.nr_out_of_order == 0 &&
+			 results[t].receiver.nr_corrupted == 0;
+	}
+
+	PRINT_DASH_START;
+	printf("\tMemory of the large slot regions after %d messages of each size:\n", NR_REPEATS);
+	printf("\t%12s", "messages");
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		printf(" %12s", transports[t]);
+	}
+	printf("\n");
+	for(uint32_t s = 0; s < NR_STEPS; s++)
+	{
+		printf("\t%12s", step_names[s]);
+		for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+		{
+			printf(" %9lu KB", results[t].sender.region_bytes[s] / 1024);
+		}
+		printf("\n");
+	}
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		printf("\t%s: %u received, %u out of order, %u corrupted\n", transports[t], results[t].receiver.nr_received,
+			results[t].receiver.nr_out_of_order, results[t].receiver.nr_corrupted);
+	}
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Differs per message and word, so a message read from a stale or trimmed region shows up */
+static uint64_t pattern(uint32_t seq, uint32_t i)
+{
+	return ((uint64_t)i * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)seq << 40);
+}
+
+static bool run_round(const char *transport, struct round_result *result)
+{
+	struct itc_test_proc procs[] = {
+		{ .main = run_receiver, .result = &result->receiver, .result_size = sizeof(result->receiver) },
+		{ .main = run_sender, .arg = (void *)transport, .result = &result->sender, .result_size = sizeof(result->sender) }
+	};
+
+	setenv("ITC_TRANSPORTS", transport, 1);
+
+	return itc_test_run(procs, 2);
+}
+
+/* Answers every sync, so the sender knows the large slot has been given back, and trimmed if it is to be */
+static bool run_receiver(void *arg, int fd)
+{
+	struct receiver_result result;
+	uint32_t next_seq = 0;
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *msg;
+	bool done = false;
+
+	(void)arg;
+	memset(&result, 0, sizeof(result));
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(RECEIVER_MBOX_NAME, 0);
+	while(!done)
+	{
+		msg = itc_receive(10000);
+		if(msg == NULL)
+		{
+			break;
+		}
+
+		switch(msg->msgno)
+		{
+		case REGIONS_DATA_MSG:
+		{
+			bool intact = itc_size(msg) >= sizeof(msg->regions_data);
+
+			for(uint32_t i = 0; intact && i < msg->regions_data.nr_words; i++)
+			{
+				intact = msg->regions_data.words[i] == pattern(msg->regions_data.seq, i);
+			}
+
+			result.nr_received++;
+			result.nr_corrupted += intact ? 0 : 1;
+			result.nr_out_of_order += msg->regions_data.seq != next_seq;
+			next_seq = msg->regions_data.seq + 1;
+			itc_free(&msg);
+			break;
+		}
+		case REGIONS_SYNC_MSG:
+		{
+			itc_mbox_id_t from = itc_sender(msg);
+
+			itc_free(&msg);
+			msg = itc_alloc(sizeof(uint32_t), REGIONS_SYNC_REPLY);
+			if(!itc_send(&msg, from, ITC_MY_MBOX_ID, NULL))
+			{
+				itc_free(&msg);
+			}
+			break;
+		}
+		default:
+			done = msg->msgno == REGIONS_DONE_MSG;
+			itc_free(&msg);
+			break;
+		}
+	}
+
+	if(!itc_test_write(fd, &result, sizeof(result)))
+	{
+		return false;
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return true;
+}
+
+static bool run_sender(void *arg, int fd)
+{
+	const char *transport = (const char *)arg;
+	struct sender_result result;
+	itc_mbox_id_t my_mbox_id, receiver_mbox_id;
+	uint64_t static_bytes;
+	union itc_msg *msg;
+	uint32_t seq = 0;
+
+	memset(&result, 0, sizeof(result));
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(SENDER_MBOX_NAME, 0);
+	receiver_mbox_id = itc_test_locate(RECEIVER_MBOX_NAME);
+	if(receiver_mbox_id == ITC_NO_MBOX_ID || !sync_with(receiver_mbox_id))
+	{
+		return false;
+	}
+
+	// Our own segment and the static pools the syncs touched are all that is there before the first large message
+	static_bytes = region_bytes(transport, receiver_mbox_id, 0);
+	for(uint32_t step = 0; step < NR_STEPS; step++)
+	{
+		for(uint32_t n = 0; n < NR_REPEATS; n++, seq++)
+		{
+			msg = itc_alloc(step_sizes[step], REGIONS_DATA_MSG);
+			msg->regions_data.seq = seq;
+			msg->regions_data.nr_words = (step_sizes[step] - offsetof(union itc_msg, regions_data.words)) / sizeof(uint64_t);
+			for(uint32_t w = 0; w < msg->regions_data.nr_words; w++)
+			{
+				msg->regions_data.words[w] = pattern(seq, w);
+			}
+
+			// One at a time, so every message takes the same large slot
+			if(!itc_send(&msg, receiver_mbox_id, ITC_MY_MBOX_ID, NULL) || !sync_with(receiver_mbox_id))
+			{
+				return false;
+			}
+		}
+
+		result.region_bytes[step] = region_bytes(transport, receiver_mbox_id, static_bytes);
+	}
+
+	msg = itc_alloc(sizeof(uint32_t), REGIONS_DONE_MSG);
+	if(!itc_send(&msg, receiver_mbox_id, ITC_MY_MBOX_ID, NULL))
+	{
+		itc_free(&msg);
+		return false;
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+
+	return itc_test_write(fd, &result, sizeof(result));
+}
+
+/* The sync is behind everything sent before it, so once it is answered their slots have been given back */
+static bool sync_with(itc_mbox_id_t receiver_mbox_id)
+{
+	union itc_msg *msg;
+	bool ok;
+
+	msg = itc_alloc(sizeof(uint32_t), REGIONS_SYNC_MSG);
+	if(!itc_send(&msg, receiver_mbox_id, ITC_MY_MBOX_ID, NULL))
+	{
+		itc_free(&msg);
+		return false;
+	}
+
+	// Nothing else is sent to us
+	msg = itc_receive(5000);
+	if(msg == NULL)
+	{
+		return false;
+	}
+
+	ok = msg->msgno == REGIONS_SYNC_REPLY;
+	itc_free(&msg);
+	return ok;
+}
+
+/* Beyond static_bytes. sysvshm regions are segments of their own, created by the sender that needs them first, which is
+** only us here besides our own segment. posixshm regions are parts of the receiver's file, whose pages are otherwise only
+** allocated for what the static pools used */
+static uint64_t region_bytes(const char *transport, itc_mbox_id_t receiver_mbox_id, uint64_t static_bytes)
+{
+	uint64_t bytes = 0;
+
+	if(strcmp(transport, "sysvshm") == 0)
+	{
+		char line[256];
+		FILE *f = fopen("/proc/sysvipc/shm", "r");
+		size_t size;
+		int cpid;
+
+		if(f == NULL)
+		{
+			return 0;
+		}
+
+		while(fgets(line, sizeof(line), f) != NULL)
+		{
+			if(sscanf(line, "%*d %*d %*o %zu %d", &size, &cpid) == 2 && cpid == getpid())
+			{
+				bytes += size;
+			}
+		}
+
+		fclose(f);
+		bytes -= static_bytes;
+	} else
+	{
+		char path[64];
+		struct stat st;
+
+		snprintf(path, sizeof(path), POSIXSHM_FILENAME, receiver_mbox_id & 0xFFF00000);
+		if(stat(path, &st) == 0)
+		{
+			bytes = (uint64_t)st.st_blocks * 512 - static_bytes;
+		}
+	}
+
+	return bytes;
+}
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define NR_SENDS_PER_SIZE	50
+#define NR_WARMUP_SENDS		4	// Sends per size that may fault segments and slot regions in
+#define MAX_STEADY_FAULTS	2	// Per send after warm-up, anything more means itc_send() still touches fresh pages
+#define RECEIVER_MBOX_NAME	"pf_receiver"
+#define SENDER_MBOX_NAME	"pf_sender"
+#define PF_DATA_MSG		0x1
+#define PF_ACK_MSG		0x2
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		unsigned char	data[1];
+	} pf_data;
+};
+
+static const size_t payload_sizes[] = { 64, 1000, 4000, 16000, 200000, 1048576, 4194304 };
+#define NR_PAYLOAD_SIZES	(sizeof(payload_sizes) / sizeof(payload_sizes[0]))
+
+struct send_faults {
+	long			first;	// Faults of the very first send of this size
+	long			total;
+	long			max;
+	long			steady_max;	// Max of the sends after NR_WARMUP_SENDS
+};
+
+static long thread_minflt(void);
+static bool run_round(uint32_t init_flags, struct send_faults *faults);
+static bool run_receiver(void *arg, int fd);
+static bool run_sender(void *arg, int fd);
+
+/* Expect main call:    ./itc_shm_page_faults [transport]
+** Counts minor page faults taken by the sending thread inside itc_send() towards another process over a shared memory
+** transport, "sysvshm" by default, for 64B - 4MB messages. Every message is acked, as the unlimited pool carries one
+** large message at a time. Runs once with itc_init() flags 0 and once with ITC_PREFAULT_SHM. Once warmed up, no send may
+** take more than MAX_STEADY_FAULTS faults. itccoord must be running. */
+int main(int argc, char* argv[])
+{
+	const char *transport = (argc > 1) ? argv[1] : "sysvshm";
+	struct send_faults faults[2][NR_PAYLOAD_SIZES];
+	bool passed = true;
+
+	setenv("ITC_TRANSPORTS", transport, 1);
+
+	if(!run_round(0, faults[0]) || !run_round(ITC_PREFAULT_SHM, faults[1]))
+	{
+		printf("\tFailed to run test, is itccoord running and is %s available?\n", transport);
+		return EXIT_FAILURE;
+	}
+
+	PRINT_DASH_START;
+	printf("\tMinor page faults of the sender inside itc_send() over %s, first send / average / max of %d sends / max after %d:\n",
+		transport, NR_SENDS_PER_SIZE, NR_WARMUP_SENDS);
+	printf("\t%12s %34s %34s\n", "payload", "flags 0", "ITC_PREFAULT_SHM");
+	for(uint32_t i = 0; i < NR_PAYLOAD_SIZES; i++)
+	{
+		printf("\t%10zuB %8ld / %6.1f / %6ld / %4ld %8ld / %6.1f / %6ld / %4ld\n", payload_sizes[i],
+			faults[0][i].first, (double)faults[0][i].total / NR_SENDS_PER_SIZE, faults[0][i].max, faults[0][i].steady_max,
+			faults[1][i].first, (double)faults[1][i].total / NR_SENDS_PER_SIZE, faults[1][i].max, faults[1][i].steady_max);
+		passed = passed && faults[0][i].steady_max <= MAX_STEADY_FAULTS && faults[1][i].steady_max <= MAX_STEADY_FAULTS;
+	}
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static long thread_minflt(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_THREAD, &usage);
+	return usage.ru_minflt;
+}
+
+/* faults has NR_PAYLOAD_SIZES entries */
+static bool run_round(uint32_t init_flags, struct send_faults *faults)
+{
+	struct itc_test_proc procs[] = {
+		{ .main = run_receiver, .arg = &init_flags },
+		{ .main = run_sender, .arg = &init_flags, .result = faults, .result_size = NR_PAYLOAD_SIZES * sizeof(struct send_faults) }
+	};
+
+	return itc_test_run(procs, 2);
+}
+
+static bool run_receiver(void *arg, int fd)
+{
+	uint32_t init_flags = *(uint32_t *)arg;
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *msg;
+
+	(void)fd;
+	if(!itc_init(4, ITC_MALLOC, init_flags))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(RECEIVER_MBOX_NAME, 0);
+	for(uint32_t i = 0; i < NR_PAYLOAD_SIZES * NR_SENDS_PER_SIZE; i++)
+	{
+		msg = itc_receive(5000);
+		if(msg == NULL)
+		{
+			return false;
+		}
+
+		itc_mbox_id_t sender = itc_sender(msg);
+		itc_free(&msg);
+
+		msg = itc_alloc(sizeof(uint32_t), PF_ACK_MSG);
+		itc_send(&msg, sender, ITC_MY_MBOX_ID, NULL);
+	}
+
+	sleep(1); // Let the last ack be picked up before our shared memory goes away
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return true;
+}
+
+static bool run_sender(void *arg, int fd)
+{
+	uint32_t init_flags = *(uint32_t *)arg;
+	struct send_faults faults[NR_PAYLOAD_SIZES];
+	itc_mbox_id_t my_mbox_id, receiver_mbox_id;
+	union itc_msg *msg;
+
+	if(!itc_init(4, ITC_MALLOC, init_flags))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(SENDER_MBOX_NAME, 0);
+	receiver_mbox_id = itc_test_locate(RECEIVER_MBOX_NAME);
+	if(receiver_mbox_id == ITC_NO_MBOX_ID)
+	{
+		return false;
+	}
+
+	for(uint32_t i = 0; i < NR_PAYLOAD_SIZES; i++)
+	{
+		memset(&faults[i], 0, sizeof(struct send_faults));
+
+		for(int n = 0; n < NR_SENDS_PER_SIZE; n++)
+		{
+			long before, delta;
+
+			// Fault the message itself in first, only faults inside itc_send() are counted
+			msg = itc_alloc(payload_sizes[i], PF_DATA_MSG);
+			memset(msg->pf_data.data, n, payload_sizes[i] - sizeof(uint32_t));
+
+			before = thread_minflt();
+			if(!itc_send(&msg, receiver_mbox_id, ITC_MY_MBOX_ID, NULL))
+			{
+				itc_free(&msg);
+				return false;
+			}
+			delta = thread_minflt() - before;
+
+			faults[i].first = (n == 0) ? delta : faults[i].first;
+			faults[i].total += delta;
+			faults[i].max = (delta > faults[i].max) ? delta : faults[i].max;
+			if(n >= NR_WARMUP_SENDS && delta > faults[i].steady_max)
+			{
+				faults[i].steady_max = delta;
+			}
+
+			msg = itc_receive(5000);
+			if(msg == NULL)
+			{
+				return false;
+			}
+			itc_free(&msg);
+		}
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+
+	return itc_test_write(fd, faults, sizeof(faults));
+}
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define NR_SENDERS		4
+#define NR_MSGS_PER_SENDER	5000
+#define RECEIVER_MBOX_NAME	"burst_receiver"
+#define BURST_DATA_MSG		0x1
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	sender_idx;
+		uint32_t	seq;
+		uint32_t	nr_words;
+		uint64_t	words[1];
+	} burst_data;
+};
+
+/* One size per pool, the last one goes to the unlimited pool */
+static const size_t payload_sizes[] = { 64, 400, 900, 1900, 4000, 12000, 40000 };
+#define NR_PAYLOAD_SIZES	(sizeof(payload_sizes) / sizeof(payload_sizes[0]))
+
+static const char *transports[] = { "sysvshm", "posixshm" };
+#define NR_TRANSPORTS		(sizeof(transports) / sizeof(transports[0]))
+
+struct round_result {
+	uint32_t		nr_received;
+	uint32_t		nr_out_of_order;
+	uint32_t		nr_corrupted;
+	uint64_t		elapsed_ns;	// From the first to the last message received
+};
+
+static uint64_t pattern(uint32_t sender_idx, uint32_t seq, uint32_t i);
+static size_t payload_size(uint32_t seq);
+static bool run_round(const char *transport, struct round_result *result);
+static bool run_receiver(void *arg, int fd);
+static bool run_sender(void *arg, int fd);
+
+/* Expect main call:    ./itc_shm_ring_burst
+** NR_SENDERS sender processes send NR_MSGS_PER_SENDER messages each to one receiver process as fast as they can, without
+** waiting for anything in between, once over sysvshm and once over posixshm. Sizes cycle through all pools, so the senders
+** keep contending for the same slots and ring, and the regions of the large slots are grown while other senders use them.
+** Every message must arrive intact and in the order its sender sent it. Prints messages/s at the receiver. itccoord must
+** be running. */
+int main(void)
+{
+	struct round_result results[NR_TRANSPORTS];
+	bool passed = true;
+
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		if(!run_round(transports[t], &results[t]))
+		{
+			printf("\tFailed to run test over %s, is itccoord running?\n", transports[t]);
+			return EXIT_FAILURE;
+		}
+
+		passed = passed && results[t].nr_received == NR_SENDERS * NR_MSGS_PER_SENDER && results[t].nr_out_of_order == 0 &&
+			 results[t].nr_corrupted == 0;
+	}
+
+	PRINT_DASH_START;
+	printf("\t%d senders, %d messages each, %zu - %zu bytes:\n", NR_SENDERS, NR_MSGS_PER_SENDER, payload_sizes[0],
+		payload_sizes[NR_PAYLOAD_SIZES - 1] << 3);
+	printf("\t%12s %12s %14s %12s %14s\n", "transport", "received", "out of order", "corrupted", "messages/s");
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		printf("\t%12s %12u %14u %12u %14.0f\n", transports[t], results[t].nr_received, results[t].nr_out_of_order,
+			results[t].nr_corrupted, results[t].nr_received / ((double)results[t].elapsed_ns / 1000000000.0));
+	}
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Differs per sender, message and word, so a slot handed to two senders at once shows up */
+static uint64_t pattern(uint32_t sender_idx, uint32_t seq, uint32_t i)
+{
+	return ((uint64_t)i * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)sender_idx << 48) ^ ((uint64_t)seq << 16);
+}
+
+/* Large messages are rare, as in real traffic, and up to 8 times the largest size, so their slots get grown while in use */
+static size_t payload_size(uint32_t seq)
+{
+	return (seq % 50) == 49 ? payload_sizes[NR_PAYLOAD_SIZES - 1] << ((seq / 50) % 4) : payload_sizes[seq % (NR_PAYLOAD_SIZES - 1)];
+}
+
+static bool run_round(const char *transport, struct round_result *result)
+{
+	struct itc_test_proc procs[1 + NR_SENDERS] = {
+		{ .main = run_receiver, .result = result, .result_size = sizeof(*result) }
+	};
+	uint32_t sender_idx[NR_SENDERS];
+
+	for(uint32_t s = 0; s < NR_SENDERS; s++)
+	{
+		sender_idx[s] = s;
+		procs[1 + s].main = run_sender;
+		procs[1 + s].arg = &sender_idx[s];
+	}
+
+	setenv("ITC_TRANSPORTS", transport, 1);
+
+	return itc_test_run(procs, 1 + NR_SENDERS);
+}
+
+static bool run_receiver(void *arg, int fd)
+{
+	struct round_result result;
+	uint32_t next_seq[NR_SENDERS] = { 0 };
+	uint64_t t_first = 0;
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *msg;
+
+	(void)arg;
+	memset(&result, 0, sizeof(result));
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(RECEIVER_MBOX_NAME, 0);
+	for(uint32_t n = 0; n < NR_SENDERS * NR_MSGS_PER_SENDER; n++)
+	{
+		msg = itc_receive(10000);
+		if(msg == NULL)
+		{
+			break;
+		}
+
+		if(t_first == 0)
+		{
+			t_first = itc_test_now_ns();
+		}
+
+		bool intact = msg->msgno == BURST_DATA_MSG && msg->burst_data.sender_idx < NR_SENDERS &&
+			      itc_size(msg) == payload_size(msg->burst_data.seq);
+		for(uint32_t i = 0; intact && i < msg->burst_data.nr_words; i++)
+		{
+			intact = msg->burst_data.words[i] == pattern(msg->burst_data.sender_idx, msg->burst_data.seq, i);
+		}
+
+		if(intact)
+		{
+			result.nr_out_of_order += msg->burst_data.seq != next_seq[msg->burst_data.sender_idx];
+			next_seq[msg->burst_data.sender_idx] = msg->burst_data.seq + 1;
+		}
+
+		result.nr_received++;
+		result.nr_corrupted += intact ? 0 : 1;
+		itc_free(&msg);
+	}
+	result.elapsed_ns = itc_test_now_ns() - t_first;
+
+	if(!itc_test_write(fd, &result, sizeof(result)))
+	{
+		return false;
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return true;
+}
+
+static bool run_sender(void *arg, int fd)
+{
+	uint32_t sender_idx = *(uint32_t *)arg;
+	itc_mbox_id_t my_mbox_id, receiver_mbox_id;
+	union itc_msg *msg;
+	char name[32];
+
+	(void)fd;
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	snprintf(name, sizeof(name), "burst_sender_%u", sender_idx);
+	my_mbox_id = itc_create_mailbox(name, 0);
+	receiver_mbox_id = itc_test_locate(RECEIVER_MBOX_NAME);
+	if(receiver_mbox_id == ITC_NO_MBOX_ID)
+	{
+		return false;
+	}
+
+	for(uint32_t seq = 0; seq < NR_MSGS_PER_SENDER; seq++)
+	{
+		size_t size = payload_size(seq);
+
+		msg = itc_alloc(size, BURST_DATA_MSG);
+		msg->burst_data.sender_idx = sender_idx;
+		msg->burst_data.seq = seq;
+		msg->burst_data.nr_words = size < sizeof(msg->burst_data) ? 0 :
+					   (size - offsetof(union itc_msg, burst_data.words)) / sizeof(uint64_t);
+		for(uint32_t w = 0; w < msg->burst_data.nr_words; w++)
+		{
+			msg->burst_data.words[w] = pattern(sender_idx, seq, w);
+		}
+
+		if(!itc_send(&msg, receiver_mbox_id, ITC_MY_MBOX_ID, NULL))
+		{
+			itc_free(&msg);
+			return false;
+		}
+	}
+
+	// Our messages are copied out of the segment by the receiver, nothing to wait for
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+
+	return true;
+}
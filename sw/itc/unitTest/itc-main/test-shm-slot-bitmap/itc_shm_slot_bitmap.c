@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define RECEIVER_MBOX_NAME	"bitmap_receiver"
+#define SENDER_MBOX_NAME	"bitmap_sender"
+#define MAX_SLOTS		256	// More than all static pools of a shm segment together
+#define SMALL_SIZE		16	// Fits the smallest pool
+#define MEDIUM_SIZE		1500	// Fits the 2016 bytes pool, but none below
+#define MAX_POOL_SLOTS		32	// No pool of a segment has more slots, the smallest shares its page with the metadata
+#define BITMAP_DATA_MSG		0x1
+#define BITMAP_SYNC_MSG		0x2
+#define BITMAP_SYNC_REPLY	0x3
+#define BITMAP_DONE_MSG		0x4
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	seq;
+		uint32_t	size;
+		uint8_t		bytes[1];
+	} bitmap_data;
+};
+
+static const char *transports[] = { "sysvshm", "posixshm" };
+#define NR_TRANSPORTS		(sizeof(transports) / sizeof(transports[0]))
+
+/* Slots taken while the receiver is stopped, in the order of the rounds */
+enum round { SMALL_FIRST, MEDIUM, SMALL_AGAIN, NR_ROUNDS };
+
+struct sender_result {
+	uint32_t		nr_taken[NR_ROUNDS];
+};
+
+struct receiver_result {
+	uint32_t		nr_received;
+	uint32_t		nr_out_of_order;
+	uint32_t		nr_corrupted;
+};
+
+struct round_result {
+	struct sender_result	sender;
+	struct receiver_result	receiver;
+};
+
+static bool run_round(const char *transport, struct round_result *result);
+static bool run_receiver(void *arg, int fd);
+static bool run_sender(void *arg, int fd);
+static bool send_rounds(pid_t receiver, struct sender_result *result);
+static uint32_t fill_slots(itc_mbox_id_t receiver_mbox_id, pid_t receiver, uint32_t size, uint32_t *seq);
+static bool sync_with(itc_mbox_id_t receiver_mbox_id);
+static bool is_stopped(pid_t pid);
+
+/* Expect main call:    ./itc_shm_slot_bitmap
+** Each shm pool hands out its slots from the bits of one word, and a sender spills over into the next larger pool once a
+** pool is used up. The receiver process is stopped, so that nothing is given back, while a sender takes slots with small
+** messages until a send fails. That must be more slots than any pool has, so allocation went across the words of all
+** static pools. After the receiver has taken everything out, medium messages must only get the slots of the pools from
+** theirs upwards, and then small messages again exactly as many slots as the first time, so every bit freed came back to
+** its word. All messages must arrive intact and in order. Done once over sysvshm and once over posixshm. itccoord must be
+** running. */
+int main(void)
+{
+	struct round_result results[NR_TRANSPORTS];
+	bool passed = true;
+
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		if(!run_round(transports[t], &results[t]))
+		{
+			printf("\tFailed to run test over %s, is itccoord running?\n", transports[t]);
+			return EXIT_FAILURE;
+		}
+
+		struct sender_result *taken = &results[t].sender;
+		passed = passed && taken->nr_taken[SMALL_FIRST] > MAX_POOL_SLOTS && taken->nr_taken[MEDIUM] > 0 &&
+			 taken->nr_taken[MEDIUM] < taken->nr_taken[SMALL_FIRST] &&
+			 taken->nr_taken[SMALL_AGAIN] == taken->nr_taken[SMALL_FIRST] &&
+			 results[t].receiver.nr_received == taken->nr_taken[SMALL_FIRST] + taken->nr_taken[MEDIUM] + taken->nr_taken[SMALL_AGAIN] &&
+			 results[t].receiver.nr_out_of_order == 0 && results[t].receiver.nr_corrupted == 0;
+	}
+
+	PRINT_DASH_START;
+	printf("\tSlots taken while the receiver is stopped, %d and %d bytes:\n", SMALL_SIZE, MEDIUM_SIZE);
+	printf("\t%12s %12s %12s %12s %12s %14s %12s\n", "transport", "small", "medium", "small again", "received", "out of order",
+		"corrupted");
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		printf("\t%12s %12u %12u %12u %12u %14u %12u\n", transports[t], results[t].sender.nr_taken[SMALL_FIRST],
+			results[t].sender.nr_taken[MEDIUM], results[t].sender.nr_taken[SMALL_AGAIN], results[t].receiver.nr_received,
+			results[t].receiver.nr_out_of_order, results[t].receiver.nr_corrupted);
+	}
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* The sender stops and continues the receiver, so it is only forked once the receiver is there */
+static bool run_round(const char *transport, struct round_result *result)
+{
+	struct itc_test_proc procs[] = {
+		{ .main = run_receiver, .result = &result->receiver, .result_size = sizeof(result->receiver) },
+		{ .main = run_sender, .result = &result->sender, .result_size = sizeof(result->sender) }
+	};
+	bool ok;
+
+	setenv("ITC_TRANSPORTS", transport, 1);
+	if(!itc_test_start(&procs[0]))
+	{
+		return false;
+	}
+
+	procs[1].arg = &procs[0].pid;
+	ok = itc_test_start(&procs[1]);
+	ok = itc_test_finish(&procs[0]) && ok;
+
+	return itc_test_finish(&procs[1]) && ok;
+}
+
+/* Answers every sync, so the sender knows all slots before it have been given back */
+static bool run_receiver(void *arg, int fd)
+{
+	struct receiver_result result;
+	uint32_t next_seq = 0;
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *msg;
+	bool done = false;
+
+	(void)arg;
+	memset(&result, 0, sizeof(result));
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(RECEIVER_MBOX_NAME, 0);
+	while(!done)
+	{
+		msg = itc_receive(10000);
+		if(msg == NULL)
+		{
+			break;
+		}
+
+		switch(msg->msgno)
+		{
+		case BITMAP_DATA_MSG:
+		{
+			bool intact = itc_size(msg) == msg->bitmap_data.size;
+
+			for(uint32_t i = 0; intact && i < msg->bitmap_data.size - sizeof(msg->bitmap_data) + 1; i++)
+			{
+				intact = msg->bitmap_data.bytes[i] == (uint8_t)(msg->bitmap_data.seq + i);
+			}
+
+			result.nr_received++;
+			result.nr_corrupted += intact ? 0 : 1;
+			result.nr_out_of_order += msg->bitmap_data.seq != next_seq;
+			next_seq = msg->bitmap_data.seq + 1;
+			itc_free(&msg);
+			break;
+		}
+		case BITMAP_SYNC_MSG:
+		{
+			itc_mbox_id_t from = itc_sender(msg);
+
+			itc_free(&msg);
+			msg = itc_alloc(sizeof(uint32_t), BITMAP_SYNC_REPLY);
+			if(!itc_send(&msg, from, ITC_MY_MBOX_ID, NULL))
+			{
+				itc_free(&msg);
+			}
+			break;
+		}
+		default:
+			done = msg->msgno == BITMAP_DONE_MSG;
+			itc_free(&msg);
+			break;
+		}
+	}
+
+	if(!itc_test_write(fd, &result, sizeof(result)))
+	{
+		return false;
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return true;
+}
+
+static bool run_sender(void *arg, int fd)
+{
+	pid_t receiver = *(pid_t *)arg;
+	struct sender_result result;
+
+	memset(&result, 0, sizeof(result));
+	if(!send_rounds(receiver, &result) || !itc_test_write(fd, &result, sizeof(result)))
+	{
+		// Never leave the receiver stopped behind us
+		kill(receiver, SIGCONT);
+		return false;
+	}
+
+	return true;
+}
+
+static bool send_rounds(pid_t receiver, struct sender_result *result)
+{
+	static const uint32_t sizes[NR_ROUNDS] = { SMALL_SIZE, MEDIUM_SIZE, SMALL_SIZE };
+	itc_mbox_id_t my_mbox_id, receiver_mbox_id;
+	union itc_msg *msg;
+	uint32_t seq = 0;
+
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(SENDER_MBOX_NAME, 0);
+	receiver_mbox_id = itc_test_locate(RECEIVER_MBOX_NAME);
+	if(receiver_mbox_id == ITC_NO_MBOX_ID || !sync_with(receiver_mbox_id))
+	{
+		return false;
+	}
+
+	for(uint32_t round = 0; round < NR_ROUNDS; round++)
+	{
+		result->nr_taken[round] = fill_slots(receiver_mbox_id, receiver, sizes[round], &seq);
+		if(!sync_with(receiver_mbox_id))
+		{
+			return false;
+		}
+	}
+
+	msg = itc_alloc(sizeof(uint32_t), BITMAP_DONE_MSG);
+	if(!itc_send(&msg, receiver_mbox_id, ITC_MY_MBOX_ID, NULL))
+	{
+		itc_free(&msg);
+		return false;
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+
+	return true;
+}
+
+/* Stops the receiver and sends until no slot is left for size, which takes a second of waiting for one at the end */
+static uint32_t fill_slots(itc_mbox_id_t receiver_mbox_id, pid_t receiver, uint32_t size, uint32_t *seq)
+{
+	union itc_msg *msg;
+	uint32_t nr_taken = 0;
+
+	kill(receiver, SIGSTOP);
+	while(!is_stopped(receiver))
+	{
+		usleep(1000);
+	}
+
+	for(; nr_taken < MAX_SLOTS; nr_taken++)
+	{
+		msg = itc_alloc(size, BITMAP_DATA_MSG);
+		msg->bitmap_data.seq = *seq;
+		msg->bitmap_data.size = size;
+		for(uint32_t i = 0; i < size - sizeof(msg->bitmap_data) + 1; i++)
+		{
+			msg->bitmap_data.bytes[i] = (uint8_t)(*seq + i);
+		}
+
+		if(!itc_send(&msg, receiver_mbox_id, ITC_MY_MBOX_ID, NULL))
+		{
+			itc_free(&msg);
+			break;
+		}
+		(*seq)++;
+	}
+	kill(receiver, SIGCONT);
+
+	return nr_taken;
+}
+
+/* The sync is behind everything sent before it, so once it is answered all their slots are free again */
+static bool sync_with(itc_mbox_id_t receiver_mbox_id)
+{
+	union itc_msg *msg;
+	bool ok;
+
+	msg = itc_alloc(sizeof(uint32_t), BITMAP_SYNC_MSG);
+	if(!itc_send(&msg, receiver_mbox_id, ITC_MY_MBOX_ID, NULL))
+	{
+		itc_free(&msg);
+		return false;
+	}
+
+	// Nothing else is sent to us
+	msg = itc_receive(5000);
+	if(msg == NULL)
+	{
+		return false;
+	}
+
+	ok = msg->msgno == BITMAP_SYNC_REPLY;
+	itc_free(&msg);
+	return ok;
+}
+
+/* SIGSTOP is only delivered asynchronously, the rx threads could still take a few messages out right after kill() */
+static bool is_stopped(pid_t pid)
+{
+	char path[320];
+	struct dirent *entry;
+	bool stopped = true;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+	dir = opendir(path);
+	if(dir == NULL)
+	{
+		return false;
+	}
+
+	while(stopped && (entry = readdir(dir)) != NULL)
+	{
+		char state = '?';
+		FILE *f;
+
+		if(entry->d_name[0] == '.')
+		{
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "/proc/%d/task/%s/stat", pid, entry->d_name);
+		f = fopen(path, "r");
+		// The state follows the command name in parentheses, which may contain spaces
+		stopped = f != NULL && fscanf(f, "%*[^)]) %c", &state) == 1 && state == 'T';
+		if(f != NULL)
+		{
+			fclose(f);
+		}
+	}
+
+	closedir(dir);
+	return stopped;
+}
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define NR_MSGS_PER_TARGET	2000
+#define CALL_EVERY		16	// One itc_call() to the rpc mailbox per 16 messages sent
+#define DD_DATA_MSG		0x1
+#define DD_END_MSG		0x2
+#define DD_REQUEST_MSG		0x3
+#define DD_REPLY_MSG		0x4
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		itc_mbox_id_t	from;	// What itc_sender() has to say on the other side
+		uint32_t	seq;
+		uint32_t	nr_bytes;
+		uint8_t		data[1];
+	} dd_data;
+};
+
+#define DATA_OFFSET		offsetof(union itc_msg, dd_data.data)
+
+/* Below and above the 1KB copybreak of the sysvmq rx thread, and above msgmax so fragments are reassembled too */
+static const size_t data_sizes[] = { 0, 40, 500, 1000, 1012, 1013, 1100, 3000, 6000, 20000 };
+#define NR_DATA_SIZES		(sizeof(data_sizes) / sizeof(data_sizes[0]))
+
+enum target_e {
+	TARGET_QUEUE = 0,	// itc_receive() with timeout
+	TARGET_FD,		// poll() on itc_get_fd() first, then itc_receive(ITC_NO_WAIT)
+	TARGET_RPC,		// itc_call() requests, answered by itc_reply()
+	NR_TARGETS
+};
+
+static const char *target_names[NR_TARGETS] = { "dd_queue", "dd_fd", "dd_rpc" };
+
+struct target_result {
+	uint32_t		nr_received;
+	uint32_t		nr_corrupted;	// Wrong size, sender, receiver or content
+	uint32_t		nr_out_of_order;
+	uint32_t		nr_fd_timeouts;	// Messages that came without the fd becoming readable
+};
+
+struct receiver_thread {
+	enum target_e		target;
+	struct target_result	result;
+};
+
+static uint8_t pattern(uint32_t seq, uint32_t i);
+static union itc_msg *alloc_data(uint32_t msgno, itc_mbox_id_t from, uint32_t seq);
+static bool check_data(union itc_msg *msg, itc_mbox_id_t me, uint32_t *next_seq, struct target_result *result);
+static bool run_receiver(void *arg, int fd);
+static void *receiver_thread(void *data);
+static bool run_sender(void *arg, int fd);
+
+/* Expect main call:    ./itc_sysvmq_direct_delivery
+** The sysvmq rx thread queues messages from other processes straight onto their local mailbox. A sender process sends
+** messages of 12 bytes - 20KB, below and above the copybreak of the rx thread, to three mailboxes on three threads of a
+** receiver process over sysvmq: one waits in itc_receive(), one polls its itc_get_fd() first and one answers itc_call()
+** requests. Every message must arrive intact, in order, at the right mailbox, with the right sender, and every call must
+** get its own reply. itccoord must be running. */
+int main(void)
+{
+	struct target_result results[NR_TARGETS];
+	uint32_t nr_replies = 0;
+	struct itc_test_proc procs[] = {
+		{ .main = run_receiver, .result = results, .result_size = sizeof(results) },
+		{ .main = run_sender, .result = &nr_replies, .result_size = sizeof(nr_replies) }
+	};
+	bool passed;
+
+	setenv("ITC_TRANSPORTS", "sysvmq", 1);
+	passed = itc_test_run(procs, 2);
+	if(!passed)
+	{
+		printf("\tFailed to run test, is itccoord running?\n");
+		return EXIT_FAILURE;
+	}
+
+	PRINT_DASH_START;
+	printf("\t%d messages to each mailbox over sysvmq, %u of %d calls answered:\n", NR_MSGS_PER_TARGET, nr_replies,
+		NR_MSGS_PER_TARGET / CALL_EVERY);
+	printf("\t%12s %12s %12s %14s %14s\n", "mailbox", "received", "corrupted", "out of order", "fd timeouts");
+	for(uint32_t t = 0; t < NR_TARGETS; t++)
+	{
+		printf("\t%12s %12u %12u %14u %14u\n", target_names[t], results[t].nr_received, results[t].nr_corrupted,
+			results[t].nr_out_of_order, results[t].nr_fd_timeouts);
+		passed = passed && results[t].nr_corrupted == 0 && results[t].nr_out_of_order == 0 &&
+			 results[t].nr_fd_timeouts == 0;
+	}
+
+	passed = passed && nr_replies == NR_MSGS_PER_TARGET / CALL_EVERY &&
+		 results[TARGET_QUEUE].nr_received == NR_MSGS_PER_TARGET && results[TARGET_FD].nr_received == NR_MSGS_PER_TARGET &&
+		 results[TARGET_RPC].nr_received == NR_MSGS_PER_TARGET / CALL_EVERY;
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Differs per message and byte, so a message delivered from a reused rx buffer that was overwritten shows up */
+static uint8_t pattern(uint32_t seq, uint32_t i)
+{
+	return (uint8_t)(i * 29 + seq * 11 + 3);
+}
+
+static union itc_msg *alloc_data(uint32_t msgno, itc_mbox_id_t from, uint32_t seq)
+{
+	uint32_t nr_bytes = data_sizes[seq % NR_DATA_SIZES];
+	union itc_msg *msg;
+
+	msg = itc_alloc(DATA_OFFSET + nr_bytes, msgno);
+	msg->dd_data.from = from;
+	msg->dd_data.seq = seq;
+	msg->dd_data.nr_bytes = nr_bytes;
+	for(uint32_t i = 0; i < nr_bytes; i++)
+	{
+		msg->dd_data.data[i] = pattern(seq, i);
+	}
+
+	return msg;
+}
+
+static bool check_data(union itc_msg *msg, itc_mbox_id_t me, uint32_t *next_seq, struct target_result *result)
+{
+	bool intact = itc_size(msg) == DATA_OFFSET + msg->dd_data.nr_bytes && itc_sender(msg) == msg->dd_data.from &&
+		      itc_receiver(msg) == me;
+
+	for(uint32_t i = 0; intact && i < msg->dd_data.nr_bytes; i++)
+	{
+		intact = msg->dd_data.data[i] == pattern(msg->dd_data.seq, i);
+	}
+
+	if(intact)
+	{
+		result->nr_out_of_order += msg->dd_data.seq != *next_seq;
+		*next_seq = msg->dd_data.seq + 1;
+	}
+
+	result->nr_received++;
+	result->nr_corrupted += intact ? 0 : 1;
+	return intact;
+}
+
+static bool run_receiver(void *arg, int fd)
+{
+	struct receiver_thread threads[NR_TARGETS];
+	struct target_result results[NR_TARGETS];
+	pthread_t tids[NR_TARGETS];
+
+	(void)arg;
+	if(!itc_init(NR_TARGETS + 1, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	for(uint32_t t = 0; t < NR_TARGETS; t++)
+	{
+		memset(&threads[t], 0, sizeof(struct receiver_thread));
+		threads[t].target	= (enum target_e)t;
+		pthread_create(&tids[t], NULL, receiver_thread, &threads[t]);
+	}
+
+	for(uint32_t t = 0; t < NR_TARGETS; t++)
+	{
+		pthread_join(tids[t], NULL);
+		results[t] = threads[t].result;
+	}
+
+	if(!itc_test_write(fd, results, sizeof(results)))
+	{
+		return false;
+	}
+
+	itc_exit();
+	return true;
+}
+
+static void *receiver_thread(void *data)
+{
+	struct receiver_thread *thread = (struct receiver_thread *)data;
+	struct target_result *result = &thread->result;
+	itc_mbox_id_t my_mbox_id;
+	uint32_t next_seq = 0;
+	union itc_msg *msg;
+	struct pollfd pfd;
+
+	my_mbox_id = itc_create_mailbox(target_names[thread->target], 0);
+	pfd.fd = itc_get_fd();
+	pfd.events = POLLIN;
+
+	for(;;)
+	{
+		if(thread->target == TARGET_FD)
+		{
+			if(poll(&pfd, 1, 10000) != 1)
+			{
+				result->nr_fd_timeouts++;
+			}
+			msg = itc_receive(ITC_NO_WAIT);
+		} else
+		{
+			msg = itc_receive(10000);
+		}
+
+		if(msg == NULL)
+		{
+			break;
+		} else if(msg->msgno == DD_END_MSG)
+		{
+			itc_free(&msg);
+			break;
+		}
+
+		bool intact = msg->msgno == (thread->target == TARGET_RPC ? DD_REQUEST_MSG : DD_DATA_MSG) &&
+			      check_data(msg, my_mbox_id, &next_seq, result);
+		if(thread->target == TARGET_RPC)
+		{
+			/* Answer with the same kind of payload, sized after the request, so the reply crosses the copybreak too */
+			union itc_msg *reply = alloc_data(DD_REPLY_MSG, my_mbox_id, intact ? msg->dd_data.seq : UINT32_MAX);
+
+			if(!itc_reply(msg, &reply))
+			{
+				itc_free(&reply);
+			}
+		}
+		itc_free(&msg);
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	return NULL;
+}
+
+static bool run_sender(void *arg, int fd)
+{
+	itc_mbox_id_t my_mbox_id, targets[NR_TARGETS];
+	union itc_msg *msg, *reply;
+	struct target_result reply_result;
+	uint32_t next_reply_seq = 0, nr_replies = 0;
+	bool ok = true;
+
+	(void)arg;
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox("dd_sender", 0);
+	for(uint32_t t = 0; t < NR_TARGETS; t++)
+	{
+		targets[t] = itc_test_locate(target_names[t]);
+		if(targets[t] == ITC_NO_MBOX_ID)
+		{
+			return false;
+		}
+	}
+
+	memset(&reply_result, 0, sizeof(reply_result));
+	for(uint32_t seq = 0; ok && seq < NR_MSGS_PER_TARGET; seq++)
+	{
+		for(uint32_t t = TARGET_QUEUE; ok && t <= TARGET_FD; t++)
+		{
+			msg = alloc_data(DD_DATA_MSG, my_mbox_id, seq);
+			if(!itc_send(&msg, targets[t], ITC_MY_MBOX_ID, NULL))
+			{
+				itc_free(&msg);
+				ok = false;
+			}
+		}
+
+		if(ok && seq % CALL_EVERY == 0)
+		{
+			msg = alloc_data(DD_REQUEST_MSG, my_mbox_id, seq / CALL_EVERY);
+			reply = itc_call(&msg, targets[TARGET_RPC], 5000);
+			if(reply == NULL)
+			{
+				printf("\tNo reply to call %u!\n", seq / CALL_EVERY);
+				if(msg != NULL)
+				{
+					itc_free(&msg);
+				}
+				ok = false;
+			} else
+			{
+				/* Replies are numbered like the requests, from 0 up */
+				if(reply->msgno == DD_REPLY_MSG && check_data(reply, my_mbox_id, &next_reply_seq, &reply_result) &&
+				   reply->dd_data.from == targets[TARGET_RPC])
+				{
+					nr_replies++;
+				}
+				itc_free(&reply);
+			}
+		}
+	}
+
+	for(uint32_t t = 0; t < NR_TARGETS; t++)
+	{
+		msg = itc_alloc(sizeof(uint32_t), DD_END_MSG);
+		if(!itc_send(&msg, targets[t], ITC_MY_MBOX_ID, NULL))
+		{
+			itc_free(&msg);
+		}
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+
+	return ok && reply_result.nr_out_of_order == 0 && itc_test_write(fd, &nr_replies, sizeof(nr_replies));
+}
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define NR_SENDS_PER_SIZE	50
+#define NR_SENDERS_MAX		2
+#define RECEIVER_MBOX_NAME	"frag_receiver"
+#define FRAG_DATA_MSG		0x1
+#define FRAG_ACK_MSG		0x2
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	sender_idx;
+		uint32_t	seq;
+		uint32_t	nr_words;
+		uint64_t	words[1];
+	} frag_data;
+};
+
+static const size_t payload_sizes[] = { 65536, 262144, 1048576, 4194304 };
+#define NR_PAYLOAD_SIZES	(sizeof(payload_sizes) / sizeof(payload_sizes[0]))
+
+static const char *transports[] = { "sysvmq", "sysvshm", "posixshm" };
+#define NR_TRANSPORTS		(sizeof(transports) / sizeof(transports[0]))
+
+struct round_result {
+	double			mbps[NR_PAYLOAD_SIZES];	// Of sender 0
+	uint32_t		nr_received;
+	uint32_t		nr_corrupted;
+};
+
+static uint64_t pattern(uint32_t sender_idx, uint32_t seq, uint32_t i);
+static bool run_round(const char *transport, uint32_t nr_senders, struct round_result *result);
+static bool run_receiver(void *arg, int fd);
+static bool run_sender(void *arg, int fd);
+
+/* Expect main call:    ./itc_sysvmq_fragments
+** A sender process sends 64KB - 4MB messages to a receiver process, which acks every message and then checks its
+** content, once over each of sysvmq, which fragments them above the kernel msgmax, sysvshm and posixshm, and the
+** throughput is printed. Then two sender processes send concurrently over sysvmq, so fragments of their messages
+** interleave in the queue of the receiver, and every message must still arrive intact. itccoord must be running. */
+int main(void)
+{
+	struct round_result results[NR_TRANSPORTS], concurrent;
+	bool available[NR_TRANSPORTS];
+	bool passed;
+
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		available[t] = run_round(transports[t], 1, &results[t]);
+	}
+
+	passed = available[0] && results[0].nr_corrupted == 0 && run_round("sysvmq", NR_SENDERS_MAX, &concurrent) &&
+		 concurrent.nr_received == NR_SENDERS_MAX * NR_PAYLOAD_SIZES * NR_SENDS_PER_SIZE && concurrent.nr_corrupted == 0;
+
+	PRINT_DASH_START;
+	printf("\tOne sender, every message acked, MB/s of %d sends per size:\n", NR_SENDS_PER_SIZE);
+	printf("\t%12s", "payload");
+	for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+	{
+		printf(" %12s", transports[t]);
+	}
+	printf("\n");
+	for(uint32_t i = 0; i < NR_PAYLOAD_SIZES; i++)
+	{
+		printf("\t%10zuKB", payload_sizes[i] / 1024);
+		for(uint32_t t = 0; t < NR_TRANSPORTS; t++)
+		{
+			if(available[t])
+			{
+				printf(" %12.1f", results[t].mbps[i]);
+			} else
+			{
+				printf(" %12s", "n/a");
+			}
+		}
+		printf("\n");
+	}
+	if(available[0])
+	{
+		printf("\n\t%d concurrent senders over sysvmq: %u of %lu messages received, %u corrupted\n", NR_SENDERS_MAX,
+			concurrent.nr_received, NR_SENDERS_MAX * NR_PAYLOAD_SIZES * NR_SENDS_PER_SIZE, concurrent.nr_corrupted);
+	}
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Differs per sender, message and word, so a fragment that lands in the wrong message or place shows up */
+static uint64_t pattern(uint32_t sender_idx, uint32_t seq, uint32_t i)
+{
+	return ((uint64_t)i * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)sender_idx << 48) ^ ((uint64_t)seq << 16);
+}
+
+/* Only the MB/s of sender 0 are kept */
+static bool run_round(const char *transport, uint32_t nr_senders, struct round_result *result)
+{
+	uint32_t counts[2]; // Received, corrupted
+	struct itc_test_proc procs[1 + NR_SENDERS_MAX] = {
+		{ .main = run_receiver, .arg = &nr_senders, .result = counts, .result_size = sizeof(counts) },
+		{ .main = run_sender, .result = result->mbps, .result_size = sizeof(result->mbps) }
+	};
+	uint32_t sender_idx[NR_SENDERS_MAX];
+	bool ok;
+
+	for(uint32_t s = 0; s < nr_senders; s++)
+	{
+		sender_idx[s] = s;
+		procs[1 + s].main = run_sender;
+		procs[1 + s].arg = &sender_idx[s];
+	}
+
+	setenv("ITC_TRANSPORTS", transport, 1);
+	ok = itc_test_run(procs, 1 + nr_senders);
+	result->nr_received = counts[0];
+	result->nr_corrupted = counts[1];
+
+	return ok;
+}
+
+static bool run_receiver(void *arg, int fd)
+{
+	uint32_t nr_senders = *(uint32_t *)arg;
+	uint32_t counts[2] = { 0, 0 }; // Received, corrupted
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *msg, *ack;
+
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(RECEIVER_MBOX_NAME, 0);
+	for(uint32_t n = 0; n < nr_senders * NR_PAYLOAD_SIZES * NR_SENDS_PER_SIZE; n++)
+	{
+		msg = itc_receive(10000);
+		if(msg == NULL)
+		{
+			break;
+		}
+
+		/* Ack first, so checking overlaps with the next send */
+		ack = itc_alloc(sizeof(uint32_t), FRAG_ACK_MSG);
+		itc_send(&ack, itc_sender(msg), ITC_MY_MBOX_ID, NULL);
+
+		bool intact = msg->msgno == FRAG_DATA_MSG;
+		for(uint32_t i = 0; intact && i < msg->frag_data.nr_words; i++)
+		{
+			intact = msg->frag_data.words[i] == pattern(msg->frag_data.sender_idx, msg->frag_data.seq, i);
+		}
+
+		counts[0]++;
+		counts[1] += intact ? 0 : 1;
+		itc_free(&msg);
+	}
+
+	if(!itc_test_write(fd, counts, sizeof(counts)))
+	{
+		return false;
+	}
+
+	sleep(1); // Let the last ack be picked up before our resources go away
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return true;
+}
+
+static bool run_sender(void *arg, int fd)
+{
+	uint32_t sender_idx = *(uint32_t *)arg;
+	double mbps[NR_PAYLOAD_SIZES];
+	itc_mbox_id_t my_mbox_id, receiver_mbox_id;
+	union itc_msg *msg;
+	char name[32];
+	uint32_t seq = 0;
+
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	snprintf(name, sizeof(name), "frag_sender_%u", sender_idx);
+	my_mbox_id = itc_create_mailbox(name, 0);
+	receiver_mbox_id = itc_test_locate(RECEIVER_MBOX_NAME);
+	if(receiver_mbox_id == ITC_NO_MBOX_ID)
+	{
+		return false;
+	}
+
+	for(uint32_t i = 0; i < NR_PAYLOAD_SIZES; i++)
+	{
+		uint64_t elapsed = 0;
+
+		for(int n = 0; n < NR_SENDS_PER_SIZE; n++, seq++)
+		{
+			uint64_t t_start;
+
+			// Only the transfer is timed, not filling in the message
+			msg = itc_alloc(payload_sizes[i], FRAG_DATA_MSG);
+			msg->frag_data.sender_idx = sender_idx;
+			msg->frag_data.seq = seq;
+			msg->frag_data.nr_words = (payload_sizes[i] - offsetof(union itc_msg, frag_data.words)) / sizeof(uint64_t);
+			for(uint32_t w = 0; w < msg->frag_data.nr_words; w++)
+			{
+				msg->frag_data.words[w] = pattern(sender_idx, seq, w);
+			}
+
+			t_start = itc_test_now_ns();
+			if(!itc_send(&msg, receiver_mbox_id, ITC_MY_MBOX_ID, NULL))
+			{
+				itc_free(&msg);
+				return false;
+			}
+
+			msg = itc_receive(10000);
+			if(msg == NULL)
+			{
+				return false;
+			}
+			elapsed += itc_test_now_ns() - t_start;
+			itc_free(&msg);
+		}
+
+		mbps[i] = (double)(payload_sizes[i] * NR_SENDS_PER_SIZE) / ((double)elapsed / 1000000000.0) / (1024 * 1024);
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+
+	return itc_test_write(fd, mbps, sizeof(mbps));
+}
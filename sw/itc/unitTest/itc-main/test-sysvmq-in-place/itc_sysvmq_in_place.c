@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define NR_BATCHES		20
+#define BATCH_SIZE		64
+#define SG_EVERY		8	// Every 8th message of a batch is a scatter-gather one
+#define SG_SEGMENTS		3
+#define RECEIVER_MBOX_NAME	"in_place_receiver"
+#define IN_PLACE_DATA_MSG	0x1
+#define IN_PLACE_ACK_MSG	0x2
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	seq;
+		uint32_t	nr_bytes;
+		uint8_t		data[1];
+	} in_place_data;
+};
+
+#define DATA_OFFSET		offsetof(union itc_msg, in_place_data.data)
+
+/* Around the kernel msgmax too, where sysvmq stops sending in place and fragments */
+static const size_t data_sizes[] = { 0, 1, 3, 52, 100, 1000, 4000, 8000, 8100, 8192, 20000, 100000 };
+#define NR_DATA_SIZES		(sizeof(data_sizes) / sizeof(data_sizes[0]))
+
+static const struct {
+	itc_alloc_scheme	scheme;
+	const char		*name;
+} schemes[] = {
+	{ ITC_MALLOC,		"ITC_MALLOC" },
+	{ ITC_MALLOC_ALIGNED,	"ITC_MALLOC_ALIGNED" }
+};
+#define NR_SCHEMES		(sizeof(schemes) / sizeof(schemes[0]))
+
+struct round_result {
+	uint32_t		nr_received;
+	uint32_t		nr_corrupted;	// Wrong size, sender or content
+	uint32_t		nr_out_of_order;
+	uint32_t		nr_misaligned;
+};
+
+static uint8_t pattern(uint32_t seq, uint32_t i);
+static bool run_round(itc_alloc_scheme scheme, struct round_result *result);
+static bool run_receiver(void *arg, int fd);
+static bool run_sender(void *arg, int fd);
+static union itc_msg *alloc_data(uint32_t seq, uint8_t **sg_buf);
+
+/* Expect main call:    ./itc_sysvmq_in_place
+** sysvmq sends a message straight from its buffer, with the mtype written into the allocator headroom in front of it.
+** A sender process allocates batches of BATCH_SIZE messages of 12 - 100012 bytes up front, so they sit next to each other
+** on the heap, and only then sends them all to a receiver process over sysvmq. Every 8th message is a scatter-gather one,
+** which is gathered first. Every message must arrive intact, in order and from the right sender, once with ITC_MALLOC and
+** once with ITC_MALLOC_ALIGNED, where it must also start on a 64-byte boundary. itccoord must be running. */
+int main(void)
+{
+	struct round_result results[NR_SCHEMES];
+	bool passed = true;
+
+	setenv("ITC_TRANSPORTS", "sysvmq", 1);
+	for(uint32_t s = 0; s < NR_SCHEMES; s++)
+	{
+		if(!run_round(schemes[s].scheme, &results[s]))
+		{
+			printf("\tFailed to run test with %s, is itccoord running?\n", schemes[s].name);
+			return EXIT_FAILURE;
+		}
+
+		passed = passed && results[s].nr_received == NR_BATCHES * BATCH_SIZE && results[s].nr_corrupted == 0 &&
+			 results[s].nr_out_of_order == 0 && results[s].nr_misaligned == 0;
+	}
+
+	PRINT_DASH_START;
+	printf("\t%d batches of %d messages over sysvmq:\n", NR_BATCHES, BATCH_SIZE);
+	printf("\t%20s %12s %12s %14s %12s\n", "alloc scheme", "received", "corrupted", "out of order", "misaligned");
+	for(uint32_t s = 0; s < NR_SCHEMES; s++)
+	{
+		printf("\t%20s %12u %12u %14u %12u\n", schemes[s].name, results[s].nr_received, results[s].nr_corrupted,
+			results[s].nr_out_of_order, results[s].nr_misaligned);
+	}
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Differs per message and byte, so a message that overlaps another one or its mtype shows up */
+static uint8_t pattern(uint32_t seq, uint32_t i)
+{
+	return (uint8_t)(i * 13 + seq * 7 + 1);
+}
+
+static bool run_round(itc_alloc_scheme scheme, struct round_result *result)
+{
+	struct itc_test_proc procs[] = {
+		{ .main = run_receiver, .arg = &scheme, .result = result, .result_size = sizeof(*result) },
+		{ .main = run_sender, .arg = &scheme }
+	};
+
+	return itc_test_run(procs, 2);
+}
+
+static bool run_receiver(void *arg, int fd)
+{
+	itc_alloc_scheme scheme = *(itc_alloc_scheme *)arg;
+	struct round_result result;
+	itc_mbox_id_t my_mbox_id, sender_mbox_id = ITC_NO_MBOX_ID;
+	uint32_t next_seq = 0;
+	union itc_msg *msg;
+
+	memset(&result, 0, sizeof(result));
+	if(!itc_init(4, scheme, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(RECEIVER_MBOX_NAME, 0);
+	for(uint32_t n = 0; n < NR_BATCHES * BATCH_SIZE; n++)
+	{
+		msg = itc_receive(10000);
+		if(msg == NULL)
+		{
+			break;
+		}
+
+		/* The first message tells who the sender is, every later one must say the same */
+		if(sender_mbox_id == ITC_NO_MBOX_ID)
+		{
+			sender_mbox_id = itc_sender(msg);
+		}
+
+		bool intact = msg->msgno == IN_PLACE_DATA_MSG && itc_sender(msg) == sender_mbox_id &&
+			      itc_size(msg) == DATA_OFFSET + msg->in_place_data.nr_bytes;
+		for(uint32_t i = 0; intact && i < msg->in_place_data.nr_bytes; i++)
+		{
+			intact = msg->in_place_data.data[i] == pattern(msg->in_place_data.seq, i);
+		}
+
+		if(intact)
+		{
+			result.nr_out_of_order += msg->in_place_data.seq != next_seq;
+			next_seq = msg->in_place_data.seq + 1;
+		}
+
+		result.nr_received++;
+		result.nr_corrupted += intact ? 0 : 1;
+		result.nr_misaligned += (scheme == ITC_MALLOC_ALIGNED && ((uintptr_t)msg & 63) != 0) ? 1 : 0;
+
+		/* One ack per batch keeps the sender from running ahead of us */
+		if(next_seq % BATCH_SIZE == 0)
+		{
+			itc_free(&msg);
+			msg = itc_alloc(sizeof(uint32_t), IN_PLACE_ACK_MSG);
+			itc_send(&msg, sender_mbox_id, ITC_MY_MBOX_ID, NULL);
+		} else
+		{
+			itc_free(&msg);
+		}
+	}
+
+	if(!itc_test_write(fd, &result, sizeof(result)))
+	{
+		return false;
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return true;
+}
+
+static bool run_sender(void *arg, int fd)
+{
+	itc_alloc_scheme scheme = *(itc_alloc_scheme *)arg;
+	itc_mbox_id_t my_mbox_id, receiver_mbox_id;
+	union itc_msg *batch[BATCH_SIZE];
+	uint8_t *sg_bufs[BATCH_SIZE];
+	union itc_msg *ack;
+	bool ok = true;
+
+	(void)fd;
+	if(!itc_init(4, scheme, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox("in_place_sender", 0);
+	receiver_mbox_id = itc_test_locate(RECEIVER_MBOX_NAME);
+	if(receiver_mbox_id == ITC_NO_MBOX_ID)
+	{
+		return false;
+	}
+
+	for(uint32_t b = 0; ok && b < NR_BATCHES; b++)
+	{
+		for(uint32_t i = 0; i < BATCH_SIZE; i++)
+		{
+			batch[i] = alloc_data(b * BATCH_SIZE + i, &sg_bufs[i]);
+		}
+
+		for(uint32_t i = 0; i < BATCH_SIZE; i++)
+		{
+			if(ok && !itc_send(&batch[i], receiver_mbox_id, ITC_MY_MBOX_ID, NULL))
+			{
+				printf("\tFailed to send message %u!\n", b * BATCH_SIZE + i);
+				ok = false;
+			}
+
+			if(batch[i] != NULL)
+			{
+				itc_free(&batch[i]);
+			}
+		}
+
+		/* Segments are gathered while sending, nobody refers to them any more */
+		for(uint32_t i = 0; i < BATCH_SIZE; i++)
+		{
+			free(sg_bufs[i]);
+		}
+
+		ack = ok ? itc_receive(10000) : NULL;
+		ok = ok && ack != NULL && ack->msgno == IN_PLACE_ACK_MSG;
+		if(ack != NULL)
+		{
+			itc_free(&ack);
+		}
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+
+	return ok;
+}
+
+static union itc_msg *alloc_data(uint32_t seq, uint8_t **sg_buf)
+{
+	uint32_t nr_bytes = data_sizes[seq % NR_DATA_SIZES];
+	union itc_msg *msg;
+
+	*sg_buf = NULL;
+	if(seq % SG_EVERY != SG_EVERY - 1 || nr_bytes < SG_SEGMENTS)
+	{
+		msg = itc_alloc(DATA_OFFSET + nr_bytes, IN_PLACE_DATA_MSG);
+		for(uint32_t i = 0; i < nr_bytes; i++)
+		{
+			msg->in_place_data.data[i] = pattern(seq, i);
+		}
+	} else
+	{
+		/* The head ends where data starts, the pattern continues over all segments */
+		uint32_t seg_len = nr_bytes / SG_SEGMENTS;
+
+		*sg_buf = malloc(nr_bytes);
+		for(uint32_t i = 0; i < nr_bytes; i++)
+		{
+			(*sg_buf)[i] = pattern(seq, i);
+		}
+
+		msg = itc_alloc_sg(DATA_OFFSET, IN_PLACE_DATA_MSG);
+		for(uint32_t s = 0; s < SG_SEGMENTS; s++)
+		{
+			uint32_t len = (s == SG_SEGMENTS - 1) ? nr_bytes - s * seg_len : seg_len;
+
+			itc_append_segment(msg, *sg_buf + s * seg_len, len, NULL);
+		}
+	}
+
+	msg->in_place_data.seq = seq;
+	msg->in_place_data.nr_bytes = nr_bytes;
+	return msg;
+}
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "itc.h"
+#include "itc_test_proc.h"
+
+#define NR_MSGS			1200
+#define WINDOW			64	// Messages sent back to back before their echoes are collected
+#define SERVER_MBOX_NAME	"echo_server"
+#define PROFILE_PATH		"/tmp/itc_transport_echo.profile"
+#define ECHO_DATA_MSG		0x1
+#define ECHO_STOP_MSG		0x2
+
+union itc_msg {
+	uint32_t		msgno;
+	struct {
+		uint32_t	msgno;
+		uint32_t	seq;
+		uint32_t	nr_words;
+		uint32_t	pad;
+		uint64_t	words[1];
+	} echo_data;
+};
+
+/* Small ones go to sysvmq and large ones to sysvshm in the profile, so consecutive messages belong to different transports */
+static const size_t sizes[] = { 64, 200, 1000, 3000, 6000, 20000, 70000, 200000 };
+#define NR_SIZES		(sizeof(sizes) / sizeof(sizes[0]))
+
+struct echo_round {
+	const char		*client_transports;
+	const char		*server_transports;
+	bool			use_profile;
+	uint32_t		first_size;	// Index into sizes of the first message, which picks the first transport
+};
+
+static const struct echo_round rounds[] = {
+	{ "sysvshm,sysvmq",	"sysvshm,sysvmq",	true,	0 },
+	{ "sysvshm,sysvmq",	"sysvshm,sysvmq",	true,	NR_SIZES - 1 },
+	{ "sysvshm,sysvmq",	"sysvmq",		true,	NR_SIZES - 1 },	// Server lacks sysvshm
+	{ "posixshm",		"posixshm",		false,	0 },
+	{ "sysvshm",		"posixshm",		false,	3 }	// Only sysvmq in common
+};
+#define NR_ROUNDS		(sizeof(rounds) / sizeof(rounds[0]))
+
+struct round_result {
+	uint32_t		nr_echoed;
+	uint32_t		nr_out_of_order;
+	uint32_t		nr_corrupted;
+};
+
+static uint64_t pattern(uint32_t seq, uint32_t i);
+static bool run_round(const struct echo_round *round, struct round_result *result);
+static bool run_server(void *arg, int fd);
+static bool run_client(void *arg, int fd);
+static bool send_echo_data(itc_mbox_id_t to, uint32_t seq, uint32_t first_size);
+static bool check_echo(union itc_msg *msg, uint32_t *next_seq, struct round_result *result);
+
+/* Expect main call:    ./itc_transport_echo
+** A client process sends NR_MSGS messages of 64B to 200KB, WINDOW of them back to back, to an echo server process, which
+** sends each one straight back. With a transport profile the sizes alternate between the sysvmq and the sysvshm size
+** classes, so both peers move on to another transport every few messages, and the peers enable different transports per
+** round. Every echo must come back intact and in the order the client sent it, whatever transport was picked. itccoord
+** must be running. */
+int main(void)
+{
+	struct round_result results[NR_ROUNDS];
+	bool passed = true;
+	FILE *fp;
+
+	fp = fopen(PROFILE_PATH, "w");
+	if(fp == NULL)
+	{
+		printf("\tFailed to write %s!\n", PROFILE_PATH);
+		return EXIT_FAILURE;
+	}
+	fprintf(fp, "4096 sysvmq\n1048576 sysvshm\n");
+	fclose(fp);
+
+	for(uint32_t r = 0; r < NR_ROUNDS; r++)
+	{
+		if(!run_round(&rounds[r], &results[r]))
+		{
+			printf("\tFailed to run round %u, is itccoord running?\n", r);
+			unlink(PROFILE_PATH);
+			return EXIT_FAILURE;
+		}
+
+		passed = passed && results[r].nr_echoed == NR_MSGS && results[r].nr_out_of_order == 0 && results[r].nr_corrupted == 0;
+	}
+	unlink(PROFILE_PATH);
+
+	PRINT_DASH_START;
+	printf("\t%16s %16s %8s %8s %10s %14s %12s\n", "client", "server", "profile", "first", "echoed", "out of order",
+		"corrupted");
+	for(uint32_t r = 0; r < NR_ROUNDS; r++)
+	{
+		printf("\t%16s %16s %8s %8zu %10u %14u %12u\n", rounds[r].client_transports, rounds[r].server_transports,
+			rounds[r].use_profile ? "yes" : "no", sizes[rounds[r].first_size], results[r].nr_echoed,
+			results[r].nr_out_of_order, results[r].nr_corrupted);
+	}
+	printf("\n\tTest %s\n", passed ? "PASSED" : "FAILED");
+	PRINT_DASH_END;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static uint64_t pattern(uint32_t seq, uint32_t i)
+{
+	return ((uint64_t)i * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)seq << 24);
+}
+
+static bool run_round(const struct echo_round *round, struct round_result *result)
+{
+	struct itc_test_proc procs[] = {
+		{ .main = run_server, .arg = (void *)round },
+		{ .main = run_client, .arg = (void *)round, .result = result, .result_size = sizeof(*result) }
+	};
+
+	return itc_test_run(procs, 2);
+}
+
+static bool run_server(void *arg, int fd)
+{
+	const struct echo_round *round = (const struct echo_round *)arg;
+	itc_mbox_id_t my_mbox_id;
+	union itc_msg *msg;
+	bool ok = true;
+
+	(void)fd;
+	setenv("ITC_TRANSPORTS", round->server_transports, 1);
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox(SERVER_MBOX_NAME, 0);
+	for(;;)
+	{
+		msg = itc_receive(10000);
+		if(msg == NULL)
+		{
+			ok = false;
+			break;
+		} else if(msg->msgno == ECHO_STOP_MSG)
+		{
+			itc_free(&msg);
+			break;
+		}
+
+		if(!itc_send(&msg, itc_sender(msg), ITC_MY_MBOX_ID, NULL))
+		{
+			itc_free(&msg);
+			ok = false;
+			break;
+		}
+	}
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return ok;
+}
+
+static bool run_client(void *arg, int fd)
+{
+	const struct echo_round *round = (const struct echo_round *)arg;
+	struct round_result result;
+	itc_mbox_id_t my_mbox_id, server_mbox_id;
+	union itc_msg *msg;
+	uint32_t next_seq = 0;
+	bool ok = true;
+
+	setenv("ITC_TRANSPORTS", round->client_transports, 1);
+	if(round->use_profile)
+	{
+		setenv("ITC_TRANSPORT_PROFILE", PROFILE_PATH, 1);
+	}
+
+	memset(&result, 0, sizeof(result));
+	if(!itc_init(4, ITC_MALLOC, 0))
+	{
+		return false;
+	}
+
+	my_mbox_id = itc_create_mailbox("echo_client", 0);
+	server_mbox_id = itc_test_locate(SERVER_MBOX_NAME);
+	if(server_mbox_id == ITC_NO_MBOX_ID)
+	{
+		return false;
+	}
+
+	for(uint32_t seq = 0; ok && seq < NR_MSGS; seq += WINDOW)
+	{
+		uint32_t nr_sent = 0;
+
+		for(; nr_sent < WINDOW && seq + nr_sent < NR_MSGS; nr_sent++)
+		{
+			if(!send_echo_data(server_mbox_id, seq + nr_sent, round->first_size))
+			{
+				printf("\tFailed to send message %u!\n", seq + nr_sent);
+				ok = false;
+				break;
+			}
+		}
+
+		for(uint32_t n = 0; n < nr_sent; n++)
+		{
+			msg = itc_receive(10000);
+			if(msg == NULL)
+			{
+				ok = false;
+				break;
+			}
+
+			ok = check_echo(msg, &next_seq, &result) && ok;
+			itc_free(&msg);
+		}
+	}
+
+	msg = itc_alloc(sizeof(uint32_t), ECHO_STOP_MSG);
+	if(!itc_send(&msg, server_mbox_id, ITC_MY_MBOX_ID, NULL))
+	{
+		itc_free(&msg);
+	}
+
+	ok = itc_test_write(fd, &result, sizeof(result)) && ok;
+
+	itc_delete_mailbox(my_mbox_id);
+	itc_exit();
+	return ok;
+}
+
+static bool send_echo_data(itc_mbox_id_t to, uint32_t seq, uint32_t first_size)
+{
+	size_t size = sizes[(seq + first_size) % NR_SIZES];
+	union itc_msg *msg;
+
+	msg = itc_alloc(size, ECHO_DATA_MSG);
+	msg->echo_data.seq = seq;
+	msg->echo_data.nr_words = size < sizeof(msg->echo_data) ? 0 :
+				  (size - offsetof(union itc_msg, echo_data.words)) / sizeof(uint64_t);
+	for(uint32_t w = 0; w < msg->echo_data.nr_words; w++)
+	{
+		msg->echo_data.words[w] = pattern(seq, w);
+	}
+
+	if(!itc_send(&msg, to, ITC_MY_MBOX_ID, NULL))
+	{
+		itc_free(&msg);
+		return false;
+	}
+
+	return true;
+}
+
+static bool check_echo(union itc_msg *msg, uint32_t *next_seq, struct round_result *result)
+{
+	bool intact = msg->msgno == ECHO_DATA_MSG && msg->echo_data.seq < NR_MSGS;
+
+	for(uint32_t i = 0; intact && i < msg->echo_data.nr_words; i++)
+	{
+		intact = msg->echo_data.words[i] == pattern(msg->echo_data.seq, i);
+	}
+
+	result->nr_echoed++;
+	if(!intact)
+	{
+		result->nr_corrupted++;
+		return false;
+	}
+
+	if(msg->echo_data.seq != *next_seq)
+	{
+		result->nr_out_of_order++;
+	}
+	*next_seq = msg->echo_data.seq + 1;
+
+	return true;
+}